@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * Exercise pmEventIterInit(), pmEventIterNext() and pmEventIterParam()
+ * over packed event records, including missed records, parameters
+ * skipped by the caller and parameters of an unexpected type.
+ */
+#include <pcp/pmapi.h>
+#include <pcp/pmda.h>
+#include "libpcp.h"
+
+static int mydomain = 29;
+
+static pmValueSet	vs;
+static char		*ebuf;
+static int		ebuflen;
+static char		*eptr;
+static char		*ebufend;
+static pmEventArray	*eap;
+static pmEventRecord	*erp;
+
+/* === begin largely copied from unpack.c === */
+static int
+check_buf(int need)
+{
+    int		offset = eptr - ebuf;
+
+    while (&eptr[need] >= ebufend) {
+	ebuflen *= 2;
+	if ((ebuf = (char *)realloc(ebuf, ebuflen)) == NULL)
+	    return -errno;
+	eptr = &ebuf[offset];
+	ebufend = &ebuf[ebuflen-1];
+	vs.vlist[0].value.pval = (pmValueBlock *)ebuf;
+    }
+    return 0;
+}
+
+static void
+add_param(pmID pmid, int type, pmAtomValue *avp)
+{
+    int			need;
+    int			vlen;
+    int			sts;
+    pmEventParameter	*epp;
+    void		*src;
+
+    need = sizeof(pmEventParameter);
+    switch (type) {
+	case PM_TYPE_32:
+	case PM_TYPE_U32:
+	    vlen = sizeof(avp->l);
+	    src = &avp->l;
+	    break;
+	case PM_TYPE_64:
+	case PM_TYPE_U64:
+	    vlen = sizeof(avp->ll);
+	    src = &avp->ll;
+	    break;
+	case PM_TYPE_DOUBLE:
+	    vlen = sizeof(avp->d);
+	    src = &avp->d;
+	    break;
+	case PM_TYPE_STRING:
+	    vlen = strlen(avp->cp);
+	    src = avp->cp;
+	    break;
+	default:
+	    /* bogus type, carry a 32-bit payload */
+	    vlen = sizeof(avp->l);
+	    src = &avp->l;
+	    break;
+    }
+    need += PM_PDU_SIZE_BYTES(vlen);
+    if ((sts = check_buf(need)) < 0) {
+	fprintf(stderr, "add_param failed: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    epp = (pmEventParameter *)eptr;
+    epp->ep_pmid = pmid;
+    epp->ep_len = PM_VAL_HDR_SIZE + vlen;
+    epp->ep_type = type;
+    memcpy((void *)(eptr + sizeof(pmEventParameter)), src, vlen);
+    eptr += need;
+    erp->er_nparams++;
+}
+
+static void
+reset(void)
+{
+    eptr = ebuf;
+    eap = (pmEventArray *)eptr;
+    eap->ea_type = PM_TYPE_EVENT;
+    eap->ea_nrecords = 0;
+    eptr += sizeof(pmEventArray) - sizeof(pmEventRecord);
+    vs.numval = 1;
+    vs.valfmt = PM_VAL_DPTR;
+    vs.vlist[0].inst = PM_IN_NULL;
+}
+
+static void
+add_record(int sec, int flags)
+{
+    int		sts;
+
+    if ((sts = check_buf(sizeof(pmEventRecord) - sizeof(pmEventParameter))) < 0) {
+	fprintf(stderr, "add_record failed: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    eap->ea_nrecords++;
+    erp = (pmEventRecord *)eptr;
+    erp->er_timestamp.tv_sec = sec;
+    erp->er_timestamp.tv_usec = 0;
+    erp->er_nparams = 0;
+    erp->er_flags = flags;
+    eptr += sizeof(pmEventRecord) - sizeof(pmEventParameter);
+}
+/* === end copied from unpack.c === */
+
+static void
+print_param(int sts, pmValueSet *vsp)
+{
+    pmValueBlock	*vbp;
+
+    printf("    param %s: ", pmIDStr(vsp->pmid));
+    if (sts < 0) {
+	printf("%s\n", pmErrStr(sts));
+	return;
+    }
+    if (vsp->valfmt == PM_VAL_INSITU) {
+	printf("insitu %d\n", vsp->vlist[0].value.lval);
+	return;
+    }
+    vbp = vsp->vlist[0].value.pval;
+    switch (vbp->vtype) {
+	case PM_TYPE_64:
+	case PM_TYPE_U64: {
+	    __int64_t	ll;
+	    memcpy(&ll, vbp->vbuf, sizeof(ll));
+	    printf("64-bit %lld\n", (long long)ll);
+	    break;
+	}
+	case PM_TYPE_DOUBLE: {
+	    double	d;
+	    memcpy(&d, vbp->vbuf, sizeof(d));
+	    printf("double %g\n", d);
+	    break;
+	}
+	case PM_TYPE_STRING:
+	    printf("string \"%.*s\"\n", vbp->vlen - PM_VAL_HDR_SIZE, vbp->vbuf);
+	    break;
+	default:
+	    printf("type %d len %d\n", vbp->vtype, vbp->vlen);
+	    break;
+    }
+}
+
+/*
+ * Walk every record; with maxparams >= 0 read at most that many
+ * parameters from each record and leave the rest for pmEventIterNext()
+ * to skip.
+ */
+static void
+walk(char *title, int maxparams)
+{
+    pmEventIterator	iter;
+    pmValueSet		param;
+    int			sts;
+    int			n;
+
+    printf("\n=== %s ===\n", title);
+    eap->ea_len = eptr - ebuf;
+    if ((sts = pmEventIterInit(&iter, &vs, 0)) < 0) {
+	printf("pmEventIterInit: %s\n", pmErrStr(sts));
+	return;
+    }
+    printf("%d records\n", sts);
+    while (pmEventIterNext(&iter)) {
+	printf("  record @ %d flags 0x%x nparams %d missed %d\n",
+		(int)iter.ei_timestamp.tv_sec, iter.ei_flags,
+		iter.ei_nparams, iter.ei_missed);
+	for (n = 0; maxparams < 0 || n < maxparams; n++) {
+	    if ((sts = pmEventIterParam(&iter, &param)) == 0)
+		break;
+	    print_param(sts, &param);
+	}
+    }
+    /* iterator is exhausted, both calls must keep returning 0 */
+    printf("after end: next %d param %d\n",
+		pmEventIterNext(&iter), pmEventIterParam(&iter, &param));
+}
+
+int
+main(int argc, char **argv)
+{
+    pmEventIterator	iter;
+    pmAtomValue		atom;
+    pmID		pmid_type = pmID_build(mydomain, 0, 127);
+    pmID		pmid_64 = pmID_build(mydomain, 0, 130);
+    pmID		pmid_double = pmID_build(mydomain, 0, 133);
+    pmID		pmid_string = pmID_build(mydomain, 0, 134);
+    pmID		pmid_bad = pmID_build(mydomain, 0, 136);
+
+    pmSetProgname(argv[0]);
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    /* big enough that check_buf() never moves eap and erp */
+    ebuflen = 512;
+    if ((ebuf = eptr = (char *)malloc(ebuflen)) == NULL) {
+	fprintf(stderr, "initial ebuf malloc failed: %s\n", strerror(errno));
+	exit(1);
+    }
+    ebufend = &ebuf[ebuflen-1];
+    vs.pmid = pmID_build(mydomain, 0, 136);
+    vs.vlist[0].value.pval = (pmValueBlock *)ebuf;
+
+    reset();
+    walk("no records", -1);
+
+    reset();
+    add_record(100, 0);
+    walk("1 record, no params", -1);
+
+    reset();
+    add_record(101, 0);
+    atom.ul = 1;
+    add_param(pmid_type, PM_TYPE_U32, &atom);
+    atom.ll = -2;
+    add_param(pmid_64, PM_TYPE_64, &atom);
+    add_record(102, PM_EVENT_FLAG_MISSED);
+    erp->er_nparams = 3;
+    add_record(103, 0);
+    atom.ul = 4;
+    add_param(pmid_type, PM_TYPE_U32, &atom);
+    atom.d = 5.5;
+    add_param(pmid_double, PM_TYPE_DOUBLE, &atom);
+    atom.cp = "six";
+    add_param(pmid_string, PM_TYPE_STRING, &atom);
+    walk("3 records, 3 missed", -1);
+    walk("3 records, 3 missed, first param only", 1);
+    walk("3 records, 3 missed, no params", 0);
+
+    reset();
+    add_record(104, 0);
+    atom.ul = 7;
+    add_param(pmid_type, PM_TYPE_U32, &atom);
+    atom.l = 8;
+    add_param(pmid_bad, PM_TYPE_EVENT, &atom);
+    atom.cp = "nine";
+    add_param(pmid_string, PM_TYPE_STRING, &atom);
+    atom.l = 10;
+    add_param(pmid_bad, PM_TYPE_UNKNOWN, &atom);
+    add_record(105, 0);
+    atom.ll = 11;
+    add_param(pmid_64, PM_TYPE_64, &atom);
+    walk("bad parameter types are reported and stepped over", -1);
+
+    reset();
+    add_record(106, 0);
+    atom.ul = 12;
+    add_param(pmid_type, PM_TYPE_U32, &atom);
+    eap->ea_len = eptr - ebuf;
+    eap->ea_nrecords = -1;
+    printf("\n=== Error - ea_nrecords < 0 ===\n");
+    printf("pmEventIterInit: %s\n", pmErrStr(pmEventIterInit(&iter, &vs, 0)));
+
+    vs.valfmt = PM_VAL_INSITU;
+    printf("\n=== Error - insitu value ===\n");
+    printf("pmEventIterInit: %s\n", pmErrStr(pmEventIterInit(&iter, &vs, 0)));
+
+    free(ebuf);
+    return 0;
+}
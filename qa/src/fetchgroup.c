@@ -15,6 +15,7 @@
 
 #include <pcp/pmapi.h>
 #include <assert.h>
+#include <math.h>
 
 void
 __pcp_assert(int sts, const char *FILE, int LINE)
@@ -237,6 +238,67 @@ test_events(const char *event_metric_name)
     pcp_assert(sts);
 }
 
+/*
+ * The _indom_double variant converts a whole pmValueSet in one batch;
+ * instances with an error must come back as NaN, never a stale value.
+ */
+void
+test_indom_doubles(void)
+{
+    int sts;
+    pmFG fg;
+    enum { nbins = 9 };	/* sample.bin instances */
+    double raw[nbins], rate[nbins];
+    int raw_stss[nbins], rate_stss[nbins];
+    int raw_codes[nbins];
+    unsigned int raw_num, rate_num;
+    int raw_sts, rate_sts;
+    int i, j;
+
+    sts = pmCreateFetchGroup(&fg, PM_CONTEXT_HOST, "local:");
+    pcp_assert(sts);
+
+    sts = pmExtendFetchGroup_indom_double(fg, "sample.bin", NULL,
+				   raw_codes, NULL, raw, raw_stss,
+				   nbins, &raw_num, &raw_sts);
+    pcp_assert(sts);
+    sts = pmExtendFetchGroup_indom_double(fg, "sample.bin", "rate",
+				   NULL, NULL, rate, rate_stss,
+				   nbins, &rate_num, &rate_sts);
+    pcp_assert(sts);
+
+    for (i = 0; i < 3; i++) {
+	/* poison the outputs, every slot must be rewritten */
+	for (j = 0; j < nbins; j++)
+	    raw[j] = rate[j] = 42.0;
+
+	sts = pmFetchGroup(fg);
+	pcp_assert(sts);
+	pcp_assert(raw_sts);
+	pcp_assert(rate_sts);
+	assert(raw_num == nbins);
+	assert(rate_num == nbins);
+
+	for (j = 0; j < nbins; j++) {
+	    assert(raw_stss[j] == 0);
+	    assert(raw_codes[j] == 100 * (j + 1));
+	    assert(raw[j] == 100.0 * (j + 1));
+	    if (i == 0) {
+		/* no previous fetch to rate convert against */
+		assert(rate_stss[j] < 0);
+		assert(isnan(rate[j]));
+	    }
+	    else {
+		assert(rate_stss[j] == 0);
+		assert(rate[j] == 0.0);
+	    }
+	}
+    }
+
+    sts = pmDestroyFetchGroup(fg);
+    pcp_assert(sts);
+}
+
 int
 main(void)
 {
@@ -247,6 +309,7 @@ main(void)
 
     test_counter();
     test_indoms();
+    test_indom_doubles();
     test_events("sample.event.records");
     test_events("sample.event.highres_records");
 
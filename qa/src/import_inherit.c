@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * Exercise pmiStart() with inherit set, followed by pmiPutValues()
+ * through the inherited handles.  The second context inherits metrics
+ * that already had values in the first context's pending pmResult,
+ * and freed metadata from the first context is recycled before the
+ * third context is started.
+ */
+#include <pcp/pmapi.h>
+#include <pcp/import.h>
+
+#define NMETRIC	16
+
+static void
+check(int sts, char *name)
+{
+    if (sts < 0) {
+	fprintf(stderr, "%s: Error: %s\n", name, pmiErrStr(sts));
+	exit(1);
+    }
+}
+
+/* one value for every handle, based on the sample number */
+static void
+put(int *handles, int sample)
+{
+    char	buf[NMETRIC][16];
+    const char	*values[NMETRIC];
+    int		i;
+
+    for (i = 0; i < NMETRIC; i++) {
+	pmsprintf(buf[i], sizeof(buf[i]), "%d", 100 * sample + i);
+	values[i] = buf[i];
+    }
+    check(pmiPutValues(NMETRIC, handles, values), "pmiPutValues");
+}
+
+static void
+write_samples(int *handles, int first, int last)
+{
+    int		sample;
+
+    for (sample = first; sample <= last; sample++) {
+	put(handles, sample);
+	check(pmiWrite(sample, 0), "pmiWrite");
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    char	name[64];
+    char	path[MAXPATHLEN];
+    int		handles[NMETRIC];
+    int		ctx1, ctx2;
+    int		i;
+
+    if (argc != 2) {
+	fprintf(stderr, "Usage: %s dir\n", argv[0]);
+	exit(1);
+    }
+
+    pmsprintf(path, sizeof(path), "%s/one", argv[1]);
+    check(ctx1 = pmiStart(path, 0), "pmiStart one");
+    check(pmiSetHostname("qa.host"), "pmiSetHostname");
+    check(pmiSetTimezone("UTC"), "pmiSetTimezone");
+    for (i = 0; i < NMETRIC; i++) {
+	pmsprintf(name, sizeof(name), "qa.metric%02d", i);
+	check(pmiAddMetric(name, pmID_build(245, 0, i), PM_TYPE_U32,
+			PM_INDOM_NULL, PM_SEM_INSTANT, pmiUnits(0,0,0,0,0,0)),
+			"pmiAddMetric");
+	check(handles[i] = pmiGetHandle(name, ""), "pmiGetHandle");
+    }
+    /* values pending in context one when the next context is started */
+    put(handles, 1);
+
+    pmsprintf(path, sizeof(path), "%s/two", argv[1]);
+    check(ctx2 = pmiStart(path, 1), "pmiStart two");
+    check(pmiSetHostname("qa.host"), "pmiSetHostname");
+    check(pmiSetTimezone("UTC"), "pmiSetTimezone");
+    write_samples(handles, 1, 3);
+
+    /* grow context one's metric table, freeing the old one */
+    check(pmiUseContext(ctx1), "pmiUseContext one");
+    check(pmiAddMetric("qa.extra", pmID_build(245, 0, NMETRIC), PM_TYPE_U32,
+			PM_INDOM_NULL, PM_SEM_INSTANT, pmiUnits(0,0,0,0,0,0)),
+			"pmiAddMetric");
+    check(pmiWrite(1, 0), "pmiWrite one");
+    check(pmiEnd(), "pmiEnd one");
+
+    /* inherit from context two */
+    check(pmiUseContext(ctx2), "pmiUseContext two");
+    pmsprintf(path, sizeof(path), "%s/three", argv[1]);
+    check(pmiStart(path, 1), "pmiStart three");
+    check(pmiSetHostname("qa.host"), "pmiSetHostname");
+    check(pmiSetTimezone("UTC"), "pmiSetTimezone");
+    write_samples(handles, 4, 6);
+    check(pmiEnd(), "pmiEnd three");
+
+    check(pmiUseContext(ctx2), "pmiUseContext two");
+    check(pmiEnd(), "pmiEnd two");
+
+    return 0;
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * Load generator for the pmproxy REST API - a number of client threads
+ * each issue back-to-back HTTP/1.1 keep-alive GET requests for a URL,
+ * and the aggregate requests/second rate is reported at the end.
+ *
+ * To compare throughput against pmproxy worker thread counts, restart
+ * pmproxy with each "workers" setting (pmproxy.conf) or with the
+ * UV_THREADPOOL_SIZE environment variable, e.g.
+ *
+ *   for n in 1 2 4 8; do
+ *	UV_THREADPOOL_SIZE=$n pmproxy -f &
+ *	pmproxy_load -c 32 -t 10 /pmapi/fetch?names=kernel.all.load
+ *	kill %1; wait
+ *   done
+ */
+
+#include <pcp/pmapi.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+typedef struct {
+    pthread_t		tid;
+    int			fd;
+    unsigned long long	requests;
+    unsigned long long	errors;
+    unsigned long long	bytes;
+    size_t		start;		/* unconsumed data offset */
+    size_t		end;		/* end of buffered data */
+    char		buffer[65536];
+} worker_t;
+
+static const char	*host = "localhost";
+static const char	*port = "44322";
+static const char	*url = "/metrics?names=sample.long.one";
+static struct addrinfo	*address;
+static char		request[1024];
+static size_t		requestlen;
+static volatile int	stopping;
+static int		verbose;
+
+static int
+connect_server(void)
+{
+    struct addrinfo	*ap;
+    int			fd, one = 1;
+
+    for (ap = address; ap != NULL; ap = ap->ai_next) {
+	if ((fd = socket(ap->ai_family, ap->ai_socktype, ap->ai_protocol)) < 0)
+	    continue;
+	if (connect(fd, ap->ai_addr, ap->ai_addrlen) == 0) {
+	    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	    return fd;
+	}
+	close(fd);
+    }
+    return -1;
+}
+
+/* ensure at least count bytes are buffered, compacting as needed */
+static int
+fill(worker_t *wp, size_t count)
+{
+    ssize_t		bytes;
+
+    if (count > sizeof(wp->buffer))
+	return -1;
+    if (wp->start + count > sizeof(wp->buffer)) {
+	memmove(wp->buffer, wp->buffer + wp->start, wp->end - wp->start);
+	wp->end -= wp->start;
+	wp->start = 0;
+    }
+    while (wp->end - wp->start < count) {
+	bytes = read(wp->fd, wp->buffer + wp->end, sizeof(wp->buffer) - wp->end);
+	if (bytes <= 0)
+	    return -1;
+	wp->end += bytes;
+	wp->bytes += bytes;
+    }
+    return 0;
+}
+
+/* discard count bytes of buffered or yet-to-arrive response data */
+static int
+skip(worker_t *wp, size_t count)
+{
+    size_t		length;
+
+    while (count > 0) {
+	if (wp->start == wp->end && fill(wp, 1) < 0)
+	    return -1;
+	length = wp->end - wp->start;
+	if (length > count)
+	    length = count;
+	wp->start += length;
+	count -= length;
+    }
+    return 0;
+}
+
+/* return the next CRLF-terminated line, in-place and NUL-terminated */
+static char *
+line(worker_t *wp)
+{
+    char		*p, *s;
+
+    for (;;) {
+	s = wp->buffer + wp->start;
+	if ((p = memchr(s, '\n', wp->end - wp->start)) != NULL) {
+	    *p = '\0';
+	    if (p > s && p[-1] == '\r')
+		p[-1] = '\0';
+	    wp->start = (p - wp->buffer) + 1;
+	    return s;
+	}
+	if (fill(wp, wp->end - wp->start + 1) < 0)
+	    return NULL;
+    }
+}
+
+static int
+response(worker_t *wp)
+{
+    long long		length = -1;
+    int			chunked = 0, close = 0, status;
+    char		*s;
+
+    if ((s = line(wp)) == NULL || sscanf(s, "HTTP/%*s %d", &status) != 1)
+	return -1;
+    while ((s = line(wp)) != NULL && *s != '\0') {
+	if (strncasecmp(s, "Content-Length:", 15) == 0)
+	    length = strtoll(s + 15, NULL, 10);
+	else if (strncasecmp(s, "Transfer-Encoding:", 18) == 0)
+	    chunked = (strstr(s + 18, "chunked") != NULL);
+	else if (strncasecmp(s, "Connection:", 11) == 0)
+	    close = (strstr(s + 11, "close") != NULL);
+    }
+    if (s == NULL)
+	return -1;
+
+    if (chunked) {
+	do {
+	    if ((s = line(wp)) == NULL)
+		return -1;
+	    length = strtoll(s, NULL, 16);
+	    if (skip(wp, length) < 0 || (s = line(wp)) == NULL)
+		return -1;
+	} while (length > 0);
+    } else if (length > 0) {
+	if (skip(wp, length) < 0)
+	    return -1;
+    }
+    if (status != 200)
+	wp->errors++;
+    return close;
+}
+
+static void *
+worker(void *arg)
+{
+    worker_t		*wp = (worker_t *)arg;
+    int			sts;
+
+    wp->fd = -1;
+    while (!stopping) {
+	if (wp->fd < 0) {
+	    if ((wp->fd = connect_server()) < 0) {
+		wp->errors++;
+		sleep(1);
+		continue;
+	    }
+	    wp->start = wp->end = 0;
+	}
+	if (write(wp->fd, request, requestlen) != (ssize_t)requestlen ||
+	    (sts = response(wp)) < 0) {
+	    wp->errors++;
+	    close(wp->fd);
+	    wp->fd = -1;
+	    continue;
+	}
+	wp->requests++;
+	if (sts > 0) {	/* server closed the connection */
+	    close(wp->fd);
+	    wp->fd = -1;
+	}
+    }
+    if (wp->fd >= 0)
+	close(wp->fd);
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct addrinfo	hints = { 0 };
+    struct timeval	start, finish;
+    unsigned long long	requests = 0, errors = 0, bytes = 0;
+    worker_t		*workers;
+    double		elapsed;
+    int			c, i, sts, errflag = 0;
+    int			clients = 8;
+    int			seconds = 10;
+    static const char	*usage = "[-v] [-c clients] [-h host] [-p port] "
+				 "[-t seconds] [url]";
+
+    pmSetProgname(argv[0]);
+    while ((c = getopt(argc, argv, "c:h:p:t:v?")) != EOF) {
+	switch (c) {
+
+	case 'c':	/* concurrent client connections */
+	    clients = atoi(optarg);
+	    if (clients <= 0)
+		errflag++;
+	    break;
+
+	case 'h':	/* pmproxy host */
+	    host = optarg;
+	    break;
+
+	case 'p':	/* pmproxy port */
+	    port = optarg;
+	    break;
+
+	case 't':	/* test duration (sec) */
+	    seconds = atoi(optarg);
+	    if (seconds <= 0)
+		errflag++;
+	    break;
+
+	case 'v':	/* per-client reporting */
+	    verbose++;
+	    break;
+
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+    if (optind < argc)
+	url = argv[optind++];
+
+    if (errflag || optind != argc) {
+	fprintf(stderr, "Usage: %s %s\n", pmGetProgname(), usage);
+	exit(1);
+    }
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((sts = getaddrinfo(host, port, &hints, &address)) != 0) {
+	fprintf(stderr, "%s: %s:%s: %s\n", pmGetProgname(), host, port,
+		gai_strerror(sts));
+	exit(1);
+    }
+    requestlen = pmsprintf(request, sizeof(request),
+		"GET %s HTTP/1.1\r\nHost: %s:%s\r\n"
+		"Connection: keep-alive\r\n\r\n", url, host, port);
+
+    if ((workers = calloc(clients, sizeof(worker_t))) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmGetProgname());
+	exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < clients; i++) {
+	if ((sts = pthread_create(&workers[i].tid, NULL, worker, &workers[i])) != 0) {
+	    fprintf(stderr, "%s: pthread_create: %s\n", pmGetProgname(),
+		    strerror(sts));
+	    exit(1);
+	}
+    }
+    sleep(seconds);
+    stopping = 1;
+    for (i = 0; i < clients; i++) {
+	pthread_join(workers[i].tid, NULL);
+	if (verbose)
+	    printf("client %d: %llu requests, %llu errors\n",
+		    i, workers[i].requests, workers[i].errors);
+	requests += workers[i].requests;
+	errors += workers[i].errors;
+	bytes += workers[i].bytes;
+    }
+    gettimeofday(&finish, NULL);
+    elapsed = pmtimevalSub(&finish, &start);
+
+    printf("clients %d, elapsed %.2f sec, requests %llu, errors %llu\n",
+	    clients, elapsed, requests, errors);
+    printf("%.1f requests/sec, %.1f Kbytes/sec\n",
+	    requests / elapsed, bytes / elapsed / 1024.0);
+
+    freeaddrinfo(address);
+    free(workers);
+    exit(errors ? 1 : 0);
+}
@@ -45,8 +45,8 @@ _pcp_complete()
         arg_regex="-[ahKceASTOstiJ489NP0qQbByYgpXEx]"
     ;;
     pmdumplog)
-        all_args="adehiLlmnrSsTtVvxZz"
-        arg_regex="-[nSTvZ]"
+        all_args="adehiLlmnorSsTtVvxZz"
+        arg_regex="-[noSTvZ]"
     ;;
     pmdumptext)
         all_args="AaCcdFfGHhilMmNnOoPRrSstTUuVXwZz"
@@ -61,16 +61,16 @@ _pcp_complete()
         arg_regex="-[abchKNnOZ]"
     ;;
     pmlogcheck)
-        all_args="lnSTvwZz"
-        arg_regex="-[nSTZ]"
+        all_args="jlmnPSTvwZz"
+        arg_regex="-[jnPSTZ]"
     ;;
     pmlogextract)
         all_args="cdfmSsTvwZz"
         arg_regex="-[cSsTvZ]"
     ;;
     pmlogsummary)
-        all_args="aBbFfHIilMmNnpSTVvxZz"
-        arg_regex="-[BnpSTZ]"
+        all_args="aBbdFfHIijlMmNnPpRSTVvxZz"
+        arg_regex="-[BjnPpRSTZ]"
     ;;
     pmprobe)
         all_args="abdfFhIiKLnOVvZz"
@@ -1045,6 +1045,8 @@ PCP_CALL extern void __pmOptFetchRedo(fetchctl_t **);
 PCP_CALL extern void __pmOptFetchDump(FILE *, const fetchctl_t *);
 PCP_CALL extern void __pmOptFetchGetParams(optcost_t *);
 PCP_CALL extern void __pmOptFetchPutParams(optcost_t *);
+PCP_CALL extern int __pmOptFetchObserve(fetchctl_t *, const pmResult *);
+PCP_CALL extern void __pmOptFetchObserveAgents(const pmResult *);
 
 /* __pmProcessExec and friends ... replacementes for system(3) and popen(3) */
 typedef struct __pmExecCtl __pmExecCtl_t;		/* opaque handle */
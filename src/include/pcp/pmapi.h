@@ -1066,6 +1066,24 @@ PCP_CALL extern int pmUnpackHighResEventRecords(pmValueSet *, int, pmHighResResu
 /* Free set of pmHighResResults from pmUnpackEventRecords */
 PCP_CALL extern void pmFreeHighResEventResult(pmHighResResult **);
 
+/* Iterate over packed event records in place, without unpacking */
+typedef struct pmEventIterator {
+    pmTimespec		ei_timestamp;	/* current record timestamp */
+    unsigned int	ei_flags;	/* current record flags */
+    int			ei_nparams;	/* current record parameter count */
+    int			ei_missed;	/* missed records, PM_EVENT_FLAG_MISSED */
+    /* private fields, for use by the iterator routines only */
+    int			ei_highres;	/* PM_TYPE_HIGHRES_EVENT array */
+    int			ei_nrecords;	/* records in the packed array */
+    int			ei_record;	/* current record */
+    int			ei_param;	/* next parameter in current record */
+    char		*ei_base;	/* next parameter or record */
+} pmEventIterator;
+
+PCP_CALL extern int pmEventIterInit(pmEventIterator *, pmValueSet *, int);
+PCP_CALL extern int pmEventIterNext(pmEventIterator *);
+PCP_CALL extern int pmEventIterParam(pmEventIterator *, pmValueSet *);
+
 /* Service discovery, for clients. */
 #define PM_SERVER_SERVICE_SPEC	"pmcd"
 #define PM_SERVER_PROXY_SPEC	"pmproxy"
@@ -1083,6 +1101,9 @@ PCP_CALL extern int pmExtendFetchGroup_item(pmFG, const char *, const char *,
 PCP_CALL extern int pmExtendFetchGroup_indom(pmFG, const char *, const char *,
 			int[], char *[], pmAtomValue[], int, int[],
 			unsigned int, unsigned int *, int *);
+PCP_CALL extern int pmExtendFetchGroup_indom_double(pmFG, const char *,
+			const char *, int[], char *[], double[], int[],
+			unsigned int, unsigned int *, int *);
 PCP_CALL extern int pmExtendFetchGroup_event(pmFG, const char *, const char *,
 			const char *, const char *,
 			struct timespec[], pmAtomValue[], int, int[],
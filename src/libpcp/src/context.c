@@ -18,8 +18,8 @@
  * curr_handle needs to be thread-private
  * curr_ctx needs to be thread-private
  *
- * contexts[], contexts_map[], contexts_len and last_handle are protected
- * from changes * using the local contexts_lock mutex.
+ * contexts[], contexts_map[], contexts_len, contexts_hash and last_handle
+ * are protected from changes * using the local contexts_lock mutex.
  *
  * Ditto for back n_backoff, def_backoff[] and backoff[].
  *
@@ -45,6 +45,12 @@ static int		last_handle = -1;	/* last returned context handle */
  * __pmContext is found via contexts[j]
  */
 static int		*contexts_map;
+/*
+ * Hashed access from handle x to j above, so that handle mapping is
+ * not a linear scan of contexts_map[] ... only handles >= 0 (i.e. not
+ * MAP_FREE nor MAP_TEARDOWN) are present in the hash
+ */
+static __pmHashCtl	contexts_hash;
 
 /*
  * Special sentinals for contexts_map[] ...
@@ -91,20 +97,37 @@ __pmIsContextsLock(void *lock)
 static int
 map_handle_nolock(int handle)
 {
-    int		ctxnum = -1;
-    int		i;
+    __pmHashNode	*hp;
+    int			ctxnum;
 
-    for (i = 0; i < contexts_len; i++) {
-	if (contexts_map[i] == handle && contexts_map[i] >= 0) {
-	    if (contexts[i]->c_type != PM_CONTEXT_INIT) {
-		ctxnum = i;
-		break;
-	    }
-	}
-    }
+    if (handle < 0 || (hp = __pmHashSearch(handle, &contexts_hash)) == NULL)
+	return -1;
+    ctxnum = (int)(__psint_t)hp->data;
+    if (contexts_map[ctxnum] != handle ||
+	contexts[ctxnum]->c_type == PM_CONTEXT_INIT)
+	return -1;
     return ctxnum;
 }
 
+/*
+ * Maintain the contexts_hash entry when contexts_map[ctxnum] changes,
+ * called with contexts_lock mutex held.
+ */
+static int
+map_set(int ctxnum, int handle)
+{
+    int		old = contexts_map[ctxnum];
+
+    PM_ASSERT_IS_LOCKED(contexts_lock);
+
+    if (old >= 0)
+	__pmHashDel(old, (void *)(__psint_t)ctxnum, &contexts_hash);
+    contexts_map[ctxnum] = handle;
+    if (handle >= 0)
+	return __pmHashAdd(handle, (void *)(__psint_t)ctxnum, &contexts_hash);
+    return 0;
+}
+
 static int
 map_handle(int handle)
 {
@@ -185,36 +208,33 @@ waitawhile(__pmPMCDCtl *ctl)
 __pmContext *
 __pmHandleToPtr(int handle)
 {
-    int		i;
+    int		ctxnum;
 
     PM_LOCK(contexts_lock);
-    for (i = 0; i < contexts_len; i++) {
-	if (contexts_map[i] == handle && contexts_map[i] >= 0) {
-	    if (contexts[i]->c_type > PM_CONTEXT_UNDEF) {
-		__pmContext	*sts = contexts[i];
-		/*
-		 * Important Note:
-		 *   Once c_lock is locked for _any_ context, the caller
-		 *   cannot call into the routines here where contexts_lock
-		 *   is acquired without first releasing the c_lock for all
-		 *   contexts that are locked.
-		 */
-		PM_LOCK(sts->c_lock);
-		/*
-		 * Note:
-		 *   Since we're holding the contexts_lock no
-		 *   pmDestroyContext() for this context can happen between
-		 *   the test above and the lock being granted ... and
-		 *   without a pmContextDestroy() there can be no reuse
-		 *   of the __pmContext struct, so the asserts below are
-		 *   to-be-sure-to-be-sure.
-		 */
-		PM_UNLOCK(contexts_lock);
-		assert(sts->c_handle == handle);
-		assert(sts->c_type > PM_CONTEXT_UNDEF);
-		return sts;
-	    }
-	}
+    if ((ctxnum = map_handle(handle)) >= 0 &&
+	contexts[ctxnum]->c_type > PM_CONTEXT_UNDEF) {
+	__pmContext	*sts = contexts[ctxnum];
+	/*
+	 * Important Note:
+	 *   Once c_lock is locked for _any_ context, the caller
+	 *   cannot call into the routines here where contexts_lock
+	 *   is acquired without first releasing the c_lock for all
+	 *   contexts that are locked.
+	 */
+	PM_LOCK(sts->c_lock);
+	/*
+	 * Note:
+	 *   Since we're holding the contexts_lock no
+	 *   pmDestroyContext() for this context can happen between
+	 *   the test above and the lock being granted ... and
+	 *   without a pmContextDestroy() there can be no reuse
+	 *   of the __pmContext struct, so the asserts below are
+	 *   to-be-sure-to-be-sure.
+	 */
+	PM_UNLOCK(contexts_lock);
+	assert(sts->c_handle == handle);
+	assert(sts->c_type > PM_CONTEXT_UNDEF);
+	return sts;
     }
     PM_UNLOCK(contexts_lock);
     return NULL;
@@ -1066,6 +1086,7 @@ pmNewContext(int type, const char *name)
     initcontextlock(&new->c_lock);
 
     ctxnum = contexts_len;
+    contexts_map[ctxnum] = MAP_FREE;
     contexts_len++;
 
     /*
@@ -1085,7 +1106,10 @@ INIT_CONTEXT:
     PM_TPD(curr_handle) = new->c_handle = ++last_handle;
     new->c_slot = ctxnum;
     contexts[ctxnum] = &being_initialized;
-    contexts_map[ctxnum] = last_handle;
+    if ((sts = map_set(ctxnum, last_handle)) < 0) {
+	contexts[ctxnum] = new;
+	goto FAILED_LOCKED;
+    }
     PM_UNLOCK(contexts_lock);
     /* c_lock not re-initialized, created once from initcontextlock() above */
     new->c_type = (type & PM_CONTEXT_TYPEMASK);
@@ -1230,7 +1254,7 @@ FAILED_LOCKED:
         /* We could memset-0 the struct, but this is not really
            necessary.  That's the first thing we'll do in INIT_CONTEXT. */
         contexts[ctxnum] = new;
-	contexts_map[ctxnum] = MAP_FREE;
+	map_set(ctxnum, MAP_FREE);
     }
     PM_TPD(curr_handle) = old_curr_handle;
     PM_TPD(curr_ctxp) = old_curr_ctxp;
@@ -1532,7 +1556,7 @@ done:
     /* return an error code, or the handle for the new context */
     if (sts < 0 && new >= 0) {
 	PM_LOCK(contexts_lock);
-	contexts_map[ctxnum] = MAP_FREE;
+	map_set(ctxnum, MAP_FREE);
 	PM_UNLOCK(contexts_lock);
     }
 
@@ -1641,7 +1665,7 @@ pmDestroyContext(int handle)
 
     ctxp = contexts[ctxnum];
     PM_LOCK(ctxp->c_lock);
-    contexts_map[ctxnum] = MAP_TEARDOWN;
+    map_set(ctxnum, MAP_TEARDOWN);
     PM_UNLOCK(contexts_lock);
     if (ctxp->c_pmcd != NULL) {
 	__pmPMCDCtlFree(ctxp->c_pmcd);
@@ -1673,7 +1697,7 @@ pmDestroyContext(int handle)
     PM_UNLOCK(ctxp->c_lock);
 
     PM_LOCK(contexts_lock);
-    contexts_map[ctxnum] = MAP_FREE;
+    map_set(ctxnum, MAP_FREE);
     PM_UNLOCK(contexts_lock);
 
     sts = 0;
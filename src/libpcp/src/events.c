@@ -708,3 +708,150 @@ pmFreeHighResEventResult(pmHighResResult **rset)
 	__pmFreeHighResResult(rset[r]);
     free(rset);
 }
+
+/*
+ * Iterate over the idx'th instance of a packed event record metric
+ * value in place, without allocating anything ... the records and
+ * parameters are visited in order and returned via the iterator state
+ * (records) or a caller provided pmValueSet (parameters) that refers
+ * directly into the packed array.
+ *
+ * Both PM_TYPE_EVENT and PM_TYPE_HIGHRES_EVENT values are handled.
+ */
+int
+pmEventIterInit(pmEventIterator *iter, pmValueSet *vsp, int idx)
+{
+    pmEventArray	*eap;
+    int			sts;
+
+    memset(iter, 0, sizeof(*iter));
+    if (vsp->numval < 1)
+	return vsp->numval;
+    if (vsp->valfmt != PM_VAL_DPTR && vsp->valfmt != PM_VAL_SPTR)
+	return PM_ERR_CONV;
+
+    /* ea_type and ea_nrecords are at the same offsets for both types */
+    eap = (pmEventArray *)vsp->vlist[idx].value.pval;
+    iter->ei_highres = (eap->ea_type == PM_TYPE_HIGHRES_EVENT);
+    if ((sts = check_event_records(vsp, idx, iter->ei_highres)) < 0) {
+	dump_event_records(stderr, vsp, idx, iter->ei_highres);
+	return sts;
+    }
+    if (iter->ei_highres)
+	iter->ei_base = (char *)&((pmHighResEventArray *)eap)->ea_record[0];
+    else
+	iter->ei_base = (char *)&eap->ea_record[0];
+    iter->ei_nrecords = eap->ea_nrecords;
+    iter->ei_record = -1;
+    return iter->ei_nrecords;
+}
+
+/*
+ * Step to the next event record, skipping over any parameters of
+ * the current record that have not been visited.
+ * Returns 1 if positioned on a record, else 0 when no more records.
+ */
+int
+pmEventIterNext(pmEventIterator *iter)
+{
+    pmEventParameter	*epp;
+    char		*base;
+
+    if (iter->ei_record >= iter->ei_nrecords)
+	return 0;
+
+    /* skip parameters remaining in the current record */
+    while (iter->ei_param < iter->ei_nparams) {
+	epp = (pmEventParameter *)iter->ei_base;
+	iter->ei_base += sizeof(epp->ep_pmid) + PM_PDU_SIZE_BYTES(epp->ep_len);
+	iter->ei_param++;
+    }
+    if (++iter->ei_record >= iter->ei_nrecords) {
+	iter->ei_nparams = iter->ei_param = 0;
+	return 0;
+    }
+
+    base = iter->ei_base;
+    if (iter->ei_highres) {
+	pmHighResEventRecord	*hrerp = (pmHighResEventRecord *)base;
+
+	iter->ei_timestamp.tv_sec = hrerp->er_timestamp.tv_sec;
+	iter->ei_timestamp.tv_nsec = hrerp->er_timestamp.tv_nsec;
+	iter->ei_flags = hrerp->er_flags;
+	iter->ei_nparams = hrerp->er_nparams;
+	base += sizeof(hrerp->er_timestamp) + sizeof(hrerp->er_flags) +
+		sizeof(hrerp->er_nparams);
+    }
+    else {
+	pmEventRecord	*erp = (pmEventRecord *)base;
+
+	iter->ei_timestamp.tv_sec = erp->er_timestamp.tv_sec;
+	iter->ei_timestamp.tv_nsec = erp->er_timestamp.tv_usec * 1000;
+	iter->ei_flags = erp->er_flags;
+	iter->ei_nparams = erp->er_nparams;
+	base += sizeof(erp->er_timestamp) + sizeof(erp->er_flags) +
+		sizeof(erp->er_nparams);
+    }
+    iter->ei_base = base;
+    iter->ei_param = 0;
+    iter->ei_missed = 0;
+    if (iter->ei_flags & PM_EVENT_FLAG_MISSED) {
+	/* no parameters, er_nparams is the count of missed records */
+	iter->ei_missed = iter->ei_nparams;
+	iter->ei_nparams = 0;
+    }
+    return 1;
+}
+
+/*
+ * Return the next parameter of the current event record via vsp,
+ * with a single value that refers into the packed array (so vsp is
+ * only valid as long as the enclosing value is valid).
+ * Returns 1 if a parameter was returned, 0 when no more parameters,
+ * or PM_ERR_TYPE for a parameter type that cannot be an event
+ * parameter.
+ */
+int
+pmEventIterParam(pmEventIterator *iter, pmValueSet *vsp)
+{
+    pmEventParameter	*epp;
+    int			sts = 1;
+
+    if (iter->ei_record < 0 || iter->ei_record >= iter->ei_nrecords ||
+	iter->ei_param >= iter->ei_nparams)
+	return 0;
+
+    epp = (pmEventParameter *)iter->ei_base;
+    vsp->pmid = epp->ep_pmid;
+    vsp->numval = 1;
+    vsp->vlist[0].inst = PM_IN_NULL;
+    switch (epp->ep_type) {
+	case PM_TYPE_32:
+	case PM_TYPE_U32:
+	    vsp->valfmt = PM_VAL_INSITU;
+	    memcpy((void *)&vsp->vlist[0].value.lval,
+		   (char *)epp + sizeof(epp->ep_pmid) + sizeof(int),
+		   sizeof(__int32_t));
+	    break;
+	case PM_TYPE_64:
+	case PM_TYPE_U64:
+	case PM_TYPE_FLOAT:
+	case PM_TYPE_DOUBLE:
+	case PM_TYPE_AGGREGATE:
+	case PM_TYPE_STRING:
+	case PM_TYPE_AGGREGATE_STATIC:
+	    /* ep_type and ep_len have the same layout as a pmValueBlock */
+	    vsp->valfmt = PM_VAL_SPTR;
+	    vsp->vlist[0].value.pval =
+			(pmValueBlock *)((char *)epp + sizeof(epp->ep_pmid));
+	    break;
+	case PM_TYPE_EVENT:	/* no nesting! */
+	case PM_TYPE_HIGHRES_EVENT:
+	default:
+	    vsp->numval = sts = PM_ERR_TYPE;
+	    break;
+    }
+    iter->ei_base += sizeof(epp->ep_pmid) + PM_PDU_SIZE_BYTES(epp->ep_len);
+    iter->ei_param++;
+    return sts;
+}
@@ -88,11 +88,15 @@ struct __pmFetchGroupItem {
 	    int *output_inst_codes;	/* NB: may be NULL */
 	    char **output_inst_names;	/* NB: may be NULL */
 	    pmAtomValue *output_values;	/* NB: may be NULL */
+	    double *output_doubles;	/* NB: may be NULL */
 	    int output_type;
 	    int *output_stss;	/* NB: may be NULL */
 	    int *output_sts;	/* NB: may be NULL */
 	    unsigned output_maxnum;
 	    unsigned *output_num;	/* NB: may be NULL */
+	    double *vector;	/* batch conversion scratch space */
+	    int *vector_stss;
+	    unsigned vector_size;
 	} indom;
 	struct {
 	    pmID metric_pmid;
@@ -591,6 +595,10 @@ pmfg_reinit_indom(pmFGI item)
 	for (i = 0; i < item->u.indom.output_maxnum; i++)
 	    __pmReinitValue(&item->u.indom.output_values[i], item->u.indom.output_type);
 
+    if (item->u.indom.output_doubles)
+	for (i = 0; i < item->u.indom.output_maxnum; i++)
+	    item->u.indom.output_doubles[i] = (double)0.0 / (double)0.0;
+
     if (item->u.indom.output_inst_names)
 	for (i = 0; i < item->u.indom.output_maxnum; i++)
 	    item->u.indom.output_inst_names[i] = NULL;	/* break ref into indom_names[] */
@@ -796,6 +804,227 @@ pmfg_extract_convert_item(pmFG pmfg, pmID metric_pmid, int metric_inst,
     return __pmStuffDoubleValue(value, oval, otype);
 }
 
+/*
+ * Compute the single multiplier that performs the unit conversion of
+ * pmfg_convert_double, so that it can be applied to a whole vector of
+ * values.  Unit conversion is always a linear rescaling.
+ */
+static int
+pmfg_convert_factor(const pmDesc *desc, const pmFGC conv, double *factor)
+{
+    pmAtomValue v, v_scaled;
+    int sts;
+
+    if (!conv->unit_convert) {
+	*factor = 1.0;
+	return 0;
+    }
+
+    v.d = 1.0;
+    sts = pmConvScale(PM_TYPE_DOUBLE, &v, &desc->units,
+			&v_scaled, &conv->output_units);
+    if (sts)
+	return sts;
+
+    *factor = v_scaled.d * conv->output_multiplier;
+    return 0;
+}
+
+/*
+ * Extract the first num values of a pmValueSet as doubles, with the
+ * type decoding hoisted out of the per-instance loops.  Anything other
+ * than the expected encoding for numeric types is refused, and the
+ * caller falls back to per-value extraction.
+ */
+static int
+pmfg_extract_doubles(const pmValueSet *vs, int type, double *out, unsigned num)
+{
+    const pmValue *vp = vs->vlist;
+    unsigned j;
+
+    if (type == PM_TYPE_32 || type == PM_TYPE_U32) {
+	if (vs->valfmt != PM_VAL_INSITU)
+	    return PM_ERR_CONV;
+    }
+    else if (vs->valfmt == PM_VAL_INSITU)
+	return PM_ERR_CONV;
+
+    switch (type) {
+	case PM_TYPE_32:
+	    for (j = 0; j < num; j++)
+		out[j] = (__int32_t)vp[j].value.lval;
+	    break;
+	case PM_TYPE_U32:
+	    for (j = 0; j < num; j++)
+		out[j] = (__uint32_t)vp[j].value.lval;
+	    break;
+	case PM_TYPE_64:
+	    for (j = 0; j < num; j++) {
+		__int64_t ll;
+		memcpy(&ll, vp[j].value.pval->vbuf, sizeof(ll));
+		out[j] = ll;
+	    }
+	    break;
+	case PM_TYPE_U64:
+	    for (j = 0; j < num; j++) {
+		__uint64_t ull;
+		memcpy(&ull, vp[j].value.pval->vbuf, sizeof(ull));
+		out[j] = ull;
+	    }
+	    break;
+	case PM_TYPE_FLOAT:
+	    for (j = 0; j < num; j++) {
+		float f;
+		memcpy(&f, vp[j].value.pval->vbuf, sizeof(f));
+		out[j] = f;
+	    }
+	    break;
+	case PM_TYPE_DOUBLE:
+	    for (j = 0; j < num; j++)
+		memcpy(&out[j], vp[j].value.pval->vbuf, sizeof(double));
+	    break;
+	default:
+	    return PM_ERR_TYPE;
+    }
+    return 0;
+}
+
+/*
+ * Make room for batch conversion of an indom with num instances.
+ */
+static int
+pmfg_vector_reserve(pmFGI item, unsigned num)
+{
+    double *vector;
+    int *stss;
+    unsigned size;
+
+    if (num <= item->u.indom.vector_size)
+	return 0;
+
+    /* current and previous values, amortized growth */
+    size = item->u.indom.vector_size ? item->u.indom.vector_size : 16;
+    while (size < num)
+	size *= 2;
+    if ((vector = realloc(item->u.indom.vector, 2 * size * sizeof(double))) == NULL)
+	return -ENOMEM;
+    item->u.indom.vector = vector;
+    if ((stss = realloc(item->u.indom.vector_stss, size * sizeof(int))) == NULL)
+	return -ENOMEM;
+    item->u.indom.vector_stss = stss;
+    item->u.indom.vector_size = size;
+    return 0;
+}
+
+/*
+ * Batch equivalent of pmfg_extract_convert_item for all the instances
+ * of an indom item: values are decoded into a contiguous array of
+ * doubles, previous values for rate conversion are matched up by a
+ * single merge over the (sorted) instances of both results, then
+ * rate and unit conversion is done in one pass over the array.
+ *
+ * Returns zero with per-instance status in stss[], else a negative
+ * code if the batch path cannot be used for this pmValueSet.
+ */
+static int
+pmfg_convert_indom(pmFG pmfg, pmFGI item, const pmResult *newResult,
+		   const pmValueSet *iv, unsigned num, double *values, int *stss)
+{
+    const pmDesc *desc = &item->u.indom.metric_desc;
+    const pmFGC conv = &item->u.indom.conv;
+    double factor;
+    unsigned j;
+    int sts;
+
+    if ((sts = pmfg_extract_doubles(iv, desc->type, values, num)) < 0)
+	return sts;
+
+    sts = pmfg_convert_factor(desc, conv, &factor);
+
+    if (sts == 0 && conv->rate_convert) {
+	const pmResult *prev_r = pmfg->prevResult;
+	const pmValueSet *pv = NULL;
+	struct timespec timestamp, prev_t;
+	double *prev_values = &item->u.indom.vector[item->u.indom.vector_size];
+	double *all_prev = prev_values;
+	double deltaT;
+	const double epsilon = 0.000000001;	/* 1 nanosecond */
+	unsigned k;
+	int i;
+
+	if (prev_r == NULL)
+	    sts = PM_ERR_AGAIN;
+	else {
+	    for (i = 0; i < prev_r->numpmid; i++) {
+		if (prev_r->vset[i]->pmid == iv->pmid) {
+		    pv = prev_r->vset[i];
+		    break;
+		}
+	    }
+	    if (pv == NULL)
+		sts = PM_ERR_VALUE;
+	    else if (pv->numval < 0)
+		sts = pv->numval;
+	}
+	if (sts < 0)
+	    goto done;
+
+	/* previous values are needed in instance order of this result */
+	if (pv->numval > item->u.indom.vector_size) {
+	    if ((all_prev = malloc(pv->numval * sizeof(double))) == NULL)
+		return -ENOMEM;
+	}
+	if ((sts = pmfg_extract_doubles(pv, desc->type, all_prev, pv->numval)) < 0) {
+	    if (all_prev != prev_values)
+		free(all_prev);
+	    return sts;
+	}
+	for (j = k = 0; j < num; j++) {
+	    while (k < (unsigned)pv->numval && pv->vlist[k].inst < iv->vlist[j].inst)
+		k++;
+	    if (k < (unsigned)pv->numval && pv->vlist[k].inst == iv->vlist[j].inst) {
+		prev_values[j] = all_prev[k];
+		stss[j] = 0;
+	    }
+	    else {
+		prev_values[j] = values[j];
+		stss[j] = PM_ERR_VALUE;
+	    }
+	}
+	if (all_prev != prev_values)
+	    free(all_prev);
+
+	pmfg_timespec_from_timeval(&newResult->timestamp, &timestamp);
+	pmfg_timespec_from_timeval(&prev_r->timestamp, &prev_t);
+	deltaT = pmfg_timespec_delta(&timestamp, &prev_t);
+	if (deltaT < epsilon)	/* avoid division by zero */
+	    deltaT = epsilon;
+
+	for (j = 0; j < num; j++)
+	    values[j] -= prev_values[j];
+	for (j = 0; j < num; j++) {
+	    if (values[j] < 0.0 && stss[j] == 0)
+		stss[j] = pmfg_unwrap_counter(pmfg, desc->type, &values[j]);
+	}
+	for (j = 0; j < num; j++)
+	    values[j] /= deltaT;
+	if (factor != 1.0) {
+	    for (j = 0; j < num; j++)
+		values[j] *= factor;
+	}
+	return 0;
+    }
+    else if (sts == 0 && factor != 1.0) {
+	for (j = 0; j < num; j++)
+	    values[j] *= factor;
+    }
+
+done:
+    for (j = 0; j < num; j++)
+	stss[j] = sts;
+    return 0;
+}
+
 static void
 pmfg_fetch_item(pmFG pmfg, pmFGI item, pmResult *newResult)
 {
@@ -871,7 +1100,8 @@ pmfg_fetch_indom(pmFG pmfg, pmFGI item, pmResult *newResult)
 {
     int sts = 0;
     int i;
-    unsigned j;
+    unsigned j, num;
+    int toobig = 0;
     int need_indom_refresh;
     const pmValueSet *iv;
 
@@ -953,22 +1183,16 @@ pmfg_fetch_indom(pmFG pmfg, pmFGI item, pmResult *newResult)
     }
 
     /*
-     * Process each instance element in the pmValueSet.	 We persevere
-     * in the face of per-item errors (including conversion errors),
-     * since we signal individual errors, except once we run out of
-     * output space.
+     * Pass the instance identifiers and names to the user.
      */
-    for (j = 0; j < (unsigned)iv->numval; j++) {
+    num = iv->numval;
+    if (num > item->u.indom.output_maxnum) {	/* too many instances! */
+	num = item->u.indom.output_maxnum;
+	toobig = 1;
+    }
+    for (j = 0; j < num; j++) {
 	const pmValue *jv = &iv->vlist[j];
-	pmAtomValue v;
-	int stss = 0;
-
-	if (j >= item->u.indom.output_maxnum) {	/* too many instances! */
-	    sts = PM_ERR_TOOBIG;
-	    goto out;
-	}
 
-	/* Pass the instance identifier to the user. */
 	if (item->u.indom.output_inst_codes)
 	    item->u.indom.output_inst_codes[j] = jv->inst;
 
@@ -992,6 +1216,51 @@ pmfg_fetch_indom(pmFG pmfg, pmFGI item, pmResult *newResult)
 		}
 	    }
 	}
+    }
+
+    /*
+     * Values passing through a double anyway (conversions, or the
+     * caller wants doubles) are converted in one batch for the whole
+     * pmValueSet, where the types involved allow it.
+     */
+    if (item->u.indom.output_doubles ||
+	item->u.indom.conv.rate_convert || item->u.indom.conv.unit_convert) {
+	double *values;
+	int *stss;
+
+	if (pmfg_vector_reserve(item, num) < 0)
+	    goto slow;
+	values = item->u.indom.output_doubles ?
+		item->u.indom.output_doubles : item->u.indom.vector;
+	stss = item->u.indom.vector_stss;
+	if (pmfg_convert_indom(pmfg, item, newResult, iv, num, values, stss) < 0)
+	    goto slow;
+
+	for (j = 0; j < num; j++) {
+	    if (stss[j] < 0) {
+		if (item->u.indom.output_doubles)
+		    values[j] = (double)0.0 / (double)0.0;
+	    }
+	    else if (item->u.indom.output_values)
+		stss[j] = __pmStuffDoubleValue(values[j],
+				&item->u.indom.output_values[j],
+				item->u.indom.output_type);
+	}
+	if (item->u.indom.output_stss)
+	    memcpy(item->u.indom.output_stss, stss, num * sizeof(int));
+	goto done;
+    }
+
+slow:
+    /*
+     * Process each instance element in the pmValueSet.	 We persevere
+     * in the face of per-item errors (including conversion errors),
+     * since we signal individual errors.
+     */
+    for (j = 0; j < num; j++) {
+	const pmValue *jv = &iv->vlist[j];
+	pmAtomValue v;
+	int stss = 0;
 
 	/* Fetch & convert the actual value. */
 	if (item->u.indom.conv.rate_convert ||
@@ -1019,12 +1288,27 @@ pmfg_fetch_indom(pmFG pmfg, pmFGI item, pmResult *newResult)
 	/* Pass the output value. */
 	if (item->u.indom.output_values)
 	    item->u.indom.output_values[j] = v;
+	if (item->u.indom.output_doubles)
+	    item->u.indom.output_doubles[j] = v.d;
 
 out1:
+	/*
+	 * A failed batch may already have written into output_doubles,
+	 * so errors must overwrite that with the promised NaN.
+	 */
+	if (stss < 0 && item->u.indom.output_doubles)
+	    item->u.indom.output_doubles[j] = (double)0.0 / (double)0.0;
 	if (item->u.indom.output_stss)
 	    item->u.indom.output_stss[j] = stss;
     }
 
+done:
+    /* once we run out of output space, signal that instead */
+    if (toobig) {
+	sts = PM_ERR_TOOBIG;
+	goto out;
+    }
+
     if (item->u.indom.output_num)
 	*item->u.indom.output_num = j;
 
@@ -1402,11 +1686,11 @@ pmExtendFetchGroup_timestamp(pmFG pmfg, struct timeval *out_value)
     return 0;
 }
 
-int
-pmExtendFetchGroup_indom(pmFG pmfg,
+static int
+pmfg_extend_indom(pmFG pmfg,
 		const char *metric, const char *scale,
 		int out_inst_codes[], char *out_inst_names[],
-		pmAtomValue out_values[], int out_type,
+		pmAtomValue out_values[], double out_doubles[], int out_type,
 		int out_stss[], unsigned int out_maxnum,
 		unsigned int *out_num, int *out_sts)
 {
@@ -1442,6 +1726,7 @@ pmExtendFetchGroup_indom(pmFG pmfg,
     item->u.indom.output_inst_codes = out_inst_codes;
     item->u.indom.output_inst_names = out_inst_names;
     item->u.indom.output_values = out_values;
+    item->u.indom.output_doubles = out_doubles;
     item->u.indom.output_type = out_type;
     item->u.indom.output_stss = out_stss;
     item->u.indom.output_sts = out_sts;
@@ -1465,6 +1750,36 @@ out:
     return sts;
 }
 
+int
+pmExtendFetchGroup_indom(pmFG pmfg,
+		const char *metric, const char *scale,
+		int out_inst_codes[], char *out_inst_names[],
+		pmAtomValue out_values[], int out_type,
+		int out_stss[], unsigned int out_maxnum,
+		unsigned int *out_num, int *out_sts)
+{
+    return pmfg_extend_indom(pmfg, metric, scale,
+			out_inst_codes, out_inst_names, out_values, NULL,
+			out_type, out_stss, out_maxnum, out_num, out_sts);
+}
+
+/*
+ * As for pmExtendFetchGroup_indom, but values are always converted to
+ * doubles and written into a contiguous caller-provided array, which
+ * allows the whole instance domain to be converted in one batch.
+ */
+int
+pmExtendFetchGroup_indom_double(pmFG pmfg,
+		const char *metric, const char *scale,
+		int out_inst_codes[], char *out_inst_names[],
+		double out_values[], int out_stss[], unsigned int out_maxnum,
+		unsigned int *out_num, int *out_sts)
+{
+    return pmfg_extend_indom(pmfg, metric, scale,
+			out_inst_codes, out_inst_names, NULL, out_values,
+			PM_TYPE_DOUBLE, out_stss, out_maxnum, out_num, out_sts);
+}
+
 int
 pmExtendFetchGroup_event(pmFG pmfg,
 		const char *metric, const char *instance,
@@ -1700,6 +2015,8 @@ pmClearFetchGroup(pmFG pmfg)
 		pmfg_reinit_indom(item);
 		free(item->u.indom.indom_codes);
 		free(item->u.indom.indom_names);
+		free(item->u.indom.vector);
+		free(item->u.indom.vector_stss);
 		break;
 	    case pmfg_event:
 		pmfg_reinit_event(item);
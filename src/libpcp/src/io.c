@@ -417,7 +417,8 @@ __pmAccess(const char *path, int amode)
  * Open a PCP file with given mode and return a __pmFILE. An i/o
  * handler is automatically chosen based on filename suffix, e.g. .xz, .gz,
  * etc. The stdio pass-thru handler will be chosen for other files.
- * The stdio handler is the only handler currently supporting write operations.
+ * Writing is supported by the stdio handler, and by the xz handler for
+ * a new file (mode "w") named with the .xz suffix.
  * Return a valid __pmFILE pointer on success or NULL on failure.
  */
 __pmFILE *
@@ -455,8 +456,14 @@ __pmFopen(const char *path, const char *mode)
     }
     if (compress_ix >= 0) {
 	if (mode[0] != 'r' || mode[1] != '\0') {
-	    /* We don't (yet) support opening compressed files for writing. */
-	    return NULL;
+	    /*
+	     * Only the on-the-fly handlers can write compressed files,
+	     * and then only to a new file named with the suffix.
+	     */
+	    if (mode[0] != 'w' || mode[1] != '\0' ||
+		compress_ctl[compress_ix].handler == NULL ||
+		strcmp(tmpname, path) != 0)
+		return NULL;
 	}
 
 	/* Use the compressed file name and select a handler. */
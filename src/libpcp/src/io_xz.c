@@ -49,6 +49,23 @@
 #define PCP_XZ_CACHE_BLOCKS 4 /* 4 blocks in the cache, for now */
 #endif
 
+/*
+ * When writing, data is buffered until a block of this size has been
+ * accumulated (or the file is flushed), then emitted as a complete
+ * single-block xz stream.
+ * The reader below handles concatenated streams, so the file remains
+ * seekable by block and every complete stream written so far can be
+ * read while the file is still growing.  The small block size and
+ * fast preset (same as xz -0) keep both the writer's latency and the
+ * reader's cache small.
+ */
+#ifndef PCP_XZ_WRITE_BLOCK
+#define PCP_XZ_WRITE_BLOCK (1024*1024)
+#endif
+#ifndef PCP_XZ_WRITE_PRESET
+#define PCP_XZ_WRITE_PRESET 0
+#endif
+
 #define XZ_HEADER_MAGIC     "\xfd" "7zXZ\0"
 #define XZ_HEADER_MAGIC_LEN 6
 #define XZ_FOOTER_MAGIC     "YZ"
@@ -89,6 +106,9 @@ typedef struct xzfile {
     off_t uncompressed_offset;
   __uint64_t uncompressed_size;
   __uint64_t max_uncompressed_block_size;
+  int writing;		/* opened for writing, the fields below apply */
+  char *wbuf;		/* uncompressed data for the next block */
+  size_t wlen;
 } xzfile;
 
 static void
@@ -228,7 +248,11 @@ parse_indexes(FILE *f, size_t *nr_streams)
 	  goto err;
       }
 
-      if (fseek(f, -LZMA_STREAM_HEADER_SIZE, SEEK_CUR) != 0) {
+      /*
+       * Seek from the start, the previous iteration left the file
+       * positioned after the stream header, not at the footer.
+       */
+      if (fseek(f, pos - LZMA_STREAM_HEADER_SIZE, SEEK_SET) != 0) {
 	  xz_debug("%s: fseek: %m", __func__);
 	  setoserror(-PM_ERR_LOGREC);
 	  goto err;
@@ -438,7 +462,7 @@ xz_open(__pmFILE *f, const char *path, const char *mode)
 {
   xzfile *xz;
 
-  xz = malloc(sizeof *xz);
+  xz = calloc(1, sizeof *xz);
   if (xz == NULL) {
       pmNoMem("xz_open", sizeof(*xz), PM_FATAL_ERR);
       return NULL;
@@ -449,6 +473,19 @@ xz_open(__pmFILE *f, const char *path, const char *mode)
   if (xz->f == NULL)
       goto err;
 
+  if (mode[0] == 'w') {
+      /* Only sequential writing of a new file is supported. */
+      if ((xz->wbuf = malloc(PCP_XZ_WRITE_BLOCK)) == NULL) {
+	  fclose(xz->f);
+	  unlink(path);
+	  goto err;
+      }
+      xz->writing = 1;
+      xz->fd = fileno(xz->f);
+      f->priv = xz;
+      return xz;
+  }
+
   if (init(xz) == 0) {
       xz->fd = fileno(xz->f);
       f->priv = xz;
@@ -466,7 +503,7 @@ xz_fdopen(__pmFILE *f, int fd, const char *mode)
 {
   xzfile *xz;
 
-  xz = malloc(sizeof *xz);
+  xz = calloc(1, sizeof *xz);
   if (xz == NULL) {
       pmNoMem("xz_open", sizeof(*xz), PM_FATAL_ERR);
       return NULL;
@@ -510,7 +547,8 @@ xz_seek(__pmFILE *f, off_t offset, int whence)
 	return -1;
     }
 
-    if (new_offset < 0) {
+    if (new_offset < 0 ||
+	(xz->writing && new_offset > xz->uncompressed_size)) {
 	errno = EINVAL;
 	return -1;
     }
@@ -782,10 +820,12 @@ static int
 xz_getc(__pmFILE *f)
 {
     xzfile *xz = (xzfile *)f->priv;;
-    block *blk = reposition(xz);
+    block *blk;
     int c;
 
-    if (blk == NULL)
+    if (xz->writing)
+	return EOF;
+    if ((blk = reposition(xz)) == NULL)
 	return EOF;
 
     /* It's a single byte. It is guaranteed that we can copy it. */
@@ -804,6 +844,9 @@ xz_read(void *ptr, size_t size, size_t nmemb, __pmFILE *f)
     size_t n;
     size_t copied;
 
+    if (xz->writing)
+	return 0;
+
     /* Obtain the requested size in bytes. */
     size *= nmemb;
 
@@ -838,16 +881,80 @@ xz_read(void *ptr, size_t size, size_t nmemb, __pmFILE *f)
     return copied;
 }
 
+/* Compress the buffered data and append it as one complete xz stream. */
+static int
+write_block(xzfile *xz)
+{
+    uint8_t *out;
+    size_t out_size;
+    size_t out_pos = 0;
+    lzma_ret r;
+    int sts = 0;
+
+    if (xz->wlen == 0)
+	return 0;
+    out_size = lzma_stream_buffer_bound(xz->wlen);
+    if ((out = malloc(out_size)) == NULL)
+	return -1;
+    r = lzma_easy_buffer_encode(PCP_XZ_WRITE_PRESET, LZMA_CHECK_CRC32, NULL,
+		(uint8_t *)xz->wbuf, xz->wlen, out, &out_pos, out_size);
+    if (r != LZMA_OK) {
+	xz_debug("%s: encode failed (error %d)", __func__, r);
+	errno = EIO;
+	sts = -1;
+    }
+    else if (fwrite(out, 1, out_pos, xz->f) != out_pos || fflush(xz->f) != 0)
+	sts = -1;
+    else
+	xz->wlen = 0;
+    free(out);
+    return sts;
+}
+
 static size_t
 xz_write(void *ptr, size_t size, size_t nmemb, __pmFILE *f)
 {
-    xz_debug("libpcp internal error: %s not implemented\n", __func__);
-    return 0;
+    xzfile *xz = (xzfile *)f->priv;
+    const char *p = (const char *)ptr;
+    size_t itemsize = size;
+    size_t n;
+
+    if (!xz->writing || xz->uncompressed_offset != xz->uncompressed_size) {
+	/* Compressed data can only be appended. */
+	errno = EBADF;
+	return 0;
+    }
+
+    size *= nmemb;
+    while (size > 0) {
+	n = PCP_XZ_WRITE_BLOCK - xz->wlen;
+	if (n > size)
+	    n = size;
+	memcpy(xz->wbuf + xz->wlen, p, n);
+	xz->wlen += n;
+	p += n;
+	size -= n;
+	if (xz->wlen == PCP_XZ_WRITE_BLOCK && write_block(xz) < 0)
+	    break;
+    }
+    n = p - (const char *)ptr;
+    xz->uncompressed_offset += n;
+    xz->uncompressed_size += n;
+    return itemsize ? n / itemsize : 0;
 }
 
 static int
 xz_flush(__pmFILE *f)
 {
+    xzfile *xz = (xzfile *)f->priv;
+
+    /*
+     * Data normally goes out in whole blocks, but a flush (e.g. before
+     * a temporal index entry is written) must make everything written
+     * so far visible, so the partial block becomes a stream of its own.
+     */
+    if (xz->writing)
+	return write_block(xz) < 0 ? EOF : 0;
     xz_debug("libpcp internal error: %s not implemented\n", __func__);
     return EOF;
 }
@@ -855,6 +962,13 @@ xz_flush(__pmFILE *f)
 static int
 xz_fsync(__pmFILE *f)
 {
+    xzfile *xz = (xzfile *)f->priv;
+
+    if (xz->writing) {
+	if (write_block(xz) < 0)
+	    return -1;
+	return fsync(xz->fd);
+    }
     xz_debug("libpcp internal error: %s not implemented\n", __func__);
     return -1;
 }
@@ -893,6 +1007,14 @@ xz_close(__pmFILE *f)
     xzfile *xz = f->priv;
     int sts;
     
+    if (xz->writing) {
+	sts = write_block(xz);
+	if (fclose(xz->f) != 0)
+	    sts = EOF;
+	free(xz->wbuf);
+	free(xz);
+	return sts;
+    }
     lzma_index_end (xz->idx, NULL);
     sts = fclose(xz->f);
     free_blkcache(xz->cache);
@@ -41,6 +41,42 @@
 /* default costs */
 static optcost_t	optcost = { 4, 1, 15, 10, 2, 0 };
 
+/*
+ * Observed costs, fed back from the client.
+ *
+ * obs_domain is keyed by PMD and holds a smoothed estimate of how long
+ * that PMD takes to answer a fetch, as reported by pmcd in the
+ * pmcd.agent.fetch metrics (see __pmOptFetchObserveAgents()), plus the
+ * estimate that was in force when the current fetch groups were built
+ * (so we can tell when the grouping has gone stale).
+ *
+ * obs_indom is keyed by indom and holds a smoothed estimate of the
+ * number of instances returned when all instances are requested, which
+ * replaces the static c_indomsize guess in missinst().
+ *
+ * The latency skew cost is kept out of optcost_t so that structure
+ * keeps its layout for __pmOptFetchGetParams() and friends.
+ */
+typedef struct {
+    double	o_latency;	/* smoothed fetch latency (msec) */
+    double	o_grouped;	/* o_latency when groups were last built */
+    int		o_count;	/* number of observations */
+    __uint64_t	o_fetches;	/* last pmcd.agent.fetch.count value */
+    __uint64_t	o_usec;		/* last pmcd.agent.fetch.time value */
+} obsdomain_t;
+
+typedef struct {
+    double	o_numinst;	/* smoothed instances per "all" fetch */
+} obsindom_t;
+
+#define OBS_ALPHA	0.25	/* EWMA weight for a new observation */
+#define OBS_SETTLE	3	/* observations before we suggest a redo */
+#define OBS_MINDIFF	1.0	/* msec, ignore drift smaller than this */
+#define OBS_LATENCY	1	/* cost per msec a PMD waits on a slower one */
+
+static __pmHashCtl	obs_domain;
+static __pmHashCtl	obs_indom;
+
 #ifdef PM_MULTI_THREAD
 static pthread_mutex_t	optfetch_lock = PTHREAD_MUTEX_INITIALIZER;
 #else
@@ -149,7 +185,7 @@ addinst(int *numinst, int **instlist, optreq_t *new)
  * is this than the set of instances identified by numb and listb[]?
  */
 static int
-missinst(int numa, int *lista, int numb, int *listb)
+missinst(int indomsize, int numa, int *lista, int numb, int *listb)
 {
     int		xtra = 0;
     int		i;
@@ -160,8 +196,8 @@ missinst(int numa, int *lista, int numb, int *listb)
     /* count in lista[] but _not_ in listb[] */
     if (numa == 0) {
 	/* special case for all instances in lista[] */
-	if (numb != 0  && numb < optcost.c_indomsize)
-	    xtra += optcost.c_indomsize - numb;
+	if (numb != 0  && numb < indomsize)
+	    xtra += indomsize - numb;
     }
     else {
 	/* not all instances for both lista[] and listb[] */
@@ -220,6 +256,90 @@ redopmid(fetchctl_t *fp)
     }
 }
 
+/*
+ * expected number of instances for an indom, observed if we have seen
+ * it, else the static guess
+ */
+static int
+indomsize(pmInDom indom)
+{
+    __pmHashNode	*hp;
+
+    PM_ASSERT_IS_LOCKED(optfetch_lock);
+
+    if (indom != PM_INDOM_NULL &&
+	(hp = __pmHashSearch((unsigned int)indom, &obs_indom)) != NULL)
+	return (int)(((obsindom_t *)hp->data)->o_numinst + 0.5);
+    return optcost.c_indomsize;
+}
+
+static obsdomain_t *
+obsdomain(int pmd)
+{
+    __pmHashNode	*hp;
+
+    PM_ASSERT_IS_LOCKED(optfetch_lock);
+
+    if ((hp = __pmHashSearch((unsigned int)pmd, &obs_domain)) == NULL)
+	return NULL;
+    return (obsdomain_t *)hp->data;
+}
+
+/*
+ * cost of the latency skew between the PMDs in this fetch ... every
+ * PMD's values wait for the slowest PMD in the same fetch, so a slow
+ * PMD drags everyone else in its fetch group along with it
+ */
+static int
+latencyCost(fetchctl_t *fp)
+{
+    indomctl_t		*idp;
+    pmidctl_t		*pmp;
+    obsdomain_t		*op;
+    __pmID_int		*pmidp;
+    double		maxlat = 0;
+    double		sumlat = 0;
+    double		skew;
+    int			npmd = 0;
+    int			pmd;
+    int			seen[32];	/* small cache of PMDs already counted */
+    int			nseen = 0;
+    int			i;
+
+    PM_ASSERT_IS_LOCKED(optfetch_lock);
+
+    if (obs_domain.nodes == 0)
+	return 0;
+
+    for (idp = fp->f_idp; idp != NULL; idp = idp->i_next) {
+	for (pmp = idp->i_pmp; pmp != NULL; pmp = pmp->p_next) {
+	    pmidp = (__pmID_int *)&pmp->p_pmid;
+	    pmd = pmidp->domain;
+	    for (i = 0; i < nseen; i++) {
+		if (seen[i] == pmd)
+		    break;
+	    }
+	    if (i < nseen)
+		continue;
+	    if (nseen < (int)(sizeof(seen)/sizeof(seen[0])))
+		seen[nseen++] = pmd;
+	    if ((op = obsdomain(pmd)) == NULL || op->o_count == 0)
+		continue;
+	    npmd++;
+	    sumlat += op->o_latency;
+	    if (op->o_latency > maxlat)
+		maxlat = op->o_latency;
+	}
+    }
+    if (npmd < 2)
+	return 0;
+
+    skew = OBS_LATENCY * (npmd * maxlat - sumlat);
+    if (skew >= OPT_COST_INFINITY / 4)
+	return OPT_COST_INFINITY / 4;
+    return (int)skew;
+}
+
 static int
 optCost(fetchctl_t *fp)
 {
@@ -282,10 +402,15 @@ optCost(fetchctl_t *fp)
      */
     for (idp = fp->f_idp; idp != NULL; idp = idp->i_next) {
 	for (pmp = idp->i_pmp; pmp != NULL; pmp = pmp->p_next) {
-	    cost += optcost.c_xtrainst * missinst(idp->i_numinst, idp->i_instlist, pmp->p_numinst, pmp->p_instlist);
+	    cost += optcost.c_xtrainst * missinst(indomsize(idp->i_indom), idp->i_numinst, idp->i_instlist, pmp->p_numinst, pmp->p_instlist);
 	}
     }
 
+    /*
+     * cost for holding up fast PMDs behind slow ones
+     */
+    cost += latencyCost(fp);
+
     return cost;
 }
 
@@ -660,9 +785,24 @@ __pmOptFetchRedo(fetchctl_t **root)
     optreq_t		*p_rqp;
     optreq_t		*rlist;
     int			numreq;
+    __pmHashNode	*hp;
+    obsdomain_t		*op;
 
     rlist = NULL;
     numreq = 0;
+
+    /*
+     * new groups will be built from the current observed costs
+     */
+    PM_LOCK(optfetch_lock);
+    for (hp = __pmHashWalk(&obs_domain, PM_HASH_WALK_START);
+	 hp != NULL;
+	 hp = __pmHashWalk(&obs_domain, PM_HASH_WALK_NEXT)) {
+	op = (obsdomain_t *)hp->data;
+	op->o_grouped = op->o_latency;
+    }
+    PM_UNLOCK(optfetch_lock);
+
     /*
      * collect all of the requests first
      */
@@ -723,6 +863,176 @@ __pmOptFetchRedo(fetchctl_t **root)
     return;
 }
 
+/*
+ * Feed back the per-PMD fetch costs reported by pmcd.  rp is the
+ * result of fetching pmcd.agent.fetch.count and pmcd.agent.fetch.time
+ * (in any order, other metrics are ignored) for all instances, which
+ * are the PMD domain numbers.  The first result for a PMD only sets
+ * the baseline, after that each result that shows new fetches by a
+ * PMD updates the estimate of its average fetch latency.
+ *
+ * pmcd counts the fetches from all of its clients, which is just what
+ * we want ... the cost is in the PMD, not in who asked.
+ */
+void
+__pmOptFetchObserveAgents(const pmResult *rp)
+{
+    const pmValueSet	*count = NULL;
+    const pmValueSet	*usec = NULL;
+    const pmValue	*cvp;
+    const pmValue	*uvp;
+    pmID		count_pmid = pmID_build(2, 4, 3);
+    pmID		usec_pmid = pmID_build(2, 4, 5);
+    obsdomain_t		*op;
+    __uint64_t		nfetch;
+    __uint64_t		ntime;
+    double		lat;
+    int			i;
+    int			j;
+
+    if (rp == NULL)
+	return;
+    for (i = 0; i < rp->numpmid; i++) {
+	if (rp->vset[i]->pmid == count_pmid)
+	    count = rp->vset[i];
+	else if (rp->vset[i]->pmid == usec_pmid)
+	    usec = rp->vset[i];
+    }
+    if (count == NULL || usec == NULL ||
+	count->numval <= 0 || usec->numval <= 0 ||
+	count->valfmt == PM_VAL_INSITU || usec->valfmt == PM_VAL_INSITU)
+	return;
+
+    PM_LOCK(optfetch_lock);
+    for (i = 0; i < count->numval; i++) {
+	cvp = &count->vlist[i];
+	for (j = 0; j < usec->numval; j++) {
+	    if (usec->vlist[j].inst == cvp->inst)
+		break;
+	}
+	if (j == usec->numval)
+	    continue;
+	uvp = &usec->vlist[j];
+	memcpy(&nfetch, cvp->value.pval->vbuf, sizeof(nfetch));
+	memcpy(&ntime, uvp->value.pval->vbuf, sizeof(ntime));
+
+	if ((op = obsdomain(cvp->inst)) == NULL) {
+	    if ((op = (obsdomain_t *)calloc(1, sizeof(obsdomain_t))) == NULL) {
+		PM_UNLOCK(optfetch_lock);
+		pmNoMem("__pmOptFetchObserveAgents", sizeof(obsdomain_t), PM_FATAL_ERR);
+	    }
+	    op->o_fetches = nfetch;
+	    op->o_usec = ntime;
+	    if (__pmHashAdd((unsigned int)cvp->inst, (void *)op, &obs_domain) < 0)
+		free(op);
+	    continue;
+	}
+	if (nfetch < op->o_fetches || ntime < op->o_usec) {
+	    /* PMD (or pmcd) restarted, start over from here */
+	    op->o_fetches = nfetch;
+	    op->o_usec = ntime;
+	    continue;
+	}
+	if (nfetch == op->o_fetches)
+	    continue;
+	lat = (double)(ntime - op->o_usec) / (nfetch - op->o_fetches) / 1000;
+	op->o_fetches = nfetch;
+	op->o_usec = ntime;
+	if (op->o_count == 0)
+	    op->o_latency = lat;
+	else
+	    op->o_latency += OBS_ALPHA * (lat - op->o_latency);
+	op->o_count++;
+    }
+    PM_UNLOCK(optfetch_lock);
+}
+
+/*
+ * Feed back the result rp of one fetch for the group fp (rp may be
+ * NULL if the fetch failed), to learn the size of the indoms where
+ * all instances are requested.
+ *
+ * Returns 1 if the PMD latencies from __pmOptFetchObserveAgents()
+ * have drifted far enough from those used to build the current fetch
+ * groups that calling __pmOptFetchRedo() is likely to produce a
+ * better grouping, else 0.
+ */
+int
+__pmOptFetchObserve(fetchctl_t *fp, const pmResult *rp)
+{
+    indomctl_t		*idp;
+    pmidctl_t		*pmp;
+    __pmID_int		*pmidp;
+    __pmHashNode	*hp;
+    obsdomain_t		*op;
+    obsindom_t		*ip;
+    double		lat;
+    int			redo = 0;
+    int			i;
+    int			j;
+
+    if (fp == NULL)
+	return 0;
+
+    PM_LOCK(optfetch_lock);
+
+    /* has any PMD in this fetch drifted since the groups were built? */
+    for (idp = fp->f_idp; idp != NULL && !redo; idp = idp->i_next) {
+	for (pmp = idp->i_pmp; pmp != NULL; pmp = pmp->p_next) {
+	    pmidp = (__pmID_int *)&pmp->p_pmid;
+	    if ((op = obsdomain(pmidp->domain)) == NULL ||
+		op->o_count < OBS_SETTLE)
+		continue;
+	    lat = op->o_latency;
+	    if ((lat > 2 * op->o_grouped || 2 * lat < op->o_grouped) &&
+		(lat - op->o_grouped > OBS_MINDIFF ||
+		 op->o_grouped - lat > OBS_MINDIFF)) {
+		redo = 1;
+		break;
+	    }
+	}
+    }
+
+    /* instance counts for the indoms where all instances were requested */
+    for (i = 0; rp != NULL && i < rp->numpmid; i++) {
+	if (rp->vset[i]->numval <= 0)
+	    continue;
+	for (idp = fp->f_idp; idp != NULL; idp = idp->i_next) {
+	    if (idp->i_indom == PM_INDOM_NULL || idp->i_numinst != 0)
+		continue;
+	    for (pmp = idp->i_pmp; pmp != NULL; pmp = pmp->p_next) {
+		if (pmp->p_pmid == rp->vset[i]->pmid)
+		    break;
+	    }
+	    if (pmp != NULL)
+		break;
+	}
+	if (idp == NULL)
+	    continue;
+	j = rp->vset[i]->numval;
+	if ((hp = __pmHashSearch((unsigned int)idp->i_indom, &obs_indom)) == NULL) {
+	    if ((ip = (obsindom_t *)malloc(sizeof(obsindom_t))) == NULL) {
+		PM_UNLOCK(optfetch_lock);
+		pmNoMem("__pmOptFetchObserve.indom", sizeof(obsindom_t), PM_FATAL_ERR);
+	    }
+	    ip->o_numinst = j;
+	    if (__pmHashAdd((unsigned int)idp->i_indom, (void *)ip, &obs_indom) < 0)
+		free(ip);
+	}
+	else {
+	    ip = (obsindom_t *)hp->data;
+	    ip->o_numinst += OBS_ALPHA * (j - ip->o_numinst);
+	}
+    }
+
+    if (redo && pmDebugOptions.optfetch) {
+	fprintf(stderr, "__pmOptFetchObserve: fp=" PRINTF_P_PFX "%p PMD latencies have drifted, regroup suggested\n", fp);
+    }
+
+    PM_UNLOCK(optfetch_lock);
+    return redo;
+}
+
 void
 __pmOptFetchGetParams(optcost_t *ocp)
 {
@@ -83,15 +83,13 @@ check_indom(pmi_context *current, pmInDom indom, int *needti)
     int		sts = 0;
     __pmArchCtl	*acp = &current->archctl;
 
-    for (i = 0; i < current->nindom; i++) {
-	if (indom == current->indom[i].indom) {
-	    if (current->indom[i].meta_done == 0) {
-		if ((sts = __pmLogPutInDom(acp, current->indom[i].indom, &stamp, current->indom[i].ninstance, current->indom[i].inst, current->indom[i].name)) < 0)
-		    return sts;
-
-		current->indom[i].meta_done = 1;
-		*needti = 1;
-	    }
+    if ((i = _pmi_find_indom(current, indom)) >= 0) {
+	if (current->indom[i].meta_done == 0) {
+	    if ((sts = __pmLogPutInDom(acp, current->indom[i].indom, &stamp, current->indom[i].ninstance, current->indom[i].inst, current->indom[i].name)) < 0)
+		return sts;
+
+	    current->indom[i].meta_done = 1;
+	    *needti = 1;
 	}
     }
 
@@ -105,9 +103,7 @@ check_metric(pmi_context *current, pmID pmid, int *needti)
     int		sts = 0;
     __pmArchCtl	*acp = &current->archctl;
 
-    for (m = 0; m < current->nmetric; m++) {
-	if (pmid != current->metric[m].pmid)
-	    continue;
+    if ((m = _pmi_find_metric(current, pmid)) >= 0) {
 	if (current->metric[m].meta_done == 0) {
 	    char	**namelist = &current->metric[m].name;
 
@@ -121,7 +117,6 @@ check_metric(pmi_context *current, pmID pmid, int *needti)
 	    if ((sts = check_indom(current, current->metric[m].desc.indom, needti)) < 0)
 		return sts;
 	}
-	break;
     }
 
     return sts;
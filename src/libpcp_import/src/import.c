@@ -24,6 +24,143 @@ static pmi_context *context_tab;
 static int ncontext;
 static pmi_context *current;
 
+/*
+ * Metrics, instance domains and instances are indexed by hash, as
+ * importers may define 100,000s of metric-instance pairs and must not
+ * pay a linear search for every one of them.  The hash node data is
+ * the index into the corresponding array.
+ */
+#define NODE_IDX(hp)	((int)(__psint_t)(hp)->data)
+#define IDX_DATA(i)	((void *)(__psint_t)(i))
+
+/* FNV-1a over the first len bytes of s */
+static unsigned int
+strhash(const char *s, size_t len)
+{
+    unsigned int	h = 2166136261U;
+
+    while (len-- > 0) {
+	h ^= (unsigned char)*s++;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+static void
+hash_add(unsigned int key, int idx, __pmHashCtl *hcp)
+{
+    if (__pmHashAdd(key, IDX_DATA(idx), hcp) < 0)
+	pmNoMem("libpcp_import: hash", sizeof(__pmHashNode), PM_FATAL_ERR);
+}
+
+static int
+find_metric_name(pmi_context *ctxp, const char *name)
+{
+    __pmHashNode	*hp;
+    unsigned int	key = strhash(name, strlen(name));
+
+    for (hp = __pmHashSearch(key, &ctxp->namehash); hp != NULL; hp = hp->next) {
+	if (hp->key == key && strcmp(name, ctxp->metric[NODE_IDX(hp)].name) == 0)
+	    return NODE_IDX(hp);
+    }
+    return -1;
+}
+
+int
+_pmi_find_metric(pmi_context *ctxp, pmID pmid)
+{
+    __pmHashNode	*hp;
+
+    for (hp = __pmHashSearch(pmid, &ctxp->pmidhash); hp != NULL; hp = hp->next) {
+	if (hp->key == pmid)
+	    return NODE_IDX(hp);
+    }
+    return -1;
+}
+
+int
+_pmi_find_indom(pmi_context *ctxp, pmInDom indom)
+{
+    __pmHashNode	*hp;
+
+    for (hp = __pmHashSearch(indom, &ctxp->indomhash); hp != NULL; hp = hp->next) {
+	if (hp->key == indom)
+	    return NODE_IDX(hp);
+    }
+    return -1;
+}
+
+static void
+index_metric(pmi_context *ctxp, int m)
+{
+    const char	*name = ctxp->metric[m].name;
+
+    hash_add(strhash(name, strlen(name)), m, &ctxp->namehash);
+    hash_add(ctxp->metric[m].pmid, m, &ctxp->pmidhash);
+}
+
+/*
+ * External instance names need only be unique up to the first space,
+ * so that is the part hashed.  Returns the length hashed, and sets
+ * *spaced as per the matching rule in find_instance().
+ */
+static size_t
+instance_prefix(const char *instance, int *spaced)
+{
+    const char	*p;
+
+    for (p = instance; *p && *p != ' '; p++)
+	;
+    *spaced = (*p == ' ') ? p - instance + 1: 0;	/* +1 => *must* compare the space too */
+    return p - instance;
+}
+
+static int
+find_instance(pmi_indom *idp, const char *instance)
+{
+    __pmHashNode	*hp;
+    unsigned int	key;
+    int			spaced;
+    int			j;
+
+    key = strhash(instance, instance_prefix(instance, &spaced));
+    for (hp = __pmHashSearch(key, &idp->namehash); hp != NULL; hp = hp->next) {
+	if (hp->key != key)
+	    continue;
+	j = NODE_IDX(hp);
+	if (spaced) {
+	    if (strncmp(instance, idp->name[j], spaced) == 0)
+		return j;
+	} else {
+	    if (strcmp(instance, idp->name[j]) == 0)
+		return j;
+	}
+    }
+    return -1;
+}
+
+static int
+find_inst(pmi_indom *idp, int inst)
+{
+    __pmHashNode	*hp;
+
+    for (hp = __pmHashSearch(inst, &idp->insthash); hp != NULL; hp = hp->next) {
+	if (hp->key == (unsigned int)inst)
+	    return NODE_IDX(hp);
+    }
+    return -1;
+}
+
+static void
+index_instance(pmi_indom *idp, int j)
+{
+    int		spaced;
+
+    hash_add(strhash(idp->name[j], instance_prefix(idp->name[j], &spaced)),
+		j, &idp->namehash);
+    hash_add(idp->inst[j], j, &idp->insthash);
+}
+
 static void
 printstamp(FILE *f, const struct timeval *tp)
 {
@@ -312,14 +449,19 @@ pmiStart(const char *archive, int inherit)
     pmi_context	*old_current;
     char	*np;
     int		c = current - context_tab;
+    int		ctx;
 
     ncontext++;
     context_tab = (pmi_context *)realloc(context_tab, ncontext*sizeof(context_tab[0]));
     if (context_tab == NULL) {
 	pmNoMem("pmiStart: context_tab", ncontext*sizeof(context_tab[0]), PM_FATAL_ERR);
     }
+    /* contexts may have moved, ac_log must track each one's logctl */
+    for (ctx = 0; ctx < ncontext-1; ctx++)
+	context_tab[ctx].archctl.ac_log = &context_tab[ctx].logctl;
     old_current = &context_tab[c];
     current = &context_tab[ncontext-1];
+    memset((void *)current, 0, sizeof(*current));
 
     current->state = CONTEXT_START;
     current->archive = strdup(archive);
@@ -333,7 +475,7 @@ pmiStart(const char *archive, int inherit)
     memset((void *)&current->archctl, 0, sizeof(current->archctl));
     current->archctl.ac_log = &current->logctl;
     if (inherit && old_current != NULL) {
-	current->nmetric = old_current->nmetric;
+	current->nmetric = current->maxmetric = old_current->nmetric;
 	if (old_current->metric != NULL) {
 	    int		m;
 	    current->metric = (pmi_metric *)malloc(current->nmetric*sizeof(pmi_metric));
@@ -345,6 +487,11 @@ pmiStart(const char *archive, int inherit)
 		current->metric[m].pmid = old_current->metric[m].pmid;
 		current->metric[m].desc = old_current->metric[m].desc;
 		current->metric[m].meta_done = 0;
+		/* nothing pending for this context's pmResult yet */
+		current->metric[m].result_gen = 0;
+		current->metric[m].result_idx = 0;
+		current->metric[m].result_maxval = 0;
+		index_metric(current, m);
 	    }
 	}
 	else
@@ -361,6 +508,10 @@ pmiStart(const char *archive, int inherit)
 		current->indom[i].indom = old_current->indom[i].indom;
 		current->indom[i].ninstance = old_current->indom[i].ninstance;
 		current->indom[i].meta_done = 0;
+		current->indom[i].maxinstance = current->indom[i].ninstance;
+		__pmHashInit(&current->indom[i].namehash);
+		__pmHashInit(&current->indom[i].insthash);
+		hash_add(current->indom[i].indom, i, &current->indomhash);
 		if (old_current->indom[i].ninstance > 0) {
 		    current->indom[i].name = (char **)malloc(current->indom[i].ninstance*sizeof(char *));
 		    if (current->indom[i].name == NULL) {
@@ -371,6 +522,7 @@ pmiStart(const char *archive, int inherit)
 			pmNoMem("pmiStart: inst", current->indom[i].ninstance*sizeof(int), PM_FATAL_ERR);
 		    }
 		    current->indom[i].namebuflen = old_current->indom[i].namebuflen;
+		    current->indom[i].maxnamebuf = old_current->indom[i].namebuflen;
 		    current->indom[i].namebuf = (char *)malloc(old_current->indom[i].namebuflen);
 		    if (current->indom[i].namebuf == NULL) {
 			pmNoMem("pmiStart: namebuf", old_current->indom[i].namebuflen, PM_FATAL_ERR);
@@ -381,19 +533,21 @@ pmiStart(const char *archive, int inherit)
 			current->indom[i].name[j] = np;
 			np += strlen(np)+1;
 			current->indom[i].inst[j] = old_current->indom[i].inst[j];
+			index_instance(&current->indom[i], j);
 		    }
 		}
 		else {
 		    current->indom[i].name = NULL;
 		    current->indom[i].inst = NULL;
 		    current->indom[i].namebuflen = 0;
+		    current->indom[i].maxnamebuf = 0;
 		    current->indom[i].namebuf = NULL;
 		}
 	    }
 	}
 	else
 	    current->indom = NULL;
-	current->nhandle = old_current->nhandle;
+	current->nhandle = current->maxhandle = old_current->nhandle;
 	if (old_current->handle != NULL) {
 	    int		h;
 	    current->handle = (pmi_handle *)malloc(current->nhandle*sizeof(pmi_handle));
@@ -546,6 +700,7 @@ int
 pmiAddMetric(const char *name, pmID pmid, int type, pmInDom indom, int sem, pmUnits units)
 {
     int		m;
+    int		dup;
     int		item;
     int		cluster;
     size_t	size;
@@ -557,15 +712,16 @@ pmiAddMetric(const char *name, pmID pmid, int type, pmInDom indom, int sem, pmUn
     if (valid_pmns_name(name) == 0)
 	return current->last_sts = PMI_ERR_BADMETRICNAME;
 
-    for (m = 0; m < current->nmetric; m++) {
-	if (strcmp(name, current->metric[m].name) == 0) {
-	    /* duplicate metric name is not good */
-	    return current->last_sts = PMI_ERR_DUPMETRICNAME;
-	}
-	if (pmid == current->metric[m].pmid) {
-	    /* duplicate metric pmID is not good */
-	    return current->last_sts = PMI_ERR_DUPMETRICID;
-	}
+    /* report whichever clash is with the earlier metric */
+    m = find_metric_name(current, name);
+    dup = _pmi_find_metric(current, pmid);
+    if (m >= 0 && (dup < 0 || m <= dup)) {
+	/* duplicate metric name is not good */
+	return current->last_sts = PMI_ERR_DUPMETRICNAME;
+    }
+    if (dup >= 0) {
+	/* duplicate metric pmID is not good */
+	return current->last_sts = PMI_ERR_DUPMETRICID;
     }
 
     /*
@@ -593,12 +749,15 @@ pmiAddMetric(const char *name, pmID pmid, int type, pmInDom indom, int sem, pmUn
 	    return current->last_sts = PMI_ERR_BADSEM;
     }
 
-    current->nmetric++;
-    size = current->nmetric * sizeof(pmi_metric);
-    current->metric = (pmi_metric *)realloc(current->metric, size);
-    if (current->metric == NULL) {
-	pmNoMem("pmiAddMetric: pmi_metric", size, PM_FATAL_ERR);
+    if (current->nmetric == current->maxmetric) {
+	current->maxmetric = current->maxmetric ? 2 * current->maxmetric : 16;
+	size = current->maxmetric * sizeof(pmi_metric);
+	current->metric = (pmi_metric *)realloc(current->metric, size);
+	if (current->metric == NULL) {
+	    pmNoMem("pmiAddMetric: pmi_metric", size, PM_FATAL_ERR);
+	}
     }
+    current->nmetric++;
     mp = &current->metric[current->nmetric-1];
     if (pmid != PM_ID_NULL) {
 	mp->pmid = pmid;
@@ -623,6 +782,8 @@ pmiAddMetric(const char *name, pmID pmid, int type, pmInDom indom, int sem, pmUn
     mp->desc.sem = sem;
     mp->desc.units = units;
     mp->meta_done = 0;
+    mp->result_gen = 0;
+    index_metric(current, current->nmetric-1);
 
     return current->last_sts = 0;
 }
@@ -631,78 +792,91 @@ int
 pmiAddInstance(pmInDom indom, const char *instance, int inst)
 {
     pmi_indom	*idp;
-    const char	*p;
     char	*np;
-    int		spaced;
+    char	*oldbuf;
+    size_t	len;
+    size_t	size;
     int		i;
     int		j;
+    int		dup;
 
     if (current == NULL)
 	return PM_ERR_NOCONTEXT;
 
-    for (i = 0; i < current->nindom; i++) {
-	if (current->indom[i].indom == indom)
-	    break;
-    }
-    if (i == current->nindom) {
+    if ((i = _pmi_find_indom(current, indom)) < 0) {
 	/* extend indom table */
-	current->nindom++;
+	i = current->nindom++;
 	current->indom = (pmi_indom *)realloc(current->indom, current->nindom*sizeof(pmi_indom));
 	if (current->indom == NULL) {
 	    pmNoMem("pmiAddInstance: pmi_indom", current->nindom*sizeof(pmi_indom), PM_FATAL_ERR);
 	}
 	current->indom[i].indom = indom;
 	current->indom[i].ninstance = 0;
+	current->indom[i].maxinstance = 0;
 	current->indom[i].name = NULL;
 	current->indom[i].inst = NULL;
 	current->indom[i].namebuflen = 0;
+	current->indom[i].maxnamebuf = 0;
 	current->indom[i].namebuf = NULL;
+	__pmHashInit(&current->indom[i].namehash);
+	__pmHashInit(&current->indom[i].insthash);
+	hash_add(indom, i, &current->indomhash);
     }
     idp = &current->indom[i];
     /*
      * duplicate external instance identifier would be bad, but need
      * to honour unique to first space rule ...
-     * duplicate instance internal identifier is also not allowed
+     * duplicate instance internal identifier is also not allowed,
+     * and whichever clash is with the earlier instance is reported
      */
-    for (p = instance; *p && *p != ' '; p++)
-	;
-    spaced = (*p == ' ') ? p - instance + 1: 0;	/* +1 => *must* compare the space too */
-    for (j = 0; j < idp->ninstance; j++) {
-	if (spaced) {
-	    if (strncmp(instance, idp->name[j], spaced) == 0)
-		return current->last_sts = PMI_ERR_DUPINSTNAME;
-	} else {
-	    if (strcmp(instance, idp->name[j]) == 0)
-		return current->last_sts = PMI_ERR_DUPINSTNAME;
-	}
-	if (inst == idp->inst[j]) {
-	    return current->last_sts = PMI_ERR_DUPINSTID;
-	}
-    }
+    j = find_instance(idp, instance);
+    dup = find_inst(idp, inst);
+    if (j >= 0 && (dup < 0 || j <= dup))
+	return current->last_sts = PMI_ERR_DUPINSTNAME;
+    if (dup >= 0)
+	return current->last_sts = PMI_ERR_DUPINSTID;
+
     /* add instance marks whole indom as needing to be written */
     idp->meta_done = 0;
-    idp->ninstance++;
-    idp->name = (char **)realloc(idp->name, idp->ninstance*sizeof(char *));
-    if (idp->name == NULL) {
-	pmNoMem("pmiAddInstance: name", idp->ninstance*sizeof(char *), PM_FATAL_ERR);
-    }
-    idp->inst = (int *)realloc(idp->inst, idp->ninstance*sizeof(int));
-    if (idp->inst == NULL) {
-	pmNoMem("pmiAddInstance: inst", idp->ninstance*sizeof(int), PM_FATAL_ERR);
-    }
-    idp->namebuf = (char *)realloc(idp->namebuf, idp->namebuflen+strlen(instance)+1);
-    if (idp->namebuf == NULL) {
-	pmNoMem("pmiAddInstance: namebuf", idp->namebuflen+strlen(instance)+1, PM_FATAL_ERR);
+    if (idp->ninstance == idp->maxinstance) {
+	idp->maxinstance = idp->maxinstance ? 2 * idp->maxinstance : 16;
+	idp->name = (char **)realloc(idp->name, idp->maxinstance*sizeof(char *));
+	if (idp->name == NULL) {
+	    pmNoMem("pmiAddInstance: name", idp->maxinstance*sizeof(char *), PM_FATAL_ERR);
+	}
+	idp->inst = (int *)realloc(idp->inst, idp->maxinstance*sizeof(int));
+	if (idp->inst == NULL) {
+	    pmNoMem("pmiAddInstance: inst", idp->maxinstance*sizeof(int), PM_FATAL_ERR);
+	}
     }
-    strcpy(&idp->namebuf[idp->namebuflen], instance);
-    idp->namebuflen += strlen(instance)+1;
-    idp->inst[idp->ninstance-1] = inst;
-    /* in case namebuf moves, need to redo name[] pointers */
-    np = idp->namebuf;
-    for (j = 0; j < current->indom[i].ninstance; j++) {
-	idp->name[j] = np;
-	np += strlen(np)+1;
+    len = strlen(instance) + 1;
+    if (idp->namebuflen + len > idp->maxnamebuf) {
+	size = 2 * idp->maxnamebuf;
+	if (size < idp->namebuflen + len)
+	    size = idp->namebuflen + len;
+	if (size < 256)
+	    size = 256;
+	oldbuf = idp->namebuf;
+	idp->namebuf = (char *)realloc(idp->namebuf, size);
+	if (idp->namebuf == NULL) {
+	    pmNoMem("pmiAddInstance: namebuf", size, PM_FATAL_ERR);
+	}
+	idp->maxnamebuf = size;
+	/* if namebuf moved, need to redo name[] pointers */
+	if (idp->namebuf != oldbuf) {
+	    np = idp->namebuf;
+	    for (j = 0; j < idp->ninstance; j++) {
+		idp->name[j] = np;
+		np += strlen(np)+1;
+	    }
+	}
     }
+    j = idp->ninstance++;
+    idp->name[j] = &idp->namebuf[idp->namebuflen];
+    memcpy(idp->name[j], instance, len);
+    idp->namebuflen += len;
+    idp->inst[j] = inst;
+    index_instance(idp, j);
 
     return current->last_sts = 0;
 }
@@ -713,19 +887,13 @@ make_handle(const char *name, const char *instance, pmi_handle *hp)
     int		m;
     int		i;
     int		j;
-    int		spaced;
-    const char	*p;
     pmi_indom	*idp;
 
     if (instance != NULL && instance[0] == '\0')
 	/* map "" to NULL to help Perl callers */
 	instance = NULL;
 
-    for (m = 0; m < current->nmetric; m++) {
-	if (strcmp(name, current->metric[m].name) == 0)
-	    break;
-    }
-    if (m == current->nmetric)
+    if ((m = find_metric_name(current, name)) < 0)
 	return current->last_sts = PM_ERR_NAME;
     hp->midx = m;
 
@@ -740,29 +908,12 @@ make_handle(const char *name, const char *instance, pmi_handle *hp)
 	if (instance == NULL)
 	    /* don't expect "instance" to be NULL */
 	    return current->last_sts = PMI_ERR_INSTNULL;
-	for (i = 0; i < current->nindom; i++) {
-	    if (current->metric[hp->midx].desc.indom == current->indom[i].indom)
-		break;
-	}
-	if (i == current->nindom)
+	if ((i = _pmi_find_indom(current, current->metric[hp->midx].desc.indom)) < 0)
 	    return current->last_sts = PM_ERR_INDOM;
 	idp = &current->indom[i];
 
 	/* match to first space rule */
-
-	for (p = instance; *p && *p != ' '; p++)
-	    ;
-	spaced = (*p == ' ') ? p - instance + 1: 0;	/* +1 => *must* compare the space too */
-	for (j = 0; j < idp->ninstance; j++) {
-	    if (spaced) {
-		if (strncmp(instance, idp->name[j], spaced) == 0)
-		    break;
-	    } else {
-		if (strcmp(instance, idp->name[j]) == 0)
-		    break;
-	    }
-	}
-	if (j == idp->ninstance)
+	if ((j = find_instance(idp, instance)) < 0)
 	    return current->last_sts = PM_ERR_INST;
 	hp->inst = idp->inst[j];
     }
@@ -800,11 +951,14 @@ pmiGetHandle(const char *name, const char *instance)
     if (sts != 0)
 	return current->last_sts = sts;
 
-    current->nhandle++;
-    current->handle = (pmi_handle *)realloc(current->handle, current->nhandle*sizeof(pmi_handle));
-    if (current->handle == NULL) {
-	pmNoMem("pmiGetHandle: pmi_handle", current->nhandle*sizeof(pmi_handle), PM_FATAL_ERR);
+    if (current->nhandle == current->maxhandle) {
+	current->maxhandle = current->maxhandle ? 2 * current->maxhandle : 16;
+	current->handle = (pmi_handle *)realloc(current->handle, current->maxhandle*sizeof(pmi_handle));
+	if (current->handle == NULL) {
+	    pmNoMem("pmiGetHandle: pmi_handle", current->maxhandle*sizeof(pmi_handle), PM_FATAL_ERR);
+	}
     }
+    current->nhandle++;
     hp = &current->handle[current->nhandle-1];
     hp->midx = tmp.midx;
     hp->inst = tmp.inst;
@@ -823,6 +977,32 @@ pmiPutValueHandle(int handle, const char *value)
     return current->last_sts = _pmi_stuff_value(current, &current->handle[handle-1], value);
 }
 
+/*
+ * Batch form of pmiPutValueHandle() ... stops at the first failure
+ * and returns that error.
+ */
+int
+pmiPutValues(int count, const int *handles, const char **values)
+{
+    int		handle;
+    int		sts;
+    int		i;
+
+    if (current == NULL)
+	return PM_ERR_NOCONTEXT;
+
+    for (i = 0; i < count; i++) {
+	handle = handles[i];
+	if (handle <= 0 || handle > current->nhandle)
+	    return current->last_sts = PMI_ERR_BADHANDLE;
+	sts = _pmi_stuff_value(current, &current->handle[handle-1], values[i]);
+	if (sts < 0)
+	    return current->last_sts = sts;
+    }
+
+    return current->last_sts = 0;
+}
+
 int
 pmiPutText(unsigned int type, unsigned int class, unsigned int id, const char *content)
 {
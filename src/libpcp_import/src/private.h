@@ -20,6 +20,9 @@ typedef struct {
     pmID	pmid;
     pmDesc	desc;
     int		meta_done;
+    int		result_gen;	// result_idx is valid if == context result_gen
+    int		result_idx;	// index into vset[] of the pending pmResult
+    int		result_maxval;	// allocated size of that vset's vlist[]
 } pmi_metric;
 
 typedef struct {
@@ -30,6 +33,10 @@ typedef struct {
     int		namebuflen;	// names are packed in namebuf[] as
     char	*namebuf;	// required by __pmLogPutInDom()
     int		meta_done;
+    int		maxinstance;	// allocated size of name[] and inst[]
+    int		maxnamebuf;	// allocated size of namebuf[]
+    __pmHashCtl	namehash;	// name[] index, keyed on name to first space
+    __pmHashCtl	insthash;	// inst[] index, keyed on instance identifier
 } pmi_indom;
 
 typedef struct {
@@ -58,11 +65,19 @@ typedef struct {
     __pmLogCtl	logctl;
     __pmArchCtl	archctl;
     pmResult	*result;
+    int		maxnumpmid;	// allocated size of result->vset[]
+    int		result_gen;	// bumped for each new pending pmResult
+    __pmHashCtl	valuehash;	// metric-instance pairs in pending pmResult
     int		nmetric;
+    int		maxmetric;
     pmi_metric	*metric;
+    __pmHashCtl	namehash;	// metric[] index, keyed on metric name
+    __pmHashCtl	pmidhash;	// metric[] index, keyed on pmID
     int		nindom;
     pmi_indom	*indom;
+    __pmHashCtl	indomhash;	// indom[] index, keyed on pmInDom
     int		nhandle;
+    int		maxhandle;
     pmi_handle	*handle;
     int		ntext;
     pmi_text	*text;
@@ -83,6 +98,8 @@ typedef struct {
 #endif
 
 extern int _pmi_stuff_value(pmi_context *, pmi_handle *, const char *) _PMI_HIDDEN;
+extern int _pmi_find_metric(pmi_context *, pmID) _PMI_HIDDEN;
+extern int _pmi_find_indom(pmi_context *, pmInDom) _PMI_HIDDEN;
 extern int _pmi_put_result(pmi_context *, pmResult *) _PMI_HIDDEN;
 extern int _pmi_put_text(pmi_context *) _PMI_HIDDEN;
 extern int _pmi_put_label(pmi_context *) _PMI_HIDDEN;
@@ -17,6 +17,45 @@
 #include "import.h"
 #include "private.h"
 
+/* key for a metric-instance pair in the pending pmResult */
+static unsigned int
+value_key(pmID pmid, int inst)
+{
+    return ((unsigned int)pmid * 2654435761U) ^ (unsigned int)inst;
+}
+
+static int
+find_value(pmi_context *current, pmID pmid, int inst)
+{
+    __pmHashNode	*hp;
+    unsigned int	key = value_key(pmid, inst);
+
+    for (hp = __pmHashSearch(key, &current->valuehash); hp != NULL; hp = hp->next) {
+	if (hp->key == key && (pmID)(__psint_t)hp->data == pmid)
+	    return 1;
+    }
+    return 0;
+}
+
+static __pmHashWalkState
+drop_value(const __pmHashNode *hp, void *cdata)
+{
+    (void)hp;
+    (void)cdata;
+    return PM_HASH_WALK_DELETE_NEXT;
+}
+
+/*
+ * Empty the table for a new pmResult, keeping the buckets as the next
+ * pmResult is most likely about the same size
+ */
+static void
+clear_values(pmi_context *current)
+{
+    __pmHashWalkCB(drop_value, NULL, &current->valuehash);
+    current->valuehash.nodes = 0;
+}
+
 int
 _pmi_stuff_value(pmi_context *current, pmi_handle *hp, const char *value)
 {
@@ -38,54 +77,70 @@ _pmi_stuff_value(pmi_context *current, pmi_handle *hp, const char *value)
     mp = &current->metric[hp->midx];
 
     if (current->result == NULL) {
-	/* first time */
-	current->result = (pmResult *)malloc(sizeof(pmResult));
+	/*
+	 * first time for this pmResult ... vset[] and each vlist[] are
+	 * grown by doubling, and bumping result_gen invalidates every
+	 * metric's result_idx in one step
+	 */
+	current->maxnumpmid = 16;
+	size = sizeof(pmResult) + (current->maxnumpmid - 1)*sizeof(pmValueSet *);
+	current->result = (pmResult *)malloc(size);
 	if (current->result == NULL) {
-	    pmNoMem("_pmi_stuff_value: result malloc:", sizeof(pmResult), PM_FATAL_ERR);
+	    pmNoMem("_pmi_stuff_value: result malloc:", size, PM_FATAL_ERR);
 	}
 	current->result->numpmid = 0;
 	current->result->timestamp.tv_sec = 0;
 	current->result->timestamp.tv_usec = 0;
+	current->result_gen++;
+	clear_values(current);
     }
     rp = current->result;
 
     pmid = current->metric[hp->midx].pmid;
-    for (i = 0; i < rp->numpmid; i++) {
-	if (pmid == rp->vset[i]->pmid) {
-	    if (mp->desc.indom == PM_INDOM_NULL)
-		/* singular metric, cannot have more than one value */
-		return PMI_ERR_DUPVALUE;
-	    break;
-	}
+    if (mp->result_gen == current->result_gen) {
+	i = mp->result_idx;
+	if (mp->desc.indom == PM_INDOM_NULL)
+	    /* singular metric, cannot have more than one value */
+	    return PMI_ERR_DUPVALUE;
     }
+    else
+	i = rp->numpmid;
     if (i == rp->numpmid) {
-	rp->numpmid++;
-	size = sizeof(pmResult) + (rp->numpmid - 1)*sizeof(pmValueSet *);
-	rp = current->result = (pmResult *)realloc(current->result, size);
-	if (current->result == NULL) {
-	    pmNoMem("_pmi_stuff_value: result realloc:", size, PM_FATAL_ERR);
+	if (rp->numpmid == current->maxnumpmid) {
+	    current->maxnumpmid *= 2;
+	    size = sizeof(pmResult) + (current->maxnumpmid - 1)*sizeof(pmValueSet *);
+	    rp = current->result = (pmResult *)realloc(current->result, size);
+	    if (current->result == NULL) {
+		pmNoMem("_pmi_stuff_value: result realloc:", size, PM_FATAL_ERR);
+	    }
 	}
-	rp->vset[rp->numpmid-1] = (pmValueSet *)malloc(sizeof(pmValueSet));
+	rp->numpmid++;
+	mp->result_maxval = (mp->desc.indom == PM_INDOM_NULL) ? 1 : 4;
+	size = sizeof(pmValueSet) + (mp->result_maxval-1)*sizeof(pmValue);
+	rp->vset[rp->numpmid-1] = (pmValueSet *)malloc(size);
 	if (rp->vset[rp->numpmid-1] == NULL) {
-	    pmNoMem("_pmi_stuff_value: vset alloc:", sizeof(pmValueSet), PM_FATAL_ERR);
+	    pmNoMem("_pmi_stuff_value: vset alloc:", size, PM_FATAL_ERR);
 	}
 	vsp = rp->vset[rp->numpmid-1];
 	vsp->pmid = pmid;
 	vsp->numval = 1;
+	mp->result_gen = current->result_gen;
+	mp->result_idx = i;
     }
     else {
-	int		j;
-	for (j = 0; j < rp->vset[i]->numval; j++) {
-	    if (rp->vset[i]->vlist[j].inst == hp->inst)
-		/* each metric-instance can appear at most once per pmResult */
-		return PMI_ERR_DUPVALUE;
-	}
-	rp->vset[i]->numval++;
-	size = sizeof(pmValueSet) + (rp->vset[i]->numval-1)*sizeof(pmValue);
-	vsp = rp->vset[i] = (pmValueSet *)realloc(rp->vset[i], size);
-	if (rp->vset[i] == NULL) {
-	    pmNoMem("_pmi_stuff_value: vset realloc:", size, PM_FATAL_ERR);
+	/* each metric-instance can appear at most once per pmResult */
+	if (find_value(current, pmid, hp->inst))
+	    return PMI_ERR_DUPVALUE;
+	if (rp->vset[i]->numval == mp->result_maxval) {
+	    mp->result_maxval *= 2;
+	    size = sizeof(pmValueSet) + (mp->result_maxval-1)*sizeof(pmValue);
+	    rp->vset[i] = (pmValueSet *)realloc(rp->vset[i], size);
+	    if (rp->vset[i] == NULL) {
+		pmNoMem("_pmi_stuff_value: vset realloc:", size, PM_FATAL_ERR);
+	    }
 	}
+	vsp = rp->vset[i];
+	vsp->numval++;
     }
     vp = &vsp->vlist[vsp->numval-1];
     vp->inst = hp->inst;
@@ -177,5 +232,9 @@ _pmi_stuff_value(pmi_context *current, pmi_handle *hp, const char *value)
 	memcpy((void *)vp->value.pval->vbuf, data, dsize);
     }
 
+    if (mp->desc.indom != PM_INDOM_NULL &&
+	__pmHashAdd(value_key(pmid, hp->inst), (void *)(__psint_t)pmid, &current->valuehash) < 0)
+	pmNoMem("_pmi_stuff_value: value hash", sizeof(__pmHashNode), PM_FATAL_ERR);
+
     return 0;
 }
@@ -799,48 +799,36 @@ QmcMetric::extractNumericMetric(pmValueSet const *set, pmValue const *value, Qmc
 }
 
 void
-QmcMetricValue::extractEventRecords(QmcContext *context, int recordCount, pmResult **result)
+QmcMetricValue::extractEventRecords(QmcContext *context, int recordCount, pmEventIterator *iter)
 {
-    pmID parameterID;
-    pmID missedID = QmcEventRecord::eventMissed();
-    pmID flagsID = QmcEventRecord::eventFlags();
-    int i, p, r, parameterCount;
+    pmValueSet valueSet;
+    int p, r, sts;
 
     my.eventRecords.resize(recordCount);
 
-    for (r = 0; r < recordCount; r++) {
+    for (r = 0; r < recordCount && pmEventIterNext(iter); r++) {
 	QmcEventRecord &record = my.eventRecords[r];
+	struct timeval timestamp;
 
-	// count is the size of my.parameter vector (less flags/missed)
-	parameterCount = 0;
-	for (i = 0; i < result[r]->numpmid; i++) {
-	    parameterID = result[r]->vset[i]->pmid;
-	    if (parameterID != flagsID && parameterID != missedID)
-		parameterCount++;
-        }
+	timestamp.tv_sec = iter->ei_timestamp.tv_sec;
+	timestamp.tv_usec = iter->ei_timestamp.tv_nsec / 1000;
 
-	// initialise this record
-	record.setTimestamp(&result[r]->timestamp);
-	record.setParameterCount(parameterCount);
-	record.setMissed(0);
-	record.setFlags(0);
-
-	// i indexes into result[r], p indexes into my.parameter vector
-	for (i = p = 0; i < result[r]->numpmid; i++) {
-	    pmValueSet *valueSet = result[r]->vset[i];
-	    parameterID = valueSet->pmid;
-	    if (parameterID == flagsID)
-		record.setFlags(valueSet->vlist[0].value.lval);
-	    else if (parameterID == missedID)
-		record.setMissed(valueSet->vlist[0].value.lval);
-	    else
-		record.setParameter(p++, parameterID, context, valueSet);
+	// initialise this record, walking the packed record in place
+	record.setTimestamp(&timestamp);
+	record.setParameterCount(iter->ei_nparams);
+	record.setMissed(iter->ei_missed);
+	record.setFlags(iter->ei_flags);
+
+	// unexpected parameter types (sts < 0) are skipped
+	for (p = 0; (sts = pmEventIterParam(iter, &valueSet)) != 0; ) {
+	    if (sts > 0)
+		record.setParameter(p++, valueSet.pmid, context, &valueSet);
 	}
+	record.setParameterCount(p);
 
 	if (pmDebugOptions.value) {
 	    QTextStream cerr(stderr);
-	    pmValueSet *valueSet = result[r]->vset[0];
-	    record.dump(cerr, valueSet->vlist[0].inst, r);
+	    record.dump(cerr, PM_IN_NULL, r);
 	}
     }
 }
@@ -849,16 +837,13 @@ void
 QmcMetric::extractEventMetric(pmValueSet const *valueSet, int index, QmcMetricValue &valueRef)
 {
     pmValueSet *values = (pmValueSet *)valueSet;
-    pmResult **result;
+    pmEventIterator iter;
     int sts;
 
-    if ((sts = pmUnpackEventRecords(values, index, &result)) >= 0) {
-	valueRef.extractEventRecords(context(), sts, result);
-	pmFreeEventResult(result);
-    }
-    else {
+    if ((sts = pmEventIterInit(&iter, values, index)) >= 0)
+	valueRef.extractEventRecords(context(), sts, &iter);
+    else
 	valueRef.setCurrentError(sts);
-    }
 }
 
 int
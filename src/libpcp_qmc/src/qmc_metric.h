@@ -132,7 +132,7 @@ public:
 			 my.currentError = 0; }
 
     QVector<QmcEventRecord> const &eventRecords() const { return my.eventRecords; }
-    void extractEventRecords(QmcContext *context, int recordCount, pmResult **result);
+    void extractEventRecords(QmcContext *context, int recordCount, pmEventIterator *iter);
     void dumpEventRecords(QTextStream &os, int instid) const;
 
 private:
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#include "bitmap.h"
+
+static unsigned int
+popcount(__uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    unsigned int	count;
+
+    for (count = 0; word; count++)
+	word &= word - 1;
+    return count;
+#endif
+}
+
+/* index of the lowest set bit in a (non-zero) word */
+static unsigned int
+lowbit(__uint64_t word)
+{
+    return popcount((word & -word) - 1);
+}
+
+static void
+container_free(seriesBitmapContainer *cp)
+{
+    if (cp->array)
+	free(cp->array);
+    if (cp->bits)
+	free(cp->bits);
+    cp->array = NULL;
+    cp->bits = NULL;
+    cp->count = cp->size = 0;
+}
+
+/* bisect the array of a sparse container, returning insertion point */
+static unsigned int
+container_search(seriesBitmapContainer *cp, unsigned short low)
+{
+    unsigned int	lo = 0, hi = cp->count, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (cp->array[mid] < low)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static int
+container_contains(seriesBitmapContainer *cp, unsigned short low)
+{
+    unsigned int	i;
+
+    if (cp->bits)
+	return (cp->bits[low >> 6] >> (low & 63)) & 1;
+    i = container_search(cp, low);
+    return (i < cp->count && cp->array[i] == low);
+}
+
+static void
+container_recount(seriesBitmapContainer *cp)
+{
+    unsigned int	i, count = 0;
+
+    for (i = 0; i < BITMAP_WORDS; i++)
+	count += popcount(cp->bits[i]);
+    cp->count = count;
+}
+
+/* convert a sparse array container into a dense bitset container */
+static int
+container_to_bits(seriesBitmapContainer *cp)
+{
+    __uint64_t		*bits;
+    unsigned int	i;
+
+    if (cp->bits)
+	return 0;
+    if ((bits = calloc(BITMAP_WORDS, sizeof(__uint64_t))) == NULL)
+	return -ENOMEM;
+    for (i = 0; i < cp->count; i++)
+	bits[cp->array[i] >> 6] |= (__uint64_t)1 << (cp->array[i] & 63);
+    if (cp->array)
+	free(cp->array);
+    cp->array = NULL;
+    cp->size = 0;
+    cp->bits = bits;
+    return 0;
+}
+
+/* convert a dense bitset container back to an array, once sparse */
+static int
+container_shrink(seriesBitmapContainer *cp)
+{
+    unsigned short	*array;
+    __uint64_t		word;
+    unsigned int	i, n = 0;
+
+    if (cp->bits == NULL || cp->count > BITMAP_ARRAY_MAX)
+	return 0;
+    if ((array = malloc((cp->count + 1) * sizeof(unsigned short))) == NULL)
+	return -ENOMEM;
+    for (i = 0; i < BITMAP_WORDS; i++)
+	for (word = cp->bits[i]; word; word &= word - 1)
+	    array[n++] = (i << 6) + lowbit(word);
+    free(cp->bits);
+    cp->bits = NULL;
+    cp->array = array;
+    cp->size = cp->count + 1;
+    return 0;
+}
+
+static int
+container_add(seriesBitmapContainer *cp, unsigned short low)
+{
+    unsigned short	*array;
+    __uint64_t		mask;
+    unsigned int	i, size;
+    int			sts;
+
+    if (cp->bits) {
+	mask = (__uint64_t)1 << (low & 63);
+	if (!(cp->bits[low >> 6] & mask)) {
+	    cp->bits[low >> 6] |= mask;
+	    cp->count++;
+	}
+	return 0;
+    }
+
+    i = container_search(cp, low);
+    if (i < cp->count && cp->array[i] == low)
+	return 0;
+    if (cp->count == BITMAP_ARRAY_MAX) {
+	if ((sts = container_to_bits(cp)) < 0)
+	    return sts;
+	return container_add(cp, low);
+    }
+    if (cp->count == cp->size) {
+	size = cp->size ? cp->size * 2 : 4;
+	if (size > BITMAP_ARRAY_MAX)
+	    size = BITMAP_ARRAY_MAX;
+	if ((array = realloc(cp->array, size * sizeof(unsigned short))) == NULL)
+	    return -ENOMEM;
+	cp->array = array;
+	cp->size = size;
+    }
+    memmove(&cp->array[i + 1], &cp->array[i],
+		(cp->count - i) * sizeof(unsigned short));
+    cp->array[i] = low;
+    cp->count++;
+    return 0;
+}
+
+static int
+container_and(seriesBitmapContainer *a, seriesBitmapContainer *b)
+{
+    unsigned short	*array;
+    unsigned int	i, n;
+
+    if (a->bits && b->bits) {
+	for (i = 0; i < BITMAP_WORDS; i++)
+	    a->bits[i] &= b->bits[i];
+	container_recount(a);
+	return container_shrink(a);
+    }
+    if (a->bits) {	/* result is a subset of the array in b */
+	if ((array = malloc((b->count + 1) * sizeof(unsigned short))) == NULL)
+	    return -ENOMEM;
+	for (i = n = 0; i < b->count; i++)
+	    if (container_contains(a, b->array[i]))
+		array[n++] = b->array[i];
+	free(a->bits);
+	a->bits = NULL;
+	a->array = array;
+	a->size = b->count + 1;
+	a->count = n;
+	return 0;
+    }
+    for (i = n = 0; i < a->count; i++)	/* filter array in-place */
+	if (container_contains(b, a->array[i]))
+	    a->array[n++] = a->array[i];
+    a->count = n;
+    return 0;
+}
+
+static int
+container_or(seriesBitmapContainer *a, seriesBitmapContainer *b)
+{
+    unsigned short	*array;
+    unsigned int	i, j, n;
+    int			sts;
+
+    if (!a->bits && !b->bits && a->count + b->count <= BITMAP_ARRAY_MAX) {
+	/* merge two sorted arrays, dropping duplicates */
+	n = a->count + b->count;
+	if ((array = malloc((n + 1) * sizeof(unsigned short))) == NULL)
+	    return -ENOMEM;
+	for (i = j = n = 0; i < a->count || j < b->count; ) {
+	    if (j == b->count || (i < a->count && a->array[i] < b->array[j]))
+		array[n++] = a->array[i++];
+	    else if (i == a->count || b->array[j] < a->array[i])
+		array[n++] = b->array[j++];
+	    else {
+		array[n++] = a->array[i++];
+		j++;
+	    }
+	}
+	if (a->array)
+	    free(a->array);
+	a->array = array;
+	a->size = a->count + b->count + 1;
+	a->count = n;
+	return 0;
+    }
+
+    if ((sts = container_to_bits(a)) < 0)
+	return sts;
+    if (b->bits) {
+	for (i = 0; i < BITMAP_WORDS; i++)
+	    a->bits[i] |= b->bits[i];
+    } else {
+	for (i = 0; i < b->count; i++)
+	    a->bits[b->array[i] >> 6] |= (__uint64_t)1 << (b->array[i] & 63);
+    }
+    container_recount(a);
+    return container_shrink(a);
+}
+
+/* bisect the sorted containers, returning insertion point for a key */
+static unsigned int
+bitmap_search(seriesBitmap *bp, unsigned int key)
+{
+    unsigned int	lo = 0, hi = bp->ncontainers, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (bp->containers[mid].key < key)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static seriesBitmapContainer *
+bitmap_container(seriesBitmap *bp, unsigned int key, int create)
+{
+    seriesBitmapContainer *cp;
+    unsigned int	i, size;
+
+    i = bitmap_search(bp, key);
+    if (i < bp->ncontainers && bp->containers[i].key == key)
+	return &bp->containers[i];
+    if (!create)
+	return NULL;
+
+    if (bp->ncontainers == bp->size) {
+	size = bp->size ? bp->size * 2 : 4;
+	if ((cp = realloc(bp->containers, size * sizeof(*cp))) == NULL)
+	    return NULL;
+	bp->containers = cp;
+	bp->size = size;
+    }
+    cp = &bp->containers[i];
+    memmove(cp + 1, cp, (bp->ncontainers - i) * sizeof(*cp));
+    memset(cp, 0, sizeof(*cp));
+    cp->key = key;
+    bp->ncontainers++;
+    return cp;
+}
+
+/* drop any containers left with no members */
+static void
+bitmap_compact(seriesBitmap *bp)
+{
+    unsigned int	i, n;
+
+    for (i = n = 0; i < bp->ncontainers; i++) {
+	if (bp->containers[i].count == 0) {
+	    container_free(&bp->containers[i]);
+	    continue;
+	}
+	if (n != i)
+	    bp->containers[n] = bp->containers[i];
+	n++;
+    }
+    bp->ncontainers = n;
+}
+
+seriesBitmap *
+seriesBitmapCreate(void)
+{
+    return (seriesBitmap *)calloc(1, sizeof(seriesBitmap));
+}
+
+void
+seriesBitmapFree(seriesBitmap *bp)
+{
+    unsigned int	i;
+
+    if (bp == NULL)
+	return;
+    for (i = 0; i < bp->ncontainers; i++)
+	container_free(&bp->containers[i]);
+    if (bp->containers)
+	free(bp->containers);
+    free(bp);
+}
+
+int
+seriesBitmapAdd(seriesBitmap *bp, unsigned int value)
+{
+    seriesBitmapContainer *cp;
+
+    if ((cp = bitmap_container(bp, value >> 16, 1)) == NULL)
+	return -ENOMEM;
+    return container_add(cp, value & 0xffff);
+}
+
+int
+seriesBitmapContains(seriesBitmap *bp, unsigned int value)
+{
+    seriesBitmapContainer *cp;
+
+    if ((cp = bitmap_container(bp, value >> 16, 0)) == NULL)
+	return 0;
+    return container_contains(cp, value & 0xffff);
+}
+
+unsigned int
+seriesBitmapCount(seriesBitmap *bp)
+{
+    unsigned int	i, count = 0;
+
+    for (i = 0; i < bp->ncontainers; i++)
+	count += bp->containers[i].count;
+    return count;
+}
+
+int
+seriesBitmapAnd(seriesBitmap *a, seriesBitmap *b)
+{
+    seriesBitmapContainer *cp, *bcp;
+    unsigned int	i;
+    int			sts = 0;
+
+    for (i = 0; i < a->ncontainers; i++) {
+	cp = &a->containers[i];
+	if ((bcp = bitmap_container(b, cp->key, 0)) == NULL)
+	    container_free(cp);
+	else if ((sts = container_and(cp, bcp)) < 0)
+	    break;
+    }
+    bitmap_compact(a);
+    return sts;
+}
+
+int
+seriesBitmapOr(seriesBitmap *a, seriesBitmap *b)
+{
+    seriesBitmapContainer *cp;
+    unsigned int	i;
+    int			sts;
+
+    for (i = 0; i < b->ncontainers; i++) {
+	if ((cp = bitmap_container(a, b->containers[i].key, 1)) == NULL)
+	    return -ENOMEM;
+	if ((sts = container_or(cp, &b->containers[i])) < 0)
+	    return sts;
+    }
+    return 0;
+}
+
+int
+seriesBitmapIterate(seriesBitmap *bp, seriesBitmapCallBack func, void *arg)
+{
+    seriesBitmapContainer *cp;
+    __uint64_t		word;
+    unsigned int	i, j, high;
+    int			sts;
+
+    for (i = 0; i < bp->ncontainers; i++) {
+	cp = &bp->containers[i];
+	high = cp->key << 16;
+	if (cp->bits == NULL) {
+	    for (j = 0; j < cp->count; j++)
+		if ((sts = func(high | cp->array[j], arg)) < 0)
+		    return sts;
+	    continue;
+	}
+	for (j = 0; j < BITMAP_WORDS; j++) {
+	    for (word = cp->bits[j]; word; word &= word - 1)
+		if ((sts = func(high | (j << 6) | lowbit(word), arg)) < 0)
+		    return sts;
+	}
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#ifndef SERIES_BITMAP_H
+#define SERIES_BITMAP_H
+
+#include "pmapi.h"
+
+/*
+ * Compressed bitmap sets of (32-bit) numeric series identifiers.
+ *
+ * Members are partitioned by their high 16 bits into containers, as
+ * with roaring bitmaps.  Sparse containers hold a sorted array of the
+ * low 16 bits, dense containers switch to a fixed-size bitset.
+ */
+#define BITMAP_ARRAY_MAX	4096	/* array to bitset threshold */
+#define BITMAP_WORDS		1024	/* 64-bit words in a bitset */
+
+typedef struct seriesBitmapContainer {
+    unsigned int	key;		/* high 16 bits of each member */
+    unsigned int	count;		/* number of members present */
+    unsigned int	size;		/* allocated array entries */
+    unsigned short	*array;		/* sorted low bits - or NULL, and */
+    __uint64_t		*bits;		/* bitset of low bits when dense */
+} seriesBitmapContainer;
+
+typedef struct seriesBitmap {
+    unsigned int	ncontainers;
+    unsigned int	size;		/* allocated container entries */
+    seriesBitmapContainer *containers;	/* sorted by container key */
+} seriesBitmap;
+
+typedef int (*seriesBitmapCallBack)(unsigned int, void *);
+
+extern seriesBitmap *seriesBitmapCreate(void);
+extern void seriesBitmapFree(seriesBitmap *);
+extern int seriesBitmapAdd(seriesBitmap *, unsigned int);
+extern int seriesBitmapContains(seriesBitmap *, unsigned int);
+extern unsigned int seriesBitmapCount(seriesBitmap *);
+
+/* set operations - results are left in the first bitmap */
+extern int seriesBitmapAnd(seriesBitmap *, seriesBitmap *);
+extern int seriesBitmapOr(seriesBitmap *, seriesBitmap *);
+
+/* visit each member in ascending order, stopping on negative return */
+extern int seriesBitmapIterate(seriesBitmap *, seriesBitmapCallBack, void *);
+
+#endif	/* SERIES_BITMAP_H */
@@ -43,9 +43,13 @@ typedef struct context {
     unsigned int	cached	: 1;	/* context/source in cache */
     unsigned int	garbage	: 1;	/* context pending removal */
     unsigned int	updated : 1;	/* context labels are updated */
-    unsigned int	padding : 21;	/* zero-filled struct padding */
+    unsigned int	pooled	: 1;	/* context idle in reuse pool */
+    unsigned int	padding : 20;	/* zero-filled struct padding */
     unsigned int	timeout;	/* context timeout in milliseconds */
     uv_timer_t		timer;
+#ifdef HAVE_LIBUV
+    uv_mutex_t		lock;		/* serialises web group scrapes */
+#endif
     int			context;	/* PMAPI context handle */
     int			randomid;	/* random number identifier */
     struct dict		*pmids;		/* metric pmID to metric struct */
@@ -55,6 +59,7 @@ typedef struct context {
     struct dict		*clusters;	/* domain+cluster to cluster struct */
     sds			labels;		/* context labelset as string */
     pmLabelSet		*labelset;	/* labelset at context level */
+    struct context	*next;		/* idle context pool linkage */
     void		*privdata;
 } context_t;
 
@@ -111,6 +116,8 @@ typedef struct value {
     int			inst;		/* internal instance identifier */
     unsigned int	updated;	/* last sample modified value */
     pmAtomValue		atom;		/* most recent sampled value */
+    sds			scrapelabels;	/* rendered labels for scrapes */
+    unsigned char	scrapehash[20];	/* instance identity at render */
 } value_t;
 
 typedef struct valuelist {
@@ -119,6 +126,18 @@ typedef struct valuelist {
     value_t		value[0];
 } valuelist_t;
 
+typedef struct rollupstat {
+    pmAtomValue		min;		/* in the metric type, exactly */
+    pmAtomValue		max;
+    double		sum;
+    unsigned int	count;
+} rollupstat_t;
+
+typedef struct rollup {
+    __int64_t		window;		/* current window of this tier */
+    struct dict		*insts;		/* map identifiers to rollupstats */
+} rollup_t;
+
 typedef struct metric {
     pmDesc		desc;
     cluster_t		*cluster;
@@ -138,6 +157,9 @@ typedef struct metric {
 	pmAtomValue	atom;		/* singleton value (PM_IN_NULL) */
 	valuelist_t	*vlist;		/* instance values and metadata */
     } u;
+    rollup_t		*rollups;	/* downsampling state, for each tier */
+    sds			scrapelabels;	/* rendered labels for scrapes */
+    unsigned char	scrapehash[20];	/* metric identity at render */
 } metric_t;
 
 struct seriesGetContext;
@@ -14,6 +14,7 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <float.h>
 #include "util.h"
 #include "query.h"
 #include "schema.h"
@@ -21,13 +22,15 @@
 #include "batons.h"
 #include "slots.h"
 #include "maps.h"
+#include "sha1.h"
+#include "bitmap.h"
 #ifdef HAVE_REGEX_H
 #include <regex.h>
 #endif
 #include <fnmatch.h>
 
 #define SHA1SZ		20	/* internal sha1 hash buffer size in bytes */
-#define QUERY_PHASES	6
+#define QUERY_PHASES	7
 
 typedef struct seriesGetSID {
     seriesBatonMagic	header;		/* MAGIC_SID */
@@ -35,6 +38,9 @@ typedef struct seriesGetSID {
     sds			metric;		/* back-pointer for instance series */
     int			freed;		/* freed individually on completion */
     void		*baton;
+    dict		*windows;	/* function window accumulators */
+    sds			key;		/* XRANGE stream key, when paging */
+    sds			end;		/* XRANGE end, when paging */
 } seriesGetSID;
 
 typedef struct seriesGetLabelMap {
@@ -55,9 +61,33 @@ typedef struct seriesGetLookup {
     seriesGetSID	series[0];
 } seriesGetLookup;
 
+typedef struct seriesWindow {
+    __int64_t		window;		/* interval window number */
+    __uint64_t		start;		/* first sample time (msec) */
+    __uint64_t		stamp;		/* last sample time (msec) */
+    double		first;
+    double		last;
+    double		sum;
+    double		min;
+    double		max;
+    unsigned int	count;
+    unsigned int	emitted;	/* windows reported for this instance */
+} seriesWindow;
+
 typedef struct seriesGetQuery {
     node_t		root;
     timing_t		timing;
+    nodetype_t		inner;		/* per-series time function, or zero */
+    nodetype_t		outer;		/* cross-series function, or zero */
+    const char		*field;		/* rollup statistic field suffix */
+    int			weighted;	/* rollup averages, weight by .count */
+    unsigned int	naggregate;
+    seriesWindow	*aggregate;	/* cross-series windows, sorted */
+    dict		*ids;		/* SHA1 to numeric series identifier */
+    sds			idkey;		/* SHA1 lookup key buffer for ids */
+    unsigned char	*hashes;	/* SHA1 of each numeric identifier */
+    unsigned int	nids;
+    unsigned int	maxids;
 } seriesGetQuery;
 
 typedef struct seriesQueryBaton {
@@ -77,8 +107,6 @@ typedef struct seriesQueryBaton {
 } seriesQueryBaton;
 
 static void series_pattern_match(seriesQueryBaton *, node_t *);
-static int series_union(series_set_t *, series_set_t *);
-static int series_intersect(series_set_t *, series_set_t *);
 static void series_lookup_services(void *);
 static void series_lookup_mapping(void *);
 static void series_lookup_finished(void *);
@@ -93,11 +121,47 @@ initSeriesGetQuery(seriesQueryBaton *baton, node_t *root, timing_t *timing)
     baton->u.query.timing = *timing;
 }
 
+static void
+series_free_identifiers(seriesQueryBaton *baton)
+{
+    seriesGetQuery	*qp = &baton->u.query;
+
+    if (qp->ids)
+	dictRelease(qp->ids);
+    qp->ids = NULL;
+    sdsfree(qp->idkey);
+    qp->idkey = NULL;
+    if (qp->hashes)
+	free(qp->hashes);
+    qp->hashes = NULL;
+    qp->nids = qp->maxids = 0;
+}
+
+/*
+ * Release any leaf or interior node bitmaps left behind in the query
+ * tree when solving was abandoned part way through (on error).
+ */
+static void
+series_free_bitmaps(node_t *np)
+{
+    if (np == NULL)
+	return;
+    series_free_bitmaps(np->left);
+    series_free_bitmaps(np->right);
+    if (np->result.bitmap)
+	seriesBitmapFree(np->result.bitmap);
+    np->result.bitmap = NULL;
+}
+
 static void
 freeSeriesGetQuery(seriesQueryBaton *baton)
 {
     seriesBatonCheckMagic(baton, MAGIC_QUERY, "freeSeriesGetQuery");
     seriesBatonCheckCount(baton, "freeSeriesGetQuery");
+    if (baton->u.query.aggregate)
+	free(baton->u.query.aggregate);
+    series_free_bitmaps(&baton->u.query.root);
+    series_free_identifiers(baton);
     memset(baton, 0, sizeof(seriesQueryBaton));
     free(baton);
 }
@@ -140,10 +204,21 @@ initSeriesGetSID(seriesGetSID *sid, const char *name, int needfree, void *baton)
 static void
 freeSeriesGetSID(seriesGetSID *sid)
 {
+    dictIterator	*iterator;
+    dictEntry		*entry;
     int			needfree;
 
     seriesBatonCheckMagic(sid, MAGIC_SID, "freeSeriesGetSID");
     sdsfree(sid->name);
+    if (sid->windows) {
+	iterator = dictGetIterator(sid->windows);
+	while ((entry = dictNext(iterator)) != NULL)
+	    free(dictGetVal(entry));
+	dictReleaseIterator(iterator);
+	dictRelease(sid->windows);
+    }
+    sdsfree(sid->key);
+    sdsfree(sid->end);
     needfree = sid->freed;
     memset(sid, 0, sizeof(seriesGetSID));
     if (needfree)
@@ -391,16 +466,307 @@ extract_time(seriesQueryBaton *baton, pmSID series,
     return -EPROTO;
 }
 
+/*
+ * Time series function evaluation.  Samples of each series instance
+ * are reduced over interval windows by the inner function, and these
+ * results optionally aggregated across all matching series instances
+ * by an outer function.
+ */
+static int
+series_function(node_t *np)
+{
+    if (np == NULL)
+	return 0;
+    switch (np->type) {
+    case N_RATE: case N_AVG: case N_MAX: case N_MIN: case N_SUM:
+	return 1;
+    default:
+	break;
+    }
+    return 0;
+}
+
+static const char *
+series_function_str(nodetype_t type)
+{
+    switch (type) {
+    case N_RATE: return "rate";
+    case N_AVG: return "avg";
+    case N_MAX: return "max";
+    case N_MIN: return "min";
+    case N_SUM: return "sum";
+    default: break;
+    }
+    return "";
+}
+
+static __int64_t
+series_msec(struct timeval *tv)
+{
+    return (__int64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+static __int64_t
+series_window_origin(timing_t *tp)
+{
+    return series_msec(tp->aligns ? &tp->align : &tp->start);
+}
+
+static __int64_t
+series_window(timing_t *tp, __uint64_t stamp)
+{
+    __int64_t		delta = series_msec(&tp->delta);
+    __int64_t		offset, window;
+
+    if (delta <= 0)
+	return 0;
+    offset = (__int64_t)stamp - series_window_origin(tp);
+    window = offset / delta;
+    if (offset < 0 && (offset % delta) != 0)
+	window--;
+    return window;
+}
+
+static __uint64_t
+series_window_stamp(timing_t *tp, seriesWindow *wp)
+{
+    __int64_t		delta = series_msec(&tp->delta);
+
+    if (delta <= 0)
+	return wp->stamp;
+    return series_window_origin(tp) + wp->window * delta;
+}
+
+static sds
+series_window_stamp_str(sds stamp, __uint64_t msec)
+{
+    struct timeval	tv;
+    char		buffer[64], *point;
+
+    tv.tv_sec = msec / 1000;
+    tv.tv_usec = (msec % 1000) * 1000;
+    timeval_stream_str(&tv, buffer, sizeof(buffer));
+    if ((point = strchr(buffer, '-')) != NULL)
+	*point = '.';
+    return sdscpy(stamp, buffer);
+}
+
+static int
+series_window_value(nodetype_t type, seriesWindow *wp, double *result)
+{
+    double		delta;
+
+    if (wp->count == 0)
+	return -1;
+    switch (type) {
+    case N_RATE:
+	if (wp->count < 2 || wp->stamp <= wp->start)
+	    return -1;
+	if ((delta = wp->last - wp->first) < 0)	/* counter wrap or reset */
+	    return -1;
+	*result = delta / ((wp->stamp - wp->start) / 1000.0);
+	break;
+    case N_AVG:
+	*result = wp->sum / wp->count;
+	break;
+    case N_MAX:
+	*result = wp->max;
+	break;
+    case N_MIN:
+	*result = wp->min;
+	break;
+    case N_SUM:
+	*result = wp->sum;
+	break;
+    default:
+	return -1;
+    }
+    return 0;
+}
+
+static void
+series_window_sample(seriesWindow *wp, __int64_t window,
+		__uint64_t stamp, double number)
+{
+    if (wp->count == 0) {
+	wp->first = wp->min = wp->max = number;
+	wp->start = stamp;
+	wp->sum = 0;
+    } else {
+	if (number < wp->min)
+	    wp->min = number;
+	if (number > wp->max)
+	    wp->max = number;
+    }
+    wp->window = window;
+    if (stamp > wp->stamp)
+	wp->stamp = stamp;
+    wp->last = number;
+    wp->sum += number;
+    wp->count++;
+}
+
+/* merge one per-series window result into the sorted cross-series set */
+static void
+series_aggregate(seriesQueryBaton *baton, __int64_t window,
+		__uint64_t stamp, double result)
+{
+    seriesGetQuery	*qp = &baton->u.query;
+    seriesWindow	*wp;
+    unsigned int	lo = 0, hi = qp->naggregate, mid;
+    size_t		bytes;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (qp->aggregate[mid].window < window)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo == qp->naggregate || qp->aggregate[lo].window != window) {
+	bytes = (qp->naggregate + 1) * sizeof(seriesWindow);
+	if ((wp = (seriesWindow *)realloc(qp->aggregate, bytes)) == NULL) {
+	    baton->error = -ENOMEM;
+	    return;
+	}
+	qp->aggregate = wp;
+	memmove(&wp[lo + 1], &wp[lo], (qp->naggregate - lo) * sizeof(*wp));
+	memset(&wp[lo], 0, sizeof(*wp));
+	qp->naggregate++;
+    }
+    series_window_sample(&qp->aggregate[lo], window, stamp, result);
+}
+
+static void
+series_window_emit(seriesQueryBaton *baton, sds series, sds inst,
+		seriesWindow *wp)
+{
+    seriesGetQuery	*qp = &baton->u.query;
+    pmSeriesValue	value;
+    __uint64_t		stamp;
+    double		result;
+
+    if (wp->emitted >= qp->timing.count)
+	return;
+    if (series_window_value(qp->inner, wp, &result) < 0)
+	return;
+    wp->emitted++;
+    stamp = series_window_stamp(&qp->timing, wp);
+    if (qp->outer) {
+	series_aggregate(baton, wp->window, stamp, result);
+	return;
+    }
+    value.timestamp = series_window_stamp_str(sdsempty(), stamp);
+    value.series = inst;
+    value.data = sdscatprintf(sdsempty(), "%.*g", DBL_DIG, result);
+    baton->callbacks->on_value(series, &value, baton->userdata);
+    sdsfree(value.timestamp);
+    sdsfree(value.data);
+}
+
+/* accumulate one instance sample, emitting any completed window */
+static void
+series_window_add(seriesQueryBaton *baton, dict *windows,
+		sds series, pmSeriesValue *value)
+{
+    seriesGetQuery	*qp = &baton->u.query;
+    seriesWindow	*wp;
+    __uint64_t		stamp;
+    __int64_t		window;
+    double		number;
+    char		*end;
+
+    number = strtod(value->data, &end);
+    if (end == value->data || *end != '\0')
+	return;		/* functions apply to numeric values only */
+    stamp = strtoull(value->timestamp, NULL, 10);
+    window = series_window(&qp->timing, stamp);
+
+    if ((wp = dictFetchValue(windows, value->series)) == NULL) {
+	if ((wp = (seriesWindow *)calloc(1, sizeof(seriesWindow))) == NULL) {
+	    baton->error = -ENOMEM;
+	    return;
+	}
+	dictAdd(windows, value->series, wp);
+    } else if (wp->window != window) {
+	series_window_emit(baton, series, value->series, wp);
+	if (qp->inner == N_RATE) {
+	    /* last sample of previous window starts the next one */
+	    wp->first = wp->min = wp->max = wp->sum = wp->last;
+	    wp->start = wp->stamp;
+	    wp->count = 1;
+	} else {
+	    wp->count = 0;
+	}
+    }
+    series_window_sample(wp, window, stamp, number);
+}
+
+/*
+ * A rollup average stands for count samples - scale the sample that
+ * was just added for this instance so window averages are weighted.
+ */
+static void
+series_window_weight(dict *windows, pmSeriesValue *value)
+{
+    seriesWindow	*wp;
+    unsigned long	count;
+    char		*end;
+
+    if ((wp = dictFetchValue(windows, value->series)) == NULL || wp->count == 0)
+	return;
+    count = strtoul(value->data, &end, 10);
+    if (end == value->data || *end != '\0' || count < 2)
+	return;
+    wp->sum += wp->last * (count - 1);
+    wp->count += count - 1;
+}
+
+static void
+series_window_flush(seriesQueryBaton *baton, dict *windows, sds series)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+
+    iterator = dictGetIterator(windows);
+    while ((entry = dictNext(iterator)) != NULL)
+	series_window_emit(baton, series, (sds)dictGetKey(entry),
+			(seriesWindow *)dictGetVal(entry));
+    dictReleaseIterator(iterator);
+}
+
+/* have all instances seen so far reported as many windows as requested? */
+static int
+series_window_done(seriesQueryBaton *baton, dict *windows)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    seriesWindow	*wp;
+    int			done = (dictSize(windows) > 0);
+
+    iterator = dictGetIterator(windows);
+    while (done && (entry = dictNext(iterator)) != NULL) {
+	wp = (seriesWindow *)dictGetVal(entry);
+	if (wp->emitted < baton->u.query.timing.count)
+	    done = 0;
+    }
+    dictReleaseIterator(iterator);
+    return done;
+}
+
 /*
  * Report a timeseries result - timestamps and (instance) values
  */
 static int
-series_instance_reply(seriesQueryBaton *baton, sds series,
+series_instance_reply(seriesQueryBaton *baton, sds series, dict *windows,
 	pmSeriesValue *value, int nelements, redisReply **elements)
 {
+    const char		*field = baton->u.query.field;
+    size_t		length = field ? strlen(field) : 0;
+    size_t		clength = sizeof(".count") - 1;
     char		hashbuf[42];
     sds			inst;
-    int			i, sts = 0;
+    int			i, weight, sts = 0;
 
     for (i = 0; i < nelements; i += 2) {
 	inst = value->series;
@@ -408,6 +774,20 @@ series_instance_reply(seriesQueryBaton *baton, sds series,
 	    sts = -EPROTO;
 	    continue;
 	}
+	value->series = inst;	/* may have been reallocated */
+	weight = 0;
+	if (field) {	/* select one rollup statistic, by name suffix */
+	    if (sdslen(inst) < length ||
+		memcmp(inst + sdslen(inst) - length, field, length) != 0)
+		continue;
+	    sdsIncrLen(inst, -(ssize_t)length);
+	} else if (baton->u.query.weighted && windows &&
+		sdslen(inst) >= clength &&
+		memcmp(inst + sdslen(inst) - clength, ".count", clength) == 0) {
+	    /* sample count of the rollup average preceding it */
+	    sdsIncrLen(inst, -(ssize_t)clength);
+	    weight = 1;
+	}
 	if (sdslen(inst) == 0) {	/* no InDom, use series */
 	    inst = sdscpylen(inst, series, 40);
 	} else if (sdslen(inst) == 20) {
@@ -421,6 +801,10 @@ series_instance_reply(seriesQueryBaton *baton, sds series,
 
 	if (extract_string(baton, series, elements[i+1], &value->data, "value") < 0)
 	    sts = -EPROTO;
+	else if (weight)
+	    series_window_weight(windows, value);
+	else if (windows)
+	    series_window_add(baton, windows, series, value);
 	else
 	    baton->callbacks->on_value(series, value, baton->userdata);
     }
@@ -428,8 +812,8 @@ series_instance_reply(seriesQueryBaton *baton, sds series,
 }
 
 static int
-series_result_reply(seriesQueryBaton *baton, sds series, pmSeriesValue *value,
-		int nelements, redisReply **elements)
+series_result_reply(seriesQueryBaton *baton, sds series, dict *windows,
+		pmSeriesValue *value, int nelements, redisReply **elements)
 {
     redisReply		*reply;
     sds			msg;
@@ -452,8 +836,8 @@ series_result_reply(seriesQueryBaton *baton, sds series, pmSeriesValue *value,
 			series, XRANGE, redis_reply_type(reply));
 	    batoninfo(baton, PMLOG_RESPONSE, msg);
 	    baton->error = -EPROTO;
-	} else if ((sts = series_instance_reply(baton, series, value,
-				reply->elements, reply->element)) < 0) {
+	} else if ((sts = series_instance_reply(baton, series, windows,
+				value, reply->elements, reply->element)) < 0) {
 	    baton->error = sts;
 	}
     }
@@ -461,7 +845,7 @@ series_result_reply(seriesQueryBaton *baton, sds series, pmSeriesValue *value,
 }
 
 static void
-series_values_reply(seriesQueryBaton *baton, sds series,
+series_values_reply(seriesQueryBaton *baton, sds series, dict *windows,
 		int nelements, redisReply **elements, void *arg)
 {
     pmSeriesValue	value;
@@ -474,7 +858,7 @@ series_values_reply(seriesQueryBaton *baton, sds series,
 
     for (i = 0; i < nelements; i++) {
 	reply = elements[i];
-	if ((sts = series_result_reply(baton, series, &value,
+	if ((sts = series_result_reply(baton, series, windows, &value,
 				reply->elements, reply->element)) < 0)
 	    baton->error = sts;
     }
@@ -484,6 +868,43 @@ series_values_reply(seriesQueryBaton *baton, sds series,
     sdsfree(value.data);
 }
 
+/*
+ * Map a series SHA1 hash to a compact numeric identifier, allocated
+ * densely for this query.  Set operations during query solving are
+ * performed on bitmaps of these, and the SHA1 identifiers are only
+ * materialized again for the final result set.
+ */
+static int
+series_identifier(seriesQueryBaton *baton, const char *hash)
+{
+    seriesGetQuery	*qp = &baton->u.query;
+    dictEntry		*entry, *existing;
+    unsigned char	*hashes;
+    unsigned int	size;
+
+    if (qp->ids == NULL) {
+	if ((qp->ids = dictCreate(&sdsKeyDictCallBacks, NULL)) == NULL)
+	    return -ENOMEM;
+	qp->idkey = sdsempty();
+    }
+    qp->idkey = sdscpylen(qp->idkey, hash, SHA1SZ);
+    if ((entry = dictAddRaw(qp->ids, qp->idkey, &existing)) == NULL)
+	return (int)dictGetUnsignedIntegerVal(existing);
+
+    if (qp->nids == qp->maxids) {
+	size = qp->maxids ? qp->maxids * 2 : 256;
+	if ((hashes = realloc(qp->hashes, (size_t)size * SHA1SZ)) == NULL) {
+	    dictDelete(qp->ids, qp->idkey);
+	    return -ENOMEM;
+	}
+	qp->hashes = hashes;
+	qp->maxids = size;
+    }
+    memcpy(qp->hashes + (size_t)qp->nids * SHA1SZ, hash, SHA1SZ);
+    dictSetUnsignedIntegerVal(entry, qp->nids);
+    return qp->nids++;
+}
+
 /*
  * Save the series hash identifiers contained in a Redis response
  * for all series that are not already in this nodes set (union).
@@ -493,34 +914,35 @@ series_values_reply(seriesQueryBaton *baton, sds series,
 static int
 node_series_reply(seriesQueryBaton *baton, node_t *np, int nelements, redisReply **elements)
 {
-    series_set_t	set;
-    unsigned char	*series;
     redisReply		*reply;
     char		hashbuf[42];
     sds			msg;
-    int			i, sts = 0;
+    int			i, id, sts = 0;
 
     if (nelements <= 0)
 	return nelements;
 
-    if ((series = (unsigned char *)calloc(nelements, SHA1SZ)) == NULL) {
-	infofmt(msg, "out of memory (%s, %" FMT_INT64 " bytes)",
-			"series reply", (__int64_t)nelements * SHA1SZ);
+    if (np->result.bitmap == NULL &&
+	(np->result.bitmap = seriesBitmapCreate()) == NULL) {
+	infofmt(msg, "out of memory (%s)", "series reply");
 	batoninfo(baton, PMLOG_REQUEST, msg);
 	return -ENOMEM;
     }
-    set.series = series;
-    set.nseries = nelements;
 
     for (i = 0; i < nelements; i++) {
 	reply = elements[i];
-	if (reply->type == REDIS_REPLY_STRING) {
-	    memcpy(series, reply->str, SHA1SZ);
+	if (reply->type == REDIS_REPLY_STRING && reply->len == SHA1SZ) {
 	    if (pmDebugOptions.series) {
-		pmwebapi_hash_str(series, hashbuf, sizeof(hashbuf));
+		pmwebapi_hash_str((unsigned char *)reply->str,
+				hashbuf, sizeof(hashbuf));
 		printf("    %s\n", hashbuf);
 	    }
-	    series += SHA1SZ;
+	    if ((id = series_identifier(baton, reply->str)) < 0 ||
+		seriesBitmapAdd(np->result.bitmap, id) < 0) {
+		infofmt(msg, "out of memory (%s)", "series identifier");
+		batoninfo(baton, PMLOG_REQUEST, msg);
+		return -ENOMEM;
+	    }
 	} else {
 	    infofmt(msg, "expected string in %s set \"%s\" (type=%s)",
 		    node_subtype(np->left), np->left->key,
@@ -529,176 +951,131 @@ node_series_reply(seriesQueryBaton *baton, node_t *np, int nelements, redisReply
 	    sts = -EPROTO;
 	}
     }
-    if (sts < 0) {
-	free(set.series);
-	return sts;
-    }
-
-    return series_union(&np->result, &set);
-}
-
-static int
-series_compare(const void *a, const void *b)
-{
-    return memcmp(a, b, SHA1SZ);
+    return sts;
 }
 
 /*
- * Form resulting set via intersection of two child sets.
- * Algorithm:
- * - sort the larger set
- * - for each identifier in the smaller set
- *   o bisect to find match in sorted set
- *   o if matching, add it to the current saved set
- *
- * Memory from the smaller set is re-used to hold the result,
- * its memory is trimmed (via realloc) if the final resulting
- * set is smaller, and the larger set is freed on completion.
+ * Form resulting set via intersection of two child sets,
+ * using the left child bitmap to hold the result.  An empty
+ * set is represented by a NULL bitmap.
  */
 static int
-series_intersect(series_set_t *a, series_set_t *b)
+node_series_intersect(node_t *np, node_t *left, node_t *right)
 {
-    unsigned char	*small, *large, *saved, *cp;
-    int			nsmall, nlarge, total, i;
-
-    if (a->nseries >= b->nseries) {
-	large = a->series;	nlarge = a->nseries;
-	small = b->series;	nsmall = b->nseries;
-    } else {
-	small = a->series;	nsmall = a->nseries;
-	large = b->series;	nlarge = b->nseries;
-    }
+    seriesBitmap	*a = left->result.bitmap;
+    seriesBitmap	*b = right->result.bitmap;
+    int			sts = 0;
 
     if (pmDebugOptions.series)
-	printf("Intersect large(%d) and small(%d) series\n", nlarge, nsmall);
-
-    qsort(large, nlarge, SHA1SZ, series_compare);
-
-    for (i = 0, cp = saved = small; i < nsmall; i++, cp ++) {
-	if (!bsearch(cp, large, nlarge, SHA1SZ, series_compare))
-	    continue;		/* no match, continue advancing cp only */
-	if (saved != cp)
-	    memcpy(saved, cp, SHA1SZ);
-	saved++;		/* stashed, advance cp & saved pointers */
-    }
-
-    if ((total = (saved - small)) < nsmall) {
-	/* shrink the smaller set down further */
-	if ((small = realloc(small, total * SHA1SZ)) == NULL)
-	    return -ENOMEM;
-    }
+	printf("Intersect left(%u) and right(%u) series\n",
+		a ? seriesBitmapCount(a) : 0, b ? seriesBitmapCount(b) : 0);
 
-    if (pmDebugOptions.series && pmDebugOptions.desperate) {
-	char		hashbuf[42];
-
-	printf("Intersect result set contains %d series:\n", total);
-	for (i = 0, cp = small; i < total; cp++, i++) {
-	    pmwebapi_hash_str(cp, hashbuf, sizeof(hashbuf));
-	    printf("    %s\n", hashbuf);
-	}
+    if (a && b) {
+	sts = seriesBitmapAnd(a, b);
+    } else if (a) {
+	seriesBitmapFree(a);
+	a = NULL;
     }
+    seriesBitmapFree(b);
+    np->result.bitmap = a;
 
-    a->nseries = total;
-    a->series = small;
-    b->series = NULL;
-    b->nseries = 0;
-    free(large);
-    return 0;
+    /* finished with child leaves now, results percolated up */
+    left->result.bitmap = right->result.bitmap = NULL;
+    return sts;
 }
 
+/*
+ * Form the resulting set from union of two child sets.
+ */
 static int
-node_series_intersect(node_t *np, node_t *left, node_t *right)
+node_series_union(node_t *np, node_t *left, node_t *right)
 {
-    int			sts;
+    seriesBitmap	*a = left->result.bitmap;
+    seriesBitmap	*b = right->result.bitmap;
+    int			sts = 0;
+
+    if (pmDebugOptions.series)
+	printf("Union of left(%u) and right(%u) series\n",
+		a ? seriesBitmapCount(a) : 0, b ? seriesBitmapCount(b) : 0);
 
-    if ((sts = series_intersect(&left->result, &right->result)) >= 0)
-	np->result = left->result;
+    if (a == NULL) {
+	a = b;
+    } else if (b != NULL) {
+	sts = seriesBitmapOr(a, b);
+	seriesBitmapFree(b);
+    }
+    np->result.bitmap = a;
 
     /* finished with child leaves now, results percolated up */
-    right->result.nseries = left->result.nseries = 0;
+    left->result.bitmap = right->result.bitmap = NULL;
     return sts;
 }
 
-/*
- * Form the resulting set from union of two child sets.
- * The larger set is realloc-ated to form the result, if we
- * need to (i.e. if there are entries in the smaller set not
- * in the larger).
- *
- * Iterates over the smaller set doing a binary search of
- * each series identifier, and tracks which ones in the small
- * need to be added to the large set.
- * At the end, add more space to the larger set if needed and
- * append to it.  As a courtesy, since all callers need this,
- * we free the smaller set as well.
- */
 static int
-series_union(series_set_t *a, series_set_t *b)
+series_compare(const void *a, const void *b)
 {
-    unsigned char	*cp, *saved, *large, *small;
-    int			nlarge, nsmall, total, need, i;
+    return memcmp(a, b, SHA1SZ);
+}
 
-    if (a->nseries >= b->nseries) {
-	large = a->series;	nlarge = a->nseries;
-	small = b->series;	nsmall = b->nseries;
-    } else {
-	small = a->series;	nsmall = a->nseries;
-	large = b->series;	nlarge = b->nseries;
-    }
+typedef struct seriesExpand {
+    unsigned char	*hashes;
+    unsigned char	*series;
+} seriesExpand;
 
-    if (pmDebugOptions.series)
-	printf("Union of large(%d) and small(%d) series\n", nlarge, nsmall);
+static int
+series_expand_identifier(unsigned int id, void *arg)
+{
+    seriesExpand	*expand = (seriesExpand *)arg;
 
-    qsort(large, nlarge, SHA1SZ, series_compare);
+    memcpy(expand->series, expand->hashes + (size_t)id * SHA1SZ, SHA1SZ);
+    expand->series += SHA1SZ;
+    return 0;
+}
 
-    for (i = 0, cp = saved = small; i < nsmall; i++, cp += SHA1SZ) {
-	if (bsearch(cp, large, nlarge, SHA1SZ, series_compare) != NULL)
-	    continue;		/* already present, no need to save */
-	if (saved != cp)
-	    memcpy(saved, cp, SHA1SZ);
-	saved += SHA1SZ;	/* stashed, advance both cp & saved */
-    }
+/*
+ * Materialize the SHA1 identifiers of the final (solved) result set,
+ * after which the numeric identifier mappings are no longer needed.
+ */
+static int
+series_expand_set(seriesQueryBaton *baton, series_set_t *set)
+{
+    seriesExpand	expand;
+    unsigned int	count;
+    sds			msg;
+    int			sts = 0;
 
-    if ((need = (saved - small) / SHA1SZ) > 0) {
-	/* grow the larger set to cater for new entries, then add 'em */
-	if ((cp = realloc(large, (nlarge + need) * SHA1SZ)) == NULL)
-	    return -ENOMEM;
-	large = cp;
-	cp += (nlarge * SHA1SZ);
-	memcpy(cp, small, need * SHA1SZ);
-	total = nlarge + need;
-    } else {
-	total = nlarge;
+    if (set->bitmap) {
+	count = seriesBitmapCount(set->bitmap);
+	if (count > 0 && (set->series = calloc(count, SHA1SZ)) == NULL) {
+	    infofmt(msg, "out of memory (%s, %" FMT_INT64 " bytes)",
+			"result set", (__int64_t)count * SHA1SZ);
+	    batoninfo(baton, PMLOG_REQUEST, msg);
+	    sts = -ENOMEM;
+	} else {
+	    expand.hashes = baton->u.query.hashes;
+	    expand.series = set->series;
+	    seriesBitmapIterate(set->bitmap, series_expand_identifier, &expand);
+	    set->nseries = count;
+	    /* identifiers are in arrival order, report in SHA1 order */
+	    qsort(set->series, count, SHA1SZ, series_compare);
+	}
+	seriesBitmapFree(set->bitmap);
+	set->bitmap = NULL;
     }
 
     if (pmDebugOptions.series && pmDebugOptions.desperate) {
+	unsigned char	*cp = set->series;
 	char		hashbuf[42];
+	int		i;
 
-	printf("Union result set contains %d series:\n", total);
-	for (i = 0, cp = large; i < total; cp += SHA1SZ, i++) {
+	printf("Result set contains %d series:\n", set->nseries);
+	for (i = 0; i < set->nseries; cp += SHA1SZ, i++) {
 	    pmwebapi_hash_str(cp, hashbuf, sizeof(hashbuf));
 	    printf("    %s\n", hashbuf);
 	}
     }
 
-    a->nseries = total;
-    a->series = large;
-    b->series = NULL;
-    b->nseries = 0;
-    free(small);
-    return 0;
-}
-
-static int
-node_series_union(node_t *np, node_t *left, node_t *right)
-{
-    int			sts;
-
-    if ((sts = series_union(&left->result, &right->result)) >= 0)
-	np->result = left->result;
-
-    /* finished with child leaves now, results percolated up */
-    right->result.nseries = left->result.nseries = 0;
+    series_free_identifiers(baton);
     return sts;
 }
 
@@ -1093,6 +1470,70 @@ series_prepare_expr(seriesQueryBaton *baton, node_t *np, int level)
     return sts;
 }
 
+/*
+ * Time series functions need every sample in the time window, not
+ * just the first COUNT of them, so walk the stream in pages and apply
+ * the count to the reduced output windows instead.
+ */
+#define SERIES_PAGE_COUNT 1024
+#define DEFAULT_VALUE_COUNT 10
+
+static void series_prepare_time_reply(redisAsyncContext *, redisReply *, const sds, void *);
+
+static void
+series_request_range(seriesQueryBaton *baton, seriesGetSID *sid,
+		sds key, sds start, sds end, sds count)
+{
+    sds			cmd;
+
+    /* XRANGE key t1 t2 [COUNT count] */
+    cmd = redis_command(6);
+    cmd = redis_param_str(cmd, XRANGE, XRANGE_LEN);
+    cmd = redis_param_sds(cmd, key);
+    cmd = redis_param_sds(cmd, start);
+    cmd = redis_param_sds(cmd, end);
+    cmd = redis_param_str(cmd, "COUNT", sizeof("COUNT")-1);
+    cmd = redis_param_sds(cmd, count);
+    /* the request takes ownership of (and frees) its key */
+    redisSlotsRequest(baton->slots, XRANGE, sdsdup(key), cmd,
+				series_prepare_time_reply, sid);
+}
+
+/*
+ * Request the next page of a paged XRANGE, starting just after the
+ * stream ID of the last entry of this reply.  Returns 1 if a request
+ * was sent, 0 when there are no more pages.
+ */
+static int
+series_next_range(seriesQueryBaton *baton, seriesGetSID *sid, redisReply *reply)
+{
+    redisReply		*entry, *id;
+    unsigned long long	msec, seq;
+    sds			start, count;
+    char		*end;
+
+    if (reply->elements < SERIES_PAGE_COUNT ||
+	series_window_done(baton, sid->windows))
+	return 0;
+    entry = reply->element[reply->elements - 1];
+    if (entry->type != REDIS_REPLY_ARRAY || entry->elements < 1)
+	return 0;
+    id = entry->element[0];
+    if (id->type != REDIS_REPLY_STRING)
+	return 0;
+    msec = strtoull(id->str, &end, 10);
+    if (*end != '-')
+	return 0;
+    seq = strtoull(end + 1, NULL, 10);
+
+    start = sdscatfmt(sdsempty(), "%U-%U", msec, seq + 1);
+    count = sdscatfmt(sdsempty(), "%u", SERIES_PAGE_COUNT);
+    series_request_range(baton, sid, sid->key, start, sid->end, count);
+    sdsfree(start);
+    sdsfree(count);
+    return 1;
+}
+
 static void
 series_prepare_time_reply(
 	redisAsyncContext *c, redisReply *reply, const sds cmd, void *arg)
@@ -1117,15 +1558,19 @@ series_prepare_time_reply(
 	}
 	baton->error = -EPROTO;
     } else {
-	series_values_reply(baton, sid->name, reply->elements, reply->element, arg);
-    }
+	series_values_reply(baton, sid->name, sid->windows,
+			reply->elements, reply->element, arg);
+	if (sid->windows && baton->error == 0 &&
+	    series_next_range(baton, sid, reply))
+	    return;	/* more of this series to come */
+    }
+    if (sid->windows && baton->error == 0)
+	series_window_flush(baton, sid->windows, sid->name);
     freeSeriesGetSID(sid);
 
     series_query_end_phase(baton);
 }
 
-#define DEFAULT_VALUE_COUNT 10
-
 static void
 series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
 {
@@ -1133,8 +1578,28 @@ series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
     unsigned char	*series = result->series;
     seriesGetSID	*sid;
     char		buffer[64];
-    sds			count, start, end, key, cmd;
+    sds			count, start, end, key;
     unsigned int	i;
+    int			tier = -1;
+
+    /*
+     * Use the coarsest downsampled rollup tier satisfying any requested
+     * interval - these hold window averages under the instance names,
+     * with minimum and maximum in suffixed fields.  Sums cannot be
+     * recovered from those so need the raw values.
+     */
+    if (tp->deltas && baton->u.query.inner != N_SUM)
+	tier = redis_series_rollup(&tp->delta);
+    if (tier >= 0) {
+	if (baton->u.query.inner == N_MIN)
+	    baton->u.query.field = ".min";
+	else if (baton->u.query.inner == N_MAX)
+	    baton->u.query.field = ".max";
+	else if (baton->u.query.inner == N_AVG)
+	    baton->u.query.weighted = 1;
+	if (pmDebugOptions.series)
+	    fprintf(stderr, "ROLLUP: tier %d\n", tier);
+    }
 
     start = sdsnew(timeval_stream_str(&tp->start, buffer, sizeof(buffer)));
     if (pmDebugOptions.series)
@@ -1149,9 +1614,12 @@ series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
 
     if (tp->count == 0)
 	tp->count = DEFAULT_VALUE_COUNT;
-    count = sdscatfmt(sdsempty(), "%u", tp->count);
     if (pmDebugOptions.series)
 	fprintf(stderr, "COUNT: %u\n", tp->count);
+    if (baton->u.query.inner)
+	count = sdscatfmt(sdsempty(), "%u", SERIES_PAGE_COUNT);
+    else
+	count = sdscatfmt(sdsempty(), "%u", tp->count);
 
     /*
      * Query cache for the time series range (groups of instance:value
@@ -1163,18 +1631,16 @@ series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
 	initSeriesGetSID(sid, buffer, 1, baton);
 	seriesBatonReference(baton, "series_prepare_time");
 
-	key = sdscatfmt(sdsempty(), "pcp:values:series:%S", sid->name);
-
-	/* XREAD key t1 t2 [COUNT count] */
-	cmd = redis_command(6);
-	cmd = redis_param_str(cmd, XRANGE, XRANGE_LEN);
-	cmd = redis_param_sds(cmd, key);
-	cmd = redis_param_sds(cmd, start);
-	cmd = redis_param_sds(cmd, end);
-	cmd = redis_param_str(cmd, "COUNT", sizeof("COUNT")-1);
-	cmd = redis_param_sds(cmd, count);
-	redisSlotsRequest(baton->slots, XRANGE, key, cmd,
-				series_prepare_time_reply, sid);
+	key = redis_series_values_key(sdsempty(), sid->name, tier);
+	if (baton->u.query.inner) {
+	    /* per-instance window accumulators, kept across pages */
+	    sid->windows = dictCreate(&sdsKeyDictCallBacks, NULL);
+	    sid->key = key;
+	    sid->end = sdsdup(end);
+	}
+	series_request_range(baton, sid, key, start, end, count);
+	if (sid->key == NULL)
+	    sdsfree(key);
     }
     sdsfree(count);
     sdsfree(start);
@@ -1249,6 +1715,8 @@ series_query_expr(void *arg)
 
     seriesBatonReference(baton, "series_query_expr");
     series_prepare_expr(baton, &baton->u.query.root, 0);
+    if (series_expand_set(baton, &baton->u.query.root.result) < 0)
+	baton->error = -ENOMEM;
     series_query_end_phase(baton);
 }
 
@@ -1265,6 +1733,68 @@ series_query_report_values(void *arg)
     series_query_end_phase(baton);
 }
 
+/*
+ * Report cross-series aggregated values, in time order, using a
+ * series identifier derived from the functions and matched series.
+ */
+static void
+series_report_aggregate(seriesQueryBaton *baton)
+{
+    seriesGetQuery	*qp = &baton->u.query;
+    series_set_t	*set = &qp->root.result;
+    pmSeriesValue	value;
+    seriesWindow	*wp;
+    unsigned char	hash[SHA1SZ];
+    const char		*name;
+    SHA1_CTX		shactx;
+    char		hashbuf[42];
+    double		result;
+    sds			sid;
+    unsigned int	i, n;
+
+    SHA1Init(&shactx);
+    name = series_function_str(qp->outer);
+    SHA1Update(&shactx, (unsigned char *)name, strlen(name));
+    name = series_function_str(qp->inner);
+    SHA1Update(&shactx, (unsigned char *)name, strlen(name));
+    SHA1Update(&shactx, set->series, set->nseries * SHA1SZ);
+    SHA1Final(hash, &shactx);
+    pmwebapi_hash_str(hash, hashbuf, sizeof(hashbuf));
+    sid = sdsnewlen(hashbuf, 40);
+
+    value.timestamp = sdsempty();
+    value.series = sid;
+    value.data = sdsempty();
+
+    for (i = 0, n = 0; i < qp->naggregate && n < qp->timing.count; i++) {
+	wp = &qp->aggregate[i];
+	if (series_window_value(qp->outer, wp, &result) < 0)
+	    continue;
+	n++;
+	value.timestamp = series_window_stamp_str(value.timestamp, wp->stamp);
+	sdsclear(value.data);
+	value.data = sdscatprintf(value.data, "%.*g", DBL_DIG, result);
+	baton->callbacks->on_value(sid, &value, baton->userdata);
+    }
+
+    sdsfree(value.timestamp);
+    sdsfree(value.data);
+    sdsfree(sid);
+}
+
+static void
+series_query_report_aggregate(void *arg)
+{
+    seriesQueryBaton	*baton = (seriesQueryBaton *)arg;
+
+    seriesBatonCheckMagic(baton, MAGIC_QUERY, "series_query_report_aggregate");
+    seriesBatonCheckCount(baton, "series_query_report_aggregate");
+
+    seriesBatonReference(baton, "series_query_report_aggregate");
+    series_report_aggregate(baton);
+    series_query_end_phase(baton);
+}
+
 static int
 series_time_window(timing_t *tp)
 {
@@ -1305,12 +1835,32 @@ series_solve(pmSeriesSettings *settings,
 	node_t *root, timing_t *timing, pmSeriesFlags flags, void *arg)
 {
     seriesQueryBaton	*baton;
+    nodetype_t		inner = 0, outer = 0;
     unsigned int	i = 0;
+    sds			msg;
+
+    /* separate any time series functions from the series expression */
+    if (series_function(root)) {
+	if (series_function(root->left)) {
+	    outer = root->type;
+	    root = root->left;
+	    if (outer == N_RATE || series_function(root->left)) {
+		infofmt(msg, "Unsupported %s() function nesting",
+			series_function_str(outer));
+		moduleinfo(&settings->module, PMLOG_ERROR, msg, arg);
+		return -EINVAL;
+	    }
+	}
+	inner = root->type;
+	root = root->left;
+    }
 
     if ((baton = calloc(1, sizeof(seriesQueryBaton))) == NULL)
 	return -ENOMEM;
     initSeriesQueryBaton(baton, settings, arg);
     initSeriesGetQuery(baton, root, timing);
+    baton->u.query.inner = inner;
+    baton->u.query.outer = outer;
 
     baton->current = &baton->phases[0];
     baton->phases[i++].func = series_query_services;
@@ -1324,13 +1874,19 @@ series_solve(pmSeriesSettings *settings,
     /* Perform final matching (set of) series solving */
     baton->phases[i++].func = series_query_expr;
 
-    if ((flags & PM_SERIES_FLAG_METADATA) || !series_time_window(timing))
+    if ((flags & PM_SERIES_FLAG_METADATA) ||
+	(!inner && !series_time_window(timing))) {
 	/* Report matching series IDs, unless time windowing */
 	baton->phases[i++].func = series_query_report_matches;
-    else
+    } else {
 	/* Report actual values within the given time window */
 	baton->phases[i++].func = series_query_report_values;
 
+	/* Report values aggregated across all matching series */
+	if (outer)
+	    baton->phases[i++].func = series_query_report_aggregate;
+    }
+
     /* final callback once everything is finished, free baton */
     baton->phases[i++].func = series_query_finished;
 
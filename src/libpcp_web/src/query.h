@@ -85,6 +85,7 @@ typedef struct meta {
 typedef struct series_set {
     unsigned char	*series;
     int			nseries;
+    struct seriesBitmap	*bitmap;	/* numeric identifiers, when solving */
 } series_set_t;
 
 typedef struct node {
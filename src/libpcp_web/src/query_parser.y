@@ -146,7 +146,8 @@ static const char initial_str[]  = "Unexpected initial";
 
 %type  <n>  query
 %type  <n>  expr
-//%type  <n>  func
+%type  <n>  func
+%type  <n>  funcarg
 %type  <n>  exprlist
 %type  <n>  exprval
 %type  <n>  number
@@ -165,39 +166,49 @@ static const char initial_str[]  = "Unexpected initial";
  * yacc productions
  ***********************************************************************/
 
-query	: vector
-	| L_NAME L_ASSIGN vector
+query	: vector L_EOS
+		{ lp->yy_series.expr = $1; YYACCEPT; }
+	| func L_EOS
+		{ lp->yy_series.expr = $1; YYACCEPT; }
+	| L_NAME L_ASSIGN vector L_EOS
 		{ lp->yy_series.name = $1;
-		  $$ = lp->yy_series.expr;
+		  $$ = lp->yy_series.expr = $3;
 		  YYACCEPT;
 		}
 	/* TODO: vector expressions (many) */
 	;
 
-vector:	L_NAME L_LBRACE exprlist L_RBRACE L_EOS
-		{ lp->yy_np = newmetricquery($1, $3);
-		  $$ = lp->yy_series.expr = lp->yy_np;
-		  YYACCEPT;
-		}
-	| L_NAME L_LBRACE exprlist L_RBRACE L_LSQUARE timelist L_RSQUARE L_EOS
-		{ lp->yy_np = newmetricquery($1, $3);
-		  $$ = lp->yy_series.expr = lp->yy_np;
-		  YYACCEPT;
-		}
-	| L_LBRACE exprlist L_RBRACE L_LSQUARE timelist L_RSQUARE L_EOS
-		{ lp->yy_np = lp->yy_series.expr = $2; YYACCEPT; }
-	| L_LBRACE exprlist L_RBRACE L_EOS
-		{ lp->yy_np = lp->yy_series.expr = $2; YYACCEPT; }
-	| L_NAME L_LSQUARE timelist L_RSQUARE L_EOS
-		{ lp->yy_np = newmetric($1);
-		  $$ = lp->yy_series.expr = lp->yy_np;
-		  YYACCEPT;
-		}
-	| L_NAME L_EOS
-		{ lp->yy_np = newmetric($1);
-		  $$ = lp->yy_series.expr = lp->yy_np;
-		  YYACCEPT;
-		}
+vector:	L_NAME L_LBRACE exprlist L_RBRACE
+		{ $$ = lp->yy_np = newmetricquery($1, $3); }
+	| L_NAME L_LBRACE exprlist L_RBRACE L_LSQUARE timelist L_RSQUARE
+		{ $$ = lp->yy_np = newmetricquery($1, $3); }
+	| L_LBRACE exprlist L_RBRACE L_LSQUARE timelist L_RSQUARE
+		{ $$ = lp->yy_np = $2; }
+	| L_LBRACE exprlist L_RBRACE
+		{ $$ = lp->yy_np = $2; }
+	| L_NAME L_LSQUARE timelist L_RSQUARE
+		{ $$ = lp->yy_np = newmetric($1); }
+	| L_NAME
+		{ $$ = lp->yy_np = newmetric($1); }
+	;
+
+	/* time-series functions - the innermost reduces each series over
+	 * the interval windows, an enclosing one aggregates across series */
+func	: L_RATE L_LPAREN funcarg L_RPAREN
+		{ $$ = lp->yy_np = newtree(N_RATE, $3, NULL); }
+	| L_AVG L_LPAREN funcarg L_RPAREN
+		{ $$ = lp->yy_np = newtree(N_AVG, $3, NULL); }
+	| L_MAX L_LPAREN funcarg L_RPAREN
+		{ $$ = lp->yy_np = newtree(N_MAX, $3, NULL); }
+	| L_MIN L_LPAREN funcarg L_RPAREN
+		{ $$ = lp->yy_np = newtree(N_MIN, $3, NULL); }
+	| L_SUM L_LPAREN funcarg L_RPAREN
+		{ $$ = lp->yy_np = newtree(N_SUM, $3, NULL); }
+	;
+
+funcarg	: vector
+	| func
+	;
 
 exprlist : exprlist L_COMMA expr
 		{ lp->yy_np = newnode(N_AND);
@@ -1327,5 +1338,16 @@ pmSeriesLoad(pmSeriesSettings *settings, sds source, pmSeriesFlags flags, void *
     if (pmDebugOptions.series)
 	series_dumpexpr(sp->expr, 0);
 
+    if (sp->expr && (sp->expr->type == N_RATE || sp->expr->type == N_AVG ||
+	 sp->expr->type == N_MAX || sp->expr->type == N_MIN ||
+	 sp->expr->type == N_SUM)) {
+	sds	msg;
+
+	infofmt(msg, "Function %s() not supported when loading",
+		n_type_str(sp->expr->type));
+	moduleinfo(&settings->module, PMLOG_ERROR, msg, arg);
+	return -EINVAL;
+    }
+
     return series_load(settings, sp->expr, &sp->time, flags, arg);
 }
@@ -12,6 +12,7 @@
  * License for more details.
  */
 #include <assert.h>
+#include <float.h>
 #include "pmapi.h"
 #include "pmda.h"
 #include "schema.h"
@@ -28,6 +29,14 @@ extern sds		cursorcount;
 static sds		maxstreamlen;
 static sds		streamexpire;
 
+typedef struct rollupTier {
+    sds			name;		/* window length (msec) for keys */
+    __int64_t		msec;		/* window length in milliseconds */
+} rollupTier;
+
+static rollupTier	*rolluptiers;	/* ascending window lengths */
+static int		nrolluptiers;
+
 typedef struct redisScript {
     sds			hash;
     const char		*text;
@@ -1183,7 +1192,7 @@ redis_series_stream(redisSlots *slots, sds stamp, metric_t *metric,
     seriesBatonReferences(load, 2, "redis_series_stream");
 
     count = 6;	/* XADD key MAXLEN ~ len stamp */
-    key = sdscatfmt(sdsempty(), "pcp:values:series:%s", hash);
+    key = redis_series_values_key(sdsempty(), hash, -1);
 
     if ((sts = metric->error) < 0) {
 	stream = series_stream_append(stream,
@@ -1226,7 +1235,7 @@ redis_series_stream(redisSlots *slots, sds stamp, metric_t *metric,
     redisSlotsRequest(slots, XADD, key, cmd, redis_series_stream_callback, baton);
 
 
-    key = sdscatfmt(sdsempty(), "pcp:values:series:%s", hash);
+    key = redis_series_values_key(sdsempty(), hash, -1);
     cmd = redis_command(3);	/* EXPIRE key timer */
     cmd = redis_param_str(cmd, EXPIRE, EXPIRE_LEN);
     cmd = redis_param_sds(cmd, key);
@@ -1235,6 +1244,267 @@ redis_series_stream(redisSlots *slots, sds stamp, metric_t *metric,
     redisSlotsRequest(slots, EXPIRE, key, cmd, redis_series_timer_callback, load);
 }
 
+/* append the key for raw values, or a rollup tier, of a series stream */
+sds
+redis_series_values_key(sds key, const char *hash, int tier)
+{
+    if (tier < 0 || tier >= nrolluptiers)
+	return sdscatfmt(key, "pcp:values:series:%s", hash);
+    return sdscatfmt(key, "pcp:rollup:%S:series:%s",
+			rolluptiers[tier].name, hash);
+}
+
+/* coarsest rollup tier not longer than a requested interval, else -1 */
+int
+redis_series_rollup(struct timeval *delta)
+{
+    __int64_t			msec;
+    int				i;
+
+    if (delta == NULL)
+	return -1;
+    msec = (__int64_t)delta->tv_sec * 1000 + delta->tv_usec / 1000;
+    for (i = nrolluptiers - 1; i >= 0; i--)
+	if (rolluptiers[i].msec <= msec)
+	    return i;
+    return -1;
+}
+
+static int
+rollup_value(int type, pmAtomValue *avp, double *value)
+{
+    switch (type) {
+    case PM_TYPE_32:
+	*value = avp->l;
+	break;
+    case PM_TYPE_U32:
+	*value = avp->ul;
+	break;
+    case PM_TYPE_64:
+	*value = avp->ll;
+	break;
+    case PM_TYPE_U64:
+	*value = avp->ull;
+	break;
+    case PM_TYPE_FLOAT:
+	*value = avp->f;
+	break;
+    case PM_TYPE_DOUBLE:
+	*value = avp->d;
+	break;
+    default:
+	return -1;
+    }
+    return 0;
+}
+
+/* compare two values of a numeric metric type, without conversion */
+static int
+rollup_compare(int type, pmAtomValue *a, pmAtomValue *b)
+{
+    switch (type) {
+    case PM_TYPE_32:
+	return (a->l > b->l) - (a->l < b->l);
+    case PM_TYPE_U32:
+	return (a->ul > b->ul) - (a->ul < b->ul);
+    case PM_TYPE_64:
+	return (a->ll > b->ll) - (a->ll < b->ll);
+    case PM_TYPE_U64:
+	return (a->ull > b->ull) - (a->ull < b->ull);
+    case PM_TYPE_FLOAT:
+	return (a->f > b->f) - (a->f < b->f);
+    case PM_TYPE_DOUBLE:
+	return (a->d > b->d) - (a->d < b->d);
+    default:
+	break;
+    }
+    return 0;
+}
+
+/* minimum and maximum are written exactly as the raw values are */
+static sds
+rollup_atom_str(int type, pmAtomValue *avp)
+{
+    switch (type) {
+    case PM_TYPE_32:
+	return sdscatfmt(sdsempty(), "%i", avp->l);
+    case PM_TYPE_U32:
+	return sdscatfmt(sdsempty(), "%u", avp->ul);
+    case PM_TYPE_64:
+	return sdscatfmt(sdsempty(), "%I", avp->ll);
+    case PM_TYPE_U64:
+	return sdscatfmt(sdsempty(), "%U", avp->ull);
+    case PM_TYPE_FLOAT:
+	return sdscatprintf(sdsempty(), "%e", (double)avp->f);
+    case PM_TYPE_DOUBLE:
+	return sdscatprintf(sdsempty(), "%e", avp->d);
+    default:
+	break;
+    }
+    return sdsempty();
+}
+
+static void
+rollup_sample(rollup_t *rollup, int type, unsigned int inst, pmAtomValue *avp)
+{
+    rollupstat_t		*stat;
+    double			number;
+
+    if (rollup_value(type, avp, &number) < 0)
+	return;
+    if ((stat = dictFetchValue(rollup->insts, &inst)) == NULL) {
+	if ((stat = calloc(1, sizeof(rollupstat_t))) == NULL)
+	    return;
+	dictAdd(rollup->insts, &inst, stat);
+    }
+    if (stat->count == 0 || rollup_compare(type, avp, &stat->min) < 0)
+	stat->min = *avp;
+    if (stat->count == 0 || rollup_compare(type, avp, &stat->max) > 0)
+	stat->max = *avp;
+    stat->sum += number;
+    stat->count++;
+}
+
+static sds
+rollup_stream_append(sds stream, sds field, sds name, const char *suffix,
+		sds value)
+{
+    field = sdscpylen(field, name, sdslen(name));
+    field = sdscat(field, suffix);
+    return series_stream_append(stream, field, value);
+}
+
+/*
+ * Write one completed window of a rollup tier - the average value is
+ * stored under each instance name (as for raw values) while minimum,
+ * maximum and sample count fields carry a name suffix.
+ */
+static void
+redis_series_rollup_window(redisSlots *slots, metric_t *metric,
+		int tier, void *arg)
+{
+    seriesLoadBaton		*load = (seriesLoadBaton *)arg;
+    redisStreamBaton		*baton;
+    rollup_t			*rollup = &metric->rollups[tier];
+    rollupstat_t		*stat;
+    instance_t			*instance;
+    dictIterator		*iterator;
+    dictEntry			*entry;
+    unsigned int		count = 6;	/* XADD key MAXLEN ~ len stamp */
+    unsigned int		inst;
+    char			hashbuf[42];
+    sds				cmd, key, name, field, stamp, stream;
+    int				i, type = metric->desc.type;
+
+    name = sdsempty();
+    field = sdsempty();
+    stream = sdsempty();
+    iterator = dictGetIterator(rollup->insts);
+    while ((entry = dictNext(iterator)) != NULL) {
+	stat = (rollupstat_t *)dictGetVal(entry);
+	if (stat->count == 0)
+	    continue;
+	inst = *(unsigned int *)dictGetKey(entry);
+	if (inst == PM_IN_NULL) {
+	    sdsclear(name);
+	} else if ((instance = dictFetchValue(metric->indom->insts, &inst))) {
+	    name = sdscpylen(name, (const char *)instance->name.hash,
+				sizeof(instance->name.hash));
+	} else {
+	    memset(stat, 0, sizeof(*stat));
+	    continue;
+	}
+	stream = series_stream_append(stream, name, sdscatprintf(sdsempty(),
+			"%.*e", DBL_DIG, stat->sum / stat->count));
+	stream = rollup_stream_append(stream, field, name, ".min",
+			rollup_atom_str(type, &stat->min));
+	stream = rollup_stream_append(stream, field, name, ".max",
+			rollup_atom_str(type, &stat->max));
+	stream = rollup_stream_append(stream, field, name, ".count",
+			sdscatfmt(sdsempty(), "%u", stat->count));
+	memset(stat, 0, sizeof(*stat));
+	count += 8;
+    }
+    dictReleaseIterator(iterator);
+    sdsfree(field);
+    sdsfree(name);
+
+    if (count == 6) {	/* no samples observed in this window */
+	sdsfree(stream);
+	return;
+    }
+
+    stamp = sdscatfmt(sdsempty(), "%I-0", rollup->window * rolluptiers[tier].msec);
+    for (i = 0; i < metric->numnames; i++) {
+	if ((baton = malloc(sizeof(redisStreamBaton))) == NULL)
+	    break;
+	pmwebapi_hash_str(metric->names[i].hash, hashbuf, sizeof(hashbuf));
+	initRedisStreamBaton(baton, slots, stamp, hashbuf, load);
+	seriesBatonReferences(load, 2, "redis_series_rollup_window");
+
+	key = redis_series_values_key(sdsempty(), hashbuf, tier);
+	cmd = redis_command(count);
+	cmd = redis_param_str(cmd, XADD, XADD_LEN);
+	cmd = redis_param_sds(cmd, key);
+	cmd = redis_param_str(cmd, "MAXLEN", sizeof("MAXLEN")-1);
+	cmd = redis_param_str(cmd, "~", 1);
+	cmd = redis_param_sds(cmd, maxstreamlen);
+	cmd = redis_param_sds(cmd, stamp);
+	cmd = redis_param_raw(cmd, stream);
+	redisSlotsRequest(slots, XADD, key, cmd, redis_series_stream_callback, baton);
+
+	key = redis_series_values_key(sdsempty(), hashbuf, tier);
+	cmd = redis_command(3);	/* EXPIRE key timer */
+	cmd = redis_param_str(cmd, EXPIRE, EXPIRE_LEN);
+	cmd = redis_param_sds(cmd, key);
+	cmd = redis_param_sds(cmd, streamexpire);
+	redisSlotsRequest(slots, EXPIRE, key, cmd, redis_series_timer_callback, load);
+    }
+    sdsfree(stamp);
+    sdsfree(stream);
+}
+
+/*
+ * Incrementally maintain the downsampled rollup tiers of a metric,
+ * writing out each window once a sample beyond its end is seen.
+ */
+static void
+redis_series_rollups(redisSlots *slots, sds stamp, metric_t *metric, void *arg)
+{
+    rollup_t			*rollup;
+    value_t			*value;
+    __int64_t			msec, window;
+    int				i, j, type = metric->desc.type;
+
+    if (metric->error < 0 || type < PM_TYPE_32 || type > PM_TYPE_DOUBLE)
+	return;	/* rollups of numeric values only */
+
+    if (metric->rollups == NULL) {
+	if ((metric->rollups = calloc(nrolluptiers, sizeof(rollup_t))) == NULL)
+	    return;
+	for (i = 0; i < nrolluptiers; i++)
+	    metric->rollups[i].insts = dictCreate(&intKeyDictCallBacks, NULL);
+    }
+
+    msec = strtoll(stamp, NULL, 10);
+    for (i = 0; i < nrolluptiers; i++) {
+	rollup = &metric->rollups[i];
+	window = msec / rolluptiers[i].msec;
+	if (window != rollup->window) {
+	    redis_series_rollup_window(slots, metric, i, arg);
+	    rollup->window = window;
+	}
+	if (metric->desc.indom == PM_INDOM_NULL || metric->u.vlist == NULL) {
+	    rollup_sample(rollup, type, PM_IN_NULL, &metric->u.atom);
+	    continue;
+	}
+	for (j = 0; j < metric->u.vlist->listcount; j++) {
+	    value = &metric->u.vlist->value[j];
+	    rollup_sample(rollup, type, value->inst, &value->atom);
+	}
+    }
+}
+
 static void
 redis_series_streamed(sds stamp, metric_t *metric, void *arg)
 {
@@ -1250,6 +1520,9 @@ redis_series_streamed(sds stamp, metric_t *metric, void *arg)
 	pmwebapi_hash_str(metric->names[i].hash, hashbuf, sizeof(hashbuf));
 	redis_series_stream(slots, stamp, metric, hashbuf, arg);
     }
+
+    if (nrolluptiers)
+	redis_series_rollups(slots, stamp, metric, arg);
 }
 
 void
@@ -1706,6 +1979,44 @@ pmSeriesSetMetricRegistry(pmSeriesModule *module, mmv_registry_t *registry)
     return -ENOMEM;
 }
 
+static void
+redisRollupsInit(sds option)
+{
+    struct timeval	interval;
+    __int64_t		msec;
+    char		*error;
+    sds			*tiers;
+    int			i, j, count;
+
+    tiers = sdssplitlen(option, sdslen(option), ",", 1, &count);
+    if (tiers == NULL || count <= 0)
+	return;
+    if ((rolluptiers = calloc(count, sizeof(rollupTier))) == NULL) {
+	sdsfreesplitres(tiers, count);
+	return;
+    }
+    for (i = 0; i < count; i++) {
+	tiers[i] = sdstrim(tiers[i], " \t");
+	if (pmParseInterval(tiers[i], &interval, &error) < 0) {
+	    free(error);
+	    continue;
+	}
+	msec = (__int64_t)interval.tv_sec * 1000 + interval.tv_usec / 1000;
+	for (j = 0; j < nrolluptiers; j++)
+	    if (rolluptiers[j].msec == msec)
+		break;
+	if (msec <= 0 || j < nrolluptiers)
+	    continue;
+	/* insert in ascending order of window length */
+	for (j = nrolluptiers; j > 0 && rolluptiers[j-1].msec > msec; j--)
+	    rolluptiers[j] = rolluptiers[j-1];
+	rolluptiers[j].msec = msec;
+	rolluptiers[j].name = sdscatfmt(sdsempty(), "%I", msec);
+	nrolluptiers++;
+    }
+    sdsfreesplitres(tiers, count);
+}
+
 static void
 redisGlobalsInit(struct dict *config)
 {
@@ -1731,6 +2042,11 @@ redisGlobalsInit(struct dict *config)
 	else
 	    streamexpire = sdsnew("86400");	/* 1 day (without changes) */
     }
+
+    if (!rolluptiers) {
+	if ((option = pmIniFileLookup(config, "pmseries", "stream.rollups")))
+	    redisRollupsInit(option);
+    }
 }
 
 int
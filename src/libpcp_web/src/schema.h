@@ -105,6 +105,8 @@ redis_param_raw(sds cmd, sds param)
 extern void redis_series_source(redisSlots *, void *);
 extern void redis_series_mark(redisSlots *, sds, int, void *);
 extern void redis_series_metric(redisSlots *, metric_t *, sds, int, int, void *);
+extern sds redis_series_values_key(sds, const char *, int);
+extern int redis_series_rollup(struct timeval *);
 
 /*
  * Asynchronous schema load baton structures
@@ -29,21 +29,41 @@ static unsigned int default_timeout;	/* timeout in milliseconds */
 #define DEFAULT_BATCHSIZE 256
 static unsigned int default_batchsize;	/* for groups of metrics */
 
+#define DEFAULT_POOLSIZE 16
+static unsigned int default_poolsize;	/* idle contexts kept for reuse */
+
+#define DEFAULT_POOLTIMEOUT 60000
+static unsigned int default_pooltimeout; /* idle context lifetime (msec) */
+
 /* constant string keys (initialized during setup) */
 static sds PARAM_HOSTNAME, PARAM_HOSTSPEC, PARAM_CTXNUM, PARAM_CTXID,
            PARAM_POLLTIME, PARAM_PREFIX, PARAM_MNAME, PARAM_MNAMES,
            PARAM_PMIDS, PARAM_PMID, PARAM_INDOM, PARAM_INSTANCE,
            PARAM_INAME, PARAM_MVALUE, PARAM_TARGET, PARAM_EXPR, PARAM_MATCH;
 static sds AUTH_USERNAME, AUTH_PASSWORD;
-static sds LOCALHOST, TIMEOUT, BATCHSIZE;
+static sds LOCALHOST, TIMEOUT, BATCHSIZE, POOLSIZE, POOLTIMEOUT;
 
 enum matches { MATCH_EXACT, MATCH_GLOB, MATCH_REGEX };
 
+enum webgroup_metric {
+    WEBGROUP_POOL_HITS,
+    WEBGROUP_POOL_MISSES,
+    WEBGROUP_POOL_EXPIRED,
+    WEBGROUP_POOL_IDLE,
+    WEBGROUP_CONNECT_TIME,
+    NUM_WEBGROUP_METRIC
+};
+
 typedef struct webgroups {
     struct dict		*contexts;
     mmv_registry_t	*metrics;
     struct dict		*config;
     uv_loop_t		*events;
+    uv_mutex_t		poollock;	/* protects the idle context pool */
+    struct context	*pool;		/* idle contexts, most recent first */
+    unsigned int	poolcount;	/* number of idle pooled contexts */
+    void		*map;		/* mapped metric values (mmv) */
+    pmAtomValue		*values[NUM_WEBGROUP_METRIC];
 } webgroups;
 
 static struct webgroups *
@@ -65,10 +85,130 @@ webgroup_destroy_context(struct context *context, struct webgroups *groups)
     uv_timer_stop(&context->timer);
     if (groups)
 	dictUnlink(groups->contexts, &context->randomid);
+    uv_mutex_destroy(&context->lock);
     pmwebapi_free_context(context);
     memset(context, 0, sizeof(*context));
 }
 
+/*
+ * Pool of idle, connected contexts - rather than tearing down contexts
+ * that time out (or are explicitly destroyed), they are kept for reuse
+ * by later requests for the same hostspec.  These remain connected to
+ * pmcd and retain their metric descriptor, instance domain and label
+ * caches, so new webgroup contexts borrowing them skip all of that.
+ */
+static void
+webgroup_pool_expire(uv_timer_t *arg)
+{
+    uv_handle_t		*handle = (uv_handle_t *)arg;
+    struct context	*cp = (struct context *)handle->data;
+    struct webgroups	*gp = (struct webgroups *)cp->privdata;
+    struct context	**cpp;
+    int			found = 0;
+
+    uv_mutex_lock(&gp->poollock);
+    for (cpp = &gp->pool; *cpp != NULL; cpp = &(*cpp)->next) {
+	if (*cpp == cp) {
+	    *cpp = cp->next;
+	    gp->poolcount--;
+	    found = 1;
+	    break;
+	}
+    }
+    uv_mutex_unlock(&gp->poollock);
+
+    if (found) {
+	if (pmDebugOptions.http)
+	    fprintf(stderr, "pooled context %p expired\n", cp);
+	mmv_inc_value(gp->map, gp->values[WEBGROUP_POOL_EXPIRED], 1);
+	mmv_set_value(gp->map, gp->values[WEBGROUP_POOL_IDLE], gp->poolcount);
+	cp->next = NULL;
+	cp->pooled = 0;
+	webgroup_destroy_context(cp, NULL);
+    }
+}
+
+static void
+webgroup_release_context(struct context *cp, struct webgroups *groups)
+{
+    struct context	*evict = NULL, **cpp;
+
+    if (default_poolsize == 0 || cp->context < 0 || cp->setup == 0 ||
+	cp->garbage || cp->pooled) {
+	webgroup_destroy_context(cp, groups);
+	return;
+    }
+
+    uv_timer_stop(&cp->timer);
+    dictUnlink(groups->contexts, &cp->randomid);
+
+    uv_mutex_lock(&groups->poollock);
+    cp->pooled = 1;
+    cp->next = groups->pool;
+    groups->pool = cp;
+    if (++groups->poolcount > default_poolsize) {
+	/* evict the least recently pooled context */
+	for (cpp = &groups->pool; (*cpp)->next != NULL; cpp = &(*cpp)->next)
+	    ;	/* find the tail */
+	evict = *cpp;
+	*cpp = NULL;
+	groups->poolcount--;
+    }
+    uv_mutex_unlock(&groups->poollock);
+
+    if (pmDebugOptions.http)
+	fprintf(stderr, "context %u pooled (%p)\n", cp->randomid, cp);
+    mmv_set_value(groups->map, groups->values[WEBGROUP_POOL_IDLE],
+			groups->poolcount);
+
+    uv_timer_start(&cp->timer, webgroup_pool_expire, default_pooltimeout, 0);
+
+    if (evict) {
+	evict->pooled = 0;
+	webgroup_destroy_context(evict, NULL);
+    }
+}
+
+/* find an idle context matching the hostspec (and credentials) given */
+static struct context *
+webgroup_pool_take(struct webgroups *groups, sds hostspec)
+{
+    struct context	*cp, **cpp;
+
+    uv_mutex_lock(&groups->poollock);
+    for (cpp = &groups->pool; (cp = *cpp) != NULL; cpp = &cp->next) {
+	if (sdscmp(cp->name.sds, hostspec) == 0) {
+	    *cpp = cp->next;
+	    groups->poolcount--;
+	    cp->next = NULL;
+	    cp->pooled = 0;
+	    break;
+	}
+    }
+    uv_mutex_unlock(&groups->poollock);
+
+    if (cp) {
+	uv_timer_stop(&cp->timer);
+	mmv_set_value(groups->map, groups->values[WEBGROUP_POOL_IDLE],
+			groups->poolcount);
+    }
+    return cp;
+}
+
+static void
+webgroup_pool_free(struct webgroups *groups)
+{
+    struct context	*cp, *next;
+
+    for (cp = groups->pool; cp != NULL; cp = next) {
+	next = cp->next;
+	cp->pooled = 0;
+	webgroup_destroy_context(cp, NULL);
+    }
+    groups->pool = NULL;
+    groups->poolcount = 0;
+}
+
 static void
 webgroup_timeout_context(uv_timer_t *arg)
 {
@@ -79,7 +219,7 @@ webgroup_timeout_context(uv_timer_t *arg)
     if (pmDebugOptions.http)
 	fprintf(stderr, "context %u timed out (%p)\n", cp->randomid, cp);
 
-    webgroup_destroy_context(cp, gp);
+    webgroup_release_context(cp, gp);
 }
 
 static int
@@ -132,7 +272,8 @@ webgroup_new_context(pmWebGroupSettings *sp, dict *params,
 		int *status, sds *message, void *arg)
 {
     struct webgroups	*groups = webgroups_lookup(&sp->module);
-    struct context	*cp;
+    struct context	*cp, *pp;
+    struct timeval	started, finished;
     unsigned int	polltime;
     uv_handle_t		*handle;
     pmWebAccess		access;
@@ -167,10 +308,6 @@ webgroup_new_context(pmWebGroupSettings *sp, dict *params,
     cp->context = -1;
     cp->timeout = polltime;
 
-    handle = (uv_handle_t *)&cp->timer;
-    handle->data = (void *)cp;
-    uv_timer_init(groups->events, &cp->timer);
-
     if ((cp->randomid = random()) < 0 ||
 	dictFind(groups->contexts, &cp->randomid) != NULL) {
 	infofmt(*message, "random number failure on new web context");
@@ -201,11 +338,40 @@ webgroup_new_context(pmWebGroupSettings *sp, dict *params,
   	return NULL;
     }
 
+    if ((pp = webgroup_pool_take(groups, cp->name.sds)) != NULL) {
+	/* borrow a connected context, giving it this new identity */
+	mmv_inc_value(groups->map, groups->values[WEBGROUP_POOL_HITS], 1);
+	sdsfree(pp->origin);
+	sdsfree(pp->realm);
+	pp->origin = cp->origin;
+	pp->realm = cp->realm;
+	pp->randomid = cp->randomid;
+	pp->timeout = cp->timeout;
+	cp->origin = cp->realm = NULL;
+	pmwebapi_free_context(cp);
+	free(cp);
+	dictAdd(groups->contexts, &pp->randomid, pp);
+	if (pmDebugOptions.http)
+	    fprintf(stderr, "context %u reused (%p)\n", pp->randomid, pp);
+	return pp;
+    }
+    mmv_inc_value(groups->map, groups->values[WEBGROUP_POOL_MISSES], 1);
+
+    handle = (uv_handle_t *)&cp->timer;
+    handle->data = (void *)cp;
+    uv_timer_init(groups->events, &cp->timer);
+
+    pmtimevalNow(&started);
     if ((*message = pmwebapi_new_context(cp)) != NULL) {
 	*status = -ENOTCONN;
 	pmwebapi_free_context(cp);
 	return NULL;
     }
+    pmtimevalNow(&finished);
+    mmv_inc_value(groups->map, groups->values[WEBGROUP_CONNECT_TIME],
+			pmtimevalSub(&finished, &started) * 1000000.0);
+
+    uv_mutex_init(&cp->lock);
     dictAdd(groups->contexts, &cp->randomid, cp);
     cp->privdata = groups;
     cp->setup = 1;
@@ -314,7 +480,7 @@ pmWebGroupDestroy(pmWebGroupSettings *settings, sds id, void *arg)
 	(cp = webgroup_lookup_context(settings, &id, NULL,
 				      &sts, &msg, arg)) != NULL) {
 	gp = settings->module.privdata;
-	webgroup_destroy_context(cp, gp);
+	webgroup_release_context(cp, gp);
     }
     sdsfree(msg);
 }
@@ -1179,6 +1345,38 @@ scrape_instance_labelsets(metric_t *metric, indom_t *indom, instance_t *inst,
     sdsclear(labels->buffer);
 }
 
+/*
+ * Rendered scrape labels are kept with each metric and value until
+ * the identifying hash of the metric or instance changes, which is
+ * the case whenever any of their labelsets (or instance name) do.
+ */
+static void
+scrape_metric_changed(metric_t *metric)
+{
+    unsigned char	*hash = metric->names[0].hash;
+    int			i;
+
+    if (memcmp(metric->scrapehash, hash, sizeof(metric->scrapehash)) == 0)
+	return;
+    memcpy(metric->scrapehash, hash, sizeof(metric->scrapehash));
+    sdsfree(metric->scrapelabels);
+    metric->scrapelabels = NULL;
+    if (metric->desc.indom == PM_INDOM_NULL || metric->u.vlist == NULL)
+	return;
+    for (i = 0; i < metric->u.vlist->listsize; i++) {
+	sdsfree(metric->u.vlist->value[i].scrapelabels);
+	metric->u.vlist->value[i].scrapelabels = NULL;
+    }
+}
+
+static sds
+scrape_labels_update(sds cached, pmWebLabelSet *labels)
+{
+    if (cached == NULL)
+	return sdsdup(labels->buffer);
+    return sdscpylen(cached, labels->buffer, sdslen(labels->buffer));
+}
+
 static int
 webgroup_scrape(pmWebGroupSettings *settings, context_t *cp,
 		int numpmid, struct metric **mplist, pmID *pmidlist,
@@ -1202,6 +1400,12 @@ webgroup_scrape(pmWebGroupSettings *settings, context_t *cp,
     labels.buffer = sdsnewlen(SDS_NOINIT, PM_MAXLABELJSONLEN);
     sdsclear(labels.buffer);
 
+    /*
+     * Values and rendered labels are kept with the context metrics,
+     * so concurrent scrapes of one context (from separate worker
+     * threads) must take turns.
+     */
+    uv_mutex_lock(&cp->lock);
     if ((sts = pmFetch(numpmid, pmidlist, &result)) >= 0) {
 	scrape.seconds = result->timestamp.tv_sec;
 	scrape.nanoseconds = result->timestamp.tv_usec * 1000;
@@ -1256,13 +1460,18 @@ webgroup_scrape(pmWebGroupSettings *settings, context_t *cp,
 
 		    if (metric->labels == NULL)
 			pmwebapi_metric_hash(metric);
-		    scrape_metric_labelsets(metric, &labels);
-		    settings->callbacks.on_scrape_labels(cp->origin, &labels, arg);
-		    scrape.metric.labels = labels.buffer;
+		    scrape_metric_changed(metric);
+		    if (metric->scrapelabels == NULL) {
+			scrape_metric_labelsets(metric, &labels);
+			settings->callbacks.on_scrape_labels(cp->origin, &labels, arg);
+			metric->scrapelabels = scrape_labels_update(NULL, &labels);
+		    }
+		    scrape.metric.labels = metric->scrapelabels;
 
 		    settings->callbacks.on_scrape(cp->origin, &scrape, arg);
 		    continue;
 		}
+		scrape_metric_changed(metric);
 		for (k = 0; k < metric->u.vlist->listcount; k++) {
 		    value = &metric->u.vlist->value[k];
 		    instance = dictFetchValue(indom->insts, &value->inst);
@@ -1278,9 +1487,17 @@ webgroup_scrape(pmWebGroupSettings *settings, context_t *cp,
 
 		    if (instance->labels == NULL)
 			pmwebapi_instance_hash(indom, instance);
-		    scrape_instance_labelsets(metric, indom, instance, &labels);
-		    settings->callbacks.on_scrape_labels(cp->origin, &labels, arg);
-		    scrape.instance.labels = labels.buffer;
+		    if (value->scrapelabels == NULL ||
+			memcmp(value->scrapehash, instance->name.hash,
+				sizeof(value->scrapehash)) != 0) {
+			scrape_instance_labelsets(metric, indom, instance, &labels);
+			settings->callbacks.on_scrape_labels(cp->origin, &labels, arg);
+			value->scrapelabels = scrape_labels_update(
+					value->scrapelabels, &labels);
+			memcpy(value->scrapehash, instance->name.hash,
+				sizeof(value->scrapehash));
+		    }
+		    scrape.instance.labels = value->scrapelabels;
 
 		    settings->callbacks.on_scrape(cp->origin, &scrape, arg);
 		}
@@ -1288,6 +1505,7 @@ webgroup_scrape(pmWebGroupSettings *settings, context_t *cp,
 	}
 	pmFreeResult(result);
     }
+    uv_mutex_unlock(&cp->lock);
     free(pmidlist);
 
     sdsfree(v);
@@ -1642,6 +1860,8 @@ pmWebGroupSetup(pmWebGroupModule *module)
     LOCALHOST = sdsnew("localhost");
     TIMEOUT = sdsnew("pmwebapi.timeout");
     BATCHSIZE = sdsnew("pmwebapi.batchsize");
+    POOLSIZE = sdsnew("pmwebapi.poolsize");
+    POOLTIMEOUT = sdsnew("pmwebapi.pooltimeout");
     AUTH_USERNAME = sdsnew("auth.username");
     AUTH_PASSWORD = sdsnew("auth.password");
 
@@ -1652,6 +1872,9 @@ pmWebGroupSetup(pmWebGroupModule *module)
 
     /* setup a dictionary mapping context number to data */
     groups->contexts = dictCreate(&intKeyDictCallBacks, NULL);
+    uv_mutex_init(&groups->poollock);
+    default_poolsize = DEFAULT_POOLSIZE;
+    default_pooltimeout = DEFAULT_POOLTIMEOUT;
     return 0;
 }
 
@@ -1671,6 +1894,7 @@ int
 pmWebGroupSetConfiguration(pmWebGroupModule *module, dict *config)
 {
     struct webgroups	*webgroups = webgroups_lookup(module);
+    double		seconds;
     char		*endnum;
     sds			value;
 
@@ -1690,6 +1914,24 @@ pmWebGroupSetConfiguration(pmWebGroupModule *module, dict *config)
 	    default_batchsize = DEFAULT_BATCHSIZE;
     }
 
+    if ((value = dictFetchValue(config, POOLSIZE)) == NULL) {
+	default_poolsize = DEFAULT_POOLSIZE;
+    } else {
+	default_poolsize = strtoul(value, &endnum, 0);
+	if (*endnum != '\0')
+	    default_poolsize = DEFAULT_POOLSIZE;
+    }
+
+    if ((value = dictFetchValue(config, POOLTIMEOUT)) == NULL) {
+	default_pooltimeout = DEFAULT_POOLTIMEOUT;
+    } else {
+	seconds = strtod(value, &endnum);
+	if (*endnum != '\0' || seconds <= 0)
+	    default_pooltimeout = DEFAULT_POOLTIMEOUT;
+	else
+	    default_pooltimeout = (unsigned int)(seconds * 1000.0);
+    }
+
     if (webgroups) {
 	webgroups->config = config;
 	return 0;
@@ -1697,6 +1939,59 @@ pmWebGroupSetConfiguration(pmWebGroupModule *module, dict *config)
     return -ENOMEM;
 }
 
+static void
+webgroup_metrics(struct webgroups *groups)
+{
+    mmv_registry_t	*registry = groups->metrics;
+    pmUnits		countunits = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE);
+    pmUnits		timeunits = MMV_UNITS(0,1,0,0,PM_TIME_USEC,0);
+    void		*map;
+
+    mmv_stats_add_metric(registry, "contexts.pool.hits", 1,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, 0,
+	"new contexts satisfied from the idle context pool",
+	"Count of new web group contexts that borrowed an idle, connected\n"
+	"context from the pool instead of establishing a new one.");
+    mmv_stats_add_metric(registry, "contexts.pool.misses", 2,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, 0,
+	"new contexts established without the idle context pool",
+	"Count of new web group contexts for which no matching context was\n"
+	"pooled, such that a new PMAPI context had to be established.");
+    mmv_stats_add_metric(registry, "contexts.pool.expired", 3,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, 0,
+	"idle pooled contexts destroyed after pmwebapi.pooltimeout",
+	"Count of idle contexts removed from the pool and destroyed after\n"
+	"remaining unused for the pmwebapi.pooltimeout interval.");
+    mmv_stats_add_metric(registry, "contexts.pool.idle", 4,
+	MMV_TYPE_U32, MMV_SEM_INSTANT, countunits, 0,
+	"current number of idle contexts in the pool",
+	"Number of connected contexts currently idle in the pool, available\n"
+	"for reuse by new web group contexts for the same hostspec.");
+    mmv_stats_add_metric(registry, "contexts.connect_time", 5,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, timeunits, 0,
+	"time spent establishing new web group contexts",
+	"Cumulative time spent connecting to pmcd and setting up new web\n"
+	"group contexts, on pool misses.  Divide by contexts.pool.misses\n"
+	"for the average context setup latency.");
+
+    if ((map = mmv_stats_start(registry)) == NULL) {
+	if (pmDebugOptions.http)
+	    fprintf(stderr, "%s: failed to start metrics\n", "webgroup_metrics");
+	return;
+    }
+    groups->values[WEBGROUP_POOL_HITS] =
+	mmv_lookup_value_desc(map, "contexts.pool.hits", NULL);
+    groups->values[WEBGROUP_POOL_MISSES] =
+	mmv_lookup_value_desc(map, "contexts.pool.misses", NULL);
+    groups->values[WEBGROUP_POOL_EXPIRED] =
+	mmv_lookup_value_desc(map, "contexts.pool.expired", NULL);
+    groups->values[WEBGROUP_POOL_IDLE] =
+	mmv_lookup_value_desc(map, "contexts.pool.idle", NULL);
+    groups->values[WEBGROUP_CONNECT_TIME] =
+	mmv_lookup_value_desc(map, "contexts.connect_time", NULL);
+    groups->map = map;
+}
+
 int
 pmWebGroupSetMetricRegistry(pmWebGroupModule *module, mmv_registry_t *registry)
 {
@@ -1704,6 +1999,8 @@ pmWebGroupSetMetricRegistry(pmWebGroupModule *module, mmv_registry_t *registry)
 
     if (webgroups) {
 	webgroups->metrics = registry;
+	if (registry)
+	    webgroup_metrics(webgroups);
 	return 0;
     }
     return -ENOMEM;
@@ -1715,6 +2012,8 @@ pmWebGroupClose(pmWebGroupModule *module)
     struct webgroups	*groups = (struct webgroups *)module->privdata;
 
     if (groups) {
+	webgroup_pool_free(groups);
+	uv_mutex_destroy(&groups->poollock);
 	dictRelease(groups->contexts);
 	memset(groups, 0, sizeof(struct webgroups));
 	free(groups);
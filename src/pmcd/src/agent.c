@@ -166,6 +166,7 @@ CleanupAgent(AgentInfo* aPtr, int why, int status)
     aPtr->status.connected = 0;
     aPtr->status.busy = 0;
     aPtr->status.notReady = 0;
+    aPtr->status.lateReply = 0;
     aPtr->status.fenced = 0;
     aPtr->status.flags = 0;
     AgentDied = 1;
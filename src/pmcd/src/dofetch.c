@@ -339,6 +339,52 @@ SendFetch(DomPmidList *dpList, AgentInfo *aPtr, ClientInfo *cPtr, int ctxnum)
     return result;
 }
 
+/*
+ * Account for the time taken by an agent to answer the fetch sent
+ * at ap->fetchStart.
+ */
+void
+FetchLatency(AgentInfo *ap)
+{
+    struct timeval	now;
+    double		usec;
+    double		limit;
+    int			i;
+
+    pmtimevalNow(&now);
+    usec = pmtimevalSub(&now, &ap->fetchStart) * 1000000;
+    if (usec < 0)
+	usec = 0;
+    ap->fetchStats.count++;
+    ap->fetchStats.time += (__uint64_t)usec;
+    for (i = 0, limit = 100; i < FETCH_HIST_BUCKETS - 1; i++, limit *= 10) {
+	if (usec < limit)
+	    break;
+    }
+    ap->fetchStats.hist[i]++;
+}
+
+/*
+ * An agent that missed the fetch budget may still be working on the
+ * request.  If it has not answered within the PMDA timeout, give up
+ * on it the same way we would have if it had been waited for.
+ */
+static void
+CheckLateReply(AgentInfo *ap)
+{
+    struct timeval	now;
+
+    if (!ap->status.lateReply || pmcd_timeout <= 0)
+	return;
+    pmtimevalNow(&now);
+    if (pmtimevalSub(&now, &ap->fetchStart) < pmcd_timeout)
+	return;
+    pmNotifyErr(LOG_INFO, "DoFetch: \"%s\" agent reply overdue",
+		ap->pmDomainLabel);
+    pmcd_trace(TR_RECV_TIMEOUT, ap->outFd, PDU_RESULT, 0);
+    CleanupAgent(ap, AT_COMM, ap->inFd);
+}
+
 /*
  * pmResults coming back from PMDAs have their timestamp field
  * overloaded to contain out-of-band information such as state
@@ -359,6 +405,8 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
 {
     int			i, j;
     int 		sts;
+    int			pass;
+    int			late;
     int			ctxnum;
     unsigned int	changes = 0;
     pmTimeval		when;
@@ -375,6 +423,8 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
     int			nWait;
     int			maxFd;
     struct timeval	timeout;
+    struct timeval	deadline;
+    struct timeval	now;
     __pmHashCtl		*hcp;
     __pmHashNode	*hp;
     pmProfile		*profile;
@@ -432,40 +482,104 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
      * come back immediately.  If a request cannot be sent to an agent, a
      * suitable pmResult (containing metric not available values) will be
      * returned.
+     *
+     * Requests go to the daemon agents first (pass 0) so that they are
+     * all working concurrently while the DSO agents are called (pass 1).
      */
+    pmtimevalNow(&deadline);
+    if (pmcd_fetch_budget > 0) {
+	timeout.tv_sec = pmcd_fetch_budget / 1000;
+	timeout.tv_usec = (pmcd_fetch_budget % 1000) * 1000;
+	pmtimevalInc(&deadline, &timeout);
+    }
     __pmFD_ZERO(&waitFds);
     nWait = 0;
     maxFd = -1;
-    for (i = 0; dList[i].domain != -1; i++) {
-	j = mapdom[dList[i].domain];
-	results[j] = SendFetch(&dList[i], &agent[j], cip, ctxnum);
-	if (results[j] == NULL) { /* Wait for agent's response */
-	    int fd = agent[j].outFd;
-	    agent[j].status.busy = 1;
-	    __pmFD_SET(fd, &waitFds);
-	    if (fd > maxFd)
-		maxFd = fd;
-	    nWait++;
-	} else {
-	    changes |= ExtractState(results[j]);
+    for (pass = 0; pass < 2; pass++) {
+	for (i = 0; dList[i].domain != -1; i++) {
+	    j = mapdom[dList[i].domain];
+	    if ((agent[j].ipcType == AGENT_DSO) != (pass == 1))
+		continue;
+	    if (agent[j].status.lateReply)
+		CheckLateReply(&agent[j]);
+	    else
+		pmtimevalNow(&agent[j].fetchStart);
+	    results[j] = SendFetch(&dList[i], &agent[j], cip, ctxnum);
+	    if (results[j] == NULL) { /* Wait for agent's response */
+		int fd = agent[j].outFd;
+		agent[j].status.busy = 1;
+		__pmFD_SET(fd, &waitFds);
+		if (fd > maxFd)
+		    maxFd = fd;
+		nWait++;
+	    } else {
+		if (agent[j].ipcType == AGENT_DSO &&
+		    !agent[j].status.madeDsoResult)
+		    FetchLatency(&agent[j]);
+		changes |= ExtractState(results[j]);
+	    }
 	}
     }
     /* Construct pmResult for bad-pmID list */
     if (dList[i].listSize != 0)
 	results[nAgents] = MakeBadResult(dList[i].listSize, dList[i].list, PM_ERR_NOAGENT);
 
-    /* Wait for results to roll in from agents */
+    /* Wait for results to roll in from agents, in completion order */
     while (nWait > 0) {
         __pmFD_COPY(&readyFds, &waitFds);
-	if (nWait > 1) {
+	if (nWait > 1 || pmcd_fetch_budget > 0) {
 	    timeout.tv_sec = pmcd_timeout;
 	    timeout.tv_usec = 0;
+	    late = 0;
+	    if (pmcd_fetch_budget > 0) {
+		/*
+		 * Use whatever remains of the fetch budget if that ends
+		 * before the PMDA timeout, so agents that have already
+		 * answered are not held up by a slow one
+		 */
+		pmtimevalNow(&now);
+		if (pmtimevalSub(&deadline, &now) <= 0) {
+		    timeout.tv_sec = 0;
+		    late = 1;
+		}
+		else if (pmcd_timeout <= 0 ||
+			 pmtimevalSub(&deadline, &now) < pmcd_timeout) {
+		    pmtimevalFromReal(pmtimevalSub(&deadline, &now), &timeout);
+		    late = 1;
+		}
+	    }
 
             retry:
 	    setoserror(0);
 	    sts = __pmSelectRead(maxFd+1, &readyFds, &timeout);
 
-	    if (sts == 0) {
+	    if (sts == 0 && late) {
+		/*
+		 * Fetch budget exhausted, return "try again" for the
+		 * agents still busy.  Their replies are discarded when
+		 * they eventually arrive (see HandleReadyAgents), and
+		 * until then the agent is treated as not ready.
+		 */
+		for (i = 0; i < nAgents; i++) {
+		    if (!agent[i].status.busy)
+			continue;
+		    for (j = 0; dList[j].domain != -1; j++)
+			if (dList[j].domain == agent[i].pmDomainId)
+			    break;
+		    results[i] = MakeBadResult(dList[j].listSize,
+					       dList[j].list,
+					       PM_ERR_AGAIN);
+		    agent[i].status.busy = 0;
+		    agent[i].status.lateReply = 1;
+		    agent[i].status.notReady = 1;
+		    agent[i].fetchStats.late++;
+		    if (pmDebugOptions.appl0)
+			fprintf(stderr, "DoFetch: \"%s\" agent missed %d msec budget\n",
+				agent[i].pmDomainLabel, pmcd_fetch_budget);
+		}
+		break;
+	    }
+	    else if (sts == 0) {
 		pmNotifyErr(LOG_INFO, "DoFetch: select timeout");
 
 		/* Timeout, terminate agents with undelivered results */
@@ -505,8 +619,10 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
 	    __pmFD_CLR(ap->outFd, &waitFds);
 	    nWait--;
 	    pinpdu = sts = __pmGetPDU(ap->outFd, ANY_SIZE, pmcd_timeout, &pb);
-	    if (sts > 0)
+	    if (sts > 0) {
 		pmcd_trace(TR_RECV_PDU, ap->outFd, sts, (int)((__psint_t)pb & 0xffffffff));
+		FetchLatency(ap);
+	    }
 	    if (sts == PDU_RESULT) {
 		if ((sts = __pmDecodeResult(pb, &results[i])) >= 0) {
 		    if (results[i]->numpmid == aFreq[i]) {
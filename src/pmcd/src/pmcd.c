@@ -104,6 +104,7 @@ static pmLongOptions longopts[] = {
     { "", 1, 'L', "BYTES", "maximum size for PDUs from clients [default 65536]" },
     { "", 1, 'q', "TIME", "PMDA initial negotiation timeout (seconds) [default 3]" },
     { "", 1, 't', "TIME", "PMDA response timeout (seconds) [default 5]" },
+    { "", 1, 'b', "MSEC", "PMDA fetch response budget (milliseconds) [default 0]" },
     { "verify", 0, 'v', 0, "check validity of pmcd configuration, then exit" },
     PMAPI_OPTIONS_HEADER("Connection options"),
     { "interface", 1, 'i', "ADDR", "accept connections on this IP address" },
@@ -118,7 +119,7 @@ static pmLongOptions longopts[] = {
 
 static pmOptions opts = {
     .flags = PM_OPTFLAG_POSIX,
-    .short_options = "Ac:C:D:fH:i:l:L:M:N:n:p:P:q:Qs:St:T:U:vx:?",
+    .short_options = "Ab:c:C:D:fH:i:l:L:M:N:n:p:P:q:Qs:St:T:U:vx:?",
     .long_options = longopts,
 };
 
@@ -249,6 +250,17 @@ ParseOptions(int argc, char *argv[], int *nports)
 		}
 		break;
 
+	    case 'b':
+		val = (int)strtol(opts.optarg, &endptr, 10);
+		if (*endptr != '\0' || val < 0) {
+		    pmprintf("%s: -b requires a positive numeric argument\n",
+			pmGetProgname());
+		    opts.errors++;
+		} else {
+		    pmcd_fetch_budget = val;
+		}
+		break;
+
 	    case 'T':
 		val = (int)strtol(opts.optarg, &endptr, 10);
 		if (*endptr != '\0' || val < 0) {
@@ -609,7 +621,51 @@ HandleReadyAgents(__pmFdSet *readyFds)
 
     for (i = 0; i < nAgents; i++) {
 	ap = &agent[i];
-	if (ap->status.notReady) {
+	if (ap->status.lateReply) {
+	    fd = ap->outFd;
+	    if (__pmFD_ISSET(fd, readyFds)) {
+		int		pinpdu;
+
+		/*
+		 * Reply to a fetch that missed the fetch budget, the
+		 * client has already been answered so discard it
+		 */
+		ap->status.lateReply = 0;
+		pinpdu = sts = __pmGetPDU(ap->outFd, ANY_SIZE, pmcd_timeout, &pb);
+		if (sts > 0) {
+		    pmcd_trace(TR_RECV_PDU, ap->outFd, sts, (int)((__psint_t)pb & 0xffffffff));
+		    FetchLatency(ap);
+		}
+		if (sts == PDU_RESULT) {
+		    ap->status.notReady = 0;
+		}
+		else if (sts == PDU_ERROR) {
+		    if ((s = __pmDecodeError(pb, &sts)) < 0) {
+			sts = s;
+			pmcd_trace(TR_RECV_ERR, ap->outFd, PDU_ERROR, sts);
+		    }
+		    else {
+			/* still not ready if the agent said so */
+			if (sts != PM_ERR_PMDANOTREADY)
+			    ap->status.notReady = 0;
+			sts = 1;
+		    }
+		}
+		else {
+		    if (sts < 0)
+			pmcd_trace(TR_RECV_ERR, ap->outFd, PDU_RESULT, sts);
+		    else
+			pmcd_trace(TR_WRONG_PDU, ap->outFd, PDU_RESULT, sts);
+		    sts = PM_ERR_IPC;
+		}
+		if (pinpdu > 0)
+		    __pmUnpinPDUBuf(pb);
+
+		if (sts <= 0)
+		    CleanupAgent(ap, AT_COMM, fd);
+	    }
+	}
+	else if (ap->status.notReady) {
 	    fd = ap->outFd;
 	    if (__pmFD_ISSET(fd, readyFds)) {
 		int		pinpdu;
@@ -71,6 +71,19 @@ typedef struct {
     pid_t agentPid;			/* Process ID of the agent */
 } PipeInfo;
 
+/*
+ * Per-agent fetch latency statistics, exported via pmcd.agent.fetch.*
+ * Histogram buckets are decades from 100 usec up to 1 sec.
+ */
+#define FETCH_HIST_BUCKETS	6
+
+typedef struct {
+    __uint64_t	count;			/* fetches completed by the agent */
+    __uint64_t	late;			/* replies that missed the budget */
+    __uint64_t	time;			/* total fetch latency (usec) */
+    __uint64_t	hist[FETCH_HIST_BUCKETS]; /* latency histogram */
+} FetchStats;
+
 /* The agent table and its size. */
 
 typedef struct {
@@ -93,10 +106,13 @@ typedef struct {
 	    notReady : 1,		/* Agent not ready to process PDUs */
 	    startNotReady : 1,		/* Agent starts in non-ready state */
 	    fenced : 1,			/* Agent fenced; no sampling */
-	    unused : 7,			/* Zero-padded, unused space */
+	    lateReply : 1,		/* Fetch reply outstanding past budget */
+	    unused : 6,			/* Zero-padded, unused space */
 	    flags : 16;			/* Agent-supplied connection flags */
     } status;
     int		reason;			/* if ! connected */
+    struct timeval fetchStart;		/* when current fetch was sent */
+    FetchStats	fetchStats;		/* fetch latency statistics */
     union {				/* per-ipcType info */
 	DsoInfo    dso;
 	SocketInfo socket;
@@ -147,6 +163,7 @@ extern int		AgentDied;	/* for updating mapdom[] */
 
 PMCD_CALL extern AgentInfo *pmcd_agent(int);
 extern void CleanupAgent(AgentInfo *, int, int);
+extern void FetchLatency(AgentInfo *);
 extern int HarvestAgents(unsigned int);
 
 /* pmdaroot file descriptor */
@@ -155,6 +172,9 @@ extern int	pmdarootfd;
 /* timeout to PMDAs (secs) */
 PMCD_DATA extern int	pmcd_timeout;
 
+/* budget for fast agents' fetch replies (msec), 0 to wait for all */
+PMCD_DATA extern int	pmcd_fetch_budget;
+
 /* timeout for credentials */
 extern int	_creds_timeout;
 
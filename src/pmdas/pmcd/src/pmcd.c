@@ -87,6 +87,8 @@ static pmDesc	desctab[] = {
     { PMDA_PMID(0,24), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
 /* labels */
     { PMDA_PMID(0,25), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0) },
+/* control.fetch_budget */
+    { PMDA_PMID(0,26), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,1,0,0,PM_TIME_MSEC,0) },
 
 /* pdu_in.error */
     { PMDA_PMID(1,0), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
@@ -185,6 +187,24 @@ static pmDesc	desctab[] = {
     { PMDA_PMID(4,1), PM_TYPE_32, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
 /* agent.fenced */
     { PMDA_PMID(4,2), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0) },
+/* agent.fetch.count */
+    { PMDA_PMID(4,3), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* agent.fetch.late */
+    { PMDA_PMID(4,4), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* agent.fetch.time */
+    { PMDA_PMID(4,5), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) },
+/* agent.fetch.latency.under_100us */
+    { PMDA_PMID(4,6), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* agent.fetch.latency.under_1ms */
+    { PMDA_PMID(4,7), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* agent.fetch.latency.under_10ms */
+    { PMDA_PMID(4,8), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* agent.fetch.latency.under_100ms */
+    { PMDA_PMID(4,9), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* agent.fetch.latency.under_1s */
+    { PMDA_PMID(4,10), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* agent.fetch.latency.over_1s */
+    { PMDA_PMID(4,11), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
 
 /* pmie.configfile */
     { PMDA_PMID(5,0), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
@@ -206,6 +226,14 @@ static pmDesc	desctab[] = {
     { PMDA_PMID(5,8), PM_TYPE_FLOAT, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,-1,1,0,PM_TIME_SEC,PM_COUNT_ONE) },
 /* pmie.eval.actual */
     { PMDA_PMID(5,9), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* pmie.eval.drift */
+    { PMDA_PMID(5,10), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) },
+/* pmie.fetch.count */
+    { PMDA_PMID(5,11), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* pmie.fetch.time */
+    { PMDA_PMID(5,12), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) },
+/* pmie.eval.sched */
+    { PMDA_PMID(5,13), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) },
 
 /* client.whoami */
     { PMDA_PMID(6,0), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
@@ -472,6 +500,13 @@ stat_time_differs(struct stat *statbuf, struct stat *lastsbuf)
     return 0;
 }
 
+/* pmie.eval.drift and later metrics are absent from version 1 stats */
+static int
+pmie_has_item(pmie_t *pmie, int item)
+{
+    return item < 10 || ((pmiestats_t *)pmie->mmap)->version >= 2;
+}
+
 /* use a static timestamp, stat PMIE_SUBDIR, if changed update "pmies" */
 static unsigned int
 refresh_pmie_indom(void)
@@ -525,7 +560,7 @@ refresh_pmie_indom(void)
 				fullpath, osstrerror());
 		    continue;
 		}
-		if (statbuf.st_size != sizeof(pmiestats_t))
+		if (PMIESTATS_SIZE_VERSION(statbuf.st_size) == 0)
 		    continue;
 		if  ((endp = strdup(dp->d_name)) == NULL) {
 		    pmNoMem("pmie iname", strlen(dp->d_name), PM_RECOV_ERR);
@@ -551,7 +586,8 @@ refresh_pmie_indom(void)
 		    free(endp);
 		    continue;
 		}
-		else if (((pmiestats_t *)ptr)->version != 1) {
+		else if (((pmiestats_t *)ptr)->version !=
+			 PMIESTATS_SIZE_VERSION(statbuf.st_size)) {
 		    pmNotifyErr(LOG_WARNING, "incompatible pmie version: %s",
 				fullpath);
 		    __pmMemoryUnmap(ptr, statbuf.st_size);
@@ -1531,6 +1567,10 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 				fetch_labels(pmda->e_context, &atom, &host);
 				break;
 
+			case 26:	/* control.fetch_budget */
+				atom.ul = pmcd_fetch_budget;
+				break;
+
 			default:
 				sts = atom.l = PM_ERR_PMID;
 				break;
@@ -1649,6 +1689,23 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 			case 2:		/* agent.fenced */
 			    atom.ul = agent[j].status.fenced;
 			    break;
+			case 3:		/* agent.fetch.count */
+			    atom.ull = agent[j].fetchStats.count;
+			    break;
+			case 4:		/* agent.fetch.late */
+			    atom.ull = agent[j].fetchStats.late;
+			    break;
+			case 5:		/* agent.fetch.time */
+			    atom.ull = agent[j].fetchStats.time;
+			    break;
+			case 6:		/* agent.fetch.latency.* */
+			case 7:
+			case 8:
+			case 9:
+			case 10:
+			case 11:
+			    atom.ull = agent[j].fetchStats.hist[item - 6];
+			    break;
 			default:
 			    sts = atom.l = PM_ERR_PMID;
 			    break;
@@ -1672,6 +1729,8 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 	    case 5:	/* pmie metrics */
 		refresh_pmie_indom();
 		for (j = numval = 0; j < npmies; j++) {
+		    if (!pmie_has_item(&pmies[j], item))
+			continue;
 		    if (__pmInProfile(pmieindom, _profile, pmies[j].pid))
 			numval++;
 		}
@@ -1683,6 +1742,8 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 		    vset->pmid = pmidlist[i];
 		}
 		for (j = numval = 0; j < npmies; ++j) {
+		    if (!pmie_has_item(&pmies[j], item))
+			continue;
 		    if (!__pmInProfile(pmieindom, _profile, pmies[j].pid))
 			continue;
 		    vset->vlist[numval].inst = pmies[j].pid;
@@ -1718,6 +1779,18 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 			case 9:		/* pmie.eval.actual */
 			    atom.ul = pmie->eval_actual;
 			    break;
+			case 10:	/* pmie.eval.drift */
+			    atom.ull = pmie->eval_drift;
+			    break;
+			case 11:	/* pmie.fetch.count */
+			    atom.ull = pmie->fetch_count;
+			    break;
+			case 12:	/* pmie.fetch.time */
+			    atom.ull = pmie->fetch_time;
+			    break;
+			case 13:	/* pmie.eval.sched */
+			    atom.ull = pmie->eval_sched;
+			    break;
 			default:
 			    sts = atom.l = PM_ERR_PMID;
 			    break;
@@ -1866,6 +1939,14 @@ pmcd_store(pmResult *result, pmdaExt *pmda)
 		    pmcd_timeout = val;
 		}
 	    }
+	    else if (item == 26) { /* pmcd.control.fetch_budget */
+		val = vsp->vlist[0].value.lval;
+		if (val < 0) {
+		    sts = PM_ERR_SIGN;
+		    break;
+		}
+		pmcd_fetch_budget = val;
+	    }
 	    else if (item == 8) { /* pmcd.control.register */
 		for (j = 0; j < vsp->numval; j++) {
 		    if (0 <= vsp->vlist[j].inst && vsp->vlist[j].inst < NUMREG)
@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * Arrow IPC file writer ... the file is the "ARROW1" magic, a Schema
+ * message, a RecordBatch message per batch, an end-of-stream marker
+ * and a Footer locating the batches, so that readers can map the file
+ * and use the column buffers in place.  Message metadata is encoded as
+ * FlatBuffers, built here back to front as the FlatBuffers library
+ * does, and always little-endian; column data is in host byte order,
+ * as declared in the Schema.
+ */
+
+#include "pmapi.h"
+#include "libpcp.h"
+#include "arrow.h"
+
+/* Schema.fbs, Message.fbs and File.fbs from the Arrow format */
+#define METADATA_V5		4
+#define HEADER_SCHEMA		1
+#define HEADER_RECORDBATCH	3
+#define TYPE_INT		2
+#define TYPE_FLOATINGPOINT	3
+#define TYPE_TIMESTAMP		10
+#define PRECISION_DOUBLE	2
+#define TIMEUNIT_MICROSECOND	2
+#ifdef HAVE_NETWORK_BYTEORDER
+#define ENDIANNESS		1	/* Big */
+#else
+#define ENDIANNESS		0	/* Little */
+#endif
+
+#define NCOLUMNS		4
+#define NBUFFERS		(2 * NCOLUMNS)	/* validity and data */
+
+static const char	magic[8] = "ARROW1";	/* with padding */
+
+typedef struct {
+    unsigned char	*buf;		/* contents are the last used bytes */
+    size_t		size;
+    size_t		used;
+    size_t		minalign;
+    size_t		field[8];	/* table fields, by used when added */
+    int			nfield;
+    size_t		tstart;		/* used when table was started */
+} fbuilder;
+
+typedef struct {
+    __int64_t		time;		/* usec since the epoch */
+    double		value;
+    pmID		pmid;
+    int			inst;
+    unsigned int	seq;		/* order added, for a stable sort */
+} row_t;
+
+typedef struct {
+    __int64_t		offset;		/* of message in file */
+    __int32_t		metalen;	/* prefix and metadata length */
+    __int64_t		bodylen;
+} block_t;
+
+struct arrow_writer {
+    FILE		*f;
+    __int64_t		offset;		/* bytes written to f */
+    int			sts;		/* first write error */
+    int			nmeta;
+    char		**keys;		/* custom metadata for the Schema */
+    char		**values;
+    row_t		*rows;
+    int			nrows;
+    int			maxrows;
+    unsigned int	seq;
+    block_t		*blocks;	/* record batches written */
+    int			nblocks;
+    int			maxblocks;
+};
+
+static void
+fb_init(fbuilder *b)
+{
+    memset(b, 0, sizeof(*b));
+    b->minalign = 1;
+}
+
+static void
+fb_push(fbuilder *b, const void *data, size_t len)
+{
+    unsigned char	*buf;
+    size_t		size;
+
+    if (b->size - b->used < len) {
+	size = b->size ? b->size : 512;
+	while (size - b->used < len)
+	    size *= 2;
+	if ((buf = (unsigned char *)malloc(size)) == NULL)
+	    pmNoMem("arrow metadata", size, PM_FATAL_ERR);
+	if (b->used)
+	    memcpy(buf + size - b->used, b->buf + b->size - b->used, b->used);
+	free(b->buf);
+	b->buf = buf;
+	b->size = size;
+    }
+    b->used += len;
+    memcpy(b->buf + b->size - b->used, data, len);
+}
+
+static void
+fb_pad(fbuilder *b, size_t len)
+{
+    static const unsigned char	zero[8];
+    size_t			n;
+
+    for ( ; len > 0; len -= n) {
+	n = len > sizeof(zero) ? sizeof(zero) : len;
+	fb_push(b, zero, n);
+    }
+}
+
+/* pad so that after len more bytes, used is a multiple of align */
+static void
+fb_prep(fbuilder *b, size_t align, size_t len)
+{
+    if (align > b->minalign)
+	b->minalign = align;
+    fb_pad(b, (align - ((b->used + len) % align)) % align);
+}
+
+static void
+fb_put16(fbuilder *b, unsigned int v)
+{
+    unsigned char	x[2] = { v, v >> 8 };
+
+    fb_push(b, x, sizeof(x));
+}
+
+static void
+fb_put32(fbuilder *b, __uint32_t v)
+{
+    unsigned char	x[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+    fb_push(b, x, sizeof(x));
+}
+
+static void
+fb_put64(fbuilder *b, __int64_t v)
+{
+    fb_put32(b, (__uint64_t)v >> 32);
+    fb_put32(b, (__uint32_t)v);
+}
+
+/* reference to an object created earlier, i.e. at a higher address */
+static void
+fb_ref(fbuilder *b, size_t obj)
+{
+    fb_prep(b, 4, 0);
+    fb_put32(b, b->used + 4 - obj);
+}
+
+static size_t
+fb_string(fbuilder *b, const char *s)
+{
+    size_t	len = strlen(s);
+
+    fb_prep(b, 4, len + 1);
+    fb_pad(b, 1);
+    fb_push(b, s, len);
+    fb_put32(b, len);
+    return b->used;
+}
+
+static size_t
+fb_vector(fbuilder *b, size_t *objs, int n)
+{
+    int		i;
+
+    fb_prep(b, 4, 4 * n);
+    for (i = n - 1; i >= 0; i--)
+	fb_ref(b, objs[i]);
+    fb_put32(b, n);
+    return b->used;
+}
+
+/* vector of structs of two longs, FieldNode or Buffer */
+static size_t
+fb_pairs(fbuilder *b, __int64_t *pairs, int n)
+{
+    int		i;
+
+    fb_prep(b, 4, 16 * n);
+    fb_prep(b, 8, 16 * n);
+    for (i = n - 1; i >= 0; i--) {
+	fb_put64(b, pairs[2*i+1]);
+	fb_put64(b, pairs[2*i]);
+    }
+    fb_put32(b, n);
+    return b->used;
+}
+
+static size_t
+fb_blocks(fbuilder *b, block_t *blocks, int n)
+{
+    int		i;
+
+    fb_prep(b, 4, 24 * n);
+    fb_prep(b, 8, 24 * n);
+    for (i = n - 1; i >= 0; i--) {
+	fb_put64(b, blocks[i].bodylen);
+	fb_pad(b, 4);
+	fb_put32(b, blocks[i].metalen);
+	fb_put64(b, blocks[i].offset);
+    }
+    fb_put32(b, n);
+    return b->used;
+}
+
+static void
+fb_start(fbuilder *b)
+{
+    memset(b->field, 0, sizeof(b->field));
+    b->nfield = 0;
+    b->tstart = b->used;
+}
+
+static void
+fb_slot(fbuilder *b, int id)
+{
+    b->field[id] = b->used;
+    if (id >= b->nfield)
+	b->nfield = id + 1;
+}
+
+static void
+fb_add8(fbuilder *b, int id, unsigned int v)
+{
+    unsigned char	x = v;
+
+    fb_push(b, &x, 1);
+    fb_slot(b, id);
+}
+
+static void
+fb_add16(fbuilder *b, int id, unsigned int v)
+{
+    fb_prep(b, 2, 0);
+    fb_put16(b, v);
+    fb_slot(b, id);
+}
+
+static void
+fb_add32(fbuilder *b, int id, __uint32_t v)
+{
+    fb_prep(b, 4, 0);
+    fb_put32(b, v);
+    fb_slot(b, id);
+}
+
+static void
+fb_add64(fbuilder *b, int id, __int64_t v)
+{
+    fb_prep(b, 8, 0);
+    fb_put64(b, v);
+    fb_slot(b, id);
+}
+
+static void
+fb_addref(fbuilder *b, int id, size_t obj)
+{
+    fb_ref(b, obj);
+    fb_slot(b, id);
+}
+
+/* finish a table, with its vtable immediately before it */
+static size_t
+fb_end(fbuilder *b)
+{
+    size_t	obj, vt;
+    __int32_t	soffset;
+    int		i;
+
+    fb_prep(b, 4, 0);
+    fb_put32(b, 0);
+    obj = b->used;
+    for (i = b->nfield - 1; i >= 0; i--)
+	fb_put16(b, b->field[i] ? obj - b->field[i] : 0);
+    fb_put16(b, obj - b->tstart);
+    fb_put16(b, (b->nfield + 2) * 2);
+    vt = b->used;
+
+    soffset = vt - obj;
+    b->buf[b->size - obj] = soffset;
+    b->buf[b->size - obj + 1] = soffset >> 8;
+    b->buf[b->size - obj + 2] = soffset >> 16;
+    b->buf[b->size - obj + 3] = soffset >> 24;
+    return obj;
+}
+
+static unsigned char *
+fb_finish(fbuilder *b, size_t root, size_t *lenp)
+{
+    fb_prep(b, b->minalign, 4);
+    fb_ref(b, root);
+    *lenp = b->used;
+    return b->buf + b->size - b->used;
+}
+
+static size_t
+fb_column(fbuilder *b, const char *name, int typeid, size_t type)
+{
+    size_t	sname, children;
+
+    sname = fb_string(b, name);
+    children = fb_vector(b, NULL, 0);
+    fb_start(b);
+    fb_addref(b, 0, sname);			/* name */
+    fb_add8(b, 1, 0);				/* nullable */
+    fb_add8(b, 2, typeid);			/* type_type */
+    fb_addref(b, 3, type);			/* type */
+    fb_addref(b, 5, children);			/* children */
+    return fb_end(b);
+}
+
+static size_t
+fb_int(fbuilder *b, int bits, int sign)
+{
+    fb_start(b);
+    fb_add32(b, 0, bits);			/* bitWidth */
+    fb_add8(b, 1, sign);			/* is_signed */
+    return fb_end(b);
+}
+
+static size_t
+build_schema(fbuilder *b, arrow_writer *w)
+{
+    size_t	*kv, fields[NCOLUMNS];
+    size_t	key, value, meta, tz, type;
+    int		i;
+
+    if ((kv = (size_t *)calloc(w->nmeta + 1, sizeof(size_t))) == NULL)
+	pmNoMem("arrow schema", (w->nmeta + 1) * sizeof(size_t), PM_FATAL_ERR);
+    for (i = 0; i < w->nmeta; i++) {
+	key = fb_string(b, w->keys[i]);
+	value = fb_string(b, w->values[i]);
+	fb_start(b);
+	fb_addref(b, 0, key);
+	fb_addref(b, 1, value);
+	kv[i] = fb_end(b);
+    }
+    meta = fb_vector(b, kv, w->nmeta);
+    free(kv);
+
+    tz = fb_string(b, "UTC");
+    fb_start(b);
+    fb_add16(b, 0, TIMEUNIT_MICROSECOND);	/* unit */
+    fb_addref(b, 1, tz);			/* timezone */
+    type = fb_end(b);
+    fields[0] = fb_column(b, "time", TYPE_TIMESTAMP, type);
+    fields[1] = fb_column(b, "pmid", TYPE_INT, fb_int(b, 32, 0));
+    fields[2] = fb_column(b, "inst", TYPE_INT, fb_int(b, 32, 1));
+    fb_start(b);
+    fb_add16(b, 0, PRECISION_DOUBLE);		/* precision */
+    type = fb_end(b);
+    fields[3] = fb_column(b, "value", TYPE_FLOATINGPOINT, type);
+
+    type = fb_vector(b, fields, NCOLUMNS);
+    fb_start(b);
+    fb_add16(b, 0, ENDIANNESS);			/* endianness */
+    fb_addref(b, 1, type);			/* fields */
+    fb_addref(b, 2, meta);			/* custom_metadata */
+    return fb_end(b);
+}
+
+static void
+emit(arrow_writer *w, const void *data, size_t len)
+{
+    if (w->sts == 0 && fwrite(data, 1, len, w->f) != len)
+	w->sts = -oserror();
+    w->offset += len;
+}
+
+static void
+emit_pad(arrow_writer *w, size_t len)
+{
+    static const char	zero[8];
+
+    emit(w, zero, (8 - len % 8) % 8);
+}
+
+static void
+emit32(arrow_writer *w, __uint32_t v)
+{
+    unsigned char	x[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+    emit(w, x, sizeof(x));
+}
+
+/*
+ * Encapsulated message - continuation marker, metadata length, then
+ * the metadata padded to 8 bytes (the body, if any, follows).
+ */
+static block_t
+emit_message(arrow_writer *w, fbuilder *b, int htype, size_t header, __int64_t bodylen)
+{
+    unsigned char	*meta;
+    size_t		len, msg;
+    block_t		block;
+
+    fb_start(b);
+    fb_add64(b, 3, bodylen);			/* bodyLength */
+    fb_addref(b, 2, header);			/* header */
+    fb_add16(b, 0, METADATA_V5);		/* version */
+    fb_add8(b, 1, htype);			/* header_type */
+    msg = fb_end(b);
+    meta = fb_finish(b, msg, &len);
+
+    block.offset = w->offset;
+    block.metalen = 8 + len + (8 - len % 8) % 8;
+    block.bodylen = bodylen;
+    emit32(w, 0xffffffff);
+    emit32(w, block.metalen - 8);
+    emit(w, meta, len);
+    emit_pad(w, len);
+    return block;
+}
+
+arrow_writer *
+arrow_create(FILE *f, int nmeta, char **keys, char **values)
+{
+    arrow_writer	*w;
+    fbuilder		b;
+
+    if ((w = (arrow_writer *)calloc(1, sizeof(*w))) == NULL)
+	pmNoMem("arrow_create", sizeof(*w), PM_FATAL_ERR);
+    w->f = f;
+    w->nmeta = nmeta;
+    w->keys = keys;
+    w->values = values;
+
+    emit(w, magic, sizeof(magic));
+    fb_init(&b);
+    emit_message(w, &b, HEADER_SCHEMA, build_schema(&b, w), 0);
+    free(b.buf);
+    return w;
+}
+
+void
+arrow_append(arrow_writer *w, struct timeval *stamp, pmID pmid, int inst, double value)
+{
+    row_t	*rp;
+    size_t	size;
+
+    if (w->nrows == w->maxrows) {
+	w->maxrows = w->maxrows ? 2 * w->maxrows : 4096;
+	size = w->maxrows * sizeof(row_t);
+	if ((w->rows = (row_t *)realloc(w->rows, size)) == NULL)
+	    pmNoMem("arrow_append", size, PM_FATAL_ERR);
+    }
+    rp = &w->rows[w->nrows++];
+    rp->time = (__int64_t)stamp->tv_sec * 1000000 + stamp->tv_usec;
+    rp->value = value;
+    rp->pmid = pmid;
+    rp->inst = inst;
+    rp->seq = w->seq++;
+}
+
+static int
+rowcmp(const void *a, const void *b)
+{
+    const row_t	*ra = (const row_t *)a;
+    const row_t	*rb = (const row_t *)b;
+
+    if (ra->pmid != rb->pmid)
+	return ra->pmid < rb->pmid ? -1 : 1;
+    if (ra->inst != rb->inst)
+	return ra->inst < rb->inst ? -1 : 1;
+    if (ra->seq != rb->seq)
+	return ra->seq < rb->seq ? -1 : 1;
+    return 0;
+}
+
+static void
+write_batch(arrow_writer *w)
+{
+    __int64_t	nodes[2 * NCOLUMNS];
+    __int64_t	buffers[2 * NBUFFERS];
+    __int64_t	bodylen = 0;
+    size_t	width[NCOLUMNS] = { 8, 4, 4, 8 };
+    size_t	size, header, vnodes, vbuffers;
+    char	*column;
+    fbuilder	b;
+    block_t	*bp;
+    int		n = w->nrows;
+    int		c, i;
+
+    qsort(w->rows, n, sizeof(row_t), rowcmp);
+
+    for (c = 0; c < NCOLUMNS; c++) {
+	nodes[2*c] = n;				/* length */
+	nodes[2*c+1] = 0;			/* null_count */
+	buffers[4*c] = bodylen;			/* validity, none */
+	buffers[4*c+1] = 0;
+	buffers[4*c+2] = bodylen;		/* values */
+	buffers[4*c+3] = n * width[c];
+	bodylen += (n * width[c] + 7) & ~7;
+    }
+
+    fb_init(&b);
+    vbuffers = fb_pairs(&b, buffers, NBUFFERS);
+    vnodes = fb_pairs(&b, nodes, NCOLUMNS);
+    fb_start(&b);
+    fb_add64(&b, 0, n);				/* length */
+    fb_addref(&b, 1, vnodes);			/* nodes */
+    fb_addref(&b, 2, vbuffers);			/* buffers */
+    header = fb_end(&b);
+
+    if (w->nblocks == w->maxblocks) {
+	w->maxblocks = w->maxblocks ? 2 * w->maxblocks : 16;
+	size = w->maxblocks * sizeof(block_t);
+	if ((w->blocks = (block_t *)realloc(w->blocks, size)) == NULL)
+	    pmNoMem("arrow batches", size, PM_FATAL_ERR);
+    }
+    bp = &w->blocks[w->nblocks++];
+    *bp = emit_message(w, &b, HEADER_RECORDBATCH, header, bodylen);
+    free(b.buf);
+
+    size = n * sizeof(double);
+    if ((column = (char *)malloc(size ? size : 1)) == NULL)
+	pmNoMem("arrow column", size, PM_FATAL_ERR);
+    for (c = 0; c < NCOLUMNS; c++) {
+	for (i = 0; i < n; i++) {
+	    row_t	*rp = &w->rows[i];
+
+	    switch (c) {
+		case 0:
+		    ((__int64_t *)column)[i] = rp->time;
+		    break;
+		case 1:
+		    ((__uint32_t *)column)[i] = rp->pmid;
+		    break;
+		case 2:
+		    ((__int32_t *)column)[i] = rp->inst;
+		    break;
+		case 3:
+		    ((double *)column)[i] = rp->value;
+		    break;
+	    }
+	}
+	emit(w, column, n * width[c]);
+	emit_pad(w, n * width[c]);
+    }
+    free(column);
+    w->nrows = 0;
+}
+
+/*
+ * Called after all values from an archive record have been appended,
+ * so that each batch covers a contiguous time range.
+ */
+int
+arrow_end_record(arrow_writer *w)
+{
+    if (w->nrows >= ARROW_BATCH_ROWS)
+	write_batch(w);
+    return w->sts;
+}
+
+int
+arrow_finish(arrow_writer *w)
+{
+    unsigned char	*footer;
+    size_t		len, schema, batches, dicts, root;
+    fbuilder		b;
+    int			sts;
+
+    if (w->nrows > 0 || w->nblocks == 0)
+	write_batch(w);
+
+    /* end-of-stream marker */
+    emit32(w, 0xffffffff);
+    emit32(w, 0);
+
+    fb_init(&b);
+    batches = fb_blocks(&b, w->blocks, w->nblocks);
+    dicts = fb_blocks(&b, NULL, 0);
+    schema = build_schema(&b, w);
+    fb_start(&b);
+    fb_addref(&b, 1, schema);			/* schema */
+    fb_addref(&b, 2, dicts);			/* dictionaries */
+    fb_addref(&b, 3, batches);			/* recordBatches */
+    fb_add16(&b, 0, METADATA_V5);		/* version */
+    root = fb_end(&b);
+    footer = fb_finish(&b, root, &len);
+    emit(w, footer, len);
+    emit32(w, len);
+    emit(w, magic, 6);
+    free(b.buf);
+
+    if (fflush(w->f) != 0 && w->sts == 0)
+	w->sts = -oserror();
+    sts = w->sts;
+    free(w->rows);
+    free(w->blocks);
+    free(w);
+    return sts;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#ifndef _ARROW_H
+#define _ARROW_H
+
+/*
+ * Metric values in the Apache Arrow IPC file format, one row per value
+ * with time, pmid, inst and value columns.  Within each record batch
+ * rows are grouped by metric and instance, in time order, so each
+ * metric-instance series is a contiguous run of every column.
+ */
+#define ARROW_BATCH_ROWS	65536	/* rows per record batch, at least */
+
+typedef struct arrow_writer arrow_writer;
+
+extern arrow_writer *arrow_create(FILE *, int, char **, char **);
+extern void arrow_append(arrow_writer *, struct timeval *, pmID, int, double);
+extern int arrow_end_record(arrow_writer *);
+extern int arrow_finish(arrow_writer *);
+
+#endif /* _ARROW_H */
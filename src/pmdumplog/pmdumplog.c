@@ -20,16 +20,20 @@
 #include <float.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include "arrow.h"
 
 static struct pmTimeval	pmtv;
 static char		timebuf[32];	/* for pmCtime result + .xxx */
 static int		numpmid;
 static pmID		*pmid;
-static pmID		pmid_flags;
-static pmID		pmid_missed;
 static int		sflag;
 static int		xflag;		/* for -x (long timestamps) */
 static pmLogLabel	label;
+static arrow_writer	*arrow;		/* for -o, values in Arrow format */
+static __pmHashCtl	arrowpmids;	/* numeric metrics named in schema */
+static int		nmeta;
+static char		**metakeys;
+static char		**metavalues;
 
 static pmLongOptions longopts[] = {
     PMAPI_OPTIONS_HEADER("Options"),
@@ -43,6 +47,7 @@ static pmLongOptions longopts[] = {
     { "label", 0, 'l', 0, "dump the archive label" },
     { "metrics", 0, 'm', 0, "dump values of the metrics (default)" },
     PMOPT_NAMESPACE,
+    { "arrow", 1, 'o', "FILE", "write metric values to FILE in Arrow IPC format" },
     { "reverse", 0, 'r', 0, "process archive in reverse chronological order" },
     PMOPT_START,
     { "sizes", 0, 's', 0, "report size of data records in archive" },
@@ -60,7 +65,7 @@ static pmLongOptions longopts[] = {
 static int overrides(int, pmOptions *);
 static pmOptions opts = {
     .flags = PM_OPTFLAG_DONE | PM_OPTFLAG_STDOUT_TZ | PM_OPTFLAG_BOUNDARIES,
-    .short_options = "aD:dehilLmMn:rS:sT:tv:xZ:z?",
+    .short_options = "aD:dehilLmMn:o:rS:sT:tv:xZ:z?",
     .long_options = longopts,
     .short_usage = "[options] [archive [metricname ...]]",
     .override = overrides,
@@ -121,39 +126,6 @@ do_size(pmResult *rp)
     return nbyte;
 }
 
-static void
-setup_event_derived_metrics(void)
-{
-    int sts;
-
-    if (pmid_flags == 0) {
-	/*
-	 * get PMID for event.flags and event.missed
-	 * note that pmUnpackEventRecords() will have called
-	 * __pmRegisterAnon(), so the anon metrics
-	 * should now be in the PMNS
-	 */
-	char	*name_flags = "event.flags";
-	char	*name_missed = "event.missed";
-
-	if ((sts = pmLookupName(1, &name_flags, &pmid_flags)) < 0) {
-	    /* should not happen! */
-	    fprintf(stderr, "Warning: cannot get PMID for %s: %s\n",
-		    name_flags, pmErrStr(sts));
-	    /* avoid subsequent warnings ... */
-	    pmid_flags = pmID_build(pmID_domain(pmid_flags), pmID_cluster(pmid_flags), 1);
-	}
-	sts = pmLookupName(1, &name_missed, &pmid_missed);
-	if (sts < 0) {
-	    /* should not happen! */
-	    fprintf(stderr, "Warning: cannot get PMID for %s: %s\n",
-		    name_missed, pmErrStr(sts));
-	    /* avoid subsequent warnings ... */
-	    pmid_missed = pmID_build(pmID_domain(pmid_missed), pmID_cluster(pmid_missed), 1);
-	}
-    }
-}
-
 static int
 dump_nrecords(int nrecords, int nmissed)
 {
@@ -185,30 +157,13 @@ dump_nparams(int numpmid)
 }
 
 static void
-dump_parameter(pmValueSet *xvsp, int index, int *flagsp)
+dump_parameter(pmValueSet *xvsp)
 {
-    int		sts, flags = *flagsp;
+    int		sts;
     pmDesc	desc;
     char	**names;
 
     if ((sts = pmNameAll(xvsp->pmid, &names)) >= 0) {
-	if (index == 0) {
-	    if (xvsp->pmid == pmid_flags) {
-		flags = *flagsp = xvsp->vlist[0].value.lval;
-		printf(" flags 0x%x", flags);
-		printf(" (%s) ---\n", pmEventFlagsStr(flags));
-		free(names);
-		return;
-	    }
-	    printf(" ---\n");
-	}
-	if ((flags & PM_EVENT_FLAG_MISSED) && index == 1 &&
-	    (xvsp->pmid == pmid_missed)) {
-	    printf("        ==> %d missed event records\n",
-		    xvsp->vlist[0].value.lval);
-	    free(names);
-	    return;
-	}
 	printf("        %s (", pmIDStr(xvsp->pmid));
 	__pmPrintMetricNames(stdout, sts, names, " or ");
 	printf("):");
@@ -229,13 +184,15 @@ static void
 dump_event(int numnames, char **names, pmValueSet *vsp, int index, int indom, int type)
 {
     int		r;		/* event records */
-    int		p;		/* event parameters */
-    int		flags;
+    int		sts;
+    int		nparams;
     int		nrecords;
     int		nmissed = 0;
     int		highres = (type == PM_TYPE_HIGHRES_EVENT);
     char	*iname;
     pmValue	*vp = &vsp->vlist[index];
+    pmValueSet	xvs;		/* one parameter, refers into vp */
+    pmEventIterator	iter;
 
     printf("    %s (", pmIDStr(vsp->pmid));
     __pmPrintMetricNames(stdout, numnames, names, " or ");
@@ -253,71 +210,58 @@ dump_event(int numnames, char **names, pmValueSet *vsp, int index, int indom, in
     }
     printf(": ");
 
-    if (highres) {
-	pmHighResResult	**hr;
-
-	if ((nrecords = pmUnpackHighResEventRecords(vsp, index, &hr)) < 0)
-	    return;
-	if (nrecords == 0) {
-	    printf("No event records\n");
-	    pmFreeHighResEventResult(hr);
-	    return;
-	}
-	setup_event_derived_metrics();
-
-	for (r = 0; r < nrecords; r++) {
-	    if (hr[r]->numpmid == 2 && hr[r]->vset[0]->pmid == pmid_flags &&
-		(hr[r]->vset[0]->vlist[0].value.lval & PM_EVENT_FLAG_MISSED) &&
-		hr[r]->vset[1]->pmid == pmid_missed) {
-		nmissed += hr[r]->vset[1]->vlist[0].value.lval;
-	    }
+    if ((nrecords = pmEventIterInit(&iter, vsp, index)) < 0)
+	return;
+    if (nrecords == 0) {
+	printf("No event records\n");
+	return;
+    }
+    while (pmEventIterNext(&iter))
+	nmissed += iter.ei_missed;
+    dump_nrecords(nrecords, nmissed);
+
+    pmEventIterInit(&iter, vsp, index);
+    for (r = 0; pmEventIterNext(&iter); r++) {
+	printf("        --- event record [%d] timestamp ", r);
+	if (highres) {
+	    struct timespec	ts;
+
+	    ts.tv_sec = iter.ei_timestamp.tv_sec;
+	    ts.tv_nsec = iter.ei_timestamp.tv_nsec;
+	    pmPrintHighResStamp(stdout, &ts);
 	}
-	dump_nrecords(nrecords, nmissed);
-
-	for (r = 0; r < nrecords; r++) {
-	    printf("        --- event record [%d] timestamp ", r);
-	    pmPrintHighResStamp(stdout, &hr[r]->timestamp);
-	    if (dump_nparams(hr[r]->numpmid) < 0)
-		continue;
-	    flags = 0;
-	    for (p = 0; p < hr[r]->numpmid; p++)
-		dump_parameter(hr[r]->vset[p], p, &flags);
+	else {
+	    pmtv.tv_sec = iter.ei_timestamp.tv_sec;
+	    pmtv.tv_usec = iter.ei_timestamp.tv_nsec / 1000;
+	    __pmPrintTimeval(stdout, &pmtv);
 	}
-	pmFreeHighResEventResult(hr);
-    }
-    else {
-	pmResult	**res;
-
-	if ((nrecords = pmUnpackEventRecords(vsp, index, &res)) < 0)
-	    return;
-	if (nrecords == 0) {
-	    printf("No event records\n");
-	    pmFreeEventResult(res);
-	    return;
+	/*
+	 * count parameters the way pmUnpackEventRecords() reports them,
+	 * i.e. with event.flags (and event.missed) as leading parameters
+	 */
+	nparams = iter.ei_nparams;
+	if (iter.ei_flags & PM_EVENT_FLAG_MISSED)
+	    nparams = 2;
+	else if (iter.ei_flags)
+	    nparams++;
+	if (dump_nparams(nparams) < 0)
+	    continue;
+	if (iter.ei_flags) {
+	    printf(" flags 0x%x", iter.ei_flags);
+	    printf(" (%s) ---\n", pmEventFlagsStr(iter.ei_flags));
 	}
-	setup_event_derived_metrics();
-
-	for (r = 0; r < nrecords; r++) {
-	    if (res[r]->numpmid == 2 && res[r]->vset[0]->pmid == pmid_flags &&
-		(res[r]->vset[0]->vlist[0].value.lval & PM_EVENT_FLAG_MISSED) &&
-		res[r]->vset[1]->pmid == pmid_missed) {
-		nmissed += res[r]->vset[1]->vlist[0].value.lval;
-	    }
+	else
+	    printf(" ---\n");
+	if (iter.ei_flags & PM_EVENT_FLAG_MISSED) {
+	    printf("        ==> %d missed event records\n", iter.ei_missed);
+	    continue;
 	}
-	dump_nrecords(nrecords, nmissed);
-
-	for (r = 0; r < nrecords; r++) {
-	    printf("        --- event record [%d] timestamp ", r);
-	    pmtv.tv_sec = res[r]->timestamp.tv_sec;
-	    pmtv.tv_usec = res[r]->timestamp.tv_usec;
-	    __pmPrintTimeval(stdout, &pmtv);
-	    if (dump_nparams(res[r]->numpmid) < 0)
-		continue;
-	    flags = 0;
-	    for (p = 0; p < res[r]->numpmid; p++)
-		dump_parameter(res[r]->vset[p], p, &flags);
+	while ((sts = pmEventIterParam(&iter, &xvs)) != 0) {
+	    if (sts < 0)
+		printf("        Error: %s\n", pmErrStr(sts));
+	    else
+		dump_parameter(&xvs);
 	}
-	pmFreeEventResult(res);
     }
 }
 
@@ -440,6 +384,114 @@ next:
     }
 }
 
+static int
+isnumeric(int type)
+{
+    return type == PM_TYPE_32 || type == PM_TYPE_U32 ||
+	   type == PM_TYPE_64 || type == PM_TYPE_U64 ||
+	   type == PM_TYPE_FLOAT || type == PM_TYPE_DOUBLE;
+}
+
+/* append numeric values from one archive record to the Arrow batch */
+static void
+arrow_result(pmResult *resp)
+{
+    int		i;
+    int		j;
+    int		sts;
+    pmDesc	desc;
+    pmAtomValue	av;
+    pmValueSet	*vsp;
+
+    for (i = 0; i < resp->numpmid; i++) {
+	vsp = resp->vset[i];
+	if (vsp->numval <= 0)
+	    continue;
+	if (pmLookupDesc(vsp->pmid, &desc) < 0 || !isnumeric(desc.type))
+	    continue;
+	for (j = 0; j < vsp->numval; j++) {
+	    if (pmExtractValue(vsp->valfmt, &vsp->vlist[j], desc.type, &av, PM_TYPE_DOUBLE) < 0)
+		continue;
+	    arrow_append(arrow, &resp->timestamp, vsp->pmid, vsp->vlist[j].inst, av.d);
+	}
+    }
+    if ((sts = arrow_end_record(arrow)) < 0) {
+	fprintf(stderr, "%s: Arrow output failed: %s\n", pmGetProgname(), pmErrStr(sts));
+	exit(1);
+    }
+}
+
+static void
+addmeta(const char *key, const char *value)
+{
+    size_t	size = (nmeta + 1) * sizeof(char *);
+
+    if ((metakeys = (char **)realloc(metakeys, size)) == NULL ||
+	(metavalues = (char **)realloc(metavalues, size)) == NULL)
+	pmNoMem("addmeta", size, PM_FATAL_ERR);
+    if ((metakeys[nmeta] = strdup(key)) == NULL ||
+	(metavalues[nmeta] = strdup(value)) == NULL)
+	pmNoMem("addmeta", strlen(key) + strlen(value), PM_FATAL_ERR);
+    nmeta++;
+}
+
+/*
+ * name each numeric metric in the schema, keyed by the same number as
+ * the pmid column, so pmid values can be mapped without decoding
+ */
+static void
+arrow_metric(pmID id, const char *name)
+{
+    pmDesc	desc;
+    char	key[32];
+
+    if (pmLookupDesc(id, &desc) < 0 || !isnumeric(desc.type))
+	return;
+    if (__pmHashSearch(id, &arrowpmids) != NULL)
+	return;
+    __pmHashAdd(id, NULL, &arrowpmids);
+    pmsprintf(key, sizeof(key), "pcp.metric.%u", (unsigned int)id);
+    addmeta(key, name);
+}
+
+static void
+arrow_name(const char *name)
+{
+    pmID	id;
+
+    if (pmLookupName(1, (char **)&name, &id) >= 0)
+	arrow_metric(id, name);
+}
+
+static void
+arrow_start(const char *file)
+{
+    FILE	*f;
+    char	*name;
+    int		i;
+
+    if (strcmp(file, "-") == 0)
+	f = stdout;
+    else if ((f = fopen(file, "w")) == NULL) {
+	fprintf(stderr, "%s: Cannot create \"%s\": %s\n", pmGetProgname(), file, osstrerror());
+	exit(1);
+    }
+    addmeta("pcp.archive", opts.archives[0]);
+    addmeta("pcp.hostname", label.ll_hostname);
+    addmeta("pcp.timezone", label.ll_tz);
+    if (numpmid > 0) {
+	for (i = 0; i < numpmid; i++) {
+	    if (pmNameID(pmid[i], &name) < 0)
+		continue;
+	    arrow_metric(pmid[i], name);
+	    free(name);
+	}
+    }
+    else
+	pmTraversePMNS("", arrow_name);
+    arrow = arrow_create(f, nmeta, metakeys, metavalues);
+}
+
 static void
 dumpDesc(__pmContext *ctxp)
 {
@@ -951,6 +1003,7 @@ main(int argc, char *argv[])
     int			c;
     int			sts;
     char		*rawfile = NULL;
+    char		*arrowfile = NULL;
     int			i;
     int			ctxid;
     int			first = 1;
@@ -1011,6 +1064,11 @@ main(int argc, char *argv[])
 	    Mflag = 1;
 	    break;
 
+	case 'o':	/* metric values in Arrow format */
+	    arrowfile = opts.optarg;
+	    mflag = 1;
+	    break;
+
 	case 'r':	/* read log in reverse chornological order */
 	    mode = PM_MODE_BACK;
 	    break;
@@ -1035,6 +1093,14 @@ main(int argc, char *argv[])
 	}
     }
 
+    /* Arrow data on stdout cannot be mixed with any text reports */
+    if (arrowfile != NULL && strcmp(arrowfile, "-") == 0 &&
+	dflag + eflag + hflag + iflag + lflag + sflag + tflag > 0) {
+	pmprintf("%s: -o - cannot be used with -a, -d, -e, -h, -i, -l, -L, -s or -t\n",
+		pmGetProgname());
+	opts.errors++;
+    }
+
     if (opts.errors ||
 	(opts.flags & PM_OPTFLAG_EXIT) ||
 	(vflag && opts.optind != argc) ||
@@ -1071,6 +1137,9 @@ main(int argc, char *argv[])
 	exit(1);
     }
 
+    if (arrowfile != NULL && strcmp(arrowfile, "-") == 0)
+	opts.flags &= ~PM_OPTFLAG_STDOUT_TZ;	/* no -z note in the Arrow data */
+
     if ((sts = ctxid = pmNewContext(PM_CONTEXT_ARCHIVE, opts.archives[0])) < 0) {
 	fprintf(stderr, "%s: Cannot open archive \"%s\": %s\n",
 		pmGetProgname(), opts.archives[0], pmErrStr(sts));
@@ -1191,6 +1260,8 @@ main(int argc, char *argv[])
 	    fprintf(stderr, "%s: pmSetMode: %s\n", pmGetProgname(), pmErrStr(sts));
 	    exit(1);
 	}
+	if (arrowfile)
+	    arrow_start(arrowfile);
 	sts = 0;
 	for ( ; ; ) {
 	    sts = __pmLogFetch(ctxp, 0, NULL, &raw_result);
@@ -1243,7 +1314,7 @@ main(int argc, char *argv[])
 		pmFreeResult(raw_result);
 		continue;
 	    }
-	    if (first && mode == PM_MODE_BACK) {
+	    if (first && mode == PM_MODE_BACK && arrow == NULL) {
 		first = 0;
 		printf("\nLog finished at %24.24s - dump in reverse order\n",
 			pmCtime((const time_t *)&result->timestamp.tv_sec, timebuf));
@@ -1253,14 +1324,22 @@ main(int argc, char *argv[])
 		sts = PM_ERR_EOL;
 		break;
 	    }
-	    putchar('\n');
-	    dump_result(result);
+	    if (arrow)
+		arrow_result(result);
+	    else {
+		putchar('\n');
+		dump_result(result);
+	    }
 	    pmFreeResult(raw_result);
 	}
 	if (sts != PM_ERR_EOL) {
 	    fprintf(stderr, "%s: pmFetch: %s\n", pmGetProgname(), pmErrStr(sts));
 	    exit(1);
 	}
+	if (arrow && (sts = arrow_finish(arrow)) < 0) {
+	    fprintf(stderr, "%s: Arrow output failed: %s\n", pmGetProgname(), pmErrStr(sts));
+	    exit(1);
+	}
     }
 
     exit(0);
@@ -70,6 +70,8 @@ int		dowrap;				/* counter wrap? default no */
 int		doexit;				/* time to exit stage left? */
 int		dorotate;			/* is a log rotation pending? */
 int		inrun;				/* parsing done, in run() */
+int		fetchThreads;			/* concurrent host fetches, -F */
+int		replay;				/* fast archive replay, -R */
 pmiestats_t	*perf;				/* live performance data */
 pmiestats_t	instrument;			/* used if no mmap (archive) */
 
@@ -80,6 +82,7 @@ pmiestats_t	instrument;			/* used if no mmap (archive) */
 
 Task		*taskq = NULL;		/* evaluator task queue */
 Expr		*curr;			/* current executing rule expression */
+unsigned int	evalSeq;		/* Task evaluation sequence number */
 
 SymbolTable	hosts;			/* currently known hosts */
 SymbolTable	metrics;		/* currently known metrics */
@@ -600,7 +603,10 @@ freeFetch(Fetch *f)
 	    freeHost(f->host);
 	}
 	pmDestroyContext(f->handle);
-	if (f->result) pmFreeResult(f->result);
+	if (replay)
+	    replayFree(f);
+	else if (f->result)
+	    pmFreeResult(f->result);
 	if (f->pmids) free(f->pmids);
 	free(f);
     }
@@ -675,6 +681,7 @@ freeExpr(Expr *x)
 	    free(x->metrics);
 	}
 	if (x->ring) free(x->ring);
+	if (x->sharers) free(x->sharers);
 	free(x);
     }
 }
@@ -763,12 +770,22 @@ changeSmpls(Expr **p, int nsmpls)
 }
 
 
+/* record another parent of a common subexpression */
+void
+addSharer(Expr *x, Expr *parent)
+{
+    x->sharers = (Expr **) ralloc(x->sharers, (x->nsharers + 1) * sizeof(Expr *));
+    x->sharers[x->nsharers++] = parent;
+}
+
+
 /* propagate instance domain, semantics and units from
    argument expressions to parents */
 static void
 instExpr(Expr *x)
 {
     int	    up = 0;
+    int	    i;
     Expr    *arg1 = x->arg1;
     Expr    *arg2 = x->arg2;
     Expr    *arg = primary(arg1, arg2);
@@ -838,8 +855,12 @@ instExpr(Expr *x)
 	newRingBfr(x);
     }
 
-    if (up && x->parent)
-	instExpr(x->parent);
+    if (up) {
+	if (x->parent)
+	    instExpr(x->parent);
+	for (i = 0; i < x->nsharers; i++)
+	    instExpr(x->sharers[i]);
+    }
 }
 
 
@@ -849,6 +870,7 @@ void
 instFetchExpr(Expr *x)
 {
     Metric  *m;
+    Expr    *p;
     int     ninst;
     int	    up = 0;
     int     i;
@@ -902,12 +924,13 @@ instFetchExpr(Expr *x)
 	newRingBfr(x);
 	up = 1;
     }
-    if (x->parent) {
-	/* do we need to propagate changes? */
-	if (up ||
-	    (UNITS_UNKNOWN(x->parent->units) && !UNITS_UNKNOWN(x->units))) {
-	    instExpr(x->parent);
-	}
+    /* do we need to propagate changes? */
+    for (i = -1; i < x->nsharers; i++) {
+	p = (i < 0) ? x->parent : x->sharers[i];
+	if (p == NULL)
+	    continue;
+	if (up || (UNITS_UNKNOWN(p->units) && !UNITS_UNKNOWN(x->units)))
+	    instExpr(p);
     }
 }
 
@@ -107,10 +107,13 @@ typedef struct expr {
     struct expr	    *arg1;	/* NULL || (Expr *) */
     struct expr     *arg2;	/* NULL || (Expr *) */
     struct expr	    *parent;	/* parent of this Expr */
+    struct expr	    **sharers;	/* other parents, if a common subexpr */
+    int		    nsharers;	/* number of other parents */
 
     /* evaluator */
     Eval	    *eval;	/* evaluator function */
     int		    valid;	/* number of valid samples */
+    unsigned int    seq;	/* last evaluation, if shared */
 
     /* description of value matrix */
     int		    hdom;	/* cardinality of host dimension */
@@ -185,6 +188,9 @@ typedef struct fetch {
     int		   npmids;	/* number of metrics in fetch */
     pmID	   *pmids;	/* array of metric ids to fetch */
     pmResult       *result;     /* result of fetch */
+    int		   status;	/* pmFetch status, concurrent fetches */
+    int		   nreplay;	/* allocated result and stamps (-R) */
+    RealTime	   *stamps;	/* time stamp of each held value (-R) */
 } Fetch;
 
 /* set of bundled fetches for single host (may be archive or live):
@@ -211,6 +217,7 @@ typedef struct task {
     RealTime      delta;	/* sample interval */
     TickTime      tick;		/* count up deltas */
     RealTime      eval;		/* scheduled evaluation time */
+    unsigned long long sched;	/* order of scheduling, for equal eval */
     RealTime	  retry;	/* delta for retry down Hosts and Metrics */
     int		  nrules;	/* number of rules in this task */
     Symbol	  *rules;	/* array of rules to be evaluated */
@@ -312,6 +319,7 @@ typedef struct archive {
     char            *hname;	/* host name */
     RealTime	    first;	/* timestamp for first pmResult */
     RealTime	    last;	/* timestamp for last pmResult */
+    struct replay   *replay;	/* sequential record reader (-R) */
 } Archive;
 
 
@@ -356,6 +364,7 @@ void rotate(Expr *);
 
 Expr *primary(Expr *, Expr *);
 void changeSmpls(Expr **, int);
+void addSharer(Expr *, Expr *);
 void instFetchExpr(Expr *);
 char *getStringValue(Expr *, int);
 
@@ -414,6 +423,8 @@ extern int	   dowrap;	/* counter wrap? default no */
 extern int	   doexit;	/* signalled its time to exit */
 extern int	   dorotate;	/* log rotation was requested */
 extern int	   inrun;	/* parsing done, in run() */
+extern int	   fetchThreads; /* concurrent host fetch threads */
+extern int	   replay;	/* fast sequential archive replay (-R) */
 extern pmiestats_t *perf;	/* pmie performance data ptr */
 extern pmiestats_t instrument;	/* pmie performance data struct */
 
@@ -425,6 +436,7 @@ extern SymbolTable metrics;	/* currently known metrics */
 
 extern Task	   *taskq;	/* evaluator task queue */
 extern Expr	   *curr;	/* current executing rule expression */
+extern unsigned int evalSeq;	/* Task evaluation sequence number */
 
 extern RealTime	   now;		/* current time */
 extern RealTime    start;	/* start evaluation */
@@ -31,37 +31,67 @@
  * scheduling
  ***********************************************************************/
 
+/*
+ * Tasks waiting for evaluation are kept in a binary heap, ordered on
+ * scheduled evaluation time.  Of Tasks due at the same time, the one
+ * (re)scheduled most recently goes first.  taskq remains the list of
+ * all Tasks, in syntactic order.
+ */
+static Task		**heap;		/* heap[0] is the next Task due */
+static int		heapsize;	/* allocated heap entries */
+static int		nheap;		/* Tasks in the heap */
+static unsigned long long schedseq;	/* count of Tasks scheduled */
+
+/* is Task a due for evaluation before Task b? */
+static int
+before(Task *a, Task *b)
+{
+    if (a->eval != b->eval)
+	return a->eval < b->eval;
+    return a->sched > b->sched;
+}
+
 /* enter Task into task queue */
 static void
 enque(Task *t)
 {
-    Task	*q;
+    int		i, j;
 
-    q = taskq;
-    if (q == NULL) {
-	taskq = t;
-	t->next = NULL;
-	t->prev = NULL;
+    if (nheap == heapsize) {
+	heapsize = heapsize ? heapsize * 2 : 16;
+	heap = (Task **)ralloc(heap, heapsize * sizeof(Task *));
     }
-    else {
-	while (q) {
-	    if (t->eval <= q->eval) {
-		t->next = q;
-		t->prev = q->prev;
-		if (q->prev) q->prev->next = t;
-		else taskq = t;
-		q->prev = t;
-		break;
-	    }
-	    if (q->next == NULL) {
-		q->next = t;
-		t->next = NULL;
-		t->prev = q;
-		break;
-	    }
-	    q = q->next;
-	}
+    t->sched = ++schedseq;
+    for (i = nheap++; i > 0; i = j) {
+	j = (i - 1) / 2;
+	if (!before(t, heap[j]))
+	    break;
+	heap[i] = heap[j];
+    }
+    heap[i] = t;
+}
+
+/* remove next Task due from task queue */
+static Task *
+deque(void)
+{
+    Task	*t;
+    Task	*last;
+    int		i, j;
+
+    if (nheap == 0)
+	return NULL;
+    t = heap[0];
+    last = heap[--nheap];
+    for (i = 0; (j = 2 * i + 1) < nheap; i = j) {
+	if (j + 1 < nheap && before(heap[j + 1], heap[j]))
+	    j++;
+	if (!before(heap[j], last))
+	    break;
+	heap[i] = heap[j];
     }
+    heap[i] = last;
+    return t;
 }
 
 
@@ -203,6 +233,7 @@ eval(Task *task)
 {
     Symbol	*s;
     pmValueSet  *vset;
+    RealTime	drift;
     int		i;
 
     if (pmDebugOptions.appl2) {
@@ -210,7 +241,12 @@ eval(Task *task)
 	dumpTask(task);
     }
 
+    /* how late are we, relative to the scheduled evaluation time? */
+    if (!archives && (drift = getReal() - task->eval) > 0)
+	perf->eval_drift += (unsigned long long)(drift * 1000000);
+
     /* fetch metrics */
+    evalSeq++;
     taskFetch(task);
 
     /* evaluate rule expressions */
@@ -823,11 +859,41 @@ findEval(Expr *x)
 }
 
 
+/*
+ * fast archive replay (-R) - no timers or interpolation, each Task is
+ * evaluated at the first archive record carrying any of its metrics
+ * once its delta has elapsed
+ */
+static void
+replayRun(void)
+{
+    Archive	*a;
+    Task	*t;
+    RealTime	stamp;
+
+    replayInit();
+    while (replayRecord(&a, &stamp) && stamp <= stop) {
+	for (t = taskq; t != NULL; t = t->next) {
+	    if (t->eval > stamp || (!waiting(t) && !replayFresh(t, a)))
+		continue;
+	    now = stamp;
+	    if (waiting(t))
+		enable(t);
+	    reflectTime(t->delta);
+	    eval(t);
+	    t->tick = (TickTime)((stamp - t->epoch) / t->delta) + 1;
+	    t->eval = t->epoch + t->tick * t->delta;
+	}
+    }
+}
+
+
 /* run evaluator */
 void
 run(void)
 {
     Task	*t;
+    RealTime	begin;
 
     /* empty task queue */
     if (taskq == NULL)
@@ -847,9 +913,17 @@ run(void)
 	t = t->next;
     }
 
+    if (replay)
+	replayRun();
+
     /* evaluate and reschedule */
-    t = taskq;
-    for (;;) {
+    nheap = 0;
+    for (t = taskq; t->next; t = t->next)
+	;
+    for (; t; t = t->prev)	/* so that the first in taskq goes first */
+	enque(t);
+    t = deque();
+    while (!replay) {
 	now = t->eval;
 	if (now > stop)
 	    break;
@@ -880,10 +954,10 @@ run(void)
 	    t->tick++;
 	    t->eval = t->epoch + t->tick * t->delta;
 	}
-	taskq = t->next;
-	if (taskq) taskq->prev = NULL;
+	begin = getReal();
 	enque(t);
-	t = taskq;
+	t = deque();
+	perf->eval_sched += (unsigned long long)((getReal() - begin) * 1000000);
     }
 
     if (!quiet)
@@ -25,7 +25,20 @@
 #include "andor.h"
 
 #define ROTATE(x)  if ((x)->nsmpls > 1) rotate(x);
-#define EVALARG(x) if ((x)->op < NOP) ((x)->eval)(x);
+/* common subexpressions (nsharers > 0) are evaluated once per Task */
+#define EVALARG(x) if ((x)->op < NOP && \
+		       ((x)->nsharers == 0 || (x)->seq != evalSeq)) { \
+			(x)->seq = evalSeq; ((x)->eval)(x); }
+
+/*
+ * operand and result sample buffers never overlap, so the per-instance
+ * loops in the skeletons can be vectorized by the compiler
+ */
+#if defined(__GNUC__)
+#define RESTRICT __restrict__
+#else
+#define RESTRICT
+#endif
 
 /* expression evaluator function prototypes */
 void rule(Expr *);
@@ -98,7 +98,9 @@ static pmLongOptions longopts[] = {
     { "interact", 0, 'd', 0, "interactive debugging mode" },
     { "primary", 0, 'P', 0, "execute as primary inference engine" },
     { "foreground", 0, 'f', 0, "run in the foreground, not as a daemon" },
+    { "fetchthreads", 1, 'F', "N", "fetch from up to N hosts concurrently [default 0]" },
     { "", 0, 'H', NULL }, /* was: no DNS lookup on the default hostname */
+    { "replay", 0, 'R', 0, "fast sequential replay of archives, no interpolation" },
     { "", 1, 'j', "FILE", "stomp protocol (JMS) file" },
     { "logfile", 1, 'l', "FILE", "send status and error messages to FILE" },
     { "username", 1, 'U', "USER", "run as named USER in daemon mode [default pcp]" },
@@ -116,7 +118,7 @@ static pmLongOptions longopts[] = {
 
 static pmOptions opts = {
     .flags = PM_OPTFLAG_STDOUT_TZ,
-    .short_options = "a:A:bc:CdD:efHh:j:l:n:O:PqS:t:T:U:vVWXxzZ:?",
+    .short_options = "a:A:bc:CdD:efF:Hh:j:l:n:O:PqRS:t:T:U:vVWXxzZ:?",
     .long_options = longopts,
     .short_usage = "[options] [filename ...]",
     .override = override,
@@ -376,7 +378,7 @@ startmonitor(void)
     strncpy(perf->defaultfqdn, "(uninitialized)", sizeof(perf->defaultfqdn));
     perf->defaultfqdn[sizeof(perf->defaultfqdn)-1] = '\0';
 
-    perf->version = 1;
+    perf->version = PMIESTATS_VERSION;
 }
 
 
@@ -467,6 +469,7 @@ getargs(int argc, char *argv[])
     char		*subopts;
     char		*subopt;
     char		*msg;
+    char		*endnum;
     int			checkFlag = 0;
     int			foreground = 0;
     int			primary = 0;
@@ -547,6 +550,19 @@ getargs(int argc, char *argv[])
 	    foreground = 1;
 	    break;
 
+	case 'F':			/* concurrent host fetch threads */
+	    fetchThreads = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || fetchThreads < 0) {
+		pmprintf("%s: -F requires a non-negative thread count\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+
+	case 'R':			/* fast archive replay */
+	    replay = 1;
+	    break;
+
 	case 'P':			/* primary (local) pmie process */
 	    primary = 1;
 	    isdaemon = 1;
@@ -643,6 +659,10 @@ getargs(int argc, char *argv[])
 	dfltConn = opts.context = PM_CONTEXT_HOST;
 	dfltHostConn = opts.hosts[c];
     }
+    if (replay && !archives) {
+	fprintf(stderr, "%s: -R requires archives (-a)\n", pmGetProgname());
+	exit(1);
+    }
 
     if (foreground)
 	isdaemon = 0;
@@ -25,6 +25,7 @@
 
 #include <math.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "pmapi.h"
 #include "libpcp.h"
 #include "dstruct.h"
@@ -450,9 +451,11 @@ bundle(Task *t, Expr *x)
 	}
     }
     else {
+	/* common subexpressions are bundled once, by their first parent */
 	if (x->arg1) {
-	    bundle(t, x->arg1);
-	    if (x->arg2)
+	    if (x->arg1->nsharers == 0 || x->arg1->parent == x)
+		bundle(t, x->arg1);
+	    if (x->arg2 && (x->arg2->nsharers == 0 || x->arg2->parent == x))
 		bundle(t, x->arg2);
 	}
     }
@@ -649,6 +652,69 @@ scale(pmUnits in)
     return f;
 }
 
+/*
+ * reshape x and then each expression using it (the parent and any
+ * other sharers of a common subexpression), returning the count of
+ * expressions reshaped
+ */
+static int
+reshapeExpr(Expr *x)
+{
+    Expr	*p;
+    int		reshape = 0;
+    int		i;
+
+    /*
+     * only reshape expressions that may have set values
+     */
+    if (x->op == CND_FETCH ||
+	x->op == CND_NEG || x->op == CND_ADD || x->op == CND_SUB ||
+	x->op == CND_MUL || x->op == CND_DIV ||
+	x->op == CND_SUM_HOST || x->op == CND_SUM_INST ||
+	x->op == CND_SUM_TIME ||
+	x->op == CND_AVG_HOST || x->op == CND_AVG_INST ||
+	x->op == CND_AVG_TIME ||
+	x->op == CND_MAX_HOST || x->op == CND_MAX_INST ||
+	x->op == CND_MAX_TIME ||
+	x->op == CND_MIN_HOST || x->op == CND_MIN_INST ||
+	x->op == CND_MIN_TIME ||
+	x->op == CND_EQ || x->op == CND_NEQ ||
+	x->op == CND_LT || x->op == CND_LTE ||
+	x->op == CND_GT || x->op == CND_GTE ||
+	x->op == CND_NOT || x->op == CND_AND || x->op == CND_OR ||
+	x->op == CND_RISE || x->op == CND_FALL || x->op == CND_INSTANT ||
+	x->op == CND_MATCH || x->op == CND_NOMATCH) {
+	reshape++;
+	instFetchExpr(x);
+	findEval(x);
+	if (pmDebugOptions.appl1) {
+	    fprintf(stderr, "reinitMetric: reshaped ...\n");
+	    dumpExpr(x);
+	}
+    }
+
+    for (i = -1; i < x->nsharers; i++) {
+	if ((p = (i < 0) ? x->parent : x->sharers[i]) == NULL)
+	    continue;		/* x is root of expression tree */
+	/*
+	 * used to stop if p->metrics != m, but this is wrong
+	 * when the same metric is used as the left and right
+	 * operator (with different instance specifiers), e.g.
+	 * all_inst(foo == foo #'magic') ...
+	 */
+	;
+	/* 
+	 * if operand is a set -> scalar function, like
+	 * CND_COUNT_INST, don't propagate instance reshaping
+	 * further up the tree
+	 */
+	if (isScalarResult(p))
+	    continue;
+	reshape += reshapeExpr(p);
+    }
+    return reshape;
+}
+
 /*
  * initialize / reinitialize Metric (m)
  * reinit is 0 for init case, 1 for reinit case
@@ -848,57 +914,8 @@ init(Metric *m, int reinit)
 	 * we reach the top of the tree or the designated metrics
 	 * associated with the node are not the same
 	 */
-	Expr	*x = m->expr;
-	int	reshape = 0;
-	while (x) {
-	    /*
-	     * only reshape expressions that may have set values
-	     */
-	    if (x->op == CND_FETCH ||
-		x->op == CND_NEG || x->op == CND_ADD || x->op == CND_SUB ||
-		x->op == CND_MUL || x->op == CND_DIV ||
-		x->op == CND_SUM_HOST || x->op == CND_SUM_INST ||
-		x->op == CND_SUM_TIME ||
-		x->op == CND_AVG_HOST || x->op == CND_AVG_INST ||
-		x->op == CND_AVG_TIME ||
-		x->op == CND_MAX_HOST || x->op == CND_MAX_INST ||
-		x->op == CND_MAX_TIME ||
-		x->op == CND_MIN_HOST || x->op == CND_MIN_INST ||
-		x->op == CND_MIN_TIME ||
-		x->op == CND_EQ || x->op == CND_NEQ ||
-		x->op == CND_LT || x->op == CND_LTE ||
-		x->op == CND_GT || x->op == CND_GTE ||
-		x->op == CND_NOT || x->op == CND_AND || x->op == CND_OR ||
-		x->op == CND_RISE || x->op == CND_FALL || x->op == CND_INSTANT ||
-		x->op == CND_MATCH || x->op == CND_NOMATCH) {
-		reshape++;
-		instFetchExpr(x);
-		findEval(x);
-		if (pmDebugOptions.appl1) {
-		    fprintf(stderr, "reinitMetric: reshaped ...\n");
-		    dumpExpr(x);
-		}
-	    }
-	    if (x->parent) {
-		x = x->parent;
-		/*
-		 * used to stop if x->metrics != m, but this is wrong
-		 * when the same metric is used as the left and right
-		 * operator (with different instance specifiers), e.g.
-		 * all_inst(foo == foo #'magic') ...
-		 */
-		;
-		/* 
-		 * if operand is a set -> scalar function, like
-		 * CND_COUNT_INST, don't propagate instance reshaping
-		 * further up the tree
-		 */
-		if (isScalarResult(x))
-		    break;
-	    }
-	    else
-		break;		/* x is root of expression tree */
-	}
+	Expr	*x;
+	int	reshape = reshapeExpr(m->expr);
 	if (reshape && pmDebugOptions.appl1 && pmDebugOptions.desperate) {
 	    x = m->expr;
 	    while (x->parent)
@@ -1012,6 +1029,405 @@ mark_all(Host *hdown)
     }
 }
 
+/*
+ * Concurrent fetching (live mode, -F) - a pool of threads issue the
+ * fetches for every host of a Task at once, so that one tick costs
+ * the slowest host's round trip rather than the sum of all of them.
+ * libpcp tracks the current context per-thread, so each fetch thread
+ * simply switches to the context of the Fetch it claims.  Failures
+ * are handled afterwards, serially, by the evaluator thread.
+ */
+static pthread_mutex_t	fetchlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	fetchwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	fetchdone = PTHREAD_COND_INITIALIZER;
+static Fetch		**fetchq;	/* fetches for the current Task */
+static int		fetchqsize;	/* allocated fetchq entries */
+static int		fetchqlen;	/* fetches queued this round */
+static int		fetchnext;	/* next unclaimed fetchq entry */
+static int		fetchbusy;	/* fetches not yet completed */
+static int		nfetchers;	/* fetch threads started */
+
+static void *
+fetchWorker(void *arg)
+{
+    Fetch	*f;
+
+    (void)arg;
+    pthread_mutex_lock(&fetchlock);
+    for (;;) {
+	while (fetchnext >= fetchqlen)
+	    pthread_cond_wait(&fetchwork, &fetchlock);
+	f = fetchq[fetchnext++];
+	pthread_mutex_unlock(&fetchlock);
+
+	if ((f->status = pmUseContext(f->handle)) >= 0)
+	    f->status = pmFetch(f->npmids, f->pmids, &f->result);
+	if (f->status < 0)
+	    f->result = NULL;
+
+	pthread_mutex_lock(&fetchlock);
+	if (--fetchbusy == 0)
+	    pthread_cond_signal(&fetchdone);
+    }
+    return NULL;
+}
+
+/* start fetch threads on demand, returns non-zero if any are running */
+static int
+fetchStart(int count)
+{
+    pthread_t	tid;
+    int		sts;
+
+    if (count > fetchThreads)
+	count = fetchThreads;
+    while (nfetchers < count) {
+	if ((sts = pthread_create(&tid, NULL, fetchWorker, NULL)) != 0) {
+	    pmNotifyErr(LOG_WARNING, "cannot start fetch thread: %s\n",
+			strerror(sts));
+	    break;
+	}
+	pthread_detach(tid);
+	nfetchers++;
+    }
+    return nfetchers;
+}
+
+/* issue all fetches for live hosts of given Task, wait for completion */
+static int
+fetchConcurrent(Task *t)
+{
+    Host	*h;
+    Fetch	*f;
+    Fetch	**q;
+    int		n = 0;
+
+    for (h = t->hosts; h; h = h->next) {
+	for (f = h->fetches; f; f = f->next) {
+	    if (f->result) pmFreeResult(f->result);
+	    f->result = NULL;
+	    f->status = 0;
+	    if (!h->down)
+		n++;
+	}
+    }
+    if (n == 0)
+	return 1;
+    if (n > fetchqsize) {
+	if ((q = realloc(fetchq, n * sizeof(Fetch *))) == NULL)
+	    return 0;
+	fetchq = q;
+	fetchqsize = n;
+    }
+    if (fetchStart(n) == 0)
+	return 0;
+
+    pthread_mutex_lock(&fetchlock);
+    fetchqlen = fetchnext = 0;
+    for (h = t->hosts; h; h = h->next) {
+	if (h->down)
+	    continue;
+	for (f = h->fetches; f; f = f->next)
+	    fetchq[fetchqlen++] = f;
+    }
+    fetchbusy = fetchqlen;
+    pthread_cond_broadcast(&fetchwork);
+    while (fetchbusy > 0)
+	pthread_cond_wait(&fetchdone, &fetchlock);
+    fetchqlen = fetchnext = 0;
+    pthread_mutex_unlock(&fetchlock);
+    return 1;
+}
+
+/*
+ * Fast archive replay (-R) - rather than interpolating every Fetch at
+ * each Task's delta, each archive is read sequentially, just once, and
+ * the most recent value of every metric in it is held.  A reader thread
+ * per archive decodes records ahead of the evaluator, which merges the
+ * archives in time order and builds Fetch results from the held values.
+ */
+#define REPLAY_AHEAD	64	/* records decoded ahead, per archive */
+
+typedef struct {
+    pmResult	*rslt;		/* archive record */
+    int		refs;		/* held values still referring to it */
+} Record;
+
+typedef struct {
+    pmValueSet	*vset;		/* most recent values of a metric */
+    Record	*rec;		/* record containing vset */
+    RealTime	stamp;		/* time stamp of that record */
+} Held;
+
+struct replay {
+    int			handle;		/* PM_MODE_FORW context */
+    pthread_mutex_t	lock;
+    pthread_cond_t	cond;		/* queue state changed */
+    pmResult		*queue[REPLAY_AHEAD];
+    int			head;		/* oldest queued record */
+    int			count;		/* records queued */
+    int			done;		/* reader has stopped, with ... */
+    int			sts;		/* ... this pmFetchArchive status */
+    __pmHashCtl		held;		/* Held values, by pmID */
+    RealTime		stamp;		/* time stamp of latest record */
+};
+
+static void *
+replayReader(void *arg)
+{
+    struct replay	*rp = (struct replay *)arg;
+    pmResult		*r;
+    int			sts;
+
+    sts = pmUseContext(rp->handle);
+    while (sts >= 0) {
+	if ((sts = pmFetchArchive(&r)) < 0)
+	    break;
+	pthread_mutex_lock(&rp->lock);
+	while (rp->count == REPLAY_AHEAD)
+	    pthread_cond_wait(&rp->cond, &rp->lock);
+	rp->queue[(rp->head + rp->count) % REPLAY_AHEAD] = r;
+	rp->count++;
+	pthread_cond_broadcast(&rp->cond);
+	pthread_mutex_unlock(&rp->lock);
+    }
+
+    pthread_mutex_lock(&rp->lock);
+    rp->sts = sts;
+    rp->done = 1;
+    pthread_cond_broadcast(&rp->cond);
+    pthread_mutex_unlock(&rp->lock);
+    return NULL;
+}
+
+/* open a sequential context for each archive, start its reader */
+void
+replayInit(void)
+{
+    Archive		*a;
+    struct replay	*rp;
+    struct timeval	tv;
+    pthread_t		tid;
+    int			sts;
+
+    pmtimevalFromReal(start, &tv);
+    for (a = archives; a != NULL; a = a->next) {
+	rp = (struct replay *)zalloc(sizeof(struct replay));
+	if ((rp->handle = pmNewContext(PM_CONTEXT_ARCHIVE, a->fname)) < 0) {
+	    fprintf(stderr, "%s: cannot open archive %s\n"
+		    "pmNewContext: %s\n", pmGetProgname(), a->fname,
+		    pmErrStr(rp->handle));
+	    exit(1);
+	}
+	if ((sts = pmSetMode(PM_MODE_FORW, &tv, 0)) < 0) {
+	    fprintf(stderr, "%s: pmSetMode failed: %s\n", pmGetProgname(),
+		    pmErrStr(sts));
+	    exit(1);
+	}
+	pthread_mutex_init(&rp->lock, NULL);
+	pthread_cond_init(&rp->cond, NULL);
+	if ((sts = pthread_create(&tid, NULL, replayReader, rp)) != 0) {
+	    fprintf(stderr, "%s: cannot start reader for archive %s: %s\n",
+		    pmGetProgname(), a->fname, strerror(sts));
+	    exit(1);
+	}
+	pthread_detach(tid);
+	a->replay = rp;
+    }
+}
+
+static void
+replayRelease(Record *rec)
+{
+    if (--rec->refs == 0) {
+	pmFreeResult(rec->rslt);
+	free(rec);
+    }
+}
+
+static __pmHashWalkState
+replayDrop(const __pmHashNode *hp, void *arg)
+{
+    Held	*hv = (Held *)hp->data;
+
+    (void)arg;
+    replayRelease(hv->rec);
+    free(hv);
+    return PM_HASH_WALK_DELETE_NEXT;
+}
+
+/*
+ * consume the earliest queued record across all archives, and hold
+ * its values - returns 0 once every archive has been read
+ */
+int
+replayRecord(Archive **ap, RealTime *stamp)
+{
+    Archive		*a;
+    Archive		*next = NULL;
+    struct replay	*rp;
+    pmResult		*r;
+    __pmHashNode	*hp;
+    Held		*hv;
+    Record		*rec;
+    RealTime		t;
+    RealTime		earliest = 0;
+    int			sts;
+    int			i;
+
+    for (a = archives; a != NULL; a = a->next) {
+	rp = a->replay;
+	pthread_mutex_lock(&rp->lock);
+	while (rp->count == 0 && !rp->done)
+	    pthread_cond_wait(&rp->cond, &rp->lock);
+	r = rp->count ? rp->queue[rp->head] : NULL;
+	sts = rp->sts;
+	pthread_mutex_unlock(&rp->lock);
+
+	if (r == NULL) {
+	    if (sts < 0 && sts != PM_ERR_EOL) {
+		fprintf(stderr, "%s: pmFetchArchive from %s failed: %s\n",
+			pmGetProgname(), a->fname, pmErrStr(sts));
+		rp->sts = PM_ERR_EOL;	/* reported */
+	    }
+	    continue;
+	}
+	t = pmtimevalToReal(&r->timestamp);
+	if (next == NULL || t < earliest) {
+	    next = a;
+	    earliest = t;
+	}
+    }
+    if (next == NULL)
+	return 0;
+
+    rp = next->replay;
+    pthread_mutex_lock(&rp->lock);
+    r = rp->queue[rp->head];
+    rp->head = (rp->head + 1) % REPLAY_AHEAD;
+    rp->count--;
+    pthread_cond_broadcast(&rp->cond);
+    pthread_mutex_unlock(&rp->lock);
+
+    if (r->numpmid == 0) {
+	/* <mark> record, no values are available across the gap */
+	__pmHashWalkCB(replayDrop, NULL, &rp->held);
+	pmFreeResult(r);
+    }
+    else {
+	rec = (Record *)alloc(sizeof(Record));
+	rec->rslt = r;
+	rec->refs = 1;
+	for (i = 0; i < r->numpmid; i++) {
+	    if ((hp = __pmHashSearch(r->vset[i]->pmid, &rp->held)) != NULL) {
+		hv = (Held *)hp->data;
+		replayRelease(hv->rec);
+	    }
+	    else {
+		hv = (Held *)alloc(sizeof(Held));
+		if (__pmHashAdd(r->vset[i]->pmid, hv, &rp->held) < 0)
+		    pmNoMem("replay held value", sizeof(__pmHashNode), PM_FATAL_ERR);
+	    }
+	    hv->vset = r->vset[i];
+	    hv->rec = rec;
+	    hv->stamp = earliest;
+	    rec->refs++;
+	}
+	replayRelease(rec);
+    }
+    rp->stamp = earliest;
+
+    *ap = next;
+    *stamp = earliest;
+    return 1;
+}
+
+/* does the Task fetch any metric from the record just read from a? */
+int
+replayFresh(Task *t, Archive *a)
+{
+    struct replay	*rp = a->replay;
+    __pmHashNode	*hp;
+    Host		*h;
+    Fetch		*f;
+    int			i;
+
+    if (t->hosts == NULL)
+	return 1;
+    for (h = t->hosts; h != NULL; h = h->next) {
+	if (strcmp(symName(h->conn), a->fname) != 0)
+	    continue;
+	for (f = h->fetches; f != NULL; f = f->next) {
+	    for (i = 0; i < f->npmids; i++) {
+		if ((hp = __pmHashSearch(f->pmids[i], &rp->held)) != NULL &&
+		    ((Held *)hp->data)->stamp == rp->stamp)
+		    return 1;
+	    }
+	}
+    }
+    return 0;
+}
+
+/*
+ * build the result for a Fetch from the values held for its archive;
+ * instance profiles are not applied, but cndFetch_n() only picks out
+ * the instances it was asked for and cndFetch_all() wants them all
+ */
+static int
+replayFetch(Fetch *f)
+{
+    static pmValueSet	novalues = { PM_ID_NULL, 0 };
+    Archive		*a;
+    struct replay	*rp = NULL;
+    __pmHashNode	*hp;
+    Held		*hv;
+    pmResult		*r;
+    int			i;
+
+    for (a = archives; a != NULL; a = a->next) {
+	if (strcmp(symName(f->host->conn), a->fname) == 0) {
+	    rp = a->replay;
+	    break;
+	}
+    }
+
+    if (f->result == NULL || f->nreplay < f->npmids) {
+	i = f->npmids > 1 ? f->npmids : 1;
+	f->result = (pmResult *)ralloc(f->result, sizeof(pmResult) +
+				(i - 1) * sizeof(pmValueSet *));
+	f->stamps = (RealTime *)ralloc(f->stamps, i * sizeof(RealTime));
+	f->nreplay = i;
+    }
+    r = f->result;
+    pmtimevalFromReal(rp ? rp->stamp : now, &r->timestamp);
+    r->numpmid = f->npmids;
+    for (i = 0; i < f->npmids; i++) {
+	if (rp && (hp = __pmHashSearch(f->pmids[i], &rp->held)) != NULL) {
+	    hv = (Held *)hp->data;
+	    r->vset[i] = hv->vset;
+	    f->stamps[i] = hv->stamp;
+	}
+	else {
+	    r->vset[i] = &novalues;
+	    f->stamps[i] = 0;
+	}
+    }
+    return 0;
+}
+
+/* release Fetch result built from held values */
+void
+replayFree(Fetch *f)
+{
+    if (f->result)
+	free(f->result);
+    if (f->stamps)
+	free(f->stamps);
+    f->result = NULL;
+    f->stamps = NULL;
+    f->nreplay = 0;
+}
+
 /* execute fetches for given Task */
 void
 taskFetch(Task *t)
@@ -1022,18 +1438,29 @@ taskFetch(Task *t)
     Metric	*m;
     pmResult	*r;
     pmValueSet	**v;
+    RealTime	begin;
+    int		concurrent;
     int		i;
     int		sts;
 
     /* do all fetches, quick as you can */
+    begin = getReal();
+    concurrent = (fetchThreads > 0 && !archives && fetchConcurrent(t));
     h = t->hosts;
     while (h) {
 	f = h->fetches;
 	while (f) {
-	    if (f->result) pmFreeResult(f->result);
+	    if (f->result && !concurrent && !replay) pmFreeResult(f->result);
 	    if (! h->down) {
-		pmUseContext(f->handle);
-		if ((sts = pmFetch(f->npmids, f->pmids, &f->result)) < 0) {
+		if (concurrent)
+		    sts = f->status;
+		else if (replay)
+		    sts = replayFetch(f);
+		else {
+		    pmUseContext(f->handle);
+		    sts = pmFetch(f->npmids, f->pmids, &f->result);
+		}
+		if (sts < 0) {
 		    if (archives) {
 			if (sts == PM_ERR_LOGREC) {
 			    fprintf(stderr, "%s: pmFetch failed: %s\n", pmGetProgname(),
@@ -1051,12 +1478,17 @@ taskFetch(Task *t)
 		    f->result = NULL;
 		}
 	    }
-	    else
+	    else {
+		/* host went down earlier in this round, drop any result */
+		if (concurrent && f->result) pmFreeResult(f->result);
 		f->result = NULL;
+	    }
 	    f = f->next;
 	}
 	h = h->next;
     }
+    perf->fetch_count++;
+    perf->fetch_time += (unsigned long long)((getReal() - begin) * 1000000);
 
     /* sort and distribute pmValueSets to requesting Metrics */
     h = t->hosts;
@@ -1079,11 +1511,15 @@ taskFetch(Task *t)
 		while (p) {
 		    m = p->metrics;
 		    while (m) {
+			if (replay)
+			    /* held values may since have been released */
+			    m->vset = NULL;
 			for (i = 0; i < r->numpmid; i++) {
 			    if (m->desc.pmid == r->vset[i]->pmid) {
 				if (r->vset[i]->numval > 0) {
 				    m->vset = r->vset[i];
-				    m->stamp = pmtimevalToReal(&r->timestamp);
+				    m->stamp = f->stamps ? f->stamps[i] :
+					pmtimevalToReal(&r->timestamp);
 				}
 				break;
 			    }
@@ -67,6 +67,14 @@ void pragmatics(Symbol, RealTime);
 /* execute fetches for given Task */
 void taskFetch(Task *);
 
+void replayInit(void);
+
+int replayRecord(Archive **, RealTime *);
+
+int replayFresh(Task *, Archive *);
+
+void replayFree(Fetch *);
+
 /* convert Expr value to pmValueSet value */
 void fillVSet(Expr *, pmValueSet *);
 
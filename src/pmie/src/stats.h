@@ -14,6 +14,7 @@
 #ifndef STATS_H
 #define STATS_H
 
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/param.h>
 
@@ -33,6 +34,21 @@ typedef struct {
     unsigned int	eval_unknown;		/* pmcd.pmie.eval.unknown  */
     unsigned int	eval_actual;		/* pmcd.pmie.eval.actual   */
     unsigned int	version;
+    /* fields below here were added in version 2 */
+    unsigned long long	eval_drift;		/* pmcd.pmie.eval.drift    */
+    unsigned long long	fetch_count;		/* pmcd.pmie.fetch.count   */
+    unsigned long long	fetch_time;		/* pmcd.pmie.fetch.time    */
+    unsigned long long	eval_sched;		/* pmcd.pmie.eval.sched    */
 } pmiestats_t;
 
+#define PMIESTATS_VERSION	2
+
+/* version 1 stats files end with the version field */
+#define PMIESTATS_V1_SIZE	(offsetof(pmiestats_t, version) + sizeof(unsigned int))
+
+/* version expected in a stats file of the given size, else zero */
+#define PMIESTATS_SIZE_VERSION(size) \
+	((size) == sizeof(pmiestats_t) ? PMIESTATS_VERSION : \
+	 (size) == PMIESTATS_V1_SIZE ? 1 : 0)
+
 #endif /* STATS_H */
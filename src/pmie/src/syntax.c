@@ -20,6 +20,7 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 #include "pmapi.h"
+#include "libpcp.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -52,6 +53,15 @@
 Symbol	parse;			/* result of parse */
 int	errs;			/* error count */
 
+/* a shareable Expr, keyed by hash in the common table */
+typedef struct {
+    Expr	*expr;
+    int		task;		/* Task sequence number, see commonExpr */
+    int		instant;	/* below a CND_INSTANT operator? */
+} Common;
+
+static __pmHashCtl	common;	/* common subexpressions */
+
 
 /***********************************************************************
  * miscellaneous local functions
@@ -246,6 +256,234 @@ postExpr(Expr *x)
 
 
 
+/***********************************************************************
+ * common subexpressions
+ * - identical predicate subexpressions of rules sharing a sample
+ *   interval (and hence a Task) are hash-consed into one Expr, which
+ *   is then evaluated at most once per Task evaluation (see EVALARG)
+ *   regardless of the number of rules using it.
+ * - rule roots and actions are never shared, nor are rulesets, as
+ *   these are evaluated conditionally.
+ ***********************************************************************/
+
+static int
+shareable(Expr *x)
+{
+    return x != NULL && x->op > RULE && x->op < ACT_SEQ &&
+	   x->op != CND_RULESET && x->op != CND_OTHER;
+}
+
+static unsigned int
+hashMix(unsigned int h, __uint64_t v)
+{
+    return (h ^ (unsigned int)(v ^ (v >> 32))) * 16777619U;
+}
+
+/* hash an argument - shared Exprs by address, constants by value */
+static unsigned int
+hashArg(Expr *x)
+{
+    __uint64_t	v = 0;
+    char	*p;
+    unsigned int h = 0;
+
+    if (x == NULL)
+	return 0;
+    if (x->op != NOP || x->sem == SEM_REGEX || x->smpls[0].ptr == NULL)
+	return hashMix(h, (__uint64_t)(__psint_t)x);
+    if (x->sem == SEM_CHAR) {
+	for (p = (char *)x->ring; *p; p++)
+	    h = hashMix(h, *p);
+	return h;
+    }
+    if (x->sem == SEM_BOOLEAN)
+	return hashMix(h, *(Boolean *)x->smpls[0].ptr);
+    memcpy(&v, x->smpls[0].ptr, sizeof(double));
+    return hashMix(h, v);
+}
+
+static int
+sameArg(Expr *a, Expr *b)
+{
+    if (a == b)
+	return 1;
+    if (a == NULL || b == NULL || a->op != NOP || b->op != NOP)
+	return 0;
+    if (a->sem != b->sem || a->tspan != b->tspan || a->valid != b->valid ||
+	memcmp(&a->units, &b->units, sizeof(pmUnits)) != 0 ||
+	a->sem == SEM_REGEX || a->smpls[0].ptr == NULL || b->smpls[0].ptr == NULL)
+	return 0;
+    if (a->sem == SEM_CHAR)
+	return strcmp((char *)a->ring, (char *)b->ring) == 0;
+    if (a->sem == SEM_BOOLEAN)
+	return memcmp(a->smpls[0].ptr, b->smpls[0].ptr, a->tspan) == 0;
+    return memcmp(a->smpls[0].ptr, b->smpls[0].ptr, a->tspan * sizeof(double)) == 0;
+}
+
+static unsigned int
+hashExpr(Expr *x, int task, int instant)
+{
+    unsigned int	h = 2166136261U;
+    Metric		*m;
+    int			i;
+
+    h = hashMix(h, task);
+    h = hashMix(h, x->op);
+    h = hashMix(h, x->hdom);
+    h = hashMix(h, x->e_idom);
+    h = hashMix(h, x->tdom);
+    h = hashMix(h, x->nsmpls);
+    h = hashMix(h, x->sem);
+    h = hashMix(h, instant);
+    h = hashMix(h, hashArg(x->arg1));
+    h = hashMix(h, hashArg(x->arg2));
+    if (x->op == CND_FETCH) {
+	for (m = x->metrics, i = 0; i < x->hdom; m++, i++) {
+	    h = hashMix(h, (__uint64_t)(__psint_t)m->mname);
+	    h = hashMix(h, (__uint64_t)(__psint_t)m->hconn);
+	    h = hashMix(h, m->specinst);
+	}
+    }
+    return h;
+}
+
+static int
+sameExpr(Expr *a, Expr *b)
+{
+    Metric	*m1, *m2;
+    int		i, j;
+
+    if (a->op != b->op || a->hdom != b->hdom || a->e_idom != b->e_idom ||
+	a->tdom != b->tdom || a->tspan != b->tspan || a->nsmpls != b->nsmpls ||
+	a->sem != b->sem || memcmp(&a->units, &b->units, sizeof(pmUnits)) != 0)
+	return 0;
+    if (!sameArg(a->arg1, b->arg1) || !sameArg(a->arg2, b->arg2))
+	return 0;
+    if (a->op != CND_FETCH)
+	return 1;
+    m1 = a->metrics;
+    m2 = b->metrics;
+    for (i = 0; i < a->hdom; i++, m1++, m2++) {
+	if (m1->mname != m2->mname || m1->hconn != m2->hconn ||
+	    m1->specinst != m2->specinst)
+	    return 0;
+	for (j = 0; j < m1->specinst; j++) {
+	    if (strcmp(m1->inames[j], m2->inames[j]) != 0)
+		return 0;
+	}
+    }
+    return 1;
+}
+
+/* discard a duplicate, which owns at most some constant arguments */
+static void
+dropExpr(Expr *x)
+{
+    /* boolean and builtin variables are referenced, not copied */
+    if (x->arg1 && (x->arg1->parent != x || x->arg1->op != NOP ||
+		    x->arg1->sem == SEM_BOOLEAN))
+	x->arg1 = NULL;
+    if (x->arg2 && (x->arg2->parent != x || x->arg2->op != NOP ||
+		    x->arg2->sem == SEM_BOOLEAN))
+	x->arg2 = NULL;
+    freeExpr(x);
+}
+
+static Expr *shareExpr(Expr *, int, int);
+
+/* replace arguments of x by their common subexpressions */
+static void
+shareArgs(Expr *x, int task, int instant)
+{
+    Metric	*m;
+
+    if (x->op == CND_INSTANT)
+	instant = 1;
+    if (shareable(x->arg1)) {
+	m = x->arg1->metrics;
+	x->arg1 = shareExpr(x->arg1, task, instant);
+	if (m != NULL && x->metrics == m)
+	    x->metrics = x->arg1->metrics;
+    }
+    if (shareable(x->arg2)) {
+	m = x->arg2->metrics;
+	x->arg2 = shareExpr(x->arg2, task, instant);
+	if (m != NULL && x->metrics == m)
+	    x->metrics = x->arg2->metrics;
+    }
+}
+
+/* x is here to stay, so becomes another parent of any shared arguments */
+static void
+linkArgs(Expr *x)
+{
+    if (shareable(x->arg1) && x->arg1->parent != x)
+	addSharer(x->arg1, x);
+    if (shareable(x->arg2) && x->arg2->parent != x)
+	addSharer(x->arg2, x);
+}
+
+/* return the common subexpression for x, registering x if new */
+static Expr *
+shareExpr(Expr *x, int task, int instant)
+{
+    __pmHashNode	*hp;
+    Common		*cp;
+    unsigned int	key;
+
+    shareArgs(x, task, instant);
+    if (x->op == CND_INSTANT)
+	instant = 1;
+
+    key = hashExpr(x, task, instant);
+    for (hp = __pmHashSearch(key, &common); hp != NULL; hp = hp->next) {
+	cp = (Common *)hp->data;
+	if (hp->key == key && cp->task == task &&
+	    cp->instant == instant && sameExpr(cp->expr, x)) {
+	    if (pmDebugOptions.appl1) {
+		fprintf(stderr, "shareExpr: " PRINTF_P_PFX "%p shared for " PRINTF_P_PFX "%p\n", cp->expr, x);
+		dumpExpr(x);
+	    }
+	    dropExpr(x);
+	    return cp->expr;
+	}
+    }
+
+    linkArgs(x);
+    cp = (Common *) alloc(sizeof(Common));
+    cp->expr = x;
+    cp->task = task;
+    cp->instant = instant;
+    if (__pmHashAdd(key, cp, &common) < 0)
+	free(cp);
+    return x;
+}
+
+/* share common subexpressions between the predicates of rules */
+static void
+commonExpr(Expr *x)
+{
+    static RealTime	lastdelta = -1;
+    static int		task;
+    RealTime		delta = *(RealTime *)((Expr *)symValue(symDelta))->smpls[0].ptr;
+
+    /*
+     * pragmatics() appends rules to the last Task while the sample
+     * interval is unchanged, so track that same sequence here
+     */
+    if (delta != lastdelta) {
+	lastdelta = delta;
+	task++;
+    }
+
+    /* for rules, this shares the predicate only - actions are not shareable */
+    if (x->op == RULE || shareable(x)) {
+	shareArgs(x, task, 0);
+	linkArgs(x);
+    }
+}
+
+
 /***********************************************************************
  * parser actions
  ***********************************************************************/
@@ -273,6 +511,7 @@ statement(char *name, Expr *x)
 	else {
 	    if (errs == 0) {
 		postExpr(x);
+		commonExpr(x);
 		s = symIntern(&rules, name);
 	    }
 	    else return NULL;
@@ -2312,7 +2312,7 @@ lookup_processes(int *count, char ***processes)
 		 pmGetConfig("PCP_TMP_DIR"), sep, PMIE_SUBDIR, sep, dp->d_name);
 	if (stat(proc, &statbuf) < 0)
 	    continue;
-	if (statbuf.st_size != sizeof(pmiestats_t))
+	if (PMIESTATS_SIZE_VERSION(statbuf.st_size) == 0)
 	    continue;
 	if ((fd = open(proc, O_RDONLY)) < 0)
 	    continue;
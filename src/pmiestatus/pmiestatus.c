@@ -24,6 +24,7 @@ main(int argc, char **argv)
     for (i=1; i < argc; i++) {
 	pmiestats_t ps;
 	struct stat st;
+	unsigned int version;
 	int f = open(argv[i], O_RDONLY, 0);
 
 	if (f < 0) {
@@ -38,18 +39,18 @@ main(int argc, char **argv)
 	    goto closefile;
 	}
 
-	if (st.st_size != sizeof(ps)) {
+	if ((version = PMIESTATS_SIZE_VERSION(st.st_size)) == 0) {
 	    fprintf(stderr, "%s: %s is not a valid pmie stats file\n",
 		    pmGetProgname(), argv[i]);
 	    goto closefile;
 	}
-	if (read(f, &ps, sizeof(ps)) != sizeof(ps)) {
+	if (read(f, &ps, st.st_size) != st.st_size) {
 	    fprintf(stderr, "%s: cannot read %ld bytes from %s\n",
-		    pmGetProgname(), (long)sizeof(ps), argv[i]);
+		    pmGetProgname(), (long)st.st_size, argv[i]);
 	    goto closefile;
 	}
 
-	if (ps.version != 1) {
+	if (ps.version != version) {
 	    fprintf(stderr, "%s: unsupported version %d in %s\n",
 		    pmGetProgname(), ps.version, argv[i]);
 	    goto closefile;
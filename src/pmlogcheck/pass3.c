@@ -14,6 +14,7 @@
  */
 
 #include <math.h>
+#include <pthread.h>
 #include "pmapi.h"
 #include "libpcp.h"
 #include "logcheck.h"
@@ -32,12 +33,62 @@ typedef struct {
     unsigned int	listsize;
 } checkData;
 
-static __pmHashCtl	hashlist;	/* hash statistics about each metric */
+/* a decoded archive record, checked by every shard */
+typedef struct {
+    pmResult		*result;
+    int			vol;		/* volume it was read from */
+} record_t;
+
+/* where the buffered diagnostics for one record and pmValueSet start */
+typedef struct {
+    int			rec;		/* index in batch */
+    int			vset;		/* index in result, -1 for record */
+    long		offset;
+} outmark_t;
+
+/*
+ * Pass 3 state for the metrics in one shard of the PMID space.  With
+ * more than one shard (-P) each is checked by its own thread, and the
+ * diagnostics are buffered in a temporary file and merged back into
+ * record order at the end of each batch, so the report is the same as
+ * when checking serially.
+ */
+typedef struct {
+    __pmHashCtl		hashlist;	/* hash statistics about each metric */
+    FILE		*out;		/* diagnostics, stderr if serial */
+    outmark_t		*marks;
+    int			nmarks;
+    int			maxmarks;
+    int			rec;		/* record being checked */
+    int			vset;		/* pmValueSet being checked */
+    int			fatal;		/* cannot continue past rec, vset */
+    int			next;		/* next mark to merge */
+    long		end;		/* end of buffered output */
+} shard_t;
+
+#define BATCHSIZE	256	/* records per batch when sharded */
+
+static shard_t		*shards;
+static shard_t		header[2];	/* per-record diagnostics, per batch */
 static int		dayflag;
 
 static __pmContext	*l_ctxp;
 static char		*l_archname;
 
+/*
+ * Serializes libpcp metadata and PMNS lookups from the shard threads
+ * with the reading of the next batch of records from the archive.
+ */
+static pthread_mutex_t	pcplock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t	batchlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	batchwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	batchdone = PTHREAD_COND_INITIALIZER;
+static record_t		*batch;		/* records being checked */
+static int		nbatch;
+static int		batchgen;	/* bumped for each new batch */
+static int		batchbusy;	/* shards still checking batch */
+
 /* time manipulation */
 static int
 tsub(struct timeval *a, struct timeval *b)
@@ -70,7 +121,10 @@ print_metric(FILE *f, pmID pmid)
     int		numnames;
     char	**names;
 
-    if ((numnames = pmNameAll(pmid, &names)) < 1)
+    pthread_mutex_lock(&pcplock);
+    numnames = pmNameAll(pmid, &names);
+    pthread_mutex_unlock(&pcplock);
+    if (numnames < 1)
 	fprintf(f, "%s", pmIDStr(pmid));
     else {
 	__pmPrintMetricNames(f, numnames, names, " or ");
@@ -100,12 +154,57 @@ print_stamp(FILE *f, struct timeval *stamp)
 	pmPrintStamp(f, stamp);
 }
 
+static int
+print_inst(FILE *f, pmInDom indom, int inst, const char *fmt)
+{
+    char	*name;
+    int		sts;
+
+    pthread_mutex_lock(&pcplock);
+    sts = pmNameInDomArchive(indom, inst, &name);
+    pthread_mutex_unlock(&pcplock);
+    if (sts >= 0) {
+	fprintf(f, fmt, name);
+	free(name);
+    }
+    return sts;
+}
+
+/*
+ * Start a diagnostic "archive.vol:[stamp" for the record being checked,
+ * noting where it begins when the shard output is buffered.
+ */
+static FILE *
+report(shard_t *sp, record_t *rp)
+{
+    outmark_t	*mp;
+    size_t	size;
+
+    if (sp->out != stderr &&
+	(sp->nmarks == 0 || sp->marks[sp->nmarks-1].rec != sp->rec ||
+	 sp->marks[sp->nmarks-1].vset != sp->vset)) {
+	if (sp->nmarks == sp->maxmarks) {
+	    sp->maxmarks = sp->maxmarks ? 2 * sp->maxmarks : 64;
+	    size = sp->maxmarks * sizeof(outmark_t);
+	    if ((sp->marks = (outmark_t *)realloc(sp->marks, size)) == NULL)
+		pmNoMem("report.marks", size, PM_FATAL_ERR);
+	}
+	mp = &sp->marks[sp->nmarks++];
+	mp->rec = sp->rec;
+	mp->vset = sp->vset;
+	mp->offset = ftell(sp->out);
+    }
+    fprintf(sp->out, "%s.%d:[", l_archname, rp->vol);
+    print_stamp(sp->out, &rp->result->timestamp);
+    return sp->out;
+}
+
 static double
-unwrap(double current, struct timeval *curtime, checkData *checkdata, int index)
+unwrap(shard_t *sp, record_t *rp, double current, checkData *checkdata, int index)
 {
     double	outval = current;
     int		wrapflag = 0;
-    char	*str = NULL;
+    FILE	*f;
 
     if ((current - checkdata->instlist[index]->lastval) < 0.0 &&
         checkdata->instlist[index]->lasttime.tv_sec > 0) {
@@ -126,45 +225,41 @@ unwrap(double current, struct timeval *curtime, checkData *checkdata, int index)
     }
 
     if (wrapflag) {
-	fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-	print_stamp(stderr, curtime);
-	fprintf(stderr, "]: ");
-	print_metric(stderr, checkdata->desc.pmid);
-	if (pmNameInDomArchive(checkdata->desc.indom, checkdata->instlist[index]->inst, &str) < 0)
-	    fprintf(stderr, ": %s wrap", typeStr(checkdata->desc.type));
-	else {
-	    fprintf(stderr, "[%s]: %s wrap", str, typeStr(checkdata->desc.type));
-	    free(str);
-	}
-	fprintf(stderr, "\n\tvalue %.0f at ", checkdata->instlist[index]->lastval);
-	print_stamp(stderr, &checkdata->instlist[index]->lasttime);
-	fprintf(stderr, "\n\tvalue %.0f at ", current);
-	print_stamp(stderr, curtime);
-	fputc('\n', stderr);
+	f = report(sp, rp);
+	fprintf(f, "]: ");
+	print_metric(f, checkdata->desc.pmid);
+	print_inst(f, checkdata->desc.indom, checkdata->instlist[index]->inst, "[%s]");
+	fprintf(f, ": %s wrap", typeStr(checkdata->desc.type));
+	fprintf(f, "\n\tvalue %.0f at ", checkdata->instlist[index]->lastval);
+	print_stamp(f, &checkdata->instlist[index]->lasttime);
+	fprintf(f, "\n\tvalue %.0f at ", current);
+	print_stamp(f, &rp->result->timestamp);
+	fputc('\n', f);
     }
 
     return outval;
 }
 
-static void
-newHashInst(pmValue *vp,
+static int
+newHashInst(shard_t *sp, record_t *rp,
+	pmValue *vp,
 	checkData *checkdata,		/* updated by this function */
 	int valfmt,
-	struct timeval *timestamp,	/* timestamp for this sample */
 	int pos)			/* position of this inst in instlist */
 {
     int		sts;
     size_t	size;
     pmAtomValue av;
+    FILE	*f;
 
     if ((sts = pmExtractValue(valfmt, vp, checkdata->desc.type, &av, PM_TYPE_DOUBLE)) < 0) {
-	fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-	print_stamp(stderr, timestamp);
-	fprintf(stderr, "] ");
-	print_metric(stderr, checkdata->desc.pmid);
-	fprintf(stderr, ": pmExtractValue failed: %s\n", pmErrStr(sts));
-	fprintf(stderr, "%s: possibly corrupt archive?\n", pmGetProgname());
-	exit(EXIT_FAILURE);
+	f = report(sp, rp);
+	fprintf(f, "] ");
+	print_metric(f, checkdata->desc.pmid);
+	fprintf(f, ": pmExtractValue failed: %s\n", pmErrStr(sts));
+	fprintf(f, "%s: possibly corrupt archive?\n", pmGetProgname());
+	sp->fatal = 1;
+	return sts;
     }
     size = (pos+1)*sizeof(instData*);
     checkdata->instlist = (instData**) realloc(checkdata->instlist, size);
@@ -176,37 +271,32 @@ newHashInst(pmValue *vp,
 	pmNoMem("newHashInst.instlist[pos]", size, PM_FATAL_ERR);
     checkdata->instlist[pos]->inst = vp->inst;
     checkdata->instlist[pos]->lastval = av.d;
-    checkdata->instlist[pos]->lasttime = *timestamp;
+    checkdata->instlist[pos]->lasttime = rp->result->timestamp;
     checkdata->listsize++;
     if (pmDebugOptions.appl1) {
-	char	*name;
-
-	fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-	print_stamp(stderr, timestamp);
-	fprintf(stderr, "] ");
-	print_metric(stderr, checkdata->desc.pmid);
+	f = report(sp, rp);
+	fprintf(f, "] ");
+	print_metric(f, checkdata->desc.pmid);
 	if (vp->inst == PM_INDOM_NULL)
-	    fprintf(stderr, ": new singular metric\n");
+	    fprintf(f, ": new singular metric\n");
 	else {
-	    fprintf(stderr, ": new metric-instance pair ");
-	    if (pmNameInDomArchive(checkdata->desc.indom, vp->inst, &name) < 0)
-		fprintf(stderr, "%d\n", vp->inst);
-	    else {
-		fprintf(stderr, "\"%s\"\n", name);
-		free(name);
-	    }
+	    fprintf(f, ": new metric-instance pair ");
+	    if (print_inst(f, checkdata->desc.indom, vp->inst, "\"%s\"\n") < 0)
+		fprintf(f, "%d\n", vp->inst);
 	}
 
     }
+    return 0;
 }
 
-static void
-newHashItem(pmValueSet *vsp,
+static int
+newHashItem(shard_t *sp, record_t *rp,
+	pmValueSet *vsp,
 	pmDesc *desc,
-	checkData *checkdata,		/* output from this function */
-	struct timeval *timestamp)	/* timestamp for this sample */
+	checkData *checkdata)		/* output from this function */
 {
     int j;
+    int	sts;
 
     checkdata->desc = *desc;
     checkdata->scale = 0.0;
@@ -228,15 +318,28 @@ newHashItem(pmValueSet *vsp,
     checkdata->listsize = 0;
     checkdata->instlist = NULL;
     for (j = 0; j < vsp->numval; j++) {
-	newHashInst(&vsp->vlist[j], checkdata, vsp->valfmt, timestamp, j);
+	if ((sts = newHashInst(sp, rp, &vsp->vlist[j], checkdata, vsp->valfmt, j)) < 0)
+	    return sts;
     }
+    return 0;
+}
+
+/* shard of the PMID space that checks this metric */
+static int
+shardof(pmID pmid)
+{
+    if (nshard <= 1)
+	return 0;
+    return (int)((((unsigned int)pmid * 2654435761U) >> 16) % nshard);
 }
 
 static void
-docheck(pmResult *result)
+docheck(shard_t *sp, record_t *rp)
 {
     int			i, j, k;
     int			sts;
+    int			id = sp - shards;
+    pmResult		*result = rp->result;
     pmDesc		desc;
     pmAtomValue 	av;
     pmValue		*vp;
@@ -245,25 +348,27 @@ docheck(pmResult *result)
     checkData		*checkdata = NULL;
     double		diff;
     struct timeval	timediff;
+    FILE		*f;
 
     for (i = 0; i < result->numpmid; i++) {
 	vsp = result->vset[i];
+	if (shardof(vsp->pmid) != id)
+	    continue;
+	sp->vset = i;
 
 	if (pmDebugOptions.appl1) {
 	    if (vsp->numval == 0) {
-		fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-		print_stamp(stderr, &result->timestamp);
-		fprintf(stderr, "] ");
-		print_metric(stderr, vsp->pmid);
-		fprintf(stderr, ": no values returned\n");
+		f = report(sp, rp);
+		fprintf(f, "] ");
+		print_metric(f, vsp->pmid);
+		fprintf(f, ": no values returned\n");
 		continue;
 	    }
 	    else if (vsp->numval < 0) {
-		fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-		print_stamp(stderr, &result->timestamp);
-		fprintf(stderr, "] ");
-		print_metric(stderr, vsp->pmid);
-		fprintf(stderr, ": error from numval: %s\n", pmErrStr(vsp->numval));
+		f = report(sp, rp);
+		fprintf(f, "] ");
+		print_metric(f, vsp->pmid);
+		fprintf(f, ": error from numval: %s\n", pmErrStr(vsp->numval));
 		continue;
 	    }
 	}
@@ -271,24 +376,25 @@ docheck(pmResult *result)
 	    continue;
 
 	/* check if pmid already in hash list */
-	if ((hptr = __pmHashSearch(vsp->pmid, &hashlist)) == NULL) {
-	    if ((sts = pmLookupDesc(vsp->pmid, &desc)) < 0) {
-		fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-		print_stamp(stderr, &result->timestamp);
-		fprintf(stderr, "] ");
-		print_metric(stderr, vsp->pmid);
-		fprintf(stderr, ": pmLookupDesc failed: %s\n", pmErrStr(sts));
+	if ((hptr = __pmHashSearch(vsp->pmid, &sp->hashlist)) == NULL) {
+	    pthread_mutex_lock(&pcplock);
+	    sts = pmLookupDesc(vsp->pmid, &desc);
+	    pthread_mutex_unlock(&pcplock);
+	    if (sts < 0) {
+		f = report(sp, rp);
+		fprintf(f, "] ");
+		print_metric(f, vsp->pmid);
+		fprintf(f, ": pmLookupDesc failed: %s\n", pmErrStr(sts));
 		/*
 		 * add to hashlist to suppress repeated error messages
 		 * ... but of course no checks on pmResult values that depend
 		 * on the pmDesc are possible
 		 */
-		if (__pmHashAdd(vsp->pmid, NULL, &hashlist) < 0) {
-		    fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-		    print_stamp(stderr, &result->timestamp);
-		    fprintf(stderr, "] ");
-		    print_metric(stderr, vsp->pmid);
-		    fprintf(stderr, ": __pmHashAdd bad failed (internal pmlogcheck error)\n");
+		if (__pmHashAdd(vsp->pmid, NULL, &sp->hashlist) < 0) {
+		    f = report(sp, rp);
+		    fprintf(f, "] ");
+		    print_metric(f, vsp->pmid);
+		    fprintf(f, ": __pmHashAdd bad failed (internal pmlogcheck error)\n");
 		}
 		continue;
 	    }
@@ -301,17 +407,17 @@ docheck(pmResult *result)
 
 	    /* create a new one & add to list */
 	    checkdata = (checkData*) malloc(sizeof(checkData));
-	    newHashItem(vsp, &desc, checkdata, &result->timestamp);
+	    if (newHashItem(sp, rp, vsp, &desc, checkdata) < 0)
+		return;
 	    if (vsp->numval > 0)
 		checkdata->valfmt = vsp->valfmt;
 	    else
 		checkdata->valfmt = -1;
-	    if (__pmHashAdd(vsp->pmid, (void*)checkdata, &hashlist) < 0) {
-		fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-		print_stamp(stderr, &result->timestamp);
-		fprintf(stderr, "] ");
-		print_metric(stderr, vsp->pmid);
-		fprintf(stderr, ": __pmHashAdd good failed (internal pmlogcheck error)\n");
+	    if (__pmHashAdd(vsp->pmid, (void*)checkdata, &sp->hashlist) < 0) {
+		f = report(sp, rp);
+		fprintf(f, "] ");
+		print_metric(f, vsp->pmid);
+		fprintf(f, ": __pmHashAdd good failed (internal pmlogcheck error)\n");
 		/* free memory allocated above on insert failure */
 		for (j = 0; j < vsp->numval; j++) {
 		    if (checkdata->instlist[j] != NULL)
@@ -334,11 +440,10 @@ docheck(pmResult *result)
 		     * are present valfmt should be the same for all
 		     * pmValueSets for a given PMID
 		     */
-		    fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-		    print_stamp(stderr, &result->timestamp);
-		    fprintf(stderr, "] ");
-		    print_metric(stderr, vsp->pmid);
-		    fprintf(stderr, ": encoding botch valfmt=%d not %d as expected\n", vsp->valfmt, checkdata->valfmt);
+		    f = report(sp, rp);
+		    fprintf(f, "] ");
+		    print_metric(f, vsp->pmid);
+		    fprintf(f, ": encoding botch valfmt=%d not %d as expected\n", vsp->valfmt, checkdata->valfmt);
 		    continue;
 		}
 	    }
@@ -354,19 +459,22 @@ docheck(pmResult *result)
 			    }
 			}
 			if (k == checkdata->listsize) {	/* no matching inst was found */
-			    newHashInst(vp, checkdata, vsp->valfmt, &result->timestamp, k);
+			    if (newHashInst(sp, rp, vp, checkdata, vsp->valfmt, k) < 0)
+				return;
 			    continue;
 			}
 		    }
 		    else if (k >= checkdata->listsize) {
 			k = checkdata->listsize;
-			newHashInst(vp, checkdata, vsp->valfmt, &result->timestamp, k);
+			if (newHashInst(sp, rp, vp, checkdata, vsp->valfmt, k) < 0)
+			    return;
 			continue;
 		    }
 		}
 		if (k >= checkdata->listsize) {	/* only error values observed so far */
 		    k = checkdata->listsize;
-		    newHashInst(vp, checkdata, vsp->valfmt, &result->timestamp, k);
+		    if (newHashInst(sp, rp, vp, checkdata, vsp->valfmt, k) < 0)
+			return;
 		    continue;
 		}
 
@@ -379,25 +487,23 @@ docheck(pmResult *result)
 		}
 		diff = pmtimevalToReal(&timediff);
 		if ((sts = pmExtractValue(vsp->valfmt, vp, checkdata->desc.type, &av, PM_TYPE_DOUBLE)) < 0) {
-		    fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-		    print_stamp(stderr, &result->timestamp);
-		    fprintf(stderr, "] ");
-		    print_metric(stderr, vsp->pmid);
-		    fprintf(stderr, ": pmExtractValue failed: %s\n", pmErrStr(sts));
+		    f = report(sp, rp);
+		    fprintf(f, "] ");
+		    print_metric(f, vsp->pmid);
+		    fprintf(f, ": pmExtractValue failed: %s\n", pmErrStr(sts));
 		    continue;
 		}
 		if (checkdata->desc.sem == PM_SEM_COUNTER) {
 		    if (diff == 0.0) continue;
 		    diff *= checkdata->scale;
 		    if (pmDebugOptions.appl2) {
-			fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-			print_stamp(stderr, &result->timestamp);
-			fprintf(stderr, "] ");
-			print_metric(stderr, checkdata->desc.pmid);
-			fprintf(stderr, ": current counter value is %.0f\n", av.d);
+			f = report(sp, rp);
+			fprintf(f, "] ");
+			print_metric(f, checkdata->desc.pmid);
+			fprintf(f, ": current counter value is %.0f\n", av.d);
 		    }
 		    if (nowrap == 0)
-			unwrap(av.d, &(result->timestamp), checkdata, k);
+			unwrap(sp, rp, av.d, checkdata, k);
 		}
 		checkdata->instlist[k]->lastval = av.d;
 		checkdata->instlist[k]->lasttime = result->timestamp;
@@ -406,65 +512,231 @@ docheck(pmResult *result)
     }
 }
 
-int
-pass3(__pmContext *ctxp, char *archname, pmOptions *opts)
+/* check this shard's metrics in a batch of records */
+static void
+checkbatch(shard_t *sp, record_t *recs, int n)
 {
-    struct timeval	timespan;
-    int			sts;
-    pmResult		*result;
-    struct timeval	label_stamp;
-    struct timeval	last_stamp;
-    struct timeval	delta_stamp;
+    __pmHashNode	*hptr;
+    checkData		*checkdata;
+    int			r, k;
+
+    for (r = 0; r < n && !sp->fatal; r++) {
+	sp->rec = r;
+	sp->vset = -1;
+	if (recs[r].result->numpmid == 0) {
+	    /*
+	     * MARK record ... make sure wrap check is not done
+	     * at next fetch (mimic interp.c from libpcp)
+	     */
+	    for (hptr = __pmHashWalk(&sp->hashlist, PM_HASH_WALK_START);
+		 hptr != NULL;
+		 hptr = __pmHashWalk(&sp->hashlist, PM_HASH_WALK_NEXT)) {
+		if ((checkdata = (checkData *)hptr->data) == NULL)
+		    continue;
+		for (k = 0; k < checkdata->listsize; k++) {
+		    checkdata->instlist[k]->lasttime.tv_sec = 0;
+		}
+	    }
+	}
+	else
+	    docheck(sp, &recs[r]);
+    }
+}
 
-    l_ctxp = ctxp;
-    l_archname = archname;
+static int
+before(outmark_t *a, outmark_t *b)
+{
+    return a->rec < b->rec || (a->rec == b->rec && a->vset < b->vset);
+}
 
-    label_stamp.tv_sec = log_label.ill_start.tv_sec;
-    label_stamp.tv_usec = log_label.ill_start.tv_usec;
+/*
+ * Copy buffered diagnostics for a batch to stderr in record order,
+ * stopping after the first fatal error, then release the records.
+ * Returns non-zero if checking cannot continue.
+ */
+static int
+flushbatch(shard_t *hp, record_t *recs, int n)
+{
+    shard_t	*sp, *best;
+    outmark_t	*mp;
+    outmark_t	limit = { INT_MAX, INT_MAX, 0 };
+    char	buf[BUFSIZ];
+    long	len, bytes;
+    int		fatal = 0;
+    int		i, r;
+
+    for (i = 0; i < nshard; i++) {
+	if (shards[i].fatal) {
+	    fatal = 1;
+	    if (shards[i].out == stderr)
+		continue;
+	    /* the last diagnostic is the one that was fatal */
+	    mp = &shards[i].marks[shards[i].nmarks-1];
+	    if (before(mp, &limit))
+		limit = *mp;
+	}
+    }
+    if (hp->out != stderr) {
+	hp->next = 0;
+	hp->end = ftell(hp->out);
+	for (i = 0; i < nshard; i++) {
+	    shards[i].next = 0;
+	    shards[i].end = ftell(shards[i].out);
+	}
+	for ( ; ; ) {
+	    best = NULL;
+	    for (i = -1; i < nshard; i++) {
+		sp = (i < 0) ? hp : &shards[i];
+		if (sp->next < sp->nmarks &&
+		    (best == NULL || before(&sp->marks[sp->next], &best->marks[best->next])))
+		    best = sp;
+	    }
+	    if (best == NULL || before(&limit, &best->marks[best->next]))
+		break;
+	    mp = &best->marks[best->next++];
+	    len = (best->next < best->nmarks ? mp[1].offset : best->end) - mp->offset;
+	    fseek(best->out, mp->offset, SEEK_SET);
+	    while (len > 0) {
+		bytes = len < (long)sizeof(buf) ? len : (long)sizeof(buf);
+		if ((bytes = fread(buf, 1, bytes, best->out)) <= 0)
+		    break;
+		fwrite(buf, 1, bytes, stderr);
+		len -= bytes;
+	    }
+	}
+	for (i = -1; i < nshard; i++) {
+	    sp = (i < 0) ? hp : &shards[i];
+	    rewind(sp->out);
+	    sp->nmarks = 0;
+	}
+    }
+    for (r = 0; r < n; r++)
+	pmFreeResult(recs[r].result);
+    return fatal;
+}
 
-    if (vflag)
-	fprintf(stderr, "%s: start pass3\n", archname);
+static void *
+shardWorker(void *arg)
+{
+    shard_t	*sp = (shard_t *)arg;
+    int		gen = 0;
 
-    /* check which timestamp print format we should be using */
-    timespan = opts->finish;
-    tsub(&timespan, &opts->start);
-    if (timespan.tv_sec > 86400) /* seconds per day: 60*60*24 */
-	dayflag = 1;
+    /* current context is per-thread */
+    pmUseContext(l_ctxp->c_handle);
 
-    if (opts->start_optarg == NULL && opts->origin_optarg == NULL && 
-	opts->align_optarg == NULL) {
-	/*
-	 * No -S or -O or -A ... start from the epoch in case there are
-	 * records with a timestamp _before_ the label timestamp.
-	 */
-	opts->start.tv_sec = opts->start.tv_usec = 0;
+    pthread_mutex_lock(&batchlock);
+    for ( ; ; ) {
+	while (batchgen == gen)
+	    pthread_cond_wait(&batchwork, &batchlock);
+	gen = batchgen;
+	pthread_mutex_unlock(&batchlock);
+
+	checkbatch(sp, batch, nbatch);
+
+	pthread_mutex_lock(&batchlock);
+	if (--batchbusy == 0)
+	    pthread_cond_signal(&batchdone);
     }
+    return NULL;
+}
 
-    if ((sts = pmSetMode(PM_MODE_FORW, &opts->start, 0)) < 0) {
-	fprintf(stderr, "%s: pmSetMode failed: %s\n", l_archname, pmErrStr(sts));
-	return STS_FATAL;
+/* start a thread per shard, returns -1 to fall back to checking serially */
+static int
+startshards(void)
+{
+    pthread_t	tid;
+    int		i, sts;
+
+    for (i = 0; i < 2; i++) {
+	if ((header[i].out = tmpfile()) == NULL) {
+	    fprintf(stderr, "%s: cannot create temporary file: %s\n",
+		    pmGetProgname(), osstrerror());
+	    return -1;
+	}
+    }
+    for (i = 0; i < nshard; i++) {
+	if ((shards[i].out = tmpfile()) == NULL) {
+	    fprintf(stderr, "%s: cannot create temporary file: %s\n",
+		    pmGetProgname(), osstrerror());
+	    return -1;
+	}
+    }
+    for (i = 0; i < nshard; i++) {
+	if ((sts = pthread_create(&tid, NULL, shardWorker, &shards[i])) != 0) {
+	    fprintf(stderr, "%s: cannot start pass3 thread: %s\n",
+		    pmGetProgname(), strerror(sts));
+	    return -1;
+	}
+	pthread_detach(tid);
     }
+    return 0;
+}
 
-    sts = 0;
-    last_stamp = opts->start;
-    for ( ; ; ) {
+static void
+startbatch(record_t *recs, int n)
+{
+    pthread_mutex_lock(&batchlock);
+    batch = recs;
+    nbatch = n;
+    batchbusy = nshard;
+    batchgen++;
+    pthread_cond_broadcast(&batchwork);
+    pthread_mutex_unlock(&batchlock);
+}
+
+static void
+waitbatch(void)
+{
+    pthread_mutex_lock(&batchlock);
+    while (batchbusy > 0)
+	pthread_cond_wait(&batchdone, &batchlock);
+    pthread_mutex_unlock(&batchlock);
+}
+
+static struct timeval	label_stamp;
+static struct timeval	last_stamp;
+
+/*
+ * Read up to max records from the time window into recs, doing the
+ * checks that apply to a record as a whole.  Returns the number of
+ * records read, *stsp is set once the end of the window is reached.
+ */
+static int
+readbatch(record_t *recs, int max, shard_t *hp, pmOptions *opts, int *stsp)
+{
+    pmResult		*result;
+    struct timeval	delta_stamp;
+    record_t		*rp;
+    FILE		*f;
+    int			sts;
+    int			n = 0;
+
+    while (n < max) {
+	rp = &recs[n];
 	/*
 	 * we need the next record with no fancy checks or record
 	 * skipping in libpcp, so use __pmLogRead_ctx() in preference
 	 * to pmFetchArchive()
 	 */
+	pthread_mutex_lock(&pcplock);
 	sts = __pmLogRead_ctx(l_ctxp, l_ctxp->c_mode, NULL, &result, PMLOGREAD_NEXT);
-	if (sts < 0)
+	rp->vol = l_ctxp->c_archctl->ac_vol;
+	pthread_mutex_unlock(&pcplock);
+	if (sts < 0) {
+	    *stsp = sts;
 	    break;
+	}
+	rp->result = result;
+	hp->rec = n;
+	hp->vset = -1;
 	result_count++;
 	delta_stamp = result->timestamp;
 	tsub(&delta_stamp, &label_stamp);
 	if (delta_stamp.tv_sec < 0 || delta_stamp.tv_usec < 0) {
-	    fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-	    print_stamp(stderr, &result->timestamp);
-	    fprintf(stderr, "]: timestamp before label timestamp: ");
-	    print_stamp(stderr, &label_stamp);
-	    fprintf(stderr, "\n");
+	    f = report(hp, rp);
+	    fprintf(f, "]: timestamp before label timestamp: ");
+	    print_stamp(f, &label_stamp);
+	    fprintf(f, "\n");
 	}
 	delta_stamp = result->timestamp;
 	tsub(&delta_stamp, &last_stamp);
@@ -475,8 +747,7 @@ pass3(__pmContext *ctxp, char *archname, pmOptions *opts)
 	    int		cnt_err = 0;
 	    pmValueSet	*vsp;
 
-	    fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-	    print_stamp(stderr, &result->timestamp);
+	    f = report(hp, rp);
 	    for (i = 0; i < result->numpmid; i++) {
 		vsp = result->vset[i];
 		if (vsp->numval > 0)
@@ -486,56 +757,126 @@ pass3(__pmContext *ctxp, char *archname, pmOptions *opts)
 		else
 		    cnt_err++;
 	    }
-	    fprintf(stderr, "] delta(stamp)=%.3fsec", pmtimevalToReal(&delta_stamp));
-	    fprintf(stderr, " numpmid=%d sum(numval)=%d", result->numpmid, sum_val);
+	    fprintf(f, "] delta(stamp)=%.3fsec", pmtimevalToReal(&delta_stamp));
+	    fprintf(f, " numpmid=%d sum(numval)=%d", result->numpmid, sum_val);
 	    if (cnt_noval > 0)
-		fprintf(stderr, " count(numval=0)=%d", cnt_noval);
+		fprintf(f, " count(numval=0)=%d", cnt_noval);
 	    if (cnt_err > 0)
-		fprintf(stderr, " count(numval<0)=%d", cnt_err);
-	    fputc('\n', stderr);
+		fprintf(f, " count(numval<0)=%d", cnt_err);
+	    fputc('\n', f);
 	}
 	if (delta_stamp.tv_sec < 0 || delta_stamp.tv_usec < 0) {
 	    /* time went backwards! */
-	    fprintf(stderr, "%s.%d:[", l_archname, l_ctxp->c_archctl->ac_vol);
-	    print_stamp(stderr, &result->timestamp);
-	    fprintf(stderr, "]: timestamp went backwards, prior timestamp: ");
-	    print_stamp(stderr, &last_stamp);
-	    fprintf(stderr, "\n");
+	    f = report(hp, rp);
+	    fprintf(f, "]: timestamp went backwards, prior timestamp: ");
+	    print_stamp(f, &last_stamp);
+	    fprintf(f, "\n");
 	}
 
 	last_stamp = result->timestamp;
 	if ((opts->finish.tv_sec > result->timestamp.tv_sec) ||
 	    ((opts->finish.tv_sec == result->timestamp.tv_sec) &&
 	     (opts->finish.tv_usec >= result->timestamp.tv_usec))) {
-	    if (result->numpmid == 0) {
-		/*
-		 * MARK record ... make sure wrap check is not done
-		 * at next fetch (mimic interp.c from libpcp)
-		 */
-		__pmHashNode	*hptr;
-		checkData	*checkdata;
-		int		k;
-		for (hptr = __pmHashWalk(&hashlist, PM_HASH_WALK_START);
-		     hptr != NULL;
-		     hptr = __pmHashWalk(&hashlist, PM_HASH_WALK_NEXT)) {
-		    checkdata = (checkData *)hptr->data;
-		    for (k = 0; k < checkdata->listsize; k++) {
-			checkdata->instlist[k]->lasttime.tv_sec = 0;
-		    }
-		}
-
+	    if (result->numpmid == 0)
 		mark_count++;
-	    }
-	    else
-		docheck(result);
-	    pmFreeResult(result);
+	    n++;
 	}
 	else {
 	    pmFreeResult(result);
-	    sts = PM_ERR_EOL;
+	    *stsp = PM_ERR_EOL;
 	    break;
 	}
     }
+    return n;
+}
+
+int
+pass3(__pmContext *ctxp, char *archname, pmOptions *opts)
+{
+    struct timeval	timespan;
+    int			sts;
+    int			n, next;
+    int			cur = 0;
+    record_t		*recs[2];
+
+    l_ctxp = ctxp;
+    l_archname = archname;
+
+    label_stamp.tv_sec = log_label.ill_start.tv_sec;
+    label_stamp.tv_usec = log_label.ill_start.tv_usec;
+
+    if (vflag)
+	fprintf(stderr, "%s: start pass3\n", archname);
+
+    /* check which timestamp print format we should be using */
+    timespan = opts->finish;
+    tsub(&timespan, &opts->start);
+    if (timespan.tv_sec > 86400) /* seconds per day: 60*60*24 */
+	dayflag = 1;
+
+    if (opts->start_optarg == NULL && opts->origin_optarg == NULL && 
+	opts->align_optarg == NULL) {
+	/*
+	 * No -S or -O or -A ... start from the epoch in case there are
+	 * records with a timestamp _before_ the label timestamp.
+	 */
+	opts->start.tv_sec = opts->start.tv_usec = 0;
+    }
+
+    if ((sts = pmSetMode(PM_MODE_FORW, &opts->start, 0)) < 0) {
+	fprintf(stderr, "%s: pmSetMode failed: %s\n", l_archname, pmErrStr(sts));
+	return STS_FATAL;
+    }
+
+    if ((shards = (shard_t *)calloc(nshard, sizeof(shard_t))) == NULL)
+	pmNoMem("pass3.shards", nshard * sizeof(shard_t), PM_FATAL_ERR);
+    if (nshard > 1 && startshards() < 0) {
+	if (vflag)
+	    fprintf(stderr, "%s: checking pass3 serially\n", archname);
+	nshard = 1;
+    }
+    if (nshard == 1) {
+	shards[0].out = header[0].out = stderr;
+	recs[0] = recs[1] = NULL;
+    }
+    else {
+	if ((recs[0] = (record_t *)malloc(2 * BATCHSIZE * sizeof(record_t))) == NULL)
+	    pmNoMem("pass3.recs", 2 * BATCHSIZE * sizeof(record_t), PM_FATAL_ERR);
+	recs[1] = recs[0] + BATCHSIZE;
+    }
+
+    sts = 0;
+    last_stamp = opts->start;
+    if (nshard == 1) {
+	record_t	rec;
+
+	while (sts == 0 && readbatch(&rec, 1, &header[0], opts, &sts) > 0) {
+	    checkbatch(&shards[0], &rec, 1);
+	    if (flushbatch(&header[0], &rec, 1))
+		exit(EXIT_FAILURE);
+	}
+    }
+    else {
+	/*
+	 * Records are decoded once, here, and each batch is checked by
+	 * all shards concurrently while the next batch is being read.
+	 */
+	n = readbatch(recs[cur], BATCHSIZE, &header[cur], opts, &sts);
+	while (n > 0) {
+	    startbatch(recs[cur], n);
+	    next = 0;
+	    if (sts == 0)
+		next = readbatch(recs[1-cur], BATCHSIZE, &header[1-cur], opts, &sts);
+	    waitbatch();
+	    if (flushbatch(&header[cur], recs[cur], n))
+		exit(EXIT_FAILURE);
+	    cur = 1 - cur;
+	    n = next;
+	}
+	/* diagnostics for a final record beyond the time window */
+	flushbatch(&header[cur], recs[cur], 0);
+	free(recs[0]);
+    }
     if (sts != PM_ERR_EOL) {
 	fprintf(stderr, "[after ");
 	print_stamp(stderr, &last_stamp);
@@ -17,6 +17,9 @@
 #include <limits.h>
 #include <ctype.h>
 #include <unistd.h>
+#if !defined(IS_MINGW)
+#include <sys/wait.h>
+#endif
 #include "pmapi.h"
 #include "libpcp.h"
 #include "logcheck.h"
@@ -25,6 +28,7 @@ char		sep;
 int		vflag;		/* verbose off by default */
 int		nowrap;		/* suppress wrap check */
 int		mflag;		/* check metadata only, suppress pass3 */
+int		nshard = 1;	/* pass3 threads, each checking some PMIDs */
 int		index_state = STATE_MISSING;
 int		meta_state = STATE_MISSING;
 int		log_state = STATE_MISSING;
@@ -33,13 +37,16 @@ int		result_count;
 __pmLogLabel	log_label;
 
 static char	*archbasename;	/* after basename() */
+static int	njobs = 1;	/* archives checked concurrently */
 
 static pmLongOptions longopts[] = {
     PMAPI_OPTIONS_HEADER("Options"),
     PMOPT_DEBUG,
+    { "jobs", 1, 'j', "N", "check up to N archives in parallel" },
     { "label", 0, 'l', 0, "print the archive label" },
     { "metadataonly", 0, 'm', 0, "skip checking log data volumes" },
     PMOPT_NAMESPACE,
+    { "shards", 1, 'P', "N", "check values in N threads, sharded by metric" },
     PMOPT_START,
     PMOPT_FINISH,
     { "verbose", 0, 'v', 0, "verbose output" },
@@ -52,9 +59,9 @@ static pmLongOptions longopts[] = {
 
 static pmOptions opts = {
     .flags = PM_OPTFLAG_DONE | PM_OPTFLAG_BOUNDARIES | PM_OPTFLAG_STDOUT_TZ,
-    .short_options = "D:lmn:S:T:zvwZ:?",
+    .short_options = "D:j:lmn:P:S:T:zvwZ:?",
     .long_options = longopts,
-    .short_usage = "[options] archive",
+    .short_usage = "[options] archive [...]",
 };
 
 static void
@@ -155,58 +162,28 @@ filter(const_dirent *dp)
     return 1;
 }
 
-int
-main(int argc, char *argv[])
+/*
+ * Check one archive, all passes.  Returns the exit status, or exits
+ * directly if checking cannot continue.
+ */
+static int
+check(char *archpathname, int lflag)
 {
-    int			c;
     int			sts;
     int			ctx;
     int			i;
-    int			lflag = 0;	/* no label by default */
     int			nfile;
     int			n;
     char		*p;
     struct dirent	**namelist;
     __pmContext		*ctxp;
-    char		*archpathname;	/* from the command line */
     char		*archdirname;	/* after dirname() */
     char		archname[MAXPATHLEN];	/* full pathname to base of archive name */
 
-    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
-	switch (c) {
-	case 'l':	/* display the archive label */
-	    lflag = 1;
-	    break;
-	case 'm':	/* only check metadata */
-	    mflag = 1;
-	    break;
-	case 'v':	/* bump verbosity */
-	    vflag++;
-	    break;
-	case 'w':	/* no wrap checks */
-	    nowrap = 1;
-	    break;
-	}
-    }
-
-    if (!opts.errors && opts.optind >= argc) {
-	pmprintf("Error: no archive specified\n\n");
-	opts.errors++;
-    }
-
-    if (opts.errors) {
-	pmUsageMessage(&opts);
-	exit(EXIT_FAILURE);
-    }
-
-    sep = pmPathSeparator();
-    setlinebuf(stderr);
-
-    __pmAddOptArchive(&opts, argv[opts.optind]);
+    __pmAddOptArchive(&opts, archpathname);
     opts.flags &= ~PM_OPTFLAG_DONE;
     __pmEndOptions(&opts);
 
-    archpathname = argv[opts.optind];
     archbasename = strdup(basename(strdup(archpathname)));
     /*
      * treat foo.index, foo.meta, foo.NNN along with any supported
@@ -323,12 +300,233 @@ main(int argc, char *argv[])
     if (!mflag)
 	sts = pass3(ctxp, archname, &opts);
 
-    if (vflag) {
-	if (result_count > 0)
-	    fprintf(stderr, "Processed %d pmResult records\n", result_count);
-	if (mark_count > 0)
-	    fprintf(stderr, "Processed %d <mark> records\n", mark_count);
+    return 0;
+}
+
+static void
+print_counts(void)
+{
+    if (result_count > 0)
+	fprintf(stderr, "Processed %d pmResult records\n", result_count);
+    if (mark_count > 0)
+	fprintf(stderr, "Processed %d <mark> records\n", mark_count);
+}
+
+#if !defined(IS_MINGW)
+typedef struct {
+    char	*archive;
+    pid_t	pid;
+    FILE	*out;		/* diagnostics, held until they can be printed in order */
+    int		fd;		/* record counts from the child */
+    int		done;
+    int		status;
+} job_t;
+
+static void
+startjob(job_t *jp, int lflag)
+{
+    int		fds[2];
+    int		counts[2];
+
+    if ((jp->out = tmpfile()) == NULL) {
+	fprintf(stderr, "%s: cannot create temporary file for \"%s\": %s\n",
+		pmGetProgname(), jp->archive, osstrerror());
+	jp->done = jp->status = 1;
+	return;
+    }
+    if (pipe(fds) < 0) {
+	fprintf(stderr, "%s: cannot create pipe for \"%s\": %s\n",
+		pmGetProgname(), jp->archive, osstrerror());
+	fclose(jp->out);
+	jp->out = NULL;
+	jp->done = jp->status = 1;
+	return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    if ((jp->pid = fork()) < 0) {
+	fprintf(stderr, "%s: cannot fork for \"%s\": %s\n",
+		pmGetProgname(), jp->archive, osstrerror());
+	close(fds[0]);
+	close(fds[1]);
+	fclose(jp->out);
+	jp->out = NULL;
+	jp->done = jp->status = 1;
+	return;
+    }
+    if (jp->pid == 0) {
+	close(fds[0]);
+	dup2(fileno(jp->out), fileno(stdout));
+	dup2(fileno(jp->out), fileno(stderr));
+	/* counts for jobs finished before this fork are the parent's */
+	result_count = mark_count = 0;
+	if (check(jp->archive, lflag) == 0) {
+	    counts[0] = result_count;
+	    counts[1] = mark_count;
+	    if (write(fds[1], counts, sizeof(counts)) != sizeof(counts))
+		exit(EXIT_FAILURE);
+	}
+	exit(EXIT_SUCCESS);
+    }
+    close(fds[1]);
+    jp->fd = fds[0];
+}
+
+static void
+finishjob(job_t *jp)
+{
+    char	buf[BUFSIZ];
+    size_t	bytes;
+    int		counts[2];
+
+    if (jp->out == NULL)
+	return;
+    if (read(jp->fd, counts, sizeof(counts)) == sizeof(counts)) {
+	result_count += counts[0];
+	mark_count += counts[1];
+    }
+    close(jp->fd);
+    fflush(stderr);
+    rewind(jp->out);
+    while ((bytes = fread(buf, 1, sizeof(buf), jp->out)) > 0)
+	fwrite(buf, 1, bytes, stderr);
+    fclose(jp->out);
+    jp->out = NULL;
+}
+
+/*
+ * Check each archive in a child process, up to njobs at a time.  All
+ * of the checking state is global and archives are independent, so
+ * processes are simpler than threads here.  Diagnostics are reported
+ * in command line order, followed by a summary over all archives.
+ */
+static int
+check_all(int narchives, char **archives, int lflag)
+{
+    job_t	*jobs;
+    pid_t	pid;
+    int		status;
+    int		failed = 0;
+    int		running = 0;
+    int		next = 0;
+    int		printed = 0;
+    int		i;
+
+    if ((jobs = (job_t *)calloc(narchives, sizeof(job_t))) == NULL)
+	pmNoMem("check_all", narchives * sizeof(job_t), PM_FATAL_ERR);
+
+    while (printed < narchives) {
+	while (running < njobs && next < narchives) {
+	    jobs[next].archive = archives[next];
+	    startjob(&jobs[next], lflag);
+	    if (!jobs[next].done)
+		running++;
+	    next++;
+	}
+	while (printed < next && jobs[printed].done) {
+	    finishjob(&jobs[printed]);
+	    if (jobs[printed].status)
+		failed++;
+	    printed++;
+	}
+	if (running == 0)
+	    continue;
+	if ((pid = wait(&status)) < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    fprintf(stderr, "%s: wait failed: %s\n", pmGetProgname(), osstrerror());
+	    exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < next; i++) {
+	    if (jobs[i].pid == pid && !jobs[i].done) {
+		jobs[i].done = 1;
+		jobs[i].status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+		running--;
+		break;
+	    }
+	}
     }
+    free(jobs);
 
+    if (vflag) {
+	fprintf(stderr, "Checked %d archives\n", narchives);
+	print_counts();
+    }
+    if (failed) {
+	fprintf(stderr, "%s: %d of %d archives could not be checked\n",
+		pmGetProgname(), failed, narchives);
+	return EXIT_FAILURE;
+    }
     return 0;
 }
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    int			c;
+    int			sts;
+    int			lflag = 0;	/* no label by default */
+    char		*endnum;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	case 'j':	/* archives checked in parallel */
+	    njobs = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || njobs <= 0) {
+		pmprintf("%s: -j requires positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'l':	/* display the archive label */
+	    lflag = 1;
+	    break;
+	case 'm':	/* only check metadata */
+	    mflag = 1;
+	    break;
+	case 'P':	/* pass3 threads */
+	    nshard = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || nshard <= 0) {
+		pmprintf("%s: -P requires positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'v':	/* bump verbosity */
+	    vflag++;
+	    break;
+	case 'w':	/* no wrap checks */
+	    nowrap = 1;
+	    break;
+	}
+    }
+
+    if (!opts.errors && opts.optind >= argc) {
+	pmprintf("Error: no archive specified\n\n");
+	opts.errors++;
+    }
+#if defined(IS_MINGW)
+    if (!opts.errors && opts.optind < argc - 1) {
+	pmprintf("Error: only one archive may be specified\n\n");
+	opts.errors++;
+    }
+#endif
+
+    if (opts.errors) {
+	pmUsageMessage(&opts);
+	exit(EXIT_FAILURE);
+    }
+
+    sep = pmPathSeparator();
+    setlinebuf(stderr);
+
+#if !defined(IS_MINGW)
+    if (opts.optind < argc - 1)
+	return check_all(argc - opts.optind, &argv[opts.optind], lflag);
+#endif
+    sts = check(argv[opts.optind], lflag);
+    if (vflag)
+	print_counts();
+    return sts;
+}
@@ -29,6 +29,7 @@ static int one_context = 1;
 
 struct timeval	last_stamp;
 __pmHashCtl	hist_hash;
+int		flushsize = 100000;	/* next temporal index update */
 
 /*
  * These structures allow us to keep track of the _last_ fetch
@@ -539,13 +540,94 @@ lookupTaskCacheNames(pmID pmid, char ***namesptr)
 void
 log_callback(int afid, void *data)
 {
-    task_t		*tp;
-    for (tp = tasklist; tp != NULL; tp = tp->t_next) {
-	if (tp->t_afid == afid) {
-	    tp->t_alarm = 1;
-	    log_alarm = 1;
-	    break;
+    /*
+     * data is the task, and with -N this may belong to a host other
+     * than the one whose tasklist is current
+     */
+    task_t		*tp = (task_t *)data;
+
+    if (tp != NULL && tp->t_afid == afid) {
+	tp->t_alarm = 1;
+	log_alarm = 1;
+    }
+}
+
+static void
+setprofile(fetchctl_t *fp)
+{
+    indomctl_t		*idp;
+
+    if (one_context || fp->f_state & OPT_STATE_PROFILE) {
+	/* profile for this fetch group has changed */
+	pmAddProfile(PM_INDOM_NULL, 0, (int *)0);
+	for (idp = fp->f_idp; idp != (indomctl_t *)0; idp = idp->i_next) {
+	    if (idp->i_indom != PM_INDOM_NULL && idp->i_numinst != 0)
+		pmAddProfile(idp->i_indom, idp->i_numinst, idp->i_instlist);
+	}
+	fp->f_state &= ~OPT_STATE_PROFILE;
+    }
+}
+
+/*
+ * Every AGENT_INTERVAL seconds pass the per-PMD fetch times that pmcd
+ * keeps to the fetch group optimizer, so PMDs that are always fetched
+ * together can still be told apart and a slow one split out into its
+ * own group.  The estimates are per PMD domain, not per pmcd, so this
+ * is not done for -N, and not at all for a pmcd without the metrics.
+ */
+#define AGENT_INTERVAL	10
+
+static void
+observe_agents(void)
+{
+    static char		*names[] = { "pmcd.agent.fetch.count", "pmcd.agent.fetch.time" };
+    static pmID		pmids[2];
+    static int		state;		/* 0 lookup, 1 ok, -1 disabled */
+    static struct timeval	last;
+    struct timeval	now;
+    pmResult		*rp;
+    int			sts;
+
+    if (state < 0 || curhost != NULL)
+	return;
+    pmtimevalNow(&now);
+    if (state == 1 && now.tv_sec - last.tv_sec < AGENT_INTERVAL)
+	return;
+    last = now;
+    if (state == 0) {
+	if ((sts = pmLookupName(2, names, pmids)) != 2) {
+	    if (pmDebugOptions.appl2)
+		fprintf(stderr, "observe_agents: no PMD fetch times: %s\n",
+			sts < 0 ? pmErrStr(sts) : "missing metric");
+	    state = -1;
+	    return;
 	}
+	state = 1;
+    }
+    if ((sts = pmFetch(2, pmids, &rp)) < 0) {
+	if (pmDebugOptions.appl2)
+	    fprintf(stderr, "observe_agents: pmFetch: %s\n", pmErrStr(sts));
+	return;
+    }
+    __pmOptFetchObserveAgents(rp);
+    pmFreeResult(rp);
+}
+
+/*
+ * With -N, send the requests for every fetch group of a task that is
+ * due ... do_work() for the task picks up the replies in myFetch().
+ */
+void
+prefetch(task_t *tp)
+{
+    fetchctl_t		*fp;
+
+    if (!parse_done || tp->t_dm)
+	return;
+    for (fp = tp->t_fetch; fp != NULL; fp = fp->f_next) {
+	setprofile(fp);
+	if (mySendFetch(fp->f_numpmid, fp->f_pmidlist) < 0)
+	    break;
     }
 }
 
@@ -560,7 +642,6 @@ do_work(task_t *tp)
     int			k;
     int			sts;
     fetchctl_t		*fp;
-    indomctl_t		*idp;
     pmResult		*resp;
     __pmPDU		*pb_in;
     __pmPDU		*pb_out;
@@ -570,7 +651,6 @@ do_work(task_t *tp)
     int			changed;
     int			needindom;
     int			needti;
-    static int		flushsize = 100000;
     long		old_meta_offset;
     long		new_offset;
     long		new_meta_offset;
@@ -582,6 +662,7 @@ do_work(task_t *tp)
     pmTimeval		tmp;
     pmTimeval		resp_tval;
     unsigned long	peek_offset;
+    int			regroup = 0;
 
     if ((pmDebugOptions.appl2) && (pmDebugOptions.desperate)) {
 	struct timeval	now;
@@ -653,15 +734,7 @@ do_work(task_t *tp)
 	    lfp->lf_fp = fp;
 	}
 
-	if (one_context || fp->f_state & OPT_STATE_PROFILE) {
-	    /* profile for this fetch group has changed */
-	    pmAddProfile(PM_INDOM_NULL, 0, (int *)0);
-	    for (idp = fp->f_idp; idp != (indomctl_t *)0; idp = idp->i_next) {
-		if (idp->i_indom != PM_INDOM_NULL && idp->i_numinst != 0)
-		    pmAddProfile(idp->i_indom, idp->i_numinst, idp->i_instlist);
-	    }
-	    fp->f_state &= ~OPT_STATE_PROFILE;
-	}
+	setprofile(fp);
 
 	clearavail(fp);
 
@@ -738,6 +811,13 @@ do_work(task_t *tp)
 	    exit(1);
 	}
 	setavail(resp);
+
+	/*
+	 * feed this fetch back into the fetch group optimizer,
+	 * remember if the groups should be rebuilt
+	 */
+	if (__pmOptFetchObserve(fp, resp))
+	    regroup = 1;
 	resp_tval.tv_sec = resp->timestamp.tv_sec;
 	resp_tval.tv_usec = resp->timestamp.tv_usec;
 
@@ -958,6 +1038,27 @@ do_work(task_t *tp)
 	lfp->lf_pb = pb_in;
     }
 
+    observe_agents();
+
+    if (regroup) {
+	/*
+	 * observed PMD costs have changed enough to warrant rebuilding
+	 * the fetch groups for this task ... the old fetchctl_t's are
+	 * gone, so release the lastfetch_t's that refer to them
+	 */
+	if (pmDebugOptions.appl2)
+	    fprintf(stderr, "callback: regroup fetches for task %p\n", tp);
+	__pmOptFetchRedo(&tp->t_fetch);
+	linkback(tp);
+	for (lfp = acp->ac_fetch; lfp != (lastfetch_t *)0; lfp = lfp->lf_next) {
+	    lfp->lf_fp = (fetchctl_t *)0;
+	    if (lfp->lf_resp != (pmResult *)0) {
+		pmFreeResult(lfp->lf_resp);
+		lfp->lf_resp = (pmResult *)0;
+	    }
+	}
+    }
+
     if (rflag && tp->t_size == 0 && pdu_metrics > 0) {
 	char	*name = NULL;
 	int	taskindex;
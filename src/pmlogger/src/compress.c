@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * Compression of archive data volumes as they are logged.
+ *
+ * With -z each data volume is compressed in a background thread as
+ * soon as pmlogger switches to the next volume, rather than hours later
+ * by pmlogger_daily.  With -Z data volumes are written compressed from
+ * the outset.  Either way the result is a <archive>.<vol>.xz file made
+ * of independently compressed blocks, that libpcp can seek into and
+ * decompress on-the-fly.
+ */
+
+#include "logger.h"
+#if defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
+
+int		compress_mode = COMPRESS_NONE;
+
+#if defined(HAVE_LZMA_DECOMPRESSION) && defined(HAVE_TRANSPARENT_DECOMPRESSION)
+#define HAVE_COMPRESS 1
+#endif
+
+typedef struct volume_s {
+    struct volume_s	*v_next;
+    char		*v_name;
+} volume_t;
+
+#if defined(HAVE_PTHREAD_H)
+static volume_t		*queue;		/* volumes waiting to be compressed */
+static pthread_mutex_t	queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t	worker;
+static int		worker_running;
+static int		worker_exit;
+#endif
+
+static void
+volname(const char *base, int vol, char *buf, size_t buflen)
+{
+    pmsprintf(buf, buflen, "%s.%d", base, vol);
+}
+
+int
+compress_supported(void)
+{
+#if defined(HAVE_COMPRESS)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Like __pmLogNewFile() but for a compressed data volume, used for -Z
+ */
+__pmFILE *
+compress_newfile(const char *base, int vol)
+{
+    char	fname[MAXPATHLEN];
+    char	xzname[MAXPATHLEN];
+    __pmFILE	*f;
+    int		sts;
+
+    volname(base, vol, fname, sizeof(fname));
+    pmsprintf(xzname, sizeof(xzname), "%s.xz", fname);
+
+    if (__pmAccess(fname, R_OK) != -1) {
+	/* exists and readable, either compressed or not ... */
+	fprintf(stderr, "%s: \"%s\" already exists, not over-written\n",
+		pmGetProgname(), fname);
+	setoserror(EEXIST);
+	return NULL;
+    }
+    if ((f = __pmFopen(xzname, "w")) == NULL) {
+	sts = oserror();
+	fprintf(stderr, "%s: failed to create \"%s\": %s\n",
+		pmGetProgname(), xzname, osstrerror());
+	setoserror(sts);
+	return NULL;
+    }
+    if ((sts = __pmSetVersionIPC(__pmFileno(f), PDU_VERSION)) < 0) {
+	fprintf(stderr, "%s: failed to setup \"%s\": %s\n",
+		pmGetProgname(), xzname, pmErrStr(sts));
+	__pmFclose(f);
+	unlink(xzname);
+	setoserror(-sts);
+	return NULL;
+    }
+    return f;
+}
+
+#if defined(HAVE_COMPRESS)
+/*
+ * Compress one finished volume.  The compressed copy is built under a
+ * hidden name and renamed into place before the original is removed,
+ * so there is always exactly one usable copy of the volume for any
+ * concurrent reader (libpcp prefers the uncompressed file when both
+ * exist).
+ */
+static void
+compress_file(const char *fname)
+{
+    char	xzname[MAXPATHLEN];
+    char	tmpname[MAXPATHLEN];
+    char	buf[65536];
+    const char	*p;
+    FILE	*in;
+    __pmFILE	*out;
+    size_t	bytes;
+    int		sts = 0;
+
+    pmsprintf(xzname, sizeof(xzname), "%s.xz", fname);
+    if ((p = strrchr(fname, '/')) != NULL)
+	pmsprintf(tmpname, sizeof(tmpname), "%.*s/.%s.xz",
+		(int)(p - fname), fname, p + 1);
+    else
+	pmsprintf(tmpname, sizeof(tmpname), ".%s.xz", fname);
+
+    if ((in = fopen(fname, "r")) == NULL) {
+	fprintf(stderr, "%s: cannot open \"%s\" to compress: %s\n",
+		pmGetProgname(), fname, osstrerror());
+	return;
+    }
+    unlink(tmpname);	/* left over from an earlier failure, perhaps */
+    if ((out = __pmFopen(tmpname, "w")) == NULL) {
+	fprintf(stderr, "%s: cannot create \"%s\": %s\n",
+		pmGetProgname(), tmpname, osstrerror());
+	fclose(in);
+	return;
+    }
+    while ((bytes = fread(buf, 1, sizeof(buf), in)) > 0) {
+	if (__pmFwrite(buf, 1, bytes, out) != bytes) {
+	    sts = -oserror();
+	    break;
+	}
+    }
+    if (sts == 0 && ferror(in))
+	sts = -EIO;
+    fclose(in);
+    if (sts == 0 && __pmFsync(out) < 0)
+	sts = -oserror();
+    if (__pmFclose(out) != 0 && sts == 0)
+	sts = -EIO;
+    if (sts == 0 && rename(tmpname, xzname) < 0)
+	sts = -oserror();
+    if (sts < 0) {
+	fprintf(stderr, "%s: compression of \"%s\" failed: %s\n",
+		pmGetProgname(), fname, pmErrStr(sts));
+	unlink(tmpname);
+	return;
+    }
+    unlink(fname);
+    if (pmDebugOptions.log)
+	fprintf(stderr, "compress_file: %s -> %s\n", fname, xzname);
+}
+
+#if defined(HAVE_PTHREAD_H)
+static void *
+compress_worker(void *arg)
+{
+    volume_t	*vp;
+    sigset_t	sigs;
+
+    (void)arg;
+    /* leave all signal handling (SIGALRM from AF, etc) to the main thread */
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    pthread_mutex_lock(&queue_lock);
+    for ( ; ; ) {
+	while (queue == NULL && !worker_exit)
+	    pthread_cond_wait(&queue_cond, &queue_lock);
+	if ((vp = queue) == NULL)
+	    break;
+	queue = vp->v_next;
+	pthread_mutex_unlock(&queue_lock);
+	compress_file(vp->v_name);
+	free(vp->v_name);
+	free(vp);
+	pthread_mutex_lock(&queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+#endif
+#endif
+
+/*
+ * Queue a finished data volume for compression (-z)
+ */
+void
+compress_volume(const char *base, int vol)
+{
+    char	fname[MAXPATHLEN];
+#if defined(HAVE_COMPRESS) && defined(HAVE_PTHREAD_H)
+    volume_t	*vp;
+    volume_t	**vpp;
+    int		sts;
+#endif
+
+    volname(base, vol, fname, sizeof(fname));
+#if defined(HAVE_COMPRESS)
+#if defined(HAVE_PTHREAD_H)
+    if ((vp = (volume_t *)malloc(sizeof(volume_t))) == NULL ||
+	(vp->v_name = strdup(fname)) == NULL) {
+	pmNoMem("compress_volume", sizeof(volume_t) + strlen(fname), PM_FATAL_ERR);
+	/*NOTREACHED*/
+    }
+    vp->v_next = NULL;
+    pthread_mutex_lock(&queue_lock);
+    for (vpp = &queue; *vpp != NULL; vpp = &(*vpp)->v_next)
+	;
+    *vpp = vp;
+    if (!worker_running) {
+	if ((sts = pthread_create(&worker, NULL, compress_worker, NULL)) != 0) {
+	    *vpp = NULL;
+	    pthread_mutex_unlock(&queue_lock);
+	    fprintf(stderr, "%s: cannot start compression thread: %s\n",
+		    pmGetProgname(), strerror(sts));
+	    /* do it the slow way then */
+	    compress_file(vp->v_name);
+	    free(vp->v_name);
+	    free(vp);
+	    return;
+	}
+	worker_running = 1;
+    }
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+#else
+    compress_file(fname);
+#endif
+#else
+    (void)fname;
+#endif
+}
+
+/*
+ * Finish any compression that is still queued or in progress, before
+ * exiting
+ */
+void
+compress_wait(void)
+{
+#if defined(HAVE_COMPRESS) && defined(HAVE_PTHREAD_H)
+    pthread_mutex_lock(&queue_lock);
+    if (!worker_running) {
+	pthread_mutex_unlock(&queue_lock);
+	return;
+    }
+    worker_exit = 1;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(worker, NULL);
+    worker_running = 0;
+#endif
+}
@@ -52,10 +52,90 @@ myLocalFetch(__pmContext *ctxp, int numpmid, pmID pmidlist[], __pmPDU **pdup)
     return __pmEncodeResult(0, result, pdup);
 }
 
+/*
+ * Multi-host mode (-N) ... send the fetch request now and let the
+ * matching myFetch() call collect the reply, so requests to many
+ * pmcds (and for every fetch group) can be in flight at once.  Only
+ * for host contexts without derived metrics, and a no-op if the
+ * request cannot be sent.
+ */
+int
+mySendFetch(int numpmid, pmID pmidlist[])
+{
+    int			n = 0;
+    int			ctx;
+    __pmContext		*ctxp;
+
+    if (curhost == NULL || numpmid < 1)
+	return 0;
+    if ((ctx = pmWhichContext()) < 0 || (ctxp = __pmHandleToPtr(ctx)) == NULL)
+	return PM_ERR_NOCONTEXT;
+    /* single threaded, see myFetch() */
+    PM_UNLOCK(ctxp->c_lock);
+    if (ctxp->c_type != PM_CONTEXT_HOST || ctxp->c_pmcd->pc_fd == -1)
+	return 0;
+
+    if (ctxp->c_sent == 0) {
+	if ((n = __pmSendProfile(ctxp->c_pmcd->pc_fd, FROM_ANON, ctx, ctxp->c_instprof)) >= 0)
+	    ctxp->c_sent = 1;
+    }
+    if (n >= 0)
+	n = __pmSendFetch(ctxp->c_pmcd->pc_fd, FROM_ANON, ctx, &ctxp->c_origin, numpmid, pmidlist);
+    if (n < 0) {
+	disconnect(n);
+	return n;
+    }
+    host_sent(curhost, pmidlist);
+    return 0;
+}
+
+/*
+ * a reply from mySendFetch() that nobody asked for ... read and
+ * discard it so the next request and reply line up
+ */
+static void
+dropFetch(__pmContext *ctxp)
+{
+    __pmPDU		*pb;
+    int			n, code = 0;
+
+    do {
+	n = host_getpdu(curhost, ctxp->c_pmcd->pc_fd, &pb);
+	if (n == PDU_ERROR)
+	    __pmDecodeError(pb, &code);	/* > 0 for PMCD state change */
+	if (n > 0)
+	    __pmUnpinPDUBuf(pb);
+    } while (n == PDU_ERROR && code > 0);
+    if (n != PDU_RESULT && !(n == PDU_ERROR && code < 0))
+	disconnect(n < 0 ? n : PM_ERR_IPC);
+}
+
+void
+myDropFetch(void)
+{
+    int			ctx;
+    __pmContext		*ctxp;
+
+    if (curhost == NULL)
+	return;
+    if (curhost->h_nused < curhost->h_nsent &&
+	(ctx = pmWhichContext()) >= 0 && (ctxp = __pmHandleToPtr(ctx)) != NULL) {
+	PM_UNLOCK(ctxp->c_lock);
+	/* disconnect() on error resets the host, ending the loop */
+	while (curhost->h_nused < curhost->h_nsent &&
+	       ctxp->c_pmcd->pc_fd != -1) {
+	    curhost->h_nused++;
+	    dropFetch(ctxp);
+	}
+    }
+    host_reset(curhost);
+}
+
 int
 myFetch(int numpmid, pmID pmidlist[], __pmPDU **pdup)
 {
     int			n = 0;
+    int			sent = 0;
     int			changed = 0;
     int			ctx;
     __pmPDU		*pb;
@@ -95,7 +175,18 @@ myFetch(int numpmid, pmID pmidlist[], __pmPDU **pdup)
 	}
     }
 
-    if (ctxp->c_sent == 0) {
+    if (curhost != NULL && curhost->h_nused < curhost->h_nsent) {
+	if (curhost->h_sent[curhost->h_nused] == pmidlist) {
+	    sent = 1;		/* request went out from mySendFetch() */
+	    curhost->h_nused++;
+	}
+	else
+	    myDropFetch();
+	if (ctxp->c_pmcd->pc_fd == -1 && (n = reconnect()) < 0)
+	    return n;
+    }
+
+    if (!sent && ctxp->c_sent == 0) {
 	/*
 	 * current profile is _not_ already cached at other end of
 	 * IPC, so send current profile
@@ -119,10 +210,11 @@ myFetch(int numpmid, pmID pmidlist[], __pmPDU **pdup)
 	    pmidlist = newlist;
 	}
 
-	n = __pmSendFetch(ctxp->c_pmcd->pc_fd, FROM_ANON, ctx, &ctxp->c_origin, numpmid, pmidlist);
+	if (!sent)
+	    n = __pmSendFetch(ctxp->c_pmcd->pc_fd, FROM_ANON, ctx, &ctxp->c_origin, numpmid, pmidlist);
 	if (n >= 0) {
 	    do {
-		n = __pmGetPDU(ctxp->c_pmcd->pc_fd, ANY_SIZE, TIMEOUT_DEFAULT, &pb);
+		n = host_getpdu(curhost, ctxp->c_pmcd->pc_fd, &pb);
 		/*
 		 * expect PDU_RESULT or
 		 *        PDU_ERROR(changed > 0)+PDU_RESULT or
@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * Multi-host mode (-N) ... one pmlogger process logging many hosts.
+ *
+ * The rest of pmlogger keeps the state for the host being logged in
+ * globals (tasklist, logctl, archctl, the hash tables, etc).  Rather
+ * than thread a host pointer through all of that, each host_t holds
+ * a copy of those globals while the host is not current, and
+ * host_use() swaps them in and out, along with the PMAPI context.
+ *
+ * Timers for every host share the one AF queue.  When tasks fall due
+ * the requests for every fetch group due from each host are sent
+ * before waiting for any reply.  Replies are then read as poll()
+ * reports them, one PDU at a time from whichever pmcd is ready, and
+ * kept with the host.  Once a host has all of its replies its tasks
+ * are run, and myFetch() takes the replies from the host rather than
+ * the socket, so logging one host never waits on another pmcd.  Each
+ * host must make progress within the request timeout.  Derived metric
+ * tasks, and reconnecting to a pmcd that was lost, are still fetched
+ * synchronously when the host is serviced.
+ */
+
+#include "logger.h"
+#if defined(HAVE_POLL_H)
+#include <poll.h>
+#endif
+
+host_t		*hostlist;	/* all hosts being logged, with -N */
+host_t		*curhost;	/* host whose state is in the globals */
+
+#if defined(HAVE_POLL_H)
+static struct pollfd	ctlpoll[CFD_NUM+1];	/* control ports + client */
+static int		nctlpoll;
+#endif
+
+static void
+host_save(host_t *hp)
+{
+    hp->h_name = pmcd_host;
+    hp->h_conn = pmcd_host_conn;
+    hp->h_archive = archBase;
+    hp->h_fd = pmcdfd;
+    hp->h_tasklist = tasklist;
+    hp->h_pm_hash = pm_hash;
+    hp->h_hist_hash = hist_hash;
+    hp->h_dyn_roots = dyn_roots;
+    hp->h_n_dyn_roots = n_dyn_roots;
+    hp->h_logctl = logctl;		/* struct assignment */
+    hp->h_archctl = archctl;		/* struct assignment */
+    hp->h_epoch = epoch;
+    hp->h_last_stamp = last_stamp;
+    hp->h_last_log_offset = last_log_offset;
+    hp->h_flushsize = flushsize;
+    hp->h_exit_samples = exit_samples;
+    hp->h_vol_samples_counter = vol_samples_counter;
+    hp->h_vol_bytes = vol_bytes;
+}
+
+static void
+host_restore(host_t *hp)
+{
+    pmcd_host = hp->h_name;
+    pmcd_host_conn = hp->h_conn;
+    archBase = hp->h_archive;
+    pmcdfd = hp->h_fd;
+    tasklist = hp->h_tasklist;
+    pm_hash = hp->h_pm_hash;
+    hist_hash = hp->h_hist_hash;
+    dyn_roots = hp->h_dyn_roots;
+    n_dyn_roots = hp->h_n_dyn_roots;
+    logctl = hp->h_logctl;		/* struct assignment */
+    archctl = hp->h_archctl;		/* struct assignment */
+    /* ac_log still points at the (global) logctl */
+    epoch = hp->h_epoch;
+    last_stamp = hp->h_last_stamp;
+    last_log_offset = hp->h_last_log_offset;
+    flushsize = hp->h_flushsize;
+    exit_samples = hp->h_exit_samples;
+    vol_samples_counter = hp->h_vol_samples_counter;
+    vol_bytes = hp->h_vol_bytes;
+}
+
+/*
+ * make hp the current host ... a host with no context yet (during
+ * setup) starts out with the initial values of the globals
+ */
+void
+host_use(host_t *hp)
+{
+    if (hp == curhost)
+	return;
+    if (curhost != NULL)
+	host_save(curhost);
+    host_restore(hp);
+    curhost = hp;
+    if (hp->h_ctx >= 0)
+	pmUseContext(hp->h_ctx);
+}
+
+/*
+ * forget about the current host, e.g. when pmcd could not be reached
+ * at startup
+ */
+void
+host_drop(host_t *hp)
+{
+    host_t	**hpp;
+
+    for (hpp = &hostlist; *hpp != NULL; hpp = &(*hpp)->h_next) {
+	if (*hpp == hp) {
+	    *hpp = hp->h_next;
+	    break;
+	}
+    }
+    if (hp == curhost)
+	curhost = NULL;
+    host_reset(hp);
+    free(hp->h_sent);
+    free(hp->h_pdu);
+    free(hp->h_conn);
+    free(hp->h_archive);
+    free(hp);
+}
+
+/* the pmcd socket for a host, the global is live for the current host */
+int
+host_fd(host_t *hp)
+{
+    return hp == curhost ? pmcdfd : hp->h_fd;
+}
+
+static task_t *
+host_tasks(host_t *hp)
+{
+    return hp == curhost ? tasklist : hp->h_tasklist;
+}
+
+/*
+ * Read the hosts file for -N ... each line names a pmcd host and the
+ * base name of the archive for that host, blank lines and lines
+ * starting with # are ignored.  Returns the number of hosts.
+ */
+int
+host_read(char *file)
+{
+    FILE	*f;
+    host_t	*hp;
+    host_t	*last = NULL;
+    char	buf[2*MAXPATHLEN];
+    char	host[MAXPATHLEN];
+    char	archive[MAXPATHLEN];
+    char	extra;
+    int		line = 0;
+    int		n = 0;
+
+    if ((f = fopen(file, "r")) == NULL) {
+	fprintf(stderr, "%s: Cannot open hosts file \"%s\": %s\n",
+		pmGetProgname(), file, osstrerror());
+	exit(1);
+    }
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+	line++;
+	if (sscanf(buf, " %c", &extra) != 1 || extra == '#')
+	    continue;
+	if (sscanf(buf, "%s %s %c", host, archive, &extra) != 2) {
+	    fprintf(stderr, "%s: %s[%d]: expected \"host archive\"\n",
+		    pmGetProgname(), file, line);
+	    exit(1);
+	}
+	if ((hp = (host_t *)calloc(1, sizeof(host_t))) == NULL)
+	    pmNoMem("host_read", sizeof(host_t), PM_FATAL_ERR);
+	if ((hp->h_conn = strdup(host)) == NULL ||
+	    (hp->h_archive = strdup(archive)) == NULL)
+	    pmNoMem("host_read", strlen(buf), PM_FATAL_ERR);
+	hp->h_ctx = -1;
+	hp->h_fd = -1;
+	hp->h_flushsize = flushsize;
+	hp->h_exit_samples = exit_samples;
+	if (last == NULL)
+	    hostlist = hp;
+	else
+	    last->h_next = hp;
+	last = hp;
+	n++;
+    }
+    fclose(f);
+    return n;
+}
+
+/* remember a request sent by mySendFetch(), replies arrive in order */
+void
+host_sent(host_t *hp, pmID *pmidlist)
+{
+    size_t	need;
+
+    if (hp->h_nsent == hp->h_maxsent) {
+	hp->h_maxsent = hp->h_maxsent ? 2 * hp->h_maxsent : 4;
+	need = hp->h_maxsent * sizeof(hp->h_sent[0]);
+	if ((hp->h_sent = (pmID **)realloc(hp->h_sent, need)) == NULL)
+	    pmNoMem("host_sent", need, PM_FATAL_ERR);
+    }
+    hp->h_sent[hp->h_nsent++] = pmidlist;
+}
+
+static void
+host_putpdu(host_t *hp, int type, __pmPDU *pb)
+{
+    size_t	need;
+
+    if (hp->h_npdu == hp->h_maxpdu) {
+	hp->h_maxpdu = hp->h_maxpdu ? 2 * hp->h_maxpdu : 4;
+	need = hp->h_maxpdu * sizeof(hp->h_pdu[0]);
+	if ((hp->h_pdu = (hostpdu_t *)realloc(hp->h_pdu, need)) == NULL)
+	    pmNoMem("host_putpdu", need, PM_FATAL_ERR);
+    }
+    hp->h_pdu[hp->h_npdu].p_type = type;
+    hp->h_pdu[hp->h_npdu++].p_pdu = pb;
+}
+
+/*
+ * the next PDU for myFetch() ... one already read by host_recv() if
+ * there is one, else straight from the socket
+ */
+int
+host_getpdu(host_t *hp, int fd, __pmPDU **pdup)
+{
+    hostpdu_t	*pp;
+
+    if (hp == NULL || hp->h_firstpdu == hp->h_npdu)
+	return __pmGetPDU(fd, ANY_SIZE, TIMEOUT_DEFAULT, pdup);
+    pp = &hp->h_pdu[hp->h_firstpdu++];
+    *pdup = pp->p_pdu;
+    return pp->p_type;
+}
+
+/* forget all requests and any replies not taken, e.g. on disconnect */
+void
+host_reset(host_t *hp)
+{
+    hostpdu_t	*pp;
+
+    for (pp = &hp->h_pdu[hp->h_firstpdu]; pp < &hp->h_pdu[hp->h_npdu]; pp++) {
+	if (pp->p_type > 0)
+	    __pmUnpinPDUBuf(pp->p_pdu);
+    }
+    hp->h_npdu = hp->h_firstpdu = 0;
+    hp->h_nsent = hp->h_nused = hp->h_nreply = 0;
+}
+
+/*
+ * no more replies can be read, myFetch() reports the error sts for
+ * the next request and disconnects
+ */
+static void
+host_fail(host_t *hp, int sts)
+{
+    host_putpdu(hp, sts, NULL);
+    hp->h_nreply = hp->h_nsent;
+}
+
+/* read one PDU that poll() says is on its way from pmcd */
+static void
+host_recv(host_t *hp)
+{
+    __pmPDU	*pb;
+    int		n, code;
+
+    if ((n = __pmGetPDU(host_fd(hp), ANY_SIZE, TIMEOUT_DEFAULT, &pb)) <= 0) {
+	host_fail(hp, n);
+	return;
+    }
+    host_putpdu(hp, n, pb);
+    if (n == PDU_ERROR) {
+	__pmDecodeError(pb, &code);
+	if (code > 0)	/* PMCD state change, the result follows */
+	    return;
+    }
+    else if (n != PDU_RESULT) {
+	/* protocol botch, myFetch() will disconnect */
+	hp->h_nreply = hp->h_nsent;
+	return;
+    }
+    hp->h_nreply++;
+}
+
+/*
+ * Service one host that has tasks due, with all the replies to its
+ * requests from host_work() already received.  Derived metric tasks
+ * were not sent ahead, so they go last to keep the replies in order.
+ */
+static void
+host_run(host_t *hp)
+{
+    task_t	*tp;
+    int		dm;
+
+    host_use(hp);
+    hp->h_due = 0;
+    for (dm = 0; dm < 2; dm++) {
+	for (tp = tasklist; tp != NULL; tp = tp->t_next) {
+	    if (tp->t_alarm && (tp->t_dm != 0) == dm) {
+		tp->t_alarm = 0;
+		do_work(tp);
+	    }
+	}
+    }
+    /* replies not taken (do_work() gave up early) */
+    myDropFetch();
+}
+
+/*
+ * Called from the main loop in place of the do_work() calls for a
+ * single host, when log_alarm is set.
+ */
+void
+host_work(void)
+{
+    host_t	*hp;
+    task_t	*tp;
+#if defined(HAVE_POLL_H)
+    struct pollfd	*pfd = NULL;
+    host_t	**pfh = NULL;
+    struct timeval	now;
+    double	timeout, wait;
+    int		npfd = 0;
+    int		maxpfd = 0;
+    int		nready;
+    int		sts;
+    int		i;
+
+    timeout = __pmRequestTimeout();
+    pmtimevalNow(&now);
+#endif
+
+    /* first, fetch requests on the wire to every host with work due */
+    for (hp = hostlist; hp != NULL; hp = hp->h_next) {
+	for (tp = host_tasks(hp); tp != NULL; tp = tp->t_next) {
+	    if (tp->t_alarm)
+		break;
+	}
+	if (tp == NULL)
+	    continue;
+	hp->h_due = 1;
+	host_use(hp);
+	for ( ; tp != NULL; tp = tp->t_next) {
+	    if (tp->t_alarm)
+		prefetch(tp);
+	}
+#if defined(HAVE_POLL_H)
+	hp->h_deadline = pmtimevalToReal(&now) + timeout;
+#endif
+    }
+
+#if defined(HAVE_POLL_H)
+    /* then collect replies from whichever pmcd is ready */
+    for ( ; ; ) {
+	pmtimevalNow(&now);
+	wait = -1;
+	npfd = 0;
+	for (hp = hostlist; hp != NULL; hp = hp->h_next) {
+	    if (!hp->h_due)
+		continue;
+	    if (hp->h_nreply < hp->h_nsent &&
+		pmtimevalToReal(&now) >= hp->h_deadline)
+		host_fail(hp, PM_ERR_TIMEOUT);
+	    if (hp->h_nreply >= hp->h_nsent || host_fd(hp) < 0) {
+		/* all replies in, or nothing in flight */
+		host_run(hp);
+		continue;
+	    }
+	    if (npfd == maxpfd) {
+		maxpfd = maxpfd ? 2 * maxpfd : 16;
+		if ((pfd = (struct pollfd *)realloc(pfd, maxpfd * sizeof(pfd[0]))) == NULL ||
+		    (pfh = (host_t **)realloc(pfh, maxpfd * sizeof(pfh[0]))) == NULL)
+		    pmNoMem("host_work", maxpfd * sizeof(pfd[0]), PM_FATAL_ERR);
+	    }
+	    pfd[npfd].fd = host_fd(hp);
+	    pfd[npfd].events = POLLIN;
+	    pfd[npfd].revents = 0;
+	    pfh[npfd++] = hp;
+	    if (wait < 0 || hp->h_deadline - pmtimevalToReal(&now) < wait)
+		wait = hp->h_deadline - pmtimevalToReal(&now);
+	}
+	if (npfd == 0)
+	    break;
+	nready = poll(pfd, npfd, (int)(wait * 1000) + 1);
+	if (nready < 0) {
+	    if ((sts = -oserror()) == -EINTR && !sig_code)
+		continue;
+	    /* exiting on a signal, or poll is broken */
+	    for (i = 0; i < npfd; i++)
+		host_fail(pfh[i], sts);
+	    continue;
+	}
+	pmtimevalNow(&now);
+	for (i = 0; i < npfd; i++) {
+	    if (pfd[i].revents == 0)
+		continue;
+	    host_recv(pfh[i]);
+	    pfh[i]->h_deadline = pmtimevalToReal(&now) + timeout;
+	}
+    }
+    free(pfd);
+    free(pfh);
+#else
+    for (hp = hostlist; hp != NULL; hp = hp->h_next) {
+	if (hp->h_due)
+	    host_run(hp);
+    }
+#endif
+}
+
+/* volume switch from the timer or SIGHUP applies to every archive */
+void
+host_newvolume(int vol_switch_type)
+{
+    host_t	*hp;
+
+    for (hp = hostlist; hp != NULL; hp = hp->h_next) {
+	host_use(hp);
+	newvolume(vol_switch_type);
+    }
+}
+
+/*
+ * With -N there may be more pmcd sockets than a __pmFdSet can hold,
+ * so the main loop polls just the control ports (which never see pmcd
+ * traffic) instead of using select.
+ */
+int
+host_poll(void)
+{
+#if defined(HAVE_POLL_H)
+    int		i;
+
+    nctlpoll = 0;
+    for (i = 0; i < CFD_NUM; i++) {
+	if (ctlfds[i] >= 0) {
+	    ctlpoll[nctlpoll].fd = ctlfds[i];
+	    ctlpoll[nctlpoll].events = POLLIN;
+	    ctlpoll[nctlpoll++].revents = 0;
+	}
+    }
+    if (clientfd >= 0) {
+	ctlpoll[nctlpoll].fd = clientfd;
+	ctlpoll[nctlpoll].events = POLLIN;
+	ctlpoll[nctlpoll++].revents = 0;
+    }
+    return poll(ctlpoll, nctlpoll, -1);
+#else
+    return -1;
+#endif
+}
+
+int
+host_ready(int fd)
+{
+#if defined(HAVE_POLL_H)
+    int		i;
+
+    for (i = 0; i < nctlpoll; i++) {
+	if (ctlpoll[i].fd == fd)
+	    return ctlpoll[i].revents != 0;
+    }
+#endif
+    return 0;
+}
@@ -192,6 +192,84 @@ extern int		sig_code;
 /* event record handling */
 extern int do_events(pmValueSet *);
 
+/*
+ * multi-host mode (-N), see hosts.c ... per-host copies of the
+ * globals above, swapped in by host_use()
+ */
+typedef struct {
+    int			p_type;		/* from __pmGetPDU(), or error */
+    __pmPDU		*p_pdu;
+} hostpdu_t;
+
+typedef struct host_s {
+    struct host_s	*h_next;
+    char		*h_conn;	/* pmcd_host_conn */
+    char		*h_name;	/* pmcd_host */
+    char		*h_archive;	/* archBase */
+    int			h_ctx;		/* PMAPI context */
+    int			h_fd;		/* pmcdfd */
+    int			h_due;		/* tasks due, see host_work() */
+    pmID		**h_sent;	/* fetches sent, in order */
+    int			h_nsent;
+    int			h_maxsent;
+    int			h_nused;	/* replies taken by myFetch() */
+    int			h_nreply;	/* complete replies received */
+    hostpdu_t		*h_pdu;		/* received, not yet taken */
+    int			h_npdu;
+    int			h_maxpdu;
+    int			h_firstpdu;
+    double		h_deadline;	/* for the next reply */
+    task_t		*h_tasklist;
+    __pmHashCtl		h_pm_hash;
+    __pmHashCtl		h_hist_hash;
+    dynroot_t		*h_dyn_roots;
+    int			h_n_dyn_roots;
+    __pmLogCtl		h_logctl;
+    __pmArchCtl		h_archctl;
+    struct timeval	h_epoch;
+    struct timeval	h_last_stamp;
+    int			h_last_log_offset;
+    int			h_flushsize;
+    int			h_exit_samples;
+    int			h_vol_samples_counter;
+    __int64_t		h_vol_bytes;
+} host_t;
+
+extern host_t		*hostlist;	/* NULL unless -N */
+extern host_t		*curhost;
+extern int		pmcdfd;
+extern int		flushsize;
+
+extern int host_read(char *);
+extern void host_use(host_t *);
+extern void host_drop(host_t *);
+extern int host_fd(host_t *);
+extern void host_work(void);
+extern void host_sent(host_t *, pmID *);
+extern int host_getpdu(host_t *, int, __pmPDU **);
+extern void host_reset(host_t *);
+extern void host_newvolume(int);
+extern int host_poll(void);
+extern int host_ready(int);
+extern void prefetch(task_t *);
+extern int mySendFetch(int, pmID *);
+extern void myDropFetch(void);
+extern void yyreset(FILE *);
+
+/*
+ * compression of data volumes (-z and -Z), see compress.c
+ */
+#define COMPRESS_NONE		0
+#define COMPRESS_FINISHED	1	/* compress each volume once finished */
+#define COMPRESS_INLINE		2	/* write volumes compressed */
+
+extern int		compress_mode;
+
+extern int compress_supported(void);
+extern __pmFILE *compress_newfile(const char *, int);
+extern void compress_volume(const char *, int);
+extern void compress_wait(void);
+
 /* QA testing and error injection support ... see do_request() */
 extern int	qa_case;
 #define QA_OFF		100
@@ -52,7 +52,7 @@ int		sig_code;		/* caught signal */
 int		qa_case;		/* QA error injection state */
 char		*note;			/* note for port map file */
 
-static int 	    pmcdfd = -1;	/* comms to pmcd */
+int 		    pmcdfd = -1;	/* comms to pmcd */
 static __pmFdSet    fds;		/* file descriptors mask for select */
 static int	    numfds;		/* number of file descriptors in mask */
 
@@ -64,27 +64,15 @@ static char	*folio_name = "<unknown>";
 static char	*dialog_title = "PCP Archive Recording Session";
 static int	sep;
 
-void
-run_done(int sts, char *msg)
+static void
+end_archive(void)
 {
     int	lsts;
 
-    if (pmDebugOptions.log && pmDebugOptions.desperate) {
-	fprintf(stderr, "run_done(%d, %s) last_log_offset=%d last_stamp=",
-		sts, msg, last_log_offset);
-	pmPrintStamp(stderr, &last_stamp);
-	fputc('\n', stderr);
-    }
-
     if ((lsts = do_epilogue()) < 0)
 	fprintf(stderr, "Warning: problem writing archive epilogue: %s\n",
 	    pmErrStr(lsts));
 
-    if (msg != NULL)
-    	fprintf(stderr, "pmlogger: %s, exiting\n", msg);
-    else
-    	fprintf(stderr, "pmlogger: End of run time, exiting\n");
-
     /*
      * write the last last temporal index entry with the time stamp
      * of the last pmResult and the seek pointer set to the offset
@@ -101,6 +89,42 @@ run_done(int sts, char *msg)
 	__pmLogPutIndex(&archctl, &tmp);
     }
 
+    if (compress_mode == COMPRESS_INLINE) {
+	/* push out the last, partial, compressed block */
+	__pmFclose(archctl.ac_mfp);
+	archctl.ac_mfp = NULL;
+    }
+}
+
+void
+run_done(int sts, char *msg)
+{
+    host_t	*hp;
+
+    if (pmDebugOptions.log && pmDebugOptions.desperate) {
+	fprintf(stderr, "run_done(%d, %s) last_log_offset=%d last_stamp=",
+		sts, msg, last_log_offset);
+	pmPrintStamp(stderr, &last_stamp);
+	fputc('\n', stderr);
+    }
+
+    if (hostlist == NULL)
+	end_archive();
+    else {
+	for (hp = hostlist; hp != NULL; hp = hp->h_next) {
+	    host_use(hp);
+	    /* reply to a request from host_work(), not wanted now */
+	    myDropFetch();
+	    end_archive();
+	}
+    }
+    compress_wait();
+
+    if (msg != NULL)
+    	fprintf(stderr, "pmlogger: %s, exiting\n", msg);
+    else
+    	fprintf(stderr, "pmlogger: End of run time, exiting\n");
+
     exit(sts);
 }
 
@@ -523,6 +547,7 @@ static pmLongOptions longopts[] = {
     PMOPT_SPECLOCAL,
     { "local-PMDA", 0, 'o', 0, "metrics sourced without connecting to pmcd" },
     PMOPT_NAMESPACE,
+    { "hosts", 1, 'N', "FILE", "log each host and archive listed in FILE" },
     { "PID", 1, 'p', "PID", "Log specified metric for the lifetime of the pid" },
     { "primary", 0, 'P', 0, "execute as primary logger instance" },
     { "report", 0, 'r', 0, "report record sizes and archive growth rate" },
@@ -535,14 +560,16 @@ static pmLongOptions longopts[] = {
     { "version", 1, 'V', "NUM", "version for archive (default and only version is 2)" },
     { "", 1, 'x', "FD", "control file descriptor for running from pmRecordControl(3)" },
     { "", 0, 'y', 0, "set timezone for times to local time rather than from PMCD host" },
+    { "compress", 0, 'z', 0, "compress each data volume once it is finished" },
+    { "compress-inline", 0, 'Z', 0, "write data volumes compressed" },
     PMOPT_HELP,
     PMAPI_OPTIONS_END
 };
 
 static pmOptions opts = {
-    .short_options = "c:CD:h:H:l:K:Lm:n:op:Prs:T:t:uU:v:V:x:y?",
+    .short_options = "c:CD:h:H:l:K:Lm:n:N:op:Prs:T:t:uU:v:V:x:yzZ?",
     .long_options = longopts,
-    .short_usage = "[options] archive",
+    .short_usage = "[options] archive | [options] -N hostsfile",
 };
 
 static FILE *
@@ -594,6 +621,184 @@ do_pmcpp(char *configfile)
     return f;
 }
 
+/*
+ * connect to PMCD on pmcd_host_conn (or a local context), setting
+ * pmcd_host and pmcdfd ... returns the context or an error
+ */
+static int
+connect_pmcd(int argc, char **argv)
+{
+    int	    		ctx;		/* handle corresponding to ctxp below */
+    __pmContext  	*ctxp;
+
+    if ((ctx = pmNewContext(host_context, pmcd_host_conn)) < 0) {
+	fprintf(stderr, "%s: Cannot connect to PMCD on host \"%s\": %s\n", pmGetProgname(), pmcd_host_conn, pmErrStr(ctx));
+	return ctx;
+    }
+    pmcd_host = (char *)pmGetContextHostName(ctx);
+    if (strlen(pmcd_host) == 0) {
+	fprintf(stderr, "%s: pmGetContextHostName(%d) failed\n",
+	    pmGetProgname(), ctx);
+	exit(1);
+    }
+    if (hostlist != NULL) {
+	/* -N, need a copy per host, not the static buffer */
+	if ((pmcd_host = strdup(pmcd_host)) == NULL)
+	    pmNoMem("connect_pmcd", MAXHOSTNAMELEN, PM_FATAL_ERR);
+    }
+
+    if (rsc_fd == -1 && host_context != PM_CONTEXT_LOCAL) {
+	/* no -x, so register client id with pmcd */
+	__pmSetClientIdArgv(argc, argv);
+    }
+
+    /*
+     * discover fd for comms channel to PMCD ... 
+     */
+    if (host_context != PM_CONTEXT_LOCAL) {
+	if ((ctxp = __pmHandleToPtr(ctx)) == NULL) {
+	    fprintf(stderr, "%s: botch: __pmHandleToPtr(%d) returns NULL!\n", pmGetProgname(), ctx);
+	    exit(1);
+	}
+	pmcdfd = ctxp->c_pmcd->pc_fd;
+	PM_UNLOCK(ctxp->c_lock);
+    }
+    return ctx;
+}
+
+/*
+ * -N ... connect to each host in turn and parse the configuration
+ * against its PMCD.  The pmcpp output from yyin is kept so the
+ * preprocessor is only run once.  Hosts that cannot be reached are
+ * dropped.
+ */
+static void
+parse_hosts(int argc, char **argv)
+{
+    FILE	*f;
+    host_t	*hp;
+    host_t	*next;
+    char	buf[BUFSIZ];
+    size_t	n;
+
+    if ((f = tmpfile()) == NULL) {
+	fprintf(stderr, "%s: cannot create temporary file for configuration: %s\n",
+		pmGetProgname(), osstrerror());
+	exit(1);
+    }
+    while ((n = fread(buf, 1, sizeof(buf), yyin)) > 0) {
+	if (fwrite(buf, 1, n, f) != n) {
+	    fprintf(stderr, "%s: cannot save configuration: %s\n",
+		    pmGetProgname(), osstrerror());
+	    exit(1);
+	}
+    }
+    __pmProcessPipeClose(yyin);
+
+    for (hp = hostlist; hp != NULL; hp = next) {
+	next = hp->h_next;
+	host_use(hp);
+	if ((hp->h_ctx = connect_pmcd(argc, argv)) < 0) {
+	    host_drop(hp);
+	    continue;
+	}
+	rewind(f);
+	yyreset(f);
+	if (yyparse() != 0)
+	    exit(1);
+	yyend();
+    }
+    fclose(f);
+
+    if (hostlist == NULL) {
+	fprintf(stderr, "%s: no PMCD could be reached, nothing to log\n",
+		pmGetProgname());
+	exit(1);
+    }
+    host_use(hostlist);
+}
+
+static void
+create_archive(int ctx, int use_localtime)
+{
+    int		sts;
+
+    archctl.ac_log = &logctl;
+    if ((sts = __pmLogCreate(pmcd_host, archBase, archive_version, &archctl)) < 0) {
+	fprintf(stderr, "__pmLogCreate: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    else {
+	/*
+	 * try and establish $TZ from the remote PMCD ...
+	 * Note the label record has been set up, but not written yet
+	 */
+	char		*name = "pmcd.timezone";
+	char		fname[MAXPATHLEN];
+	pmID		pmid;
+	pmResult	*resp;
+
+	if (compress_mode == COMPRESS_INLINE) {
+	    /*
+	     * __pmLogCreate() made an empty (no label yet) uncompressed
+	     * data volume, replace it with a compressed one
+	     */
+	    __pmFclose(archctl.ac_mfp);
+	    pmsprintf(fname, sizeof(fname), "%s.0", archBase);
+	    unlink(fname);
+	    if ((archctl.ac_mfp = compress_newfile(archBase, 0)) == NULL)
+		exit(1);
+	    if ((sts = __pmSetVersionIPC(__pmFileno(archctl.ac_mfp), archive_version)) < 0) {
+		fprintf(stderr, "__pmSetVersionIPC: %s\n", pmErrStr(sts));
+		exit(1);
+	    }
+	}
+
+	pmtimevalNow(&epoch);
+	sts = pmUseContext(ctx);
+
+	if (sts >= 0)
+	    sts = pmLookupName(1, &name, &pmid);
+	if (sts >= 0)
+	    sts = pmFetch(1, &pmid, &resp);
+	if (sts >= 0) {
+	    if (resp->vset[0]->numval > 0) { /* pmcd.timezone present */
+		strcpy(logctl.l_label.ill_tz, resp->vset[0]->vlist[0].value.pval->vbuf);
+		/* prefer to use remote time to avoid clock drift problems */
+		epoch = resp->timestamp;		/* struct assignment */
+		if (! use_localtime)
+		    pmNewZone(logctl.l_label.ill_tz);
+	    }
+	    else if (pmDebugOptions.log) {
+		fprintf(stderr,
+			"main: Could not get timezone from host %s\n",
+			pmcd_host);
+	    }
+	    pmFreeResult(resp);
+	}
+    }
+
+}
+
+static void
+start_archive(void)
+{
+    int		sts;
+
+    if ((sts = do_prologue()) < 0)
+	fprintf(stderr, "Warning: problem writing archive prologue: %s\n",
+	    pmErrStr(sts));
+}
+
+/* is fd readable after the select (or with -N, the poll) in main() */
+static int
+isready(int fd, __pmFdSet *readyfds)
+{
+    if (hostlist != NULL)
+	return host_ready(fd);
+    return __pmFD_ISSET(fd, readyfds);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -602,6 +807,7 @@ main(int argc, char **argv)
     int			use_localtime = 0;
     int			isdaemon = 0;
     char		*pmnsfile = PM_NS_DEFAULT;
+    char		*hostsfile = NULL;
     char		*username;
     char		*logfile = "pmlogger.log";
 				    /* default log (not archive) file name */
@@ -612,8 +818,8 @@ main(int argc, char **argv)
     __pmFdSet		readyfds;
     char		*p;
     char		*runtime = NULL;
-    int	    		ctx;		/* handle corresponding to ctxp below */
-    __pmContext  	*ctxp;		/* pmlogger has just this one context */
+    int	    		ctx = -1;	/* pmlogger has just this one context */
+    host_t		*hp;		/* ... unless -N, one per host */
     int			niter;
     pid_t               target_pid = 0;
     int			exit_code = 0;
@@ -700,6 +906,10 @@ main(int argc, char **argv)
 	    pmnsfile = opts.optarg;
 	    break;
 
+	case 'N':		/* many hosts from one pmlogger */
+	    hostsfile = opts.optarg;
+	    break;
+
 	case 'o':		/* local context mode, no pmcd */
 	    /*
 	     * Note, using Lflag here because this has the same
@@ -807,6 +1017,14 @@ main(int argc, char **argv)
 	    use_localtime = 1;
 	    break;
 
+	case 'z':		/* compress finished volumes */
+	    compress_mode = COMPRESS_FINISHED;
+	    break;
+
+	case 'Z':		/* compress volumes as they are written */
+	    compress_mode = COMPRESS_INLINE;
+	    break;
+
 	case '?':
 	default:
 	    opts.errors++;
@@ -830,14 +1048,33 @@ main(int argc, char **argv)
 	opts.errors++;
     }
 
-    if (!opts.errors && ((Cflag == 0 && opts.optind > argc - 1) ||
+    if (hostsfile != NULL && (pmcd_host_conn != NULL || pmcd_host_label != NULL ||
+	host_context == PM_CONTEXT_LOCAL || primary || rsc_fd != -1)) {
+	pmprintf("%s: -N cannot be used with -h, -H, -o, -P or -x\n",
+		pmGetProgname());
+	opts.errors++;
+    }
+    if (compress_mode != COMPRESS_NONE && !compress_supported()) {
+	pmprintf("%s: -z and -Z are not supported on this platform\n",
+		pmGetProgname());
+	opts.errors++;
+    }
+
+#if !defined(HAVE_POLL_H)
+    if (hostsfile != NULL) {
+	pmprintf("%s: -N is not supported on this platform\n", pmGetProgname());
+	opts.errors++;
+    }
+#endif
+
+    if (!opts.errors && ((Cflag == 0 && hostsfile == NULL && opts.optind > argc - 1) ||
 			 (Cflag == 1 && opts.optind > argc))) {
 	pmprintf("%s: insufficient arguments\n", pmGetProgname());
 	opts.errors++;
     }
 
-    if (!opts.errors && ((Cflag == 0 && opts.optind < argc - 1) ||
-			 (Cflag == 1 && opts.optind < argc))) {
+    if (!opts.errors && ((Cflag == 0 && hostsfile == NULL && opts.optind < argc - 1) ||
+			 ((Cflag == 1 || hostsfile != NULL) && opts.optind < argc))) {
 	pmprintf("%s: too many arguments\n", pmGetProgname());
 	opts.errors++;
     }
@@ -865,14 +1102,21 @@ main(int argc, char **argv)
 	    /* continue on ... writing to stderr */
 	}
 
-	/* base name for archive is here ... */
-	archBase = strdup(argv[opts.optind]);
-	if (archBase == NULL) {
-	    pmNoMem("main", strlen(argv[opts.optind])+1, PM_FATAL_ERR);
-	    /* NOTREACHED */
+	/* base name for archive is here ... or in the -N hosts file */
+	if (hostsfile == NULL) {
+	    archBase = strdup(argv[opts.optind]);
+	    if (archBase == NULL) {
+		pmNoMem("main", strlen(argv[opts.optind])+1, PM_FATAL_ERR);
+		/* NOTREACHED */
+	    }
 	}
     }
 
+    if (hostsfile != NULL && host_read(hostsfile) == 0) {
+	fprintf(stderr, "%s: no hosts in \"%s\"\n", pmGetProgname(), hostsfile);
+	exit(1);
+    }
+
     /* initialise access control */
     if (__pmAccAddOp(PM_OP_LOG_ADV) < 0 ||
 	__pmAccAddOp(PM_OP_LOG_MAND) < 0 ||
@@ -893,33 +1137,8 @@ main(int argc, char **argv)
     else if (pmcd_host_conn == NULL)
 	pmcd_host_conn = "local:";
 
-    if ((ctx = pmNewContext(host_context, pmcd_host_conn)) < 0) {
-	fprintf(stderr, "%s: Cannot connect to PMCD on host \"%s\": %s\n", pmGetProgname(), pmcd_host_conn, pmErrStr(ctx));
+    if (hostlist == NULL && (ctx = connect_pmcd(argc, argv)) < 0)
 	exit(1);
-    }
-    pmcd_host = (char *)pmGetContextHostName(ctx);
-    if (strlen(pmcd_host) == 0) {
-	fprintf(stderr, "%s: pmGetContextHostName(%d) failed\n",
-	    pmGetProgname(), ctx);
-	exit(1);
-    }
-
-    if (rsc_fd == -1 && host_context != PM_CONTEXT_LOCAL) {
-	/* no -x, so register client id with pmcd */
-	__pmSetClientIdArgv(argc, argv);
-    }
-
-    /*
-     * discover fd for comms channel to PMCD ... 
-     */
-    if (host_context != PM_CONTEXT_LOCAL) {
-	if ((ctxp = __pmHandleToPtr(ctx)) == NULL) {
-	    fprintf(stderr, "%s: botch: __pmHandleToPtr(%d) returns NULL!\n", pmGetProgname(), ctx);
-	    exit(1);
-	}
-	pmcdfd = ctxp->c_pmcd->pc_fd;
-	PM_UNLOCK(ctxp->c_lock);
-    }
 
     yyin = do_pmcpp(configfile);
     /* do not return unless yyin is valid */
@@ -933,10 +1152,14 @@ main(int argc, char **argv)
     /* prevent early timer events ... */
     __pmAFblock();
 
-    if (yyparse() != 0)
-	exit(1);
-    __pmProcessPipeClose(yyin);
-    yyend();
+    if (hostlist != NULL)
+	parse_hosts(argc, argv);
+    else {
+	if (yyparse() != 0)
+	    exit(1);
+	__pmProcessPipeClose(yyin);
+	yyend();
+    }
 
     fprintf(stderr, "Config parsed\n");
 
@@ -981,8 +1204,9 @@ main(int argc, char **argv)
     if (Cflag)
 	exit(0);
 
-    fprintf(stderr, "Starting %slogger for host \"%s\" via \"%s\"\n",
-            primary ? "primary " : "", pmcd_host, pmcd_host_conn);
+    if (hostlist == NULL)
+	fprintf(stderr, "Starting %slogger for host \"%s\" via \"%s\"\n",
+		primary ? "primary " : "", pmcd_host, pmcd_host_conn);
 
     if (!primary && tasklist == NULL && !linger) {
 	fprintf(stderr, "Nothing to log, and not the primary logger instance ... good-bye\n");
@@ -993,42 +1217,18 @@ main(int argc, char **argv)
 	pmcd_host=pmcd_host_label;
     }
 
-    archctl.ac_log = &logctl;
-    if ((sts = __pmLogCreate(pmcd_host, archBase, archive_version, &archctl)) < 0) {
-	fprintf(stderr, "__pmLogCreate: %s\n", pmErrStr(sts));
-	exit(1);
-    }
+    if (hostlist == NULL)
+	create_archive(ctx, use_localtime);
     else {
-	/*
-	 * try and establish $TZ from the remote PMCD ...
-	 * Note the label record has been set up, but not written yet
-	 */
-	char		*name = "pmcd.timezone";
-	pmID		pmid;
-	pmResult	*resp;
-
-	pmtimevalNow(&epoch);
-	sts = pmUseContext(ctx);
-
-	if (sts >= 0)
-	    sts = pmLookupName(1, &name, &pmid);
-	if (sts >= 0)
-	    sts = pmFetch(1, &pmid, &resp);
-	if (sts >= 0) {
-	    if (resp->vset[0]->numval > 0) { /* pmcd.timezone present */
-		strcpy(logctl.l_label.ill_tz, resp->vset[0]->vlist[0].value.pval->vbuf);
-		/* prefer to use remote time to avoid clock drift problems */
-		epoch = resp->timestamp;		/* struct assignment */
-		if (! use_localtime)
-		    pmNewZone(logctl.l_label.ill_tz);
-	    }
-	    else if (pmDebugOptions.log) {
-		fprintf(stderr,
-			"main: Could not get timezone from host %s\n",
-			pmcd_host);
-	    }
-	    pmFreeResult(resp);
+	for (hp = hostlist; hp != NULL; hp = hp->h_next) {
+	    host_use(hp);
+	    fprintf(stderr, "Starting logger for host \"%s\" via \"%s\"\n",
+		    pmcd_host, pmcd_host_conn);
+	    /* the first host decides the timezone for pmlogger itself */
+	    create_archive(hp->h_ctx, use_localtime || hp != hostlist);
+	    fprintf(stderr, "Archive basename: %s\n", archBase);
 	}
+	host_use(hostlist);
     }
 
     /* do ParseTimeWindow stuff for -T */
@@ -1061,7 +1261,8 @@ main(int argc, char **argv)
         last_stamp = res_end;
     }
 
-    fprintf(stderr, "Archive basename: %s\n", archBase);
+    if (hostlist == NULL)
+	fprintf(stderr, "Archive basename: %s\n", archBase);
 
     if (isdaemon) {
 #ifndef IS_MINGW
@@ -1074,21 +1275,30 @@ main(int argc, char **argv)
     /* set up control port */
     init_ports();
     __pmFD_ZERO(&fds);
-    for (i = 0; i < CFD_NUM; ++i) {
-	if (ctlfds[i] >= 0)
-	    __pmFD_SET(ctlfds[i], &fds);
-    }
+    if (hostlist == NULL) {
+	/* with -N, fds is not used ... see host_poll() */
+	for (i = 0; i < CFD_NUM; ++i) {
+	    if (ctlfds[i] >= 0)
+		__pmFD_SET(ctlfds[i], &fds);
+	}
 #ifndef IS_MINGW
-    if (pmcdfd != -1)
-	__pmFD_SET(pmcdfd, &fds);
+	if (pmcdfd != -1)
+	    __pmFD_SET(pmcdfd, &fds);
 #endif
-    if (rsc_fd != -1)
-	__pmFD_SET(rsc_fd, &fds);
-    numfds = maxfd() + 1;
+	if (rsc_fd != -1)
+	    __pmFD_SET(rsc_fd, &fds);
+	numfds = maxfd() + 1;
+    }
 
-    if ((sts = do_prologue()) < 0)
-	fprintf(stderr, "Warning: problem writing archive prologue: %s\n",
-	    pmErrStr(sts));
+    if (hostlist == NULL)
+	start_archive();
+    else {
+	for (hp = hostlist; hp != NULL; hp = hp->h_next) {
+	    host_use(hp);
+	    start_archive();
+	}
+	host_use(hostlist);
+    }
 
     sts = 0;		/* default exit status */
 
@@ -1108,10 +1318,14 @@ main(int argc, char **argv)
 	    log_alarm = 0;
 	    if (pmDebugOptions.appl2)
 		fprintf(stderr, "delayed callback: log_alarm\n");
-	    for (tp = tasklist; tp != NULL; tp = tp->t_next) {
-		if (tp->t_alarm) {
-		    tp->t_alarm = 0;
-		    do_work(tp);
+	    if (hostlist != NULL)
+		host_work();
+	    else {
+		for (tp = tasklist; tp != NULL; tp = tp->t_next) {
+		    if (tp->t_alarm) {
+			tp->t_alarm = 0;
+			do_work(tp);
+		    }
 		}
 	    }
 	    __pmAFunblock();
@@ -1122,7 +1336,10 @@ main(int argc, char **argv)
 	    vol_switch_alarm = 0;
 	    if (pmDebugOptions.appl2)
 		fprintf(stderr, "delayed callback: vol_switch_alarm\n");
-	    newvolume(VOL_SW_TIME);
+	    if (hostlist != NULL)
+		host_newvolume(VOL_SW_TIME);
+	    else
+		newvolume(VOL_SW_TIME);
 	    __pmAFunblock();
 	}
 
@@ -1133,8 +1350,12 @@ main(int argc, char **argv)
 	    /*NOTREACHED*/
 	}
 
-	__pmFD_COPY(&readyfds, &fds);
-	nready = __pmSelectRead(numfds, &readyfds, NULL);
+	if (hostlist != NULL)
+	    nready = host_poll();
+	else {
+	    __pmFD_COPY(&readyfds, &fds);
+	    nready = __pmSelectRead(numfds, &readyfds, NULL);
+	}
 
 	if (pmDebugOptions.appl2 && pmDebugOptions.desperate) {
 	    fprintf(stderr, "__pmSelectRead(%d,...) done: nready=%d run_done_alarm=%d vol_switch_alarm=%d log_alarm=%d\n", numfds, nready, run_done_alarm, vol_switch_alarm, log_alarm);
@@ -1143,10 +1364,14 @@ main(int argc, char **argv)
 	__pmAFblock();
 	if (nready > 0) {
 
+	    /* with -N, pmlc requests apply to the first host */
+	    if (hostlist != NULL)
+		host_use(hostlist);
+
 	    /* handle request on control port */
 	    for (i = 0; i < CFD_NUM; ++i) {
-		if (ctlfds[i] >= 0 && __pmFD_ISSET(ctlfds[i], &readyfds)) {
-		    if (control_req(ctlfds[i])) {
+		if (ctlfds[i] >= 0 && isready(ctlfds[i], &readyfds)) {
+		    if (control_req(ctlfds[i]) && hostlist == NULL) {
 			/* new client has connected */
 			__pmFD_SET(clientfd, &fds);
 			if (clientfd >= numfds)
@@ -1154,7 +1379,7 @@ main(int argc, char **argv)
 		    }
 		}
 	    }
-	    if (clientfd >= 0 && __pmFD_ISSET(clientfd, &readyfds)) {
+	    if (clientfd >= 0 && isready(clientfd, &readyfds)) {
 		/* process request from client, save clientfd in case client
 		 * closes connection, resetting clientfd to -1
 		 */
@@ -1162,7 +1387,8 @@ main(int argc, char **argv)
 
 		if (client_req()) {
 		    /* client closed connection */
-		    __pmFD_CLR(fd, &fds);
+		    if (hostlist == NULL)
+			__pmFD_CLR(fd, &fds);
 		    __pmCloseSocket(clientfd);
 		    clientfd = -1;
 		    pmlc_host[0] = '\0';
@@ -1171,7 +1397,7 @@ main(int argc, char **argv)
 		}
 	    }
 #ifndef IS_MINGW
-	    if (pmcdfd >= 0 && __pmFD_ISSET(pmcdfd, &readyfds)) {
+	    if (pmcdfd >= 0 && isready(pmcdfd, &readyfds)) {
 		/*
 		 * do not expect this, given synchronous commumication with the
 		 * pmcd ... either pmcd has terminated, or bogus PDU ... or its
@@ -1198,7 +1424,7 @@ main(int argc, char **argv)
 		    __pmUnpinPDUBuf(pb);
 	    }
 #endif
-	    if (rsc_fd >= 0 && __pmFD_ISSET(rsc_fd, &readyfds)) {
+	    if (rsc_fd >= 0 && isready(rsc_fd, &readyfds)) {
 		/*
 		 * some action on the recording session control fd
 		 * end-of-file means launcher has quit, otherwise we
@@ -1269,7 +1495,10 @@ main(int argc, char **argv)
 	    }
 	}
 	else if (vol_switch_flag) {
-	    newvolume(VOL_SW_SIGHUP);
+	    if (hostlist != NULL)
+		host_newvolume(VOL_SW_SIGHUP);
+	    else
+		newvolume(VOL_SW_SIGHUP);
 	    vol_switch_flag = 0;
 	}
 	else if (nready < 0 && neterror() != EINTR)
@@ -1326,7 +1555,11 @@ newvolume(int vol_switch_type)
                                    vol_switch_callback);
     }
 
-    if ((newfp = __pmLogNewFile(archBase, nextvol)) != NULL) {
+    if (compress_mode == COMPRESS_INLINE)
+	newfp = compress_newfile(archBase, nextvol);
+    else
+	newfp = __pmLogNewFile(archBase, nextvol);
+    if (newfp != NULL) {
 	if (logctl.l_state == PM_LOG_STATE_NEW) {
 	    /*
 	     * nothing has been logged as yet, force out the label records
@@ -1353,6 +1586,8 @@ newvolume(int vol_switch_type)
 	 */
 
 	__pmFclose(archctl.ac_mfp);
+	if (compress_mode == COMPRESS_FINISHED)
+	    compress_volume(archBase, archctl.ac_curvol);
 	archctl.ac_mfp = newfp;
 	logctl.l_label.ill_vol = archctl.ac_curvol = nextvol;
 	__pmLogWriteLabel(archctl.ac_mfp, &logctl.l_label);
@@ -1403,9 +1638,12 @@ disconnect(int sts)
 	}
 	if (pmcdfd != -1) {
 	    close(pmcdfd);
-	    __pmFD_CLR(pmcdfd, &fds);
+	    if (hostlist == NULL)
+		__pmFD_CLR(pmcdfd, &fds);
 	    pmcdfd = -1;
 	}
+	if (curhost != NULL)
+	    host_reset(curhost);
 	numfds = maxfd() + 1;
 	ctxp->c_pmcd->pc_fd = -1;
     }
@@ -1437,8 +1675,10 @@ reconnect(void)
     sts = pmReconnectContext(ctx);
     if (sts >= 0) {
 	pmcdfd = ctxp->c_pmcd->pc_fd;
-	__pmFD_SET(pmcdfd, &fds);
-	numfds = maxfd() + 1;
+	if (hostlist == NULL) {
+	    __pmFD_SET(pmcdfd, &fds);
+	    numfds = maxfd() + 1;
+	}
     }
     if (sts < 0)
 	return sts;
@@ -18,6 +18,10 @@
 #include <limits.h>
 #include "pmapi.h"
 #include "libpcp.h"
+#include "sketch.h"
+#if !defined(IS_MINGW)
+#include <sys/wait.h>
+#endif
 
 static pmLongOptions longopts[] = {
     PMAPI_OPTIONS_HEADER("Options"),
@@ -25,17 +29,21 @@ static pmLongOptions longopts[] = {
     { "all", 0, 'a', 0, "print all information (equivalent to -blmMy)" },
     { "", 0, 'b', 0, "print both stochastic and time averages for counter metrics" },
     { "bins", 1, 'B', "N", "print value distribution across a number of bins" },
+    { "stddev", 0, 'd', 0, "also print standard deviation" },
     { "", 0, 'f', 0, "print using \"spreadsheet\" format (tab delimited fields)" },
     { "", 0, 'F', 0, "print using \"spreadsheet\" format (comma separated values)" },
     { "header", 0, 'H', 0, "print one-line header at start showing each column" },
     { "mintime", 0, 'i', 0, "also print timestamp for minimum value" },
     { "maxtime", 0, 'I', 0, "also print timestamp for maximum value" },
+    { "jobs", 1, 'j', "N", "summarize up to N archives in parallel" },
     { "label", 0, 'l', 0, "also print the archive label and time window" },
     { "minimum", 0, 'm', 0, "also print minimum value" },
     { "maximum", 0, 'M', 0, "also print maximum value" },
     PMOPT_NAMESPACE,
     { "", 0, 'N', 0, "suppress warnings from individual archive fetches (default)" },
     { "precision", 0, 'p', 0, "number of digits to display after the decimal point" },
+    { "percentiles", 1, 'P', "LIST", "also print approximate percentiles, e.g. 50,95,99" },
+    { "archive", 1, 'R', "FILE", "archive to summarize, may be repeated" },
     PMOPT_START,
     PMOPT_FINISH,
     { "verbose", 0, 'v', 0, "verbose, enable warnings from individual archive fetches" },
@@ -50,8 +58,9 @@ static pmLongOptions longopts[] = {
 
 static int override(int, pmOptions *);
 static pmOptions opts = {
-    .flags = PM_OPTFLAG_DONE | PM_OPTFLAG_BOUNDARIES | PM_OPTFLAG_STDOUT_TZ,
-    .short_options = "abB:D:fFHiIlmMNn:p:rsS:T:vVxyzZ:?",
+    .flags = PM_OPTFLAG_DONE | PM_OPTFLAG_BOUNDARIES | PM_OPTFLAG_STDOUT_TZ |
+	     PM_OPTFLAG_MULTI,
+    .short_options = "abB:dD:fFHiIj:lmMNn:p:P:rR:sS:T:vVxyzZ:?",
     .long_options = longopts,
     .short_usage = "[options] archive [metricname ...]",
     .override = override,
@@ -72,7 +81,11 @@ typedef struct {
     struct timeval	maxtime;	/* time of maximum sample */
     int			markcount;	/* num mark records seen */
     int			marked;		/* seen since last "mark" record? */
-    unsigned int	bintotal;	/* copy of count for 2nd pass */
+    unsigned int	nobs;		/* observations (rates for counters) */
+    double		mean;		/* running mean of observations */
+    double		m2;		/* running sum of squared deviations */
+    sketch_t		sketch;		/* for percentiles */
+    hist_t		hist;		/* for bins */
     unsigned int	*bin;		/* bins for value distribution */
 } instData;
 
@@ -101,8 +114,14 @@ static unsigned int	countflag;	/* no count */
 static unsigned int	warnflag;	/* warnings are off by default */
 static unsigned int	delimiter = ' ';/* output field separator */
 static unsigned int	nbins;		/* number of distribution bins */
+static unsigned int	stddevflag;	/* no standard deviation */
+static unsigned int	npercentile;	/* number of percentiles */
+static double		*percentile;	/* percentiles to report, 0 to 100 */
 static unsigned int	precision = 3;	/* number of digits after "." */
 
+/* archives summarized concurrently, when there are several */
+static int		njobs = 1;
+
 /* time window stuff */
 static int		dayflag;
 static char		timebuf[32];		/* for pmCtime result + .xxx */
@@ -224,6 +243,8 @@ printlabel(void)
 static void
 printheaders(void)
 {
+    int		i;
+
     printf("metric");
     if (stocaveflag)
 	printf("%cstochastic_average", delimiter);
@@ -241,11 +262,89 @@ printheaders(void)
 	printf("%cmaximum_time", delimiter);
     if (countflag)
 	printf("%ccount", delimiter);
+    if (stddevflag)
+	printf("%cstddev", delimiter);
+    for (i = 0; i < npercentile; i++)
+	printf("%cp%g", delimiter, percentile[i]);
     if (nbins)
 	printf("%cbins", delimiter);
     printf("%cunits\n", delimiter);
 }
 
+/*
+ * find index to bin array for "val"
+ */
+static unsigned int
+findbin(pmID pmid, double val, double min, double max)
+{
+    unsigned int	index;
+    double		bound, next;
+    double		binsize;
+
+    binsize = (max - min) / (double)nbins;
+    bound = min;
+    for (index=0; index < nbins-1; index++) {
+	next = bound + binsize;
+	if (val >= bound && val <= next)
+	    break;
+	bound = next;
+    }
+
+    if (pmDebugOptions.appl0) {
+	int	numnames;
+	char	**names;
+	fflush(stdout);	/* keep the trace between report lines */
+	numnames = pmNameAll(pmid, &names);
+	__pmPrintMetricNames(stderr, numnames, names, " or ");
+	fprintf(stderr, " selected bin %u/%u (val=%.*f, min=%.*f, max=%.*f)\n",
+		index, nbins, (int)precision, val, (int)precision,
+		min, (int)precision, max);
+	if (numnames > 0) free(names);
+	if (index >= nbins) exit(1);
+    }
+    return index;
+}
+
+typedef struct {
+    pmID	pmid;
+    instData	*instdata;
+} binData;
+
+/*
+ * hist_walk() callback ... each histogram bucket is much narrower
+ * than a bin, so place the whole bucket in the bin for its middle
+ */
+static void
+addbin(double val, unsigned int count, void *arg)
+{
+    binData	*bp = (binData *)arg;
+    instData	*instdata = bp->instdata;
+
+    /* the histogram is approximate, the extremes are not */
+    if (val < instdata->min)
+	val = instdata->min;
+    if (val > instdata->max)
+	val = instdata->max;
+    instdata->bin[findbin(bp->pmid, val, instdata->min, instdata->max)] += count;
+}
+
+/* approximate percentile pct (0 to 100) of the observations */
+static double
+findpercentile(instData *instdata, double pct)
+{
+    double	val;
+
+    if (instdata->nobs == 0)
+	return 0.0;
+    val = sketch_quantile(&instdata->sketch, pct / 100.0);
+    /* the sketch is approximate, the extremes are not */
+    if (val < instdata->min)
+	val = instdata->min;
+    if (val > instdata->max)
+	val = instdata->max;
+    return val;
+}
+
 static void
 printsummary(const char *name)
 {
@@ -287,6 +386,13 @@ printsummary(const char *name)
 		instdata->lasttime = opts.finish;
 		instdata->count++;
 	    }
+	    if (nbins) {	/* distribute values into bins */
+		binData	bd;
+
+		bd.pmid = avedata->desc.pmid;
+		bd.instdata = instdata;
+		hist_walk(&instdata->hist, addbin, &bd);
+	    }
 	    metrictimespan = instdata->lasttime;
 	    tsub(&metrictimespan, &instdata->firsttime);
 	    metricspan = pmtimevalToReal(&metrictimespan);
@@ -352,6 +458,12 @@ printsummary(const char *name)
 		instdata->count = instdata->count - instdata->markcount - 1;
 	    if (countflag)
 		printf("%c%u", delimiter, instdata->count);
+	    if (stddevflag)
+		printf("%c%.*f", delimiter, (int)precision, instdata->nobs ?
+			sqrt(instdata->m2 / instdata->nobs) : 0.0);
+	    for (j = 0; j < npercentile; j++)
+		printf("%c%.*f", delimiter, (int)precision,
+			findpercentile(instdata, percentile[j]));
 	    for (j=0; j < nbins; j++) {	/* print value distribution summary */
 		if (j > 0 && instdata->min == instdata->max)	/* all in 1st bin */
 		    printf("%c[]%c%u", delimiter, delimiter, 0);
@@ -365,6 +477,8 @@ printsummary(const char *name)
 	    if (instdata) {
 		if (instdata->bin)
 		    free(instdata->bin);
+		sketch_free(&instdata->sketch);
+		hist_free(&instdata->hist);
 		free(instdata);
 	    }
 	}
@@ -405,6 +519,29 @@ unwrap(double current, double previous, int pmtype)
     return outval;
 }
 
+/*
+ * one observation of a value (or of a rate, for counters) ... all of
+ * the per-observation statistics are accumulated here in one pass,
+ * and the sketch and histogram are bounded in size for percentiles
+ * and binning
+ */
+static void
+observe(instData *instdata, double val)
+{
+    double	delta;
+
+    /* Welford's method, for the standard deviation */
+    instdata->nobs++;
+    delta = val - instdata->mean;
+    instdata->mean += delta / instdata->nobs;
+    instdata->m2 += delta * (val - instdata->mean);
+
+    if (npercentile)
+	sketch_add(&instdata->sketch, val);
+    if (nbins)
+	hist_add(&instdata->hist, val);
+}
+
 static void
 newHashInst(pmValue *vp,
 	aveData *avedata,		/* updated by this function */
@@ -461,11 +598,17 @@ newHashInst(pmValue *vp,
 	instdata->count = 1;
     }
     instdata->marked = 0;
-    instdata->bintotal = 0;
     instdata->markcount = 0;
     instdata->lastval = av.d;
     instdata->firsttime = *timestamp;
     instdata->lasttime = *timestamp;
+    instdata->nobs = 0;
+    instdata->mean = 0.0;
+    instdata->m2 = 0.0;
+    sketch_init(&instdata->sketch);
+    hist_init(&instdata->hist);
+    if (avedata->desc.sem != PM_SEM_COUNTER && av.d == av.d)	/* not NaN */
+	observe(instdata, av.d);
     avedata->listsize++;
     if (pmDebugOptions.appl0) {
 	int	numnames;
@@ -512,39 +655,6 @@ newHashItem(pmValueSet *vsp,
 	newHashInst(&vsp->vlist[j], avedata, vsp->valfmt, timestamp, j);
 }
 
-/*
- * find index to bin array for "val"
- */
-unsigned int
-findbin(pmID pmid, double val, double min, double max)
-{
-    unsigned int	index;
-    double		bound, next;
-    double		binsize;
-
-    binsize = (max - min) / (double)nbins;
-    bound = min;
-    for (index=0; index < nbins-1; index++) {
-	next = bound + binsize;
-	if (val >= bound && val <= next)
-	    break;
-	bound = next;
-    }
-
-    if (pmDebugOptions.appl0) {
-	int	numnames;
-	char	**names;
-	numnames = pmNameAll(pmid, &names);
-	__pmPrintMetricNames(stderr, numnames, names, " or ");
-	fprintf(stderr, " selected bin %u/%u (val=%.*f, min=%.*f, max=%.*f)\n",
-		index, nbins, (int)precision, val, (int)precision,
-		min, (int)precision, max);
-	if (numnames > 0) free(names);
-	if (index >= nbins) exit(1);
-    }
-    return index;
-}
-
 /*
  * must keep a note for every instance of every metric whenever a mark
  * record has been seen between now & the last fetch for that instance
@@ -585,132 +695,6 @@ markrecord(pmResult *result)
     }
 }
 
-static void
-calcbinning(pmResult *result)
-{
-    int			i, j, k;
-    int			sts;
-    int			wrap;
-    double		val;
-    pmAtomValue 	av;
-    pmValue		*vp;
-    pmValueSet		*vsp;
-    __pmHashNode	*hptr = NULL;
-    aveData		*avedata = NULL;
-    instData		*instdata;
-    double		diff;
-    struct timeval	timediff;
-
-    if (result->numpmid == 0)	/* mark record */
-	markrecord(result);
-
-    for (i = 0; i < result->numpmid; i++) {
-	vsp = result->vset[i];
-	if (vsp->numval == 0)
-	    continue;
-	else if (vsp->numval < 0) {
-	    pmiderr(vsp->pmid, "failed in 2nd pass archive fetch: %s\n", pmErrStr(vsp->numval));
-	    continue;
-	}
-
-	if ((hptr = __pmHashSearch(vsp->pmid, &hashlist)) != NULL) {
-	    avedata = (aveData *)hptr->data;
-	    for (j = 0; j < vsp->numval; j++) {	/* iterate thro result values */
-		int	fp_bad;
-		vp = &vsp->vlist[j];
-		k = j;	/* index into stored inst list, result may differ */
-		if ((vsp->numval > 1) || (avedata->desc.indom != PM_INDOM_NULL)) {
-		    if ((k < avedata->listsize) && (avedata->instlist[k]->inst != vp->inst)) {
-			for (k = 0; k < avedata->listsize; k++) {
-			    if (vp->inst == avedata->instlist[k]->inst)
-				break;	/* k now correct */
-			}
-			if (k == avedata->listsize) {
-			    pmiderr(vsp->pmid, "ignoring new instance found on second pass\n");
-			    continue;
-			}
-		    }
-		    else if (k >= avedata->listsize) {
-			k = avedata->listsize;
-			pmiderr(vsp->pmid, "ignoring new instance found on second pass\n");
-			continue;
-		    }
-		}
-		instdata = avedata->instlist[k];
-
-		if ((sts = pmExtractValue(vsp->valfmt, vp, avedata->desc.type, &av, PM_TYPE_DOUBLE)) < 0) {
-		    pmiderr(avedata->desc.pmid, "failed to extract value: %s\n", pmErrStr(sts));
-		    continue;
-		}
-		fp_bad = 0;
-#ifdef HAVE_FPCLASSIFY
-		fp_bad = fpclassify(av.d) == FP_NAN;
-#else
-#ifdef HAVE_ISNAN
-		fp_bad = isnan(av.d);
-#endif
-#endif
-		if (fp_bad)
-		    continue;
-
-		/* reset values from first pass needed in this second pass */
-		if (instdata->bintotal == 0) {	/* 1st time instance seen on 2nd pass */
-		    instdata->bintotal = instdata->count;
-		    instdata->lasttime = result->timestamp;
-		    instdata->firsttime = result->timestamp;
-		    instdata->lastval = av.d;
-		    if (avedata->desc.sem == PM_SEM_COUNTER)
-			instdata->count = 0;
-		    else {
-			unsigned int sts;
-			instdata->count = 1;
-			sts = findbin(avedata->desc.pmid, av.d, instdata->min, instdata->max);
-			instdata->bin[sts]++;
-		    }
-		    continue;
-		}
-
-		timediff = result->timestamp;
-		tsub(&timediff, &instdata->lasttime);
-		diff = pmtimevalToReal(&timediff);
-		wrap = 0;
-		if (avedata->desc.sem == PM_SEM_COUNTER) {
-		    diff *= avedata->scale;
-		    if (diff == 0.0) continue;
-		    if (instdata->marked)
-			val = av.d;
-		    else
-			val = unwrap(av.d, instdata->lastval, avedata->desc.type);
-		    if (instdata->marked || val < instdata->lastval) {
-			/* mark or not first one & counter not monotonic increasing */
-			wrap = 1;
-			instdata->marked = 0;
-			tadd(&instdata->firsttime, &result->timestamp);
-			tsub(&instdata->firsttime, &instdata->lasttime);
-		    }
-		    else {
-			unsigned int	sts;
-			val = (val - instdata->lastval) / diff;
-			sts = findbin(avedata->desc.pmid, val, instdata->min, instdata->max);
-			instdata->bin[sts]++;
-		    }
-		}
-		else {	/* for the other semantics */
-		    unsigned int	sts;
-		    val = av.d;
-		    sts = findbin(avedata->desc.pmid, val, instdata->min, instdata->max);
-		    instdata->bin[sts]++;
-		}
-		if (!wrap) {
-		    instdata->count++;
-		}
-		instdata->lastval = av.d;
-		instdata->lasttime = result->timestamp;
-	    }
-	}
-    }
-}
-
 static void
 calcaverage(pmResult *result)
 {
@@ -854,6 +838,7 @@ calcaverage(pmResult *result)
 			    tadd(&instdata->firsttime, &result->timestamp);
 			    tsub(&instdata->firsttime, &instdata->lasttime);
 			}
+			observe(instdata, rate);
 			if (instdata->count == 0) {		/* 1st time */
 			    instdata->min = instdata->max = rate;
 			    instdata->sum = (val - instdata->lastval);
@@ -901,6 +886,7 @@ calcaverage(pmResult *result)
 		}
 		else {	/* for the other semantics - discrete & instantaneous */
 		    val = av.d;
+		    observe(instdata, val);
 		    instdata->sum += val;
 		    instdata->stocave += val;
 		    if (val < instdata->min) {
@@ -974,14 +960,252 @@ override(int opt, pmOptions *opts)
     return 0;
 }
 
+/*
+ * Summarize one archive on stdout, returning the exit status
+ */
+static int
+summarize(char *archive, int argc, char *argv[], int lflag, int Hflag)
+{
+    int			c, i, sts, exitstatus = 0;
+    pmResult		*result;
+    struct timeval 	timespan = {0, 0};
+
+    if ((sts = c = pmNewContext(PM_CONTEXT_ARCHIVE, archive)) < 0) {
+	fprintf(stderr, "%s: Cannot open archive \"%s\": %s\n",
+		pmGetProgname(), archive, pmErrStr(sts));
+	exit(1);
+    }
+
+    if (pmGetContextOptions(c, &opts) < 0) {
+	pmflush();	/* runtime errors only at this stage */
+	exit(EXIT_FAILURE);
+    }
+    
+    if ((sts = pmSetMode(PM_MODE_FORW, &opts.start, 0)) < 0) {
+	fprintf(stderr, "%s: pmSetMode failed: %s\n", pmGetProgname(), pmErrStr(sts));
+	exit(1);
+    }
+
+    if (lflag)
+	printlabel();
+
+    logspan = pmtimevalToReal(&opts.finish) - pmtimevalToReal(&opts.start);
+
+    /* check which timestamp print format we should be using */
+    timespan = opts.finish;
+    tsub(&timespan, &opts.start);
+    if (timespan.tv_sec > 86400) /* seconds per day: 60*60*24 */
+	dayflag = 1;
+
+    /* one pass, binning included */
+    for ( ; ; ) {
+	if ((sts = pmFetchArchive(&result)) < 0)
+	    break;
+
+	if (opts.finish.tv_sec > result->timestamp.tv_sec ||
+	    (opts.finish.tv_sec == result->timestamp.tv_sec &&
+	     opts.finish.tv_usec >= result->timestamp.tv_usec)) {
+	    calcaverage(result);
+	    pmFreeResult(result);
+	}
+	else {
+	    pmFreeResult(result);
+	    sts = PM_ERR_EOL;
+	    break;
+	}
+    }
+
+    if (sts != PM_ERR_EOL) {
+	fprintf(stderr, "%s: fetch failed: %s\n", pmGetProgname(), pmErrStr(sts));
+	exitstatus = 1;
+    }
+
+    if (Hflag)
+	printheaders();
+
+    if (opts.optind >= argc) {	/* print all results */
+	if ((sts = pmTraversePMNS("", printsummary)) < 0) {
+	    fprintf(stderr, "%s: PMNS traversal failed: %s\n", pmGetProgname(), pmErrStr(sts));
+	    exit(1);
+	}
+    }
+    else {		/* print only selected results */
+	for (i = opts.optind; i < argc; i++) {
+	    char *msg;
+
+	    if (pmParseMetricSpec(argv[i], 1, archive, &msp, &msg) < 0) {
+		fputs(msg, stderr);
+		free(msg);
+		continue;
+	    }
+	    if ((sts = pmTraversePMNS(msp->metric, printsummary)) < 0)
+		fprintf(stderr, "%s: PMNS traversal failed for %s: %s\n",
+			pmGetProgname(), msp->metric, pmErrStr(sts));
+	    pmFreeMetricSpec(msp);
+	}
+    }
+
+    return exitstatus;
+}
+
+#if !defined(IS_MINGW)
+typedef struct {
+    char	*archive;
+    pid_t	pid;
+    FILE	*out;		/* report, held until it can be printed in order */
+    FILE	*err;		/* and any warnings that go with it */
+    int		done;
+    int		status;
+} job_t;
+
+static void
+startjob(job_t *jp, int argc, char *argv[], int lflag, int Hflag)
+{
+    if ((jp->out = tmpfile()) == NULL || (jp->err = tmpfile()) == NULL) {
+	fprintf(stderr, "%s: cannot create temporary file for \"%s\": %s\n",
+		pmGetProgname(), jp->archive, osstrerror());
+	if (jp->out)
+	    fclose(jp->out);
+	jp->out = NULL;
+	jp->done = jp->status = 1;
+	return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    if ((jp->pid = fork()) < 0) {
+	fprintf(stderr, "%s: cannot fork for \"%s\": %s\n",
+		pmGetProgname(), jp->archive, osstrerror());
+	fclose(jp->out);
+	fclose(jp->err);
+	jp->out = jp->err = NULL;
+	jp->done = jp->status = 1;
+	return;
+    }
+    if (jp->pid == 0) {
+	/* time window is for this archive alone */
+	opts.archives = &jp->archive;
+	opts.narchives = 1;
+	dup2(fileno(jp->out), fileno(stdout));
+	dup2(fileno(jp->err), fileno(stderr));
+	exit(summarize(jp->archive, argc, argv, lflag, Hflag));
+    }
+}
+
+static void
+copyjob(FILE *from, FILE *to)
+{
+    char	buf[BUFSIZ];
+    size_t	bytes;
+
+    rewind(from);
+    while ((bytes = fread(buf, 1, sizeof(buf), from)) > 0)
+	fwrite(buf, 1, bytes, to);
+    fflush(to);
+    fclose(from);
+}
+
+/*
+ * The child's warnings follow its report, so they stay with the
+ * archive they belong to rather than appearing as the child runs
+ */
+static void
+printjob(job_t *jp, int first)
+{
+    printf("%sArchive: %s\n", first ? "" : "\n", jp->archive);
+    fflush(stdout);
+    if (jp->out == NULL)
+	return;
+    copyjob(jp->out, stdout);
+    copyjob(jp->err, stderr);
+    jp->out = jp->err = NULL;
+}
+
+/*
+ * Summarize each archive in a child process, up to njobs at a time.
+ * Each archive is independent and all of the state above is global,
+ * so processes are simpler than threads here; the reports are printed
+ * in command line order as each one (and all before it) completes.
+ */
+static int
+summarize_all(int argc, char *argv[], int lflag, int Hflag)
+{
+    job_t	*jobs;
+    pid_t	pid;
+    int		status;
+    int		exitstatus = 0;
+    int		running = 0;
+    int		next = 0;
+    int		printed = 0;
+    int		i;
+
+    if ((jobs = (job_t *)calloc(opts.narchives, sizeof(job_t))) == NULL)
+	pmNoMem("summarize_all", opts.narchives * sizeof(job_t), PM_FATAL_ERR);
+
+    while (printed < opts.narchives) {
+	while (running < njobs && next < opts.narchives) {
+	    jobs[next].archive = opts.archives[next];
+	    startjob(&jobs[next], argc, argv, lflag, Hflag);
+	    if (!jobs[next].done)
+		running++;
+	    next++;
+	}
+	while (printed < next && jobs[printed].done) {
+	    printjob(&jobs[printed], printed == 0);
+	    if (jobs[printed].status)
+		exitstatus = 1;
+	    printed++;
+	}
+	if (running == 0)
+	    continue;
+	if ((pid = wait(&status)) < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    fprintf(stderr, "%s: wait failed: %s\n", pmGetProgname(), osstrerror());
+	    exit(1);
+	}
+	for (i = 0; i < next; i++) {
+	    if (jobs[i].pid == pid && !jobs[i].done) {
+		jobs[i].done = 1;
+		jobs[i].status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+		running--;
+		break;
+	    }
+	}
+    }
+    free(jobs);
+    return exitstatus;
+}
+#endif
+
+/* comma separated list of percentiles, each 0 to 100 */
+static int
+parsepercentiles(char *arg)
+{
+    char	*p = arg;
+    char	*end;
+    double	pct;
+    size_t	size;
+
+    for ( ; ; ) {
+	pct = strtod(p, &end);
+	if (end == p || pct < 0 || pct > 100 || (*end != ',' && *end != '\0'))
+	    return -1;
+	size = (npercentile + 1) * sizeof(double);
+	if ((percentile = (double *)realloc(percentile, size)) == NULL)
+	    pmNoMem("parsepercentiles", size, PM_FATAL_ERR);
+	percentile[npercentile++] = pct;
+	if (*end == '\0')
+	    return 0;
+	p = end + 1;
+    }
+}
+
 int
 main(int argc, char *argv[])
 {
-    int			c, i, sts, trip, exitstatus = 0;
+    int			c, sts, exitstatus = 0;
     int			lflag = 0;		/* no label by default */
     int			Hflag = 0;		/* no header by default */
-    pmResult		*result;
-    struct timeval 	timespan = {0, 0};
     char		*endnum;
     char		*archive;
 
@@ -1010,6 +1234,10 @@ main(int argc, char *argv[])
 		nbins = (unsigned int)sts;
 	    break;
 
+	case 'd':	/* print standard deviation */
+	    stddevflag = 1;
+	    break;
+
 	case 'f':	/* spreadsheet format - use tab delimiters */
 	    delimiter = '\t';
 	    break;
@@ -1030,6 +1258,15 @@ main(int argc, char *argv[])
 	    maxtimeflag = 1;
 	    break;
 
+	case 'j':	/* archives summarized in parallel */
+	    njobs = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || njobs <= 0) {
+		pmprintf("%s: -j requires positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+
 	case 'l':	/* display label */
 	    lflag = 1;
 	    break;
@@ -1054,6 +1291,18 @@ main(int argc, char *argv[])
 	    }
 	    break;
 
+	case 'P':	/* print percentiles */
+	    if (parsepercentiles(opts.optarg) < 0) {
+		pmprintf("%s: -P requires a list of percentiles from 0 to 100\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+
+	case 'R':	/* one of several archives */
+	    __pmAddOptArchive(&opts, opts.optarg);
+	    break;
+
 	case 's':	/* print sums (and only sums) */
 	    stocaveflag = timeaveflag = lflag = countflag = minflag = maxflag = 0;
 	    sumflag = 1;
@@ -1096,96 +1345,15 @@ main(int argc, char *argv[])
     opts.flags &= ~PM_OPTFLAG_DONE;
     __pmEndOptions(&opts);
 
-    if ((sts = c = pmNewContext(PM_CONTEXT_ARCHIVE, archive)) < 0) {
-	fprintf(stderr, "%s: Cannot open archive \"%s\": %s\n",
-		pmGetProgname(), archive, pmErrStr(sts));
-	exit(1);
-    }
-
-    if (pmGetContextOptions(c, &opts) < 0) {
-	pmflush();	/* runtime errors only at this stage */
-	exit(EXIT_FAILURE);
-    }
-    
-    if ((sts = pmSetMode(PM_MODE_FORW, &opts.start, 0)) < 0) {
-	fprintf(stderr, "%s: pmSetMode failed: %s\n", pmGetProgname(), pmErrStr(sts));
+#if defined(IS_MINGW)
+    if (opts.narchives > 1) {
+	fprintf(stderr, "%s: only one archive can be summarized on this platform\n",
+		pmGetProgname());
 	exit(1);
     }
-
-    if (lflag)
-	printlabel();
-
-    logspan = pmtimevalToReal(&opts.finish) - pmtimevalToReal(&opts.start);
-
-    /* check which timestamp print format we should be using */
-    timespan = opts.finish;
-    tsub(&timespan, &opts.start);
-    if (timespan.tv_sec > 86400) /* seconds per day: 60*60*24 */
-	dayflag = 1;
-
-    for (trip = 0; trip < 2; trip++) {	/* two passes if binning */
-	for ( ; ; ) {
-	    if ((sts = pmFetchArchive(&result)) < 0)
-		break;
-
-	    if (opts.finish.tv_sec > result->timestamp.tv_sec ||
-		(opts.finish.tv_sec == result->timestamp.tv_sec &&
-		 opts.finish.tv_usec >= result->timestamp.tv_usec)) {
-		if (trip == 0)
-		    calcaverage(result);
-		else
-		    calcbinning(result);
-		pmFreeResult(result);
-	    }
-	    else {
-		pmFreeResult(result);
-		sts = PM_ERR_EOL;
-		break;
-	    }
-	}
-
-	if (trip == 0 && nbins > 0) {	/* distribute values into bins */
-	    if (pmDebugOptions.appl0)
-		fprintf(stderr, "resetting for second iteration\n");
-	    if ((sts = pmSetMode(PM_MODE_FORW, &opts.start, 0)) < 0) {
-		fprintf(stderr, "%s: pmSetMode reset failed: %s\n",
-		    pmGetProgname(), pmErrStr(sts));
-		exit(1);
-	    }
-	}
-	else
-	    break;	/* two passes only when doing binning */
-    }
-
-    if (sts != PM_ERR_EOL) {
-	fprintf(stderr, "%s: fetch failed: %s\n", pmGetProgname(), pmErrStr(sts));
-	exitstatus = 1;
-    }
-
-    if (Hflag)
-	printheaders();
-
-    if (opts.optind >= argc) {	/* print all results */
-	if ((sts = pmTraversePMNS("", printsummary)) < 0) {
-	    fprintf(stderr, "%s: PMNS traversal failed: %s\n", pmGetProgname(), pmErrStr(sts));
-	    exit(1);
-	}
-    }
-    else {		/* print only selected results */
-	for (i = opts.optind; i < argc; i++) {
-	    char *msg;
-
-	    if (pmParseMetricSpec(argv[i], 1, archive, &msp, &msg) < 0) {
-		fputs(msg, stderr);
-		free(msg);
-		continue;
-	    }
-	    if ((sts = pmTraversePMNS(msp->metric, printsummary)) < 0)
-		fprintf(stderr, "%s: PMNS traversal failed for %s: %s\n",
-			pmGetProgname(), msp->metric, pmErrStr(sts));
-	    pmFreeMetricSpec(msp);
-	}
-    }
-
-    exit(exitstatus);
+#else
+    if (opts.narchives > 1)
+	exit(summarize_all(argc, argv, lflag, Hflag));
+#endif
+    exit(summarize(archive, argc, argv, lflag, Hflag));
 }
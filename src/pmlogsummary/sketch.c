@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * Percentile sketch ... values are counted in buckets whose bounds
+ * grow geometrically by a factor of gamma, so every value in a bucket
+ * is within SKETCH_ACCURACY of the value reported for that bucket.
+ * Buckets are allocated only across the range of values seen, so a
+ * metric that stays within a few orders of magnitude needs a few
+ * hundred counters at most, no matter how many values are added.
+ */
+
+#include <math.h>
+#include "pmapi.h"
+#include "sketch.h"
+
+#define SKETCH_MINVALUE	1e-9	/* smaller magnitudes are counted as zero */
+
+static double	gamma_ln;	/* log(gamma) */
+
+void
+sketch_init(sketch_t *sp)
+{
+    memset(sp, 0, sizeof(*sp));
+    if (gamma_ln == 0)
+	gamma_ln = log((1 + SKETCH_ACCURACY) / (1 - SKETCH_ACCURACY));
+}
+
+/* bucket i holds values in (gamma^(i-1), gamma^i] */
+static int
+bucket(double value)
+{
+    return (int)ceil(log(value) / gamma_ln);
+}
+
+/* the value within SKETCH_ACCURACY of everything in bucket i */
+static double
+bucket_value(int i)
+{
+    double	gamma = exp(gamma_ln);
+
+    return 2 * exp(i * gamma_ln) / (gamma + 1);
+}
+
+static void
+store_add(sketch_store *sp, int i)
+{
+    unsigned int	*count;
+    int			lo, hi;
+    int			size;
+
+    if (sp->nbucket == 0 || i < sp->offset || i >= sp->offset + sp->nbucket) {
+	/*
+	 * grow to cover i, at least doubling and extending in the
+	 * direction of i so a drifting metric does not reallocate on
+	 * every new bucket
+	 */
+	size = 2 * sp->nbucket;
+	if (size < 32)
+	    size = 32;
+	if (sp->nbucket == 0) {
+	    lo = i - size / 2;
+	}
+	else if (i < sp->offset) {
+	    hi = sp->offset + sp->nbucket - 1;
+	    if (size < hi - i + 1)
+		size = hi - i + 1;
+	    lo = hi - size + 1;
+	}
+	else {
+	    lo = sp->offset;
+	    if (size < i - lo + 1)
+		size = i - lo + 1;
+	}
+	if ((count = (unsigned int *)calloc(size, sizeof(*count))) == NULL)
+	    pmNoMem("sketch_add", size * sizeof(*count), PM_FATAL_ERR);
+	if (sp->nbucket > 0) {
+	    memcpy(&count[sp->offset - lo], sp->count, sp->nbucket * sizeof(*count));
+	    free(sp->count);
+	}
+	sp->count = count;
+	sp->offset = lo;
+	sp->nbucket = size;
+    }
+    sp->count[i - sp->offset]++;
+}
+
+void
+sketch_add(sketch_t *sp, double value)
+{
+    if (isnan(value) || isinf(value))
+	return;
+    sp->n++;
+    if (value >= SKETCH_MINVALUE)
+	store_add(&sp->pos, bucket(value));
+    else if (value <= -SKETCH_MINVALUE)
+	store_add(&sp->neg, bucket(-value));
+    else
+	sp->zero++;
+}
+
+/*
+ * Value at quantile q (0 <= q <= 1) of the values added, i.e. the
+ * median is sketch_quantile(sp, 0.5)
+ */
+double
+sketch_quantile(const sketch_t *sp, double q)
+{
+    double	rank;
+    double	seen = 0;
+    int		i;
+
+    if (sp->n == 0)
+	return 0;
+    rank = q * (sp->n - 1);
+
+    /* most negative first, i.e. largest magnitude bucket first */
+    for (i = sp->neg.nbucket - 1; i >= 0; i--) {
+	seen += sp->neg.count[i];
+	if (seen > rank)
+	    return -bucket_value(sp->neg.offset + i);
+    }
+    seen += sp->zero;
+    if (seen > rank)
+	return 0;
+    for (i = 0; i < sp->pos.nbucket; i++) {
+	seen += sp->pos.count[i];
+	if (seen > rank)
+	    return bucket_value(sp->pos.offset + i);
+    }
+    return 0;	/* not reached, counts sum to n and rank < n */
+}
+
+void
+sketch_free(sketch_t *sp)
+{
+    free(sp->pos.count);
+    free(sp->neg.count);
+    memset(sp, 0, sizeof(*sp));
+}
+
+/*
+ * Linear histogram ... the range starts out centred on the first two
+ * distinct values, and doubles (merging pairs of buckets) toward any
+ * value outside it, so the buckets always span at most about four
+ * times the observed range.
+ */
+void
+hist_init(hist_t *hp)
+{
+    memset(hp, 0, sizeof(*hp));
+}
+
+static void
+hist_grow(hist_t *hp, int down)
+{
+    unsigned int	*count = hp->count;
+    int			base = down ? HIST_NBUCKET / 2 : 0;
+    int			i;
+
+    /* in the order that never overwrites a bucket before it is merged */
+    if (down) {
+	for (i = HIST_NBUCKET / 2 - 1; i >= 0; i--)
+	    count[base + i] = count[2*i] + count[2*i + 1];
+    }
+    else {
+	for (i = 0; i < HIST_NBUCKET / 2; i++)
+	    count[i] = count[2*i] + count[2*i + 1];
+    }
+    if (down) {
+	memset(count, 0, base * sizeof(*count));
+	hp->lo -= HIST_NBUCKET * hp->width;
+    }
+    else
+	memset(&count[HIST_NBUCKET / 2], 0, (HIST_NBUCKET / 2) * sizeof(*count));
+    hp->width *= 2;
+}
+
+void
+hist_add(hist_t *hp, double value)
+{
+    double	lo, span;
+    int		i;
+
+    if (isnan(value) || isinf(value))
+	return;
+    if (hp->n++ == 0) {
+	hp->first = value;
+	return;
+    }
+    if (hp->width == 0) {
+	if (value == hp->first)
+	    return;
+	/* second distinct value, place both in the middle half */
+	if ((hp->count = (unsigned int *)calloc(HIST_NBUCKET, sizeof(*hp->count))) == NULL)
+	    pmNoMem("hist_add", HIST_NBUCKET * sizeof(*hp->count), PM_FATAL_ERR);
+	lo = value < hp->first ? value : hp->first;
+	span = fabs(value - hp->first);
+	hp->lo = lo - span / 2;
+	hp->width = 2 * span / HIST_NBUCKET;
+	i = (int)floor((hp->first - hp->lo) / hp->width);
+	hp->count[i] = hp->n - 1;
+    }
+    for ( ; ; ) {
+	i = (int)floor((value - hp->lo) / hp->width);
+	if (i < 0)
+	    hist_grow(hp, 1);
+	else if (i >= HIST_NBUCKET)
+	    hist_grow(hp, 0);
+	else
+	    break;
+    }
+    hp->count[i]++;
+}
+
+/*
+ * Call func for each non-empty bucket in ascending order, with the
+ * value at the middle of the bucket and its count
+ */
+void
+hist_walk(const hist_t *hp, hist_callback func, void *arg)
+{
+    int		i;
+
+    if (hp->n == 0)
+	return;
+    if (hp->width == 0) {
+	func(hp->first, hp->n, arg);
+	return;
+    }
+    for (i = 0; i < HIST_NBUCKET; i++) {
+	if (hp->count[i])
+	    func(hp->lo + (i + 0.5) * hp->width, hp->count[i], arg);
+    }
+}
+
+void
+hist_free(hist_t *hp)
+{
+    free(hp->count);
+    memset(hp, 0, sizeof(*hp));
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#ifndef _SKETCH_H
+#define _SKETCH_H
+
+/*
+ * Log-bucketed histogram for approximate percentiles in one pass.
+ * Any value reported is within SKETCH_ACCURACY (relative) of some
+ * observed value of the requested rank, whatever the distribution.
+ */
+#define SKETCH_ACCURACY	0.01
+
+typedef struct {
+    int			offset;		/* bucket index of count[0] */
+    int			nbucket;	/* allocated size of count[] */
+    unsigned int	*count;
+} sketch_store;
+
+typedef struct {
+    unsigned int	n;		/* values added */
+    unsigned int	zero;		/* values too close to zero to bucket */
+    sketch_store	pos;		/* buckets for values > 0 */
+    sketch_store	neg;		/* buckets for |values| where values < 0 */
+} sketch_t;
+
+extern void sketch_init(sketch_t *);
+extern void sketch_add(sketch_t *, double);
+extern double sketch_quantile(const sketch_t *, double);
+extern void sketch_free(sketch_t *);
+
+/*
+ * Linear histogram of HIST_NBUCKET equal buckets whose range follows
+ * the values added, for dividing the observed range into a few bins
+ * after a single pass.  Each bucket is at most a few thousandths of
+ * the observed range wide.
+ */
+#define HIST_NBUCKET	1024
+
+typedef struct {
+    unsigned int	n;		/* values added */
+    double		first;		/* first value, while all are equal */
+    double		lo;		/* lower bound of count[0] */
+    double		width;		/* of each bucket, 0 if all equal */
+    unsigned int	*count;
+} hist_t;
+
+typedef void (*hist_callback)(double, unsigned int, void *);
+
+extern void hist_init(hist_t *);
+extern void hist_add(hist_t *, double);
+extern void hist_walk(const hist_t *, hist_callback, void *);
+extern void hist_free(hist_t *);
+
+#endif /* _SKETCH_H */
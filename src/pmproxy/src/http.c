@@ -16,9 +16,33 @@
 #include "base64.h"
 #include "dict.h"
 #include "util.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 static int chunked_transfer_size; /* pmproxy.chunksize, pagesize by default */
+#define HTTP_QUEUED_CHUNKS	16 /* chunks in flight before buffering */
 static int smallest_buffer_size = 128;
+static int smallest_header_size = 256;
+
+#ifdef HAVE_ZLIB
+static int compress_enabled;	/* pmproxy.http.compress, on by default */
+static int compress_level;	/* pmproxy.http.compress.level */
+static int smallest_compress_size = 256;
+
+/*
+ * Per-client compressor state only exists while a compressed chunked
+ * response is in flight.  The deflate window and hash table sizes are
+ * deliberately smaller than the zlib defaults (64KiB each, instead of
+ * 128KiB) to bound the memory cost of many concurrent clients.
+ */
+#define COMPRESS_WINDOW_BITS	14
+#define COMPRESS_MEM_LEVEL	7
+
+typedef struct http_compressor {
+    z_stream		stream;
+} http_compressor;
+#endif
 
 /*
  * Simple helpers to manage the cumlative addition of JSON
@@ -212,10 +236,8 @@ http_get_buffer(struct client *client)
     sds		buffer = client->buffer;
 
     client->buffer = NULL;
-    if (buffer == NULL) {
-	buffer = sdsnewlen(SDS_NOINIT, smallest_buffer_size);
-	sdsclear(buffer);
-    }
+    if (buffer == NULL)
+	buffer = client_buffer(client->proxy, smallest_buffer_size);
     return buffer;
 }
 
@@ -237,7 +259,7 @@ http_response_header(struct client *client, unsigned int length, http_code sts,
     if (parser->http_major == 0)
 	parser->http_major = parser->http_minor = 1;
 
-    header = sdscatfmt(sdsempty(),
+    header = sdscatfmt(client_buffer(client->proxy, smallest_header_size),
 		"HTTP/%u.%u %u %s\r\n"
 		"Connection: Keep-Alive\r\n"
 		"Access-Control-Allow-Origin: *\r\n",
@@ -251,6 +273,12 @@ http_response_header(struct client *client, unsigned int length, http_code sts,
     if ((flags & HTTP_FLAG_STREAMING))
 	header = sdscatfmt(header, "Transfer-encoding: %s\r\n", "chunked");
 
+    if ((flags & HTTP_FLAG_COMPRESS))
+	header = sdscatfmt(header,
+		"Content-Encoding: %s\r\n"
+		"Vary: Accept-Encoding\r\n",
+		(client->u.http.flags & HTTP_FLAG_GZIP) ? "gzip" : "deflate");
+
     if (!(flags & HTTP_FLAG_STREAMING))
 	header = sdscatfmt(header, "Content-Length: %u\r\n", length);
 
@@ -270,51 +298,286 @@ http_response_header(struct client *client, unsigned int length, http_code sts,
 void
 http_close(struct client *client)
 {
-    uv_close((uv_handle_t *)&client->stream, on_client_close);
+    client_close(client);
+}
+
+#ifdef HAVE_ZLIB
+/*
+ * Parse an Accept-Encoding request header, returning the preferred
+ * encoding we can produce (gzip over deflate), skipping any encoding
+ * the client explicitly refuses via a zero quality value.
+ */
+static http_flags
+http_accept_encoding(const char *value)
+{
+    const char		*p = value, *name;
+    http_flags		flags = 0;
+    size_t		length;
+
+    while (*p) {
+	while (*p == ' ' || *p == '\t' || *p == ',')
+	    p++;
+	name = p;
+	while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+	    p++;
+	length = p - name;
+	for (; *p && *p != ','; p++) {
+	    if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=' &&
+		strtod(p + 2, NULL) == 0.0)
+		length = 0;	/* not acceptable to this client */
+	}
+	if ((length == 4 && strncasecmp(name, "gzip", 4) == 0) ||
+	    (length == 6 && strncasecmp(name, "x-gzip", 6) == 0) ||
+	    (length == 1 && *name == '*'))
+	    flags |= HTTP_FLAG_GZIP;
+	else if (length == 7 && strncasecmp(name, "deflate", 7) == 0)
+	    flags |= HTTP_FLAG_DEFLATE;
+    }
+    if (flags & HTTP_FLAG_GZIP)
+	return HTTP_FLAG_GZIP;
+    return flags;
+}
+
+static int
+http_compressible(struct client *client, http_flags type)
+{
+    if (!compress_enabled)
+	return 0;
+    if (!(client->u.http.flags & (HTTP_FLAG_GZIP | HTTP_FLAG_DEFLATE)))
+	return 0;
+    /* image formats are compressed already, nothing to gain here */
+    return !(type & (HTTP_FLAG_ICO|HTTP_FLAG_JPG|HTTP_FLAG_PNG|HTTP_FLAG_GIF));
+}
+
+static int
+http_deflate_init(z_stream *stream, http_flags flags)
+{
+    int			bits = COMPRESS_WINDOW_BITS;
+
+    if (flags & HTTP_FLAG_GZIP)
+	bits += 16;	/* gzip header and trailer instead of zlib */
+    memset(stream, 0, sizeof(*stream));
+    return deflateInit2(stream, compress_level, Z_DEFLATED, bits,
+			COMPRESS_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+}
+
+/* append deflated input to an output buffer, flushing as requested */
+static sds
+http_deflate(z_stream *stream, sds output,
+		const char *input, size_t length, int flush)
+{
+    unsigned char	chunk[8192];
+
+    stream->next_in = (Bytef *)input;
+    stream->avail_in = length;
+    do {
+	stream->next_out = chunk;
+	stream->avail_out = sizeof(chunk);
+	if (deflate(stream, flush) == Z_STREAM_ERROR)
+	    break;
+	output = sdscatlen(output, chunk, sizeof(chunk) - stream->avail_out);
+    } while (stream->avail_out == 0);
+    return output;
 }
 
+/* compress a complete (non-chunked) response body, in up to two parts */
+static sds
+http_compress_parts(http_flags encoding, sds prefix, sds body)
+{
+    z_stream		stream;
+    sds			output;
+
+    if (http_deflate_init(&stream, encoding) != Z_OK)
+	return NULL;
+    output = sdsempty();
+    if (prefix)
+	output = http_deflate(&stream, output, prefix, sdslen(prefix), Z_NO_FLUSH);
+    if (body)
+	output = http_deflate(&stream, output, body, sdslen(body), Z_FINISH);
+    else
+	output = http_deflate(&stream, output, NULL, 0, Z_FINISH);
+    deflateEnd(&stream);
+    return output;
+}
+
+static sds
+http_compress_body(struct client *client, sds prefix, sds body)
+{
+    return http_compress_parts(client->u.http.flags, prefix, body);
+}
+
+/*
+ * The encoding (HTTP_FLAG_GZIP or HTTP_FLAG_DEFLATE) that http_reply
+ * would use for a regular response body of this type and length, or
+ * zero if it would be sent uncompressed.  Servlets use this to keep
+ * and reuse compressed copies of responses they cache.
+ */
+http_flags
+http_reply_encoding(struct client *client, http_flags type, size_t length)
+{
+    if (length < smallest_compress_size || !http_compressible(client, type))
+	return 0;
+    return client->u.http.flags & (HTTP_FLAG_GZIP | HTTP_FLAG_DEFLATE);
+}
+
+/* compress a complete response body with the given encoding, or NULL */
+sds
+http_compress(http_flags encoding, sds body)
+{
+    return http_compress_parts(encoding, NULL, body);
+}
+
+static int
+http_compress_start(struct client *client)
+{
+    http_compressor	*compressor;
+
+    if ((compressor = calloc(1, sizeof(http_compressor))) == NULL)
+	return -ENOMEM;
+    if (http_deflate_init(&compressor->stream, client->u.http.flags) != Z_OK) {
+	free(compressor);
+	return -ENOMEM;
+    }
+    client->u.http.compress = compressor;
+    return 0;
+}
+
+static void
+http_compress_free(struct client *client)
+{
+    http_compressor	*compressor = (http_compressor *)client->u.http.compress;
+
+    if (compressor) {
+	deflateEnd(&compressor->stream);
+	free(compressor);
+	client->u.http.compress = NULL;
+    }
+}
+
+/* compress one chunk of a streamed response, releasing the original */
+static sds
+http_compress_chunk(struct client *client, sds input, int flush)
+{
+    http_compressor	*compressor = (http_compressor *)client->u.http.compress;
+    size_t		length = input ? sdslen(input) : 0;
+    sds			output;
+
+    output = http_deflate(&compressor->stream, sdsempty(), input, length, flush);
+    sdsfree(input);
+    return output;
+}
+
+/* compress the final chunk of a streamed response, ending the stream */
+static sds
+http_compress_final(struct client *client, sds message)
+{
+    sds			output, final;
+
+    if (client->buffer) {
+	output = http_compress_chunk(client, client->buffer, Z_NO_FLUSH);
+	client->buffer = NULL;
+	final = http_compress_chunk(client, message, Z_FINISH);
+	output = sdscatsds(output, final);
+	sdsfree(final);
+    } else {
+	output = http_compress_chunk(client, message, Z_FINISH);
+    }
+    http_compress_free(client);
+    client->u.http.flags &= ~HTTP_FLAG_COMPRESS;
+    return output;
+}
+#else
+http_flags
+http_reply_encoding(struct client *client, http_flags type, size_t length)
+{
+    (void)client;
+    (void)type;
+    (void)length;
+    return 0;
+}
+
+sds
+http_compress(http_flags encoding, sds body)
+{
+    (void)encoding;
+    (void)body;
+    return NULL;
+}
+#endif
+
 void
 http_reply(struct client *client, sds message, http_code sts, http_flags type)
 {
     http_flags		flags = client->u.http.flags;
+    stream_write_baton	*request = client_chain(client);
     char		length[32]; /* hex length */
-    sds			buffer, suffix;
+    size_t		bytes;
+    sds			buffer = client->buffer;
 
+    /*
+     * Response buffers (headers, any accumulated client buffer and the
+     * final message) are passed to libuv as a single chain of buffers,
+     * rather than being copied into one contiguous response.
+     */
+    client->buffer = NULL;
     if (flags & HTTP_FLAG_STREAMING) {
-	buffer = sdsempty();
-	if (client->buffer == NULL) {
-	    pmsprintf(length, sizeof(length), "%lX", (unsigned long)sdslen(message));
-	    buffer = sdscatfmt(buffer, "%s\r\n%S\r\n", length, message);
-	} else if (message != NULL) {
-	    pmsprintf(length, sizeof(length), "%lX",
-				(unsigned long)sdslen(client->buffer) + sdslen(message));
-	    buffer = sdscatfmt(buffer, "%s\r\n%S%S\r\n",
-				length, client->buffer, message);
-	    client->buffer = NULL;
-	} else {
-	    message = buffer;
+#ifdef HAVE_ZLIB
+	if ((flags & HTTP_FLAG_COMPRESS) && client->u.http.compress) {
+	    client->buffer = buffer;
+	    message = http_compress_final(client, message);
 	    buffer = NULL;
 	}
-	sdsfree(message);
-	suffix = sdsnewlen("0\r\n\r\n", 5);		/* chunked suffix */
+#endif
+	bytes = (buffer ? sdslen(buffer) : 0) + (message ? sdslen(message) : 0);
+	if (bytes > 0) {
+	    pmsprintf(length, sizeof(length), "%lX\r\n", (unsigned long)bytes);
+	    client_chain_sds(request, sdscat(client_buffer(client->proxy,
+					sizeof(length)), length));
+	    client_chain_sds(request, buffer);
+	    client_chain_sds(request, message);
+	    client_chain_static(request, "\r\n0\r\n\r\n", 7);
+	} else {
+	    sdsfree(buffer);
+	    sdsfree(message);
+	    client_chain_static(request, "0\r\n\r\n", 5);	/* chunked suffix */
+	}
+	bytes = 0;
+	if (pmDebugOptions.http)
+	    fprintf(stderr, "HTTP chunked final (client=%p)\n", client);
     } else {	/* regular non-chunked response - headers + response body */
-	if (client->buffer == NULL) {
-	    suffix = message;
-	} else if (message != NULL) {
-	    suffix = sdscatsds(client->buffer, message);
+	if (message != NULL && sdslen(message) == 0 && buffer != NULL) {
+	    sdsfree(message);
+	    message = NULL;
+	}
+	bytes = (buffer ? sdslen(buffer) : 0) + (message ? sdslen(message) : 0);
+#ifdef HAVE_ZLIB
+	if (type & HTTP_FLAG_COMPRESS) {
+	    /* already compressed by the servlet, see http_reply_encoding */
+	} else if (bytes >= smallest_compress_size &&
+	    http_compressible(client, type) &&
+	    (client->buffer = http_compress_body(client, buffer, message)) != NULL) {
+	    sdsfree(buffer);
 	    sdsfree(message);
+	    buffer = NULL;
+	    message = client->buffer;
 	    client->buffer = NULL;
-	} else {
-	    suffix = sdsempty();
+	    bytes = sdslen(message);
+	    type |= HTTP_FLAG_COMPRESS;
 	}
-	buffer = http_response_header(client, sdslen(suffix), sts, type);
-    }
-
-    if (pmDebugOptions.http) {
-	fprintf(stderr, "HTTP response (client=%p)\n%s%s",
-			client, buffer, suffix);
+#endif
+	client_chain_sds(request, http_response_header(client, bytes, sts, type));
+	if (pmDebugOptions.http && request)
+	    fprintf(stderr, "HTTP response (client=%p)\n%.*s%s%s",
+			client, (int)request->buffer[0].len,
+			request->buffer[0].base,
+			buffer ? buffer : "", message ? message : "");
+	client_chain_sds(request, buffer);
+	if (message != NULL && buffer == NULL && sdslen(message) == 0)
+	    sdsfree(message);	/* no body to send */
+	else
+	    client_chain_sds(request, message);
     }
-    client_write(client, buffer, suffix);
+    client_chain_write(client, request);
 
     if (http_should_keep_alive(&client->u.http.parser) == 0)
 	http_close(client);
@@ -358,6 +621,7 @@ http_transfer(struct client *client)
 {
     struct http_parser	*parser = &client->u.http.parser;
     http_flags		flags = client->u.http.flags;
+    stream_write_baton	*request;
     sds			buffer, suffix;
 
     /* If the client buffer length is now beyond a set maximum size,
@@ -365,21 +629,43 @@ http_transfer(struct client *client)
      * is copied into the uv_buf_t, clear it in the client, and then
      * return control to caller.
      */
+    if (client_closed(client)) {	/* nobody left to read the response */
+	sdsclear(client->buffer);
+	return;
+    }
     if (sdslen(client->buffer) >= chunked_transfer_size) {
 	if (parser->http_major == 1 && parser->http_minor > 0) {
+	    /* back-pressure: while the client is slow to read responses
+	     * keep buffering here, the next call (or the final reply)
+	     * sends everything accumulated as one larger chunk.
+	     */
+	    if ((flags & HTTP_FLAG_STREAMING) &&
+		client_congested(client, chunked_transfer_size * HTTP_QUEUED_CHUNKS))
+		return;
 	    if (!(flags & HTTP_FLAG_STREAMING)) {
 		/* send headers (no content length) and initial content */
 		flags |= HTTP_FLAG_STREAMING;
+#ifdef HAVE_ZLIB
+		if (http_compressible(client, flags) &&
+		    http_compress_start(client) == 0)
+		    flags |= HTTP_FLAG_COMPRESS;
+#endif
 		buffer = http_response_header(client, 0, HTTP_STATUS_OK, flags);
 		client->u.http.flags = flags;
 	    } else {
 		/* headers already sent, send the next chunk of content */
-		buffer = sdsempty();
+		buffer = client_buffer(client->proxy, 16);
 	    }
+#ifdef HAVE_ZLIB
+	    /* sync flush so each chunk can be decompressed on arrival */
+	    if ((flags & HTTP_FLAG_COMPRESS) && client->u.http.compress)
+		client->buffer = http_compress_chunk(client, client->buffer,
+							Z_SYNC_FLUSH);
+#endif
 	    /* prepend a chunked transfer encoding message length (hex) */
 	    buffer = sdscatprintf(buffer, "%lX\r\n", (unsigned long)sdslen(client->buffer));
-	    suffix = sdscatfmt(client->buffer, "\r\n");
 	    /* reset for next call, original released on I/O completion */
+	    suffix = client->buffer;
 	    client->buffer = NULL;
 
 	    if (pmDebugOptions.http) {
@@ -387,8 +673,11 @@ http_transfer(struct client *client)
 				"HTTP chunked suffix (client %p)\n%s",
 				client, buffer, client, suffix);
 	    }
-	    client_write(client, buffer, suffix);
-
+	    request = client_chain(client);
+	    client_chain_sds(request, buffer);
+	    client_chain_sds(request, suffix);
+	    client_chain_static(request, "\r\n", 2);
+	    client_chain_write(client, request);
 	} else if (parser->http_major <= 1) {
 	    buffer = sdsnew("HTTP 1.0 request result exceeds server limits");
 	    http_error(client, HTTP_STATUS_PAYLOAD_TOO_LARGE, buffer);
@@ -611,6 +900,13 @@ on_header_value(http_parser *request, const char *offset, size_t length)
 	}
     }
 
+#ifdef HAVE_ZLIB
+    /* response compression for all servlets */
+    if (compress_enabled &&
+	strcasecmp((sds)dictGetKey(entry), "Accept-Encoding") == 0)
+	client->u.http.flags |= http_accept_encoding(value);
+#endif
+
     return 0;
 }
 
@@ -647,6 +943,10 @@ on_message_begin(http_parser *request)
 
     if (pmDebugOptions.http)
 	fprintf(stderr, "HTTP message begin (client=%p)\n", client);
+
+    /* reset per-request state for connections that are kept alive */
+    client->u.http.flags &= ~(HTTP_FLAG_GZIP | HTTP_FLAG_DEFLATE |
+				HTTP_FLAG_COMPRESS);
     return 0;
 }
 
@@ -669,10 +969,17 @@ on_message_complete(http_parser *request)
 void
 on_http_client_close(struct client *client)
 {
+    struct servlet	*servlet = client->u.http.servlet;
+
+    if (servlet && servlet->on_release)
+	servlet->on_release(client);
     if (client->u.http.headers)
 	dictRelease(client->u.http.headers);
     if (client->u.http.parameters)
 	dictRelease(client->u.http.parameters);
+#ifdef HAVE_ZLIB
+    http_compress_free(client);
+#endif
     memset(&client->u.http, 0, sizeof(client->u.http));
 }
 
@@ -748,6 +1055,19 @@ setup_http_module(struct proxy *proxy)
     if (chunked_transfer_size < smallest_buffer_size)
 	chunked_transfer_size = smallest_buffer_size;
 
+#ifdef HAVE_ZLIB
+    if ((option = pmIniFileLookup(config, "pmproxy", "http.compress")) != NULL)
+	compress_enabled = (strcmp(option, "true") == 0);
+    else
+	compress_enabled = 1;
+    if ((option = pmIniFileLookup(config, "pmproxy", "http.compress.level")))
+	compress_level = atoi(option);
+    else
+	compress_level = Z_DEFAULT_COMPRESSION;
+    if (compress_level < Z_DEFAULT_COMPRESSION || compress_level > 9)
+	compress_level = Z_DEFAULT_COMPRESSION;
+#endif
+
     register_servlet(proxy, &pmseries_servlet);
     register_servlet(proxy, &pmwebapi_servlet);
     register_servlet(proxy, &grafana_servlet);
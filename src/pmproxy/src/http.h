@@ -41,6 +41,8 @@ typedef enum http_flags {
     HTTP_FLAG_GIF	= (1<<8),
     HTTP_FLAG_UTF8	= (1<<10),
     HTTP_FLAG_UTF16	= (1<<11),
+    HTTP_FLAG_GZIP	= (1<<12),
+    HTTP_FLAG_DEFLATE	= (1<<13),
     HTTP_FLAG_COMPRESS	= (1<<14),
     HTTP_FLAG_STREAMING	= (1<<15),
     /* maximum 16 for server.h */
@@ -50,6 +52,8 @@ typedef unsigned int http_code;
 
 extern void http_transfer(struct client *);
 extern void http_reply(struct client *, sds, http_code, http_flags);
+extern http_flags http_reply_encoding(struct client *, http_flags, size_t);
+extern sds http_compress(http_flags, sds);
 extern void http_error(struct client *, http_code, const char *);
 extern void http_close(struct client *);
 
@@ -67,6 +71,7 @@ typedef int (*httpHeadersCallBack)(struct client *, struct dict *);
 typedef int (*httpUrlCallBack)(struct client *, sds, struct dict *);
 typedef int (*httpBodyCallBack)(struct client *, const char *, size_t);
 typedef int (*httpDoneCallBack)(struct client *);
+typedef void (*httpReleaseCallBack)(struct client *);
 
 typedef struct servlet {
     const char * const	name;
@@ -77,6 +82,7 @@ typedef struct servlet {
     httpHeadersCallBack	on_headers;
     httpBodyCallBack	on_body;
     httpDoneCallBack	on_done;
+    httpReleaseCallBack	on_release;
 } servlet;
 
 extern struct servlet pmseries_servlet;
@@ -19,6 +19,10 @@
 static void
 remove_connection_from_queue(struct client *client)
 {
+    size_t		i;
+
+    for (i = 0; i < client->secure.pending.writes_count; i++)
+	sdsfree(client->secure.pending.writes_buffer[i].base);
     if (client->secure.pending.writes_buffer != NULL)
 	free(client->secure.pending.writes_buffer);
     if (client->secure.pending.prev != NULL)
@@ -107,14 +111,19 @@ on_secure_client_read(struct proxy *proxy, struct client *client,
 static void
 flush_ssl_buffer(struct client *client)
 {
-    stream_write_baton	*request = calloc(1, sizeof(stream_write_baton));
+    stream_write_baton	*request;
     ssize_t		bytes;
+    sds			buffer;
 
     if ((bytes = BIO_pending(client->secure.write)) > 0) {
-	request->buffer[0] = uv_buf_init(malloc(bytes), bytes);
-	BIO_read(client->secure.write, request->buffer[0].base, bytes);
+	buffer = sdsnewlen(SDS_NOINIT, bytes);
+	BIO_read(client->secure.write, buffer, bytes);
+	request = client_chain(client);
+	client_chain_sds(request, buffer);
+	if (request == NULL)
+	    return;
 	uv_write(&request->writer, (uv_stream_t *)&client->stream,
-			request->buffer, 1, on_client_write);
+			request->buffer, request->nbuffers, on_client_write);
     }
 }
 
@@ -140,6 +149,7 @@ flush_secure_module(struct proxy *proxy)
 			    client->secure.pending.writes_buffer[i].base,
 			    client->secure.pending.writes_buffer[i].len);
 	    if (sts > 0) {
+		sdsfree(client->secure.pending.writes_buffer[i].base);
 		used++;
 		continue;
 	    }
@@ -166,11 +176,12 @@ flush_secure_module(struct proxy *proxy)
 	flush_ssl_buffer(client);
 
 	if (used == client->secure.pending.writes_count) {
+	    client->secure.pending.writes_count = 0;
 	    remove_connection_from_queue(client);
 	} else {
 	    client->secure.pending.writes_count -= used;
 	    memmove(client->secure.pending.writes_buffer,
-		    client->secure.pending.writes_buffer + sizeof(uv_buf_t) * used,
+		    client->secure.pending.writes_buffer + used,
 		    sizeof(uv_buf_t) * client->secure.pending.writes_count);
 	}
     }
@@ -221,8 +232,9 @@ secure_client_write(struct client *client,
 	    on_client_write(writer, 1);		/* fail client */
 	    return;
 	}
+	/* request buffers are recycled once written, so take a copy */
 	dup = &client->secure.pending.writes_buffer[count-1];
-	dup->base = request->buffer[i].base;
+	dup->base = sdsnewlen(request->buffer[i].base, request->buffer[i].len);
 	dup->len = request->buffer[i].len;
 	maybe = 1;
     }
@@ -647,6 +647,7 @@ pmseries_load_done(uv_work_t *load, int status)
 
     baton->working = 0;
     baton->loading.data = NULL;
+    client_put(baton->client);
 }
 
 static void
@@ -666,6 +667,9 @@ pmseries_request_load(struct client *client, pmSeriesBaton *baton)
 	message = sdsnewlen(loading, sizeof(loading) - 1);
 	http_reply(client, message, HTTP_STATUS_CONFLICT, HTTP_FLAG_JSON);
     } else {
+	client_get(client);
+	baton->working = 1;
+	baton->loading.data = baton;
 	uv_queue_work(client->proxy->events, &baton->loading,
 			pmseries_load_work, pmseries_load_done);
     }
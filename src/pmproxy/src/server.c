@@ -41,6 +41,37 @@ proxylog(pmLogLevel level, sds message, void *arg)
     pmNotifyErr(priority, "%s%s", state, message);
 }
 
+/*
+ * Size the libuv worker thread pool - used for the CPU-intensive REST
+ * API requests (fetching, OpenMetrics scrapes) - to the number of CPUs
+ * available, or as configured.  This must be done before any work is
+ * queued, and an explicit UV_THREADPOOL_SIZE setting always wins.
+ */
+static void
+worker_init(struct proxy *proxy)
+{
+    char		count[16];
+    long		workers = 0;
+    sds			option;
+
+    if (getenv("UV_THREADPOOL_SIZE") != NULL)
+	return;
+    if ((option = pmIniFileLookup(proxy->config, "pmproxy", "workers")))
+	workers = strtol(option, NULL, 10);
+    if (workers <= 0) {
+	workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers < 4)	/* the libuv default */
+	    workers = 4;
+    }
+    if (workers > 128)		/* the libuv maximum */
+	workers = 128;
+    pmsprintf(count, sizeof(count), "%ld", workers);
+    setenv("UV_THREADPOOL_SIZE", count, 1);
+
+    if (pmDebugOptions.context)
+	fprintf(stderr, "%s: using %ld worker threads\n", "worker_init", workers);
+}
+
 static struct proxy *
 server_init(int portcount, const char *localpath)
 {
@@ -74,6 +105,10 @@ server_init(int portcount, const char *localpath)
     proxy->config = config;
     proxy->events = uv_default_loop();
     uv_loop_init(proxy->events);
+    uv_mutex_init(&proxy->deferlock);
+    uv_mutex_init(&proxy->poollock);
+    proxy->deferred_tail = &proxy->deferred;
+    worker_init(proxy);
     return proxy;
 }
 
@@ -122,15 +157,144 @@ on_buffer_alloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf)
 	buf->len = 0;
 }
 
-void
-on_client_close(uv_handle_t *handle)
+/*
+ * Write requests are recycled through a pool rather than allocated for
+ * every response, as are the sds buffers (headers, body chunks) they
+ * carry - buffers are returned here once written, cleared and reused
+ * for later responses on this event loop.  Only moderately sized
+ * buffers are kept, so a single very large response does not pin its
+ * memory.  Requests and buffers may be created on worker threads, so
+ * both pools are protected by a mutex.
+ */
+#define STREAM_WRITE_POOL	256
+#define STREAM_BUFFER_POOL	64
+#define STREAM_BUFFER_LIMIT	(64 * 1024)
+
+sds
+client_buffer(struct proxy *proxy, size_t length)
 {
-    struct client	*client = (struct client *)handle;
+    sds			buffer = NULL;
 
-    if (pmDebugOptions.context | pmDebugOptions.desperate)
-	fprintf(stderr, "%s: client %p connection closed\n",
-			"on_client_close", client);
+    uv_mutex_lock(&proxy->poollock);
+    if (proxy->nbuffers > 0)
+	buffer = proxy->buffers[--proxy->nbuffers];
+    uv_mutex_unlock(&proxy->poollock);
+
+    if (buffer == NULL) {
+	if ((buffer = sdsnewlen(SDS_NOINIT, length)) != NULL)
+	    sdsclear(buffer);
+	return buffer;
+    }
+    sdsclear(buffer);
+    return sdsMakeRoomFor(buffer, length);
+}
+
+static void
+client_buffer_free(struct proxy *proxy, sds buffer)
+{
+    if (sdsalloc(buffer) <= STREAM_BUFFER_LIMIT) {
+	uv_mutex_lock(&proxy->poollock);
+	if (proxy->buffers == NULL)
+	    proxy->buffers = calloc(STREAM_BUFFER_POOL, sizeof(sds));
+	if (proxy->buffers && proxy->nbuffers < STREAM_BUFFER_POOL) {
+	    proxy->buffers[proxy->nbuffers++] = buffer;
+	    buffer = NULL;
+	}
+	uv_mutex_unlock(&proxy->poollock);
+    }
+    if (buffer)
+	sdsfree(buffer);
+}
+
+static stream_write_baton *
+client_request_alloc(struct proxy *proxy)
+{
+    stream_write_baton	*request;
+
+    uv_mutex_lock(&proxy->poollock);
+    if ((request = proxy->pool) != NULL) {
+	proxy->pool = request->next;
+	proxy->poolsize--;
+    }
+    uv_mutex_unlock(&proxy->poollock);
+
+    if (request == NULL)
+	return calloc(1, sizeof(stream_write_baton));
+    memset(request, 0, sizeof(stream_write_baton));
+    return request;
+}
+
+static void
+client_request_free(struct proxy *proxy, stream_write_baton *request)
+{
+    unsigned int	i;
+
+    for (i = 0; i < request->nbuffers; i++) {
+	if (request->buffer[i].base && !(request->borrowed & (1 << i)))
+	    client_buffer_free(proxy, request->buffer[i].base);
+	request->buffer[i].base = NULL;
+    }
+
+    uv_mutex_lock(&proxy->poollock);
+    if (proxy->poolsize < STREAM_WRITE_POOL) {
+	request->next = proxy->pool;
+	proxy->pool = request;
+	proxy->poolsize++;
+	request = NULL;
+    }
+    uv_mutex_unlock(&proxy->poollock);
 
+    if (request)
+	free(request);
+}
+
+static void
+client_request_pool_free(struct proxy *proxy)
+{
+    stream_write_baton	*request, *next;
+    unsigned int	i;
+
+    for (request = proxy->pool; request != NULL; request = next) {
+	next = request->next;
+	free(request);
+    }
+    proxy->pool = NULL;
+    proxy->poolsize = 0;
+
+    for (i = 0; i < proxy->nbuffers; i++)
+	sdsfree(proxy->buffers[i]);
+    free(proxy->buffers);
+    proxy->buffers = NULL;
+    proxy->nbuffers = 0;
+}
+
+static void
+client_purge(struct client *client)
+{
+    struct proxy	*proxy = client->proxy;
+    stream_write_baton	*request, **rp;
+
+    if (proxy == NULL)
+	return;
+    uv_mutex_lock(&proxy->deferlock);
+    proxy->deferred_tail = &proxy->deferred;
+    for (rp = &proxy->deferred; (request = *rp) != NULL; ) {
+	if (request->client == client) {
+	    *rp = request->next;
+	    client_request_free(proxy, request);
+	} else {
+	    rp = &request->next;
+	    proxy->deferred_tail = rp;
+	}
+    }
+    client->queued = 0;
+    client->closed = 1;
+    uv_mutex_unlock(&proxy->deferlock);
+}
+
+static void
+client_free(struct client *client)
+{
     switch (client->protocol) {
     case STREAM_PCP:
 	on_pcp_client_close(client);
@@ -144,65 +308,315 @@ on_client_close(uv_handle_t *handle)
     default:
 	break;
     }
+    free(client);
+}
+
+/*
+ * Requests in progress on worker threads hold a reference to their
+ * client (taken and dropped on the loop thread), so that the client
+ * outlives a connection closed while a response is being produced.
+ */
+void
+client_get(struct client *client)
+{
+    client->refcount++;
+}
+
+void
+client_put(struct client *client)
+{
+    if (--client->refcount == 0 && client->closed)
+	client_free(client);
+}
+
+int
+client_closed(struct client *client)
+{
+    struct proxy	*proxy = client->proxy;
+    int			closed;
+
+    uv_mutex_lock(&proxy->deferlock);
+    closed = client->closed;
+    uv_mutex_unlock(&proxy->deferlock);
+    return closed;
+}
+
+void
+on_client_close(uv_handle_t *handle)
+{
+    struct client	*client = (struct client *)handle;
+
+    if (pmDebugOptions.context | pmDebugOptions.desperate)
+	fprintf(stderr, "%s: client %p connection closed\n",
+			"on_client_close", client);
+
+    /* drop deferred requests, discard further writes, wake producers */
+    client_purge(client);
 
     /* remove client from the doubly-linked list */
     if (client->next != NULL)
 	client->next->prev = client->prev;
     *client->prev = client->next;
 
-    free(client);
+    if (client->refcount == 0)
+	client_free(client);
 }
 
+/*
+ * Account for bytes handed off for writing to each client, allowing
+ * response producers on worker threads to apply back-pressure - rather
+ * than buffering an arbitrarily large response while a client reads it
+ * slowly.
+ */
+static int
+client_enqueue(struct client *client, stream_write_baton *request)
+{
+    struct proxy	*proxy = client->proxy;
+    int			closed;
+
+    uv_mutex_lock(&proxy->deferlock);
+    if ((closed = client->closed) == 0)
+	client->queued += request->bytes;
+    uv_mutex_unlock(&proxy->deferlock);
+    return closed ? -1 : 0;
+}
+
+static void
+client_dequeue(struct client *client, stream_write_baton *request)
+{
+    struct proxy	*proxy = client->proxy;
+
+    if (request->bytes == 0)
+	return;
+    uv_mutex_lock(&proxy->deferlock);
+    if (client->queued > request->bytes)
+	client->queued -= request->bytes;
+    else
+	client->queued = 0;
+    uv_mutex_unlock(&proxy->deferlock);
+    request->bytes = 0;
+}
+
+/*
+ * Write completion - the client is always found via the request and
+ * never writer->handle, as TLS writes completed on the loop thread do
+ * not pass through uv_write() and so libuv never sets their handle.
+ */
 void
 on_client_write(uv_write_t *writer, int status)
 {
-    struct client	*client = (struct client *)writer->handle;
     stream_write_baton	*request = (stream_write_baton *)writer;
+    struct client	*client = request->client;
 
     if (pmDebugOptions.af)
 	fprintf(stderr, "%s: completed write [sts=%d] to client %p\n",
 			"on_client_write", status, client);
 
-    sdsfree(request->buffer[0].base);
-    request->buffer[0].base = NULL;
-    if (request->buffer[1].base) {	/* optional second buffer */
-	sdsfree(request->buffer[1].base);
-	request->buffer[1].base = NULL;
-    }
-    free(request);
+    client_dequeue(client, request);
+    client_request_free(client->proxy, request);
 
     if (status == 0)
 	return;
 
     if (pmDebugOptions.af)
 	fprintf(stderr, "%s: %s\n", "on_client_write", uv_strerror(status));
-    uv_close((uv_handle_t *)&client->stream, on_client_close);
+    if (!uv_is_closing((uv_handle_t *)&client->stream))
+	uv_close((uv_handle_t *)&client->stream, on_client_close);
+}
+
+/*
+ * Responses may be generated on libuv worker threads (REST API requests
+ * are serviced there), but libuv streams may only be used from the loop
+ * thread.  Requests made off the loop thread are queued here, in order,
+ * and the loop is woken to complete them.
+ */
+static int
+client_on_loop(struct proxy *proxy)
+{
+    uv_thread_t		self = uv_thread_self();
+
+    return uv_thread_equal(&self, &proxy->thread);
+}
+
+static void
+client_defer(struct client *client, stream_write_baton *request)
+{
+    struct proxy	*proxy = client->proxy;
+
+    request->client = client;
+    request->next = NULL;
+    uv_mutex_lock(&proxy->deferlock);
+    if (client->closed) {	/* purged already, nothing more to do */
+	client_request_free(proxy, request);
+	request = NULL;
+    } else {
+	*proxy->deferred_tail = request;
+	proxy->deferred_tail = &request->next;
+    }
+    uv_mutex_unlock(&proxy->deferlock);
+    if (request)
+	uv_async_send(&proxy->wakeup);
 }
 
+static void
+client_request(struct client *client, stream_write_baton *request)
+{
+    if (client->stream.secure)
+	secure_client_write(client, &request->writer, request->nbuffers);
+    else
+	uv_write(&request->writer, (uv_stream_t *)&client->stream,
+		request->buffer, request->nbuffers, on_client_write);
+}
+
+static void
+on_client_deferred(uv_async_t *async)
+{
+    uv_handle_t		*handle = (uv_handle_t *)async;
+    struct proxy	*proxy = (struct proxy *)handle->data;
+    stream_write_baton	*request, *next;
+    struct client	*client;
+
+    uv_mutex_lock(&proxy->deferlock);
+    request = proxy->deferred;
+    proxy->deferred = NULL;
+    proxy->deferred_tail = &proxy->deferred;
+    uv_mutex_unlock(&proxy->deferlock);
+
+    for (; request != NULL; request = next) {
+	next = request->next;
+	request->next = NULL;
+	client = request->client;
+	handle = (uv_handle_t *)&client->stream;
+	if (request->close || uv_is_closing(handle)) {
+	    if (!uv_is_closing(handle))
+		uv_close(handle, on_client_close);
+	    client_dequeue(client, request);
+	    client_request_free(proxy, request);
+	} else {
+	    client_request(client, request);
+	}
+    }
+}
+
+stream_write_baton *
+client_chain(struct client *client)
+{
+    stream_write_baton	*request = client_request_alloc(client->proxy);
+
+    if (request)
+	request->client = client;
+    return request;
+}
+
+/* append a buffer to a write request chain, which takes ownership */
 void
-client_write(struct client *client, sds buffer, sds suffix)
+client_chain_sds(stream_write_baton *request, sds buffer)
 {
-    stream_write_baton	*request = calloc(1, sizeof(stream_write_baton));
-    unsigned int	nbuffers = 0;
+    uv_buf_t		*last;
 
-    if (request) {
-	if (pmDebugOptions.af)
-	    fprintf(stderr, "%s: sending %ld bytes [0] to client %p\n",
-			"client_write", (long)sdslen(buffer), client);
-	request->buffer[nbuffers++] = uv_buf_init(buffer, sdslen(buffer));
-	if (suffix != NULL) {
-	    if (pmDebugOptions.af)
-		fprintf(stderr, "%s: sending %ld bytes [1] to client %p\n",
-			"client_write", (long)sdslen(suffix), client);
-	    request->buffer[nbuffers++] = uv_buf_init(suffix, sdslen(suffix));
+    if (buffer == NULL)
+	return;
+    if (request == NULL) {
+	sdsfree(buffer);
+	return;
+    }
+    if (request->nbuffers == STREAM_WRITE_BUFFERS) {
+	/* no space remains - fold into the final buffer as a fallback */
+	last = &request->buffer[request->nbuffers - 1];
+	if (request->borrowed & (1 << (request->nbuffers - 1))) {
+	    last->base = sdsnewlen(last->base, last->len);
+	    request->borrowed &= ~(1 << (request->nbuffers - 1));
 	}
-	if (client->stream.secure)
-	    secure_client_write(client, &request->writer, nbuffers);
-	else
-	    uv_write(&request->writer, (uv_stream_t *)&client->stream,
-			request->buffer, nbuffers, on_client_write);
-    } else {
+	last->base = sdscatsds(last->base, buffer);
+	last->len = sdslen(last->base);
+	sdsfree(buffer);
+	return;
+    }
+    request->buffer[request->nbuffers++] = uv_buf_init(buffer, sdslen(buffer));
+}
+
+/* append constant data to a write request chain, which is never freed */
+void
+client_chain_static(stream_write_baton *request, const char *data, size_t length)
+{
+    if (request == NULL)
+	return;
+    if (request->nbuffers == STREAM_WRITE_BUFFERS) {
+	client_chain_sds(request, sdsnewlen(data, length));
+	return;
+    }
+    request->borrowed |= (1 << request->nbuffers);
+    request->buffer[request->nbuffers++] = uv_buf_init((char *)data, length);
+}
+
+void
+client_chain_write(struct client *client, stream_write_baton *request)
+{
+    unsigned int	i;
+
+    if (request == NULL) {
+	client_close(client);
+	return;
+    }
+    if (request->nbuffers == 0) {	/* nothing to send */
+	client_request_free(client->proxy, request);
+	return;
+    }
+    for (i = 0; i < request->nbuffers; i++) {
+	if (pmDebugOptions.af)
+	    fprintf(stderr, "%s: sending %ld bytes [%u] to client %p\n",
+			"client_write", (long)request->buffer[i].len, i, client);
+	request->bytes += request->buffer[i].len;
+    }
+    if (client_enqueue(client, request) < 0) {	/* connection closed */
+	client_request_free(client->proxy, request);
+	return;
+    }
+    if (client_on_loop(client->proxy))
+	client_request(client, request);
+    else
+	client_defer(client, request);
+}
+
+/*
+ * Report whether more than limit bytes remain to be written to the
+ * client.  Producers never wait for a congested client - that would
+ * tie up a worker thread (and any locks it holds) for as long as the
+ * client chooses not to read - instead they keep accumulating output
+ * and send it once the event loop has drained the write queue.
+ */
+int
+client_congested(struct client *client, size_t limit)
+{
+    struct proxy	*proxy = client->proxy;
+    int			congested;
+
+    uv_mutex_lock(&proxy->deferlock);
+    congested = (client->queued > limit && !client->closed);
+    uv_mutex_unlock(&proxy->deferlock);
+    return congested;
+}
+
+void
+client_write(struct client *client, sds buffer, sds suffix)
+{
+    stream_write_baton	*request = client_chain(client);
+
+    client_chain_sds(request, buffer);
+    client_chain_sds(request, suffix);
+    client_chain_write(client, request);
+}
+
+void
+client_close(struct client *client)
+{
+    stream_write_baton	*request;
+
+    if (client_on_loop(client->proxy)) {
 	uv_close((uv_handle_t *)&client->stream, on_client_close);
+    } else if ((request = client_request_alloc(client->proxy)) != NULL) {
+	request->close = 1;
+	client_defer(client, request);
     }
 }
 
@@ -507,10 +921,28 @@ fail:
 static void
 close_proxy(struct proxy *proxy)
 {
+    stream_write_baton	*request, *next;
+
     close_pcp_module(proxy);
     close_http_module(proxy);
     close_redis_module(proxy);
     close_secure_module(proxy);
+
+    /* event loop has stopped - drop deferred writes and their notifier */
+    if (uv_is_active((uv_handle_t *)&proxy->wakeup)) {
+	uv_close((uv_handle_t *)&proxy->wakeup, NULL);
+	uv_run(proxy->events, UV_RUN_NOWAIT);
+    }
+    uv_mutex_lock(&proxy->deferlock);
+    request = proxy->deferred;
+    proxy->deferred = NULL;
+    proxy->deferred_tail = &proxy->deferred;
+    uv_mutex_unlock(&proxy->deferlock);
+    for (; request != NULL; request = next) {
+	next = request->next;
+	client_request_free(proxy, request);
+    }
+    client_request_pool_free(proxy);
 }
 
 static void
@@ -628,6 +1060,11 @@ main_loop(void *arg)
     handle->data = (void *)proxy;
     uv_check_start(&after_io, check_proxy);
 
+    proxy->thread = uv_thread_self();
+    uv_async_init(proxy->events, &proxy->wakeup, on_client_deferred);
+    handle = (uv_handle_t *)&proxy->wakeup;
+    handle->data = (void *)proxy;
+
     uv_run(proxy->events, UV_RUN_DEFAULT);
 }
 
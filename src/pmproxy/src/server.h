@@ -26,9 +26,24 @@
 #include "http.h"
 #include "pcp.h"
 
+/*
+ * Each write request carries a (scatter-gather) chain of buffers that
+ * are handed to libuv as-is, without first concatenating them.  Chain
+ * buffers are sds strings owned by the request - freed on completion -
+ * unless marked as borrowed (constant data, never freed).
+ */
+#define STREAM_WRITE_BUFFERS	6
+
 typedef struct stream_write_baton {
     uv_write_t		writer;
-    uv_buf_t		buffer[2];
+    uv_buf_t		buffer[STREAM_WRITE_BUFFERS];
+    unsigned int	nbuffers : 8;
+    unsigned int	borrowed : 8;	/* bitmap of buffers not to be freed */
+    unsigned int	close : 1;	/* close client, no buffers to send */
+    unsigned int	pad : 15;
+    size_t		bytes;		/* total length of chained buffers */
+    struct client	*client;	/* client for a deferred request */
+    struct stream_write_baton *next;	/* deferred request list linkage */
 } stream_write_baton;
 
 typedef enum stream_family {
@@ -72,6 +87,7 @@ typedef struct http_client {
     sds			realm;		/* optional Basic Auth realm */
     void		*privdata;	/* private HTTP parsing state */
     void		*data;		/* opaque servlet information */
+    void		*compress;	/* response compression state */
     unsigned int	type : 16;	/* HTTP response content type */
     unsigned int	flags : 16;	/* request status flags field */
 } http_client;
@@ -114,6 +130,9 @@ typedef struct client {
     struct client	*next;
     struct client	**prev;
     sds			buffer;
+    size_t		queued;		/* bytes written but not completed */
+    unsigned int	refcount;	/* requests in progress on workers */
+    unsigned int	closed;		/* connection closed, discard writes */
 } client;
 
 typedef struct server {
@@ -133,6 +152,16 @@ typedef struct proxy {
     struct mmv_registry	*metrics;	/* internal performance metrics */
     struct dict		*config;	/* configuration dictionary */
     uv_loop_t		*events;	/* global, async event loop */
+    uv_thread_t		thread;		/* thread running the event loop */
+    uv_async_t		wakeup;		/* deferred requests notification */
+    uv_mutex_t		deferlock;	/* protects deferred request list */
+    struct stream_write_baton *deferred; /* requests from worker threads */
+    struct stream_write_baton **deferred_tail;
+    uv_mutex_t		poollock;	/* protects write request pool */
+    struct stream_write_baton *pool;	/* recycled write requests */
+    unsigned int	poolsize;	/* count of pooled write requests */
+    sds			*buffers;	/* recycled response buffers */
+    unsigned int	nbuffers;	/* count of pooled buffers */
 } proxy;
 
 extern void proxylog(pmLogLevel, sds, void *);
@@ -143,6 +172,16 @@ extern void on_client_write(uv_write_t *, int);
 extern void on_client_close(uv_handle_t *);
 extern void on_buffer_alloc(uv_handle_t *, size_t, uv_buf_t *);
 extern void client_write(struct client *, sds, sds);
+extern stream_write_baton *client_chain(struct client *);
+extern void client_chain_sds(stream_write_baton *, sds);
+extern void client_chain_static(stream_write_baton *, const char *, size_t);
+extern void client_chain_write(struct client *, stream_write_baton *);
+extern sds client_buffer(struct proxy *, size_t);
+extern int client_congested(struct client *, size_t);
+extern int client_closed(struct client *);
+extern void client_get(struct client *);
+extern void client_put(struct client *);
+extern void client_close(struct client *);
 extern void secure_client_write(struct client *, uv_write_t *, unsigned int);
 
 extern void on_secure_client_read(struct proxy *, struct client *,
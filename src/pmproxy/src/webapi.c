@@ -13,6 +13,7 @@
  */
 #include <assert.h>
 #include <ctype.h>
+#include <openssl/evp.h>
 #include "openmetrics.h"
 #include "server.h"
 #include "util.h"
@@ -56,8 +57,39 @@ typedef struct pmWebGroupBaton {
     unsigned int	numindoms;
     pmID		pmid;		/* metric currently being processed */
     pmInDom		indom;		/* indom currently being processed */
+    sds			scrapekey;	/* shared scrape cache entry key */
+    sds			scrapetext;	/* rendered scrape text, to share */
+    sds			scrapereply;	/* completed scrape, for waiters */
+    http_code		scrapecode;	/* completed scrape status code */
+    unsigned int	waiting;	/* queued on an identical scrape */
+    struct pmWebGroupBaton *next;	/* coalesced identical scrapes */
 } pmWebGroupBaton;
 
+/*
+ * Rendered OpenMetrics text from recent scrapes, keyed by context,
+ * credentials and the full set of request parameters.  Identical
+ * requests arriving while a scrape is in progress wait for its result
+ * rather than each performing their own fetch, label merge and
+ * rendering.  Compressed copies of the text are kept for each encoding
+ * as clients ask for them, so they are only compressed once too.
+ * Only ever accessed from the event loop thread.
+ */
+typedef struct pmWebScrapeCache {
+    sds			text;		/* most recently rendered scrape */
+    sds			gzip;		/* text with gzip encoding */
+    sds			deflate;	/* text with deflate encoding */
+    uint64_t		stamp;		/* event loop time when rendered */
+    unsigned int	inflight;	/* a scrape is in progress now */
+    struct pmWebGroupBaton *waiters;	/* identical requests, waiting */
+} pmWebScrapeCache;
+
+typedef struct pmWebScrapeKeys {
+    unsigned int	count;
+    unsigned int	size;
+    sds			*keys;
+    uint64_t		now;		/* event loop time, for expiry */
+} pmWebScrapeKeys;
+
 static pmWebRestCommand commands[] = {
     { .key = RESTKEY_CONTEXT, .name = "context", .size = sizeof("context")-1 },
     { .key = RESTKEY_PROFILE, .name = "profile", .size = sizeof("profile")-1 },
@@ -79,6 +111,13 @@ static sds PARAM_NAMES, PARAM_NAME, PARAM_PMIDS, PARAM_PMID,
 	   PARAM_INDOM, PARAM_EXPR, PARAM_VALUE, PARAM_TIMES,
 	   PARAM_CONTEXT;
 
+static dictType scrapeDictCallBacks;
+static dict *scrapecache;	/* NULL when scrape sharing is disabled */
+static uint64_t scrape_interval; /* pmproxy.openmetrics.cache (msec) */
+static unsigned int scrape_maximum = 64; /* distinct cached scrape limit */
+
+static mmv_registry_t *webgroup_registry; /* web group module metrics */
+
 
 static pmWebRestKey
 pmwebapi_lookup_restkey(sds url, unsigned int *compat, sds *context)
@@ -118,6 +157,9 @@ pmwebapi_free_baton(pmWebGroupBaton *baton)
 {
     sdsfree(baton->suffix);
     sdsfree(baton->context);
+    sdsfree(baton->scrapekey);
+    sdsfree(baton->scrapetext);
+    sdsfree(baton->scrapereply);
     /* baton->params freed in http.c */
     if (baton->labels)
 	dictRelease(baton->labels);
@@ -404,6 +446,7 @@ on_pmwebapi_scrape(sds context, pmWebScrape *scrape, void *arg)
     pmWebMetric		*metric = &scrape->metric;
     pmWebValue		*value = &scrape->value;
     long long		milliseconds;
+    size_t		length;
     char		pmidstr[20], indomstr[20];
     sds			name, semantics, result, quoted = NULL, labels = NULL;
 
@@ -412,6 +455,7 @@ on_pmwebapi_scrape(sds context, pmWebScrape *scrape, void *arg)
 	return 0;
     semantics = open_metrics_semantics(metric->sem);
     result = http_get_buffer(baton->client);
+    length = sdslen(result);
     name = open_metrics_name(metric->name);
 
     if (baton->compat == 0) {	/* include pmid, indom and type */
@@ -466,6 +510,11 @@ on_pmwebapi_scrape(sds context, pmWebScrape *scrape, void *arg)
     sdsfree(semantics);
     sdsfree(name);
 
+    /* keep a copy of the new text for any coalesced identical scrapes */
+    if (baton->scrapetext)
+	baton->scrapetext = sdscatlen(baton->scrapetext,
+				result + length, sdslen(result) - length);
+
     http_set_buffer(baton->client, result, HTTP_FLAG_TEXT);
     http_transfer(baton->client);
     return 0;
@@ -527,6 +576,297 @@ on_pmwebapi_check(sds context, pmWebAccess *access,
     return 0;
 }
 
+static void
+pmwebapi_scrape_keys_add(pmWebScrapeKeys *keys, sds key)
+{
+    unsigned int	size;
+    sds			*array;
+
+    if (keys->count == keys->size) {
+	size = keys->size ? keys->size * 2 : 8;
+	if ((array = realloc(keys->keys, size * sizeof(sds))) == NULL) {
+	    sdsfree(key);
+	    return;
+	}
+	keys->keys = array;
+	keys->size = size;
+    }
+    keys->keys[keys->count++] = key;
+}
+
+static void
+pmwebapi_scrape_param(void *arg, const dictEntry *entry)
+{
+    pmWebScrapeKeys	*keys = (pmWebScrapeKeys *)arg;
+    sds			value = (sds)dictGetVal(entry);
+
+    pmwebapi_scrape_keys_add(keys, sdscatfmt(sdsdup(dictGetKey(entry)),
+				"=%s", value ? value : ""));
+}
+
+static int
+pmwebapi_scrape_compare(const void *a, const void *b)
+{
+    return strcmp(*(const sds *)a, *(const sds *)b);
+}
+
+/*
+ * SHA-256 of the username and password presented by the client, in
+ * hex - cached and coalesced scrapes are served without the context
+ * access check, so they may only be shared between clients presenting
+ * exactly the same credentials.  Returns NULL on failure.
+ */
+static sds
+pmwebapi_scrape_credentials(struct client *client)
+{
+    unsigned char	digest[EVP_MAX_MD_SIZE];
+    unsigned int	length = 0, i;
+    sds			creds, hex;
+
+    creds = sdsempty();
+    if (client->u.http.username)
+	creds = sdscatsds(creds, client->u.http.username);
+    creds = sdscatlen(creds, "\0", 1);
+    if (client->u.http.password)
+	creds = sdscatsds(creds, client->u.http.password);
+    i = EVP_Digest(creds, sdslen(creds), digest, &length, EVP_sha256(), NULL);
+    memset(creds, 0, sdslen(creds));
+    sdsfree(creds);
+    if (i != 1 || length == 0)
+	return NULL;
+    hex = sdsempty();
+    for (i = 0; i < length; i++)
+	hex = sdscatprintf(hex, "%02x", digest[i]);
+    return hex;
+}
+
+/*
+ * identify a scrape by context, credentials and (sorted) request
+ * parameters, or NULL if it cannot be shared
+ */
+static sds
+pmwebapi_scrape_key(pmWebGroupBaton *baton)
+{
+    pmWebScrapeKeys	params = {0};
+    unsigned long	cursor = 0;
+    unsigned int	i;
+    sds			key, creds;
+
+    if ((creds = pmwebapi_scrape_credentials(baton->client)) == NULL)
+	return NULL;
+    key = sdscatfmt(sdsempty(), "%s\n%S\n%u\n%u",
+		baton->context ? baton->context : "", creds,
+		(unsigned int)baton->compat, (unsigned int)baton->times);
+    sdsfree(creds);
+    if (baton->params) {
+	do {
+	    cursor = dictScan(baton->params, cursor,
+				pmwebapi_scrape_param, NULL, &params);
+	} while (cursor);
+	qsort(params.keys, params.count, sizeof(sds), pmwebapi_scrape_compare);
+	for (i = 0; i < params.count; i++) {
+	    key = sdscatfmt(key, "\n%S", params.keys[i]);
+	    sdsfree(params.keys[i]);
+	}
+	free(params.keys);
+    }
+    return key;
+}
+
+static void
+pmwebapi_scrape_stale(void *arg, const dictEntry *entry)
+{
+    pmWebScrapeKeys	*keys = (pmWebScrapeKeys *)arg;
+    pmWebScrapeCache	*cache = (pmWebScrapeCache *)dictGetVal(entry);
+
+    if (cache->inflight == 0 && keys->now - cache->stamp >= scrape_interval)
+	pmwebapi_scrape_keys_add(keys, sdsdup(dictGetKey(entry)));
+}
+
+/* drop idle, expired entries to make space for new ones */
+static void
+pmwebapi_scrape_expire(uint64_t now)
+{
+    pmWebScrapeKeys	stale = {0};
+    unsigned long	cursor = 0;
+    unsigned int	i;
+
+    stale.now = now;
+    do {
+	cursor = dictScan(scrapecache, cursor,
+				pmwebapi_scrape_stale, NULL, &stale);
+    } while (cursor);
+    for (i = 0; i < stale.count; i++) {
+	dictDelete(scrapecache, stale.keys[i]);
+	sdsfree(stale.keys[i]);
+    }
+    free(stale.keys);
+}
+
+static void
+pmwebapi_scrape_free(void *privdata, void *value)
+{
+    pmWebScrapeCache	*cache = (pmWebScrapeCache *)value;
+
+    (void)privdata;
+    if (cache) {
+	sdsfree(cache->text);
+	sdsfree(cache->gzip);
+	sdsfree(cache->deflate);
+	free(cache);
+    }
+}
+
+/* reply with cached scrape text, compressed if the client accepts it */
+static void
+pmwebapi_scrape_reply(struct client *client, pmWebScrapeCache *cache)
+{
+    http_flags		encoding;
+    sds			*body;
+
+    encoding = http_reply_encoding(client, HTTP_FLAG_TEXT, sdslen(cache->text));
+    if (encoding) {
+	body = (encoding & HTTP_FLAG_GZIP) ? &cache->gzip : &cache->deflate;
+	if (*body == NULL)
+	    *body = http_compress(encoding, cache->text);
+	if (*body != NULL) {
+	    http_reply(client, sdsdup(*body), HTTP_STATUS_OK,
+			HTTP_FLAG_TEXT | HTTP_FLAG_COMPRESS);
+	    return;
+	}
+    }
+    http_reply(client, sdsdup(cache->text), HTTP_STATUS_OK, HTTP_FLAG_TEXT);
+}
+
+/*
+ * Serve a scrape request from a recently rendered result, or queue
+ * it behind an identical scrape already in progress.  Returns zero
+ * if the caller must go ahead and submit the scrape, in which case
+ * this request becomes the one rendering text for any later arrivals.
+ */
+static int
+pmwebapi_scrape_cached(pmWebGroupBaton *baton)
+{
+    pmWebScrapeCache	*cache;
+    struct client	*client = baton->client;
+    dictEntry		*entry;
+    uint64_t		now = uv_now(client->proxy->events);
+    sds			key;
+
+    if (scrapecache == NULL)
+	return 0;
+
+    if ((key = pmwebapi_scrape_key(baton)) == NULL)
+	return 0;	/* scrape without sharing the result */
+    if ((entry = dictFind(scrapecache, key)) != NULL) {
+	cache = (pmWebScrapeCache *)dictGetVal(entry);
+	if (cache->inflight) {
+	    baton->working = 1;
+	    baton->waiting = 1;
+	    baton->scrapekey = key;
+	    baton->next = cache->waiters;
+	    cache->waiters = baton;
+	    return 1;
+	}
+	if (cache->text && now - cache->stamp < scrape_interval) {
+	    if (pmDebugOptions.http || pmDebugOptions.series)
+		fprintf(stderr, "%s: client=%p served cached scrape\n",
+			"pmwebapi_scrape_cached", client);
+	    sdsfree(key);
+	    client->u.http.data = NULL;
+	    pmwebapi_free_baton(baton);
+	    pmwebapi_scrape_reply(client, cache);
+	    return 1;
+	}
+	cache->inflight = 1;
+    } else {
+	if (dictSize(scrapecache) >= scrape_maximum)
+	    pmwebapi_scrape_expire(now);
+	if (dictSize(scrapecache) >= scrape_maximum ||
+	    (cache = calloc(1, sizeof(pmWebScrapeCache))) == NULL) {
+	    sdsfree(key);
+	    return 0;	/* scrape without sharing the result */
+	}
+	cache->inflight = 1;
+	dictAdd(scrapecache, key, cache);	/* dictionary holds a duplicate */
+    }
+    baton->scrapekey = key;
+    baton->scrapetext = sdsempty();
+    return 0;
+}
+
+/* a waiting client has gone away, so stop waiting on its behalf */
+static void
+pmwebapi_scrape_unlink(pmWebGroupBaton *baton)
+{
+    pmWebGroupBaton	**wp;
+    pmWebScrapeCache	*cache;
+    dictEntry		*entry;
+
+    if ((entry = dictFind(scrapecache, baton->scrapekey)) == NULL)
+	return;
+    cache = (pmWebScrapeCache *)dictGetVal(entry);
+    for (wp = &cache->waiters; *wp != NULL; wp = &(*wp)->next) {
+	if (*wp == baton) {
+	    *wp = baton->next;
+	    break;
+	}
+    }
+}
+
+/*
+ * Complete all identical scrapes waiting on this one, sharing the
+ * result saved on the worker thread - called on the event loop thread
+ * once the scrape has completed.
+ */
+static void
+pmwebapi_scrape_finish(pmWebGroupBaton *baton)
+{
+    pmWebGroupBaton	*waiter, *next = NULL;
+    pmWebScrapeCache	*cache = NULL;
+    struct client	*client;
+    dictEntry		*entry;
+    http_flags		flags;
+    http_code		code = baton->scrapecode;
+    sds			reply = baton->scrapereply;
+
+    baton->scrapereply = NULL;
+    if (reply == NULL) {
+	reply = sdsnew("{\"success\":false,\"message\":\"scrape failed\"}\r\n");
+	code = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+    }
+
+    if ((entry = dictFind(scrapecache, baton->scrapekey)) != NULL) {
+	cache = (pmWebScrapeCache *)dictGetVal(entry);
+	next = cache->waiters;
+	cache->waiters = NULL;
+	cache->inflight = 0;
+	if (code == HTTP_STATUS_OK) {
+	    sdsfree(cache->text);
+	    sdsfree(cache->gzip);
+	    sdsfree(cache->deflate);
+	    cache->text = sdsdup(reply);
+	    cache->gzip = cache->deflate = NULL;
+	    cache->stamp = uv_now(baton->worker.loop);
+	}
+    }
+
+    flags = (code == HTTP_STATUS_OK) ? HTTP_FLAG_TEXT : HTTP_FLAG_JSON;
+    for (waiter = next; waiter != NULL; waiter = next) {
+	next = waiter->next;
+	client = waiter->client;
+	client->u.http.data = NULL;
+	pmwebapi_free_baton(waiter);
+	if (code == HTTP_STATUS_OK && cache != NULL)
+	    pmwebapi_scrape_reply(client, cache);
+	else
+	    http_reply(client, sdsdup(reply), code, flags);
+    }
+    sdsfree(reply);
+    sdsfree(baton->scrapekey);
+    baton->scrapekey = NULL;
+}
+
 static void
 on_pmwebapi_done(sds context, int status, sds message, void *arg)
 {
@@ -568,6 +908,16 @@ on_pmwebapi_done(sds context, int status, sds message, void *arg)
 	msg = sdscatfmt(msg, "{\"success\":false,\"message\":%S}\r\n", quoted);
 	sdsfree(quoted);
     }
+    /* keep the result for identical scrapes, completed on the loop */
+    if (baton->scrapekey) {
+	baton->scrapecode = code;
+	if (code == HTTP_STATUS_OK) {
+	    baton->scrapereply = sdscatsds(baton->scrapetext, msg);
+	    baton->scrapetext = NULL;
+	} else {
+	    baton->scrapereply = sdsdup(msg);
+	}
+    }
     http_reply(client, msg, code, flags);
     /* baton freed on uv_work_t completion callback, not here */
 }
@@ -786,14 +1136,20 @@ static void
 pmwebapi_done(uv_work_t *work, int status)
 {
     pmWebGroupBaton	*baton = (pmWebGroupBaton *)work->data;
+    struct client	*client = baton->client;
 
     if (pmDebugOptions.series)
 	fprintf(stderr, "%s: client=%p (sts=%d)\n", "pmwebapi_done",
-			baton->client, status);
+			client, status);
 
     baton->working = 0;
     baton->worker.data = NULL;
+    if (baton->scrapekey)	/* complete any scrapes waiting on this one */
+	pmwebapi_scrape_finish(baton);
+    if (client->u.http.data == baton)
+	client->u.http.data = NULL;
     pmwebapi_free_baton(baton);
+    client_put(client);
 }
 
 static int
@@ -802,7 +1158,12 @@ pmwebapi_request_done(struct client *client)
     pmWebGroupBaton	*baton = (pmWebGroupBaton *)client->u.http.data;
     uv_loop_t		*loop = client->proxy->events;
 
+    /* identical scrapes within the cache interval share one response */
+    if (baton->restkey == RESTKEY_SCRAPE && pmwebapi_scrape_cached(baton))
+	return 0;
+
     /* submit command request to worker thread */
+    client_get(client);
     baton->working = 1;
     baton->worker.data = baton;
     switch (baton->restkey) {
@@ -833,14 +1194,51 @@ pmwebapi_request_done(struct client *client)
     case RESTKEY_NONE:
     default:
 	baton->working = 0;
+	client_put(client);
 	return 1;
     }
     return 0;
 }
 
+/*
+ * The client connection has closed - a request waiting on an identical
+ * scrape is dropped.  Requests being processed on worker threads hold a
+ * client reference, so are always complete (pmwebapi_done) by now.
+ */
+static void
+pmwebapi_release_request(struct client *client)
+{
+    pmWebGroupBaton	*baton = (pmWebGroupBaton *)client->u.http.data;
+
+    if (baton == NULL)
+	return;
+    client->u.http.data = NULL;
+    if (baton->waiting)
+	pmwebapi_scrape_unlink(baton);
+    pmwebapi_free_baton(baton);
+}
+
+/*
+ * Web group module metrics are exported through the pmproxy PMDA,
+ * which exports memory mapped files below $PCP_TMP_DIR/pmproxy.
+ */
+static mmv_registry_t *
+pmwebapi_metrics(void)
+{
+    static char		path[MAXPATHLEN];
+    int			sep = pmPathSeparator();
+
+    pmsprintf(path, sizeof(path), "%s%c%s%c%s",
+		pmGetConfig("PCP_TMP_DIR"), sep, "pmproxy", sep, "webgroup");
+    webgroup_registry = mmv_stats_registry(path, 1, 0);
+    return webgroup_registry;
+}
+
 static void
 pmwebapi_servlet_setup(struct proxy *proxy)
 {
+    sds			option;
+
     PARAM_NAMES = sdsnew("names");
     PARAM_NAME = sdsnew("name");
     PARAM_PMIDS = sdsnew("pmids");
@@ -851,15 +1249,30 @@ pmwebapi_servlet_setup(struct proxy *proxy)
     PARAM_TIMES = sdsnew("times");
     PARAM_CONTEXT = sdsnew("context");
 
+    if ((option = pmIniFileLookup(proxy->config, "pmproxy", "openmetrics.cache")))
+	scrape_interval = (uint64_t)(strtod(option, NULL) * 1000.0);
+    else
+	scrape_interval = 0;
+    if (scrape_interval > 0) {
+	scrapeDictCallBacks = sdsDictCallBacks;
+	scrapeDictCallBacks.valDestructor = pmwebapi_scrape_free;
+	scrapecache = dictCreate(&scrapeDictCallBacks, NULL);
+    }
+
     pmWebGroupSetup(&pmwebapi_settings.module);
     pmWebGroupSetEventLoop(&pmwebapi_settings.module, proxy->events);
     pmWebGroupSetConfiguration(&pmwebapi_settings.module, proxy->config);
-    pmWebGroupSetMetricRegistry(&pmwebapi_settings.module, proxy->metrics);
+    pmWebGroupSetMetricRegistry(&pmwebapi_settings.module, pmwebapi_metrics());
 }
 
 static void
 pmwebapi_servlet_close(void)
 {
+    if (webgroup_registry) {
+	mmv_stats_free(webgroup_registry);
+	webgroup_registry = NULL;
+    }
+
     sdsfree(PARAM_NAMES);
     sdsfree(PARAM_NAME);
     sdsfree(PARAM_PMIDS);
@@ -869,6 +1282,11 @@ pmwebapi_servlet_close(void)
     sdsfree(PARAM_VALUE);
     sdsfree(PARAM_TIMES);
     sdsfree(PARAM_CONTEXT);
+
+    if (scrapecache) {
+	dictRelease(scrapecache);
+	scrapecache = NULL;
+    }
 }
 
 struct servlet pmwebapi_servlet = {
@@ -878,4 +1296,5 @@ struct servlet pmwebapi_servlet = {
     .on_url		= pmwebapi_request_url,
     .on_body		= pmwebapi_request_body,
     .on_done		= pmwebapi_request_done,
+    .on_release		= pmwebapi_release_request,
 };
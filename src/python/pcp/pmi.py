@@ -114,6 +114,9 @@ LIBPCP_IMPORT.pmiGetHandle.argtypes = [c_char_p, c_char_p]
 LIBPCP_IMPORT.pmiPutValueHandle.restype = c_int
 LIBPCP_IMPORT.pmiPutValueHandle.argtypes = [c_int, c_char_p]
 
+LIBPCP_IMPORT.pmiPutValues.restype = c_int
+LIBPCP_IMPORT.pmiPutValues.argtypes = [c_int, POINTER(c_int), POINTER(c_char_p)]
+
 LIBPCP_IMPORT.pmiWrite.restype = c_int
 LIBPCP_IMPORT.pmiWrite.argtypes = [c_int, c_int]
 
@@ -319,6 +322,25 @@ class pmiLogImport(object):
             raise pmiErr(status)
         return status
 
+    def pmiPutValues(self, handles, values):
+        """PMI - add values for many metric-instance pairs via handles """
+        status = LIBPCP_IMPORT.pmiUseContext(self._ctx)
+        if status < 0:
+            raise pmiErr(status)
+        count = len(handles)
+        if len(values) != count:
+            raise ValueError("handles and values differ in length")
+        handlearray = (c_int * count)(*handles)
+        valuearray = (c_char_p * count)()
+        for i, value in enumerate(values):
+            if type(value) != type(b''):
+                value = value.encode('utf-8')
+            valuearray[i] = value
+        status = LIBPCP_IMPORT.pmiPutValues(count, handlearray, valuearray)
+        if status < 0:
+            raise pmiErr(status)
+        return status
+
     def pmiWrite(self, sec, usec):
         """PMI - flush data to a Log Import archive """
         status = LIBPCP_IMPORT.pmiUseContext(self._ctx)